@@ -3,11 +3,88 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "state_machine.h"
 
 
 
+/**
+ * @def STATE_MACHINE_ALIGN
+ * @brief Alignment of the memory of the state machines.
+ */
+#define STATE_MACHINE_ALIGN             16
+
+/**
+ * @def STATE_MACHINE_ID_MAP
+ * @brief Internal option: the block of the state machine stores the map of the state IDs
+ * (see "fsm_attr_t.layout").
+ */
+#define STATE_MACHINE_ID_MAP            0x80000000
+
+/**
+ * @def STATE_MACHINE_BULK
+ * @brief Internal option: the state machine is part of a block created by "state_machine_clone_many".
+ */
+#define STATE_MACHINE_BULK              0x40000000
+
+/**
+ * @def STATE_MACHINE_BULK_FIRST
+ * @brief Internal option: the state machine is the first one of its block (see "state_machine_deinit_many").
+ */
+#define STATE_MACHINE_BULK_FIRST        0x20000000
+
+/**
+ * @def STATE_MACHINE_SPARSE
+ * @brief Internal option: the states are materialized when used (see "state_machine_init_sparse").
+ */
+#define STATE_MACHINE_SPARSE            0x10000000
+
+/**
+ * @def STATE_MACHINE_HOOK_CHAIN
+ * @brief Internal option: the hook was set by "state_machine_hook_link" ("hook_data" is a "fsm_hook_link_t").
+ */
+#define STATE_MACHINE_HOOK_CHAIN        0x08000000
+
+/**
+ * @def STATE_MACHINE_INTERNAL
+ * @brief Mask of the internal options.
+ */
+#define STATE_MACHINE_INTERNAL          (STATE_MACHINE_ID_MAP | STATE_MACHINE_BULK | STATE_MACHINE_BULK_FIRST | STATE_MACHINE_SPARSE | \
+                                         STATE_MACHINE_HOOK_CHAIN)
+
+/**
+ * @def STATE_MACHINE_INDEX
+ * @brief Position in "states" of the state with the given ID.
+ */
+#define STATE_MACHINE_INDEX(fsm, id)    (((fsm)->id_map != NULL) ? (fsm)->id_map[id] : (id))
+
+/**
+ * @def STATE_MACHINE_MASK_SIZE
+ * @brief Maximum number of states handled by the "valid_target" mask of a state.
+ */
+#define STATE_MACHINE_MASK_SIZE         32
+
+/**
+ * @def STATE_MACHINE_SPARSE_CHUNK
+ * @brief Number of states allocated together by a sparse state machine.
+ */
+#define STATE_MACHINE_SPARSE_CHUNK      64
+
+/**
+ * @def STATE_MACHINE_SPARSE_MIN_SIZE
+ * @brief Initial number of items of the hash table of a sparse state machine.
+ */
+#define STATE_MACHINE_SPARSE_MIN_SIZE   16
+
+
+
+/**
+ * @typedef fsm_layout_t
+ * @brief Position of the parts of a state machine in its block of memory.
+ */
+typedef struct _fsm_layout_t fsm_layout_t;
+
 /**
  * @typedef state_private_t
  * @brief Private data of the state machine. This data are used to call the callback functions related
@@ -15,6 +92,18 @@
  */
 typedef struct _state_private_t state_private_t;
 
+/**
+ * @typedef fsm_sparse_node_t
+ * @brief Materialized state of a sparse state machine.
+ */
+typedef struct _fsm_sparse_node_t fsm_sparse_node_t;
+
+/**
+ * @typedef fsm_sparse_chunk_t
+ * @brief Block of states of a sparse state machine.
+ */
+typedef struct _fsm_sparse_chunk_t fsm_sparse_chunk_t;
+
 /**
  * @struct _state_private_t
  * @brief See "state_private_t" for details.
@@ -25,6 +114,64 @@ struct _state_private_t {
     fsm_state_run_t run;        /**< Standard callback function: it is called when no transitions are planned
                                      for the actual state */
     fsm_state_enter_t enter;    /**< Callback function executed during a state transition */
+    fsm_state_enter_async_t enter_async;    /**< Callback function executed during an asynchronous transition */
+    const uint32_t *targets;    /**< Sorted list of the valid targets (NULL if only the mask is used) */
+    uint32_t target_nr;         /**< Number of items of "targets" */
+};
+
+/**
+ * @struct _fsm_region_t
+ * @brief See "fsm_region_t" for details.
+ */
+struct _fsm_region_t {
+    fsm_state_t *actual_state;  /**< Actual state of the region */
+    uint32_t target_state;      /**< Position of the target state of the region in "states" */
+    uint32_t first_state;       /**< First state ID of the region (base of the masks of its states) */
+};
+
+/**
+ * @struct _fsm_sparse_node_t
+ * @brief See "fsm_sparse_node_t" for details.
+ */
+struct _fsm_sparse_node_t {
+    fsm_state_t state;          /**< The state */
+    state_private_t private_data;   /**< Private data of the state */
+};
+
+/**
+ * @struct _fsm_sparse_chunk_t
+ * @brief See "fsm_sparse_chunk_t" for details.
+ */
+struct _fsm_sparse_chunk_t {
+    fsm_sparse_chunk_t *next;   /**< Previous block (the blocks are released from the last one) */
+    fsm_sparse_node_t nodes[STATE_MACHINE_SPARSE_CHUNK];    /**< The states */
+};
+
+/**
+ * @struct _fsm_sparse_t
+ * @brief See "fsm_sparse_t" for details.
+ * INFO: The states never move, so "actual_state" stays valid when the table grows.
+ */
+struct _fsm_sparse_t {
+    fsm_state_t **table;        /**< Hash table of the states (open addressing, NULL for the free items) */
+    uint32_t size;              /**< Number of items of "table" (power of 2) */
+    uint32_t count;             /**< Number of states */
+    fsm_sparse_chunk_t *chunks; /**< Blocks of the states, from the last one */
+    uint32_t used;              /**< Number of states of the last block */
+};
+
+/**
+ * @struct _fsm_layout_t
+ * @brief See "fsm_layout_t" for details.
+ */
+struct _fsm_layout_t {
+    size_t align;               /**< Alignment of the block */
+    size_t fsm_offset;          /**< Offset of the "fsm_t" structure */
+    size_t states_offset;       /**< Offset of the states */
+    size_t private_offset;      /**< Offset of the private data of the states */
+    size_t map_offset;          /**< Offset of the map of the state IDs */
+    size_t region_offset;       /**< Offset of the regions, followed by the region of every state ID */
+    size_t size;                /**< Size of the block */
 };
 
 
@@ -67,201 +214,1068 @@ static bool state_machine_go_to_state (fsm_t *fsm, uint32_t target_id);
  */
 static uint32_t state_machine_get_state (fsm_t *fsm);
 
+/**
+ * @fn state_machine_run_regions
+ * @brief Same as "state_machine_run" for the state machines with regions.
+ */
+static uint32_t state_machine_run_regions (fsm_t *fsm, void *arg);
 
+/**
+ * @fn state_machine_add_transition_regions
+ * @brief Same as "state_machine_add_transition" for the state machines with regions.
+ */
+static bool state_machine_add_transition_regions (fsm_t *fsm, uint32_t state_id, uint32_t target_id);
 
-fsm_t* state_machine_init (uint32_t state_nr, uint32_t initial_state, void *arg)
-{
-    uint32_t cntr;
-    fsm_t *fsm;
-    state_private_t *private_data;
+/**
+ * @fn state_machine_go_to_state_regions
+ * @brief Same as "state_machine_go_to_state" for the state machines with regions.
+ */
+static bool state_machine_go_to_state_regions (fsm_t *fsm, uint32_t target_id);
 
-    /* Allocate the memory needed by state machine */
-    fsm = (fsm_t *)malloc(sizeof(fsm_t));
+/**
+ * @fn state_machine_run_sparse
+ * @brief Same as "state_machine_run" for the sparse state machines.
+ */
+static uint32_t state_machine_run_sparse (fsm_t *fsm, void *arg);
 
-    /* Set the number of states of the state machine */
-    fsm->state_nr = state_nr;
+/**
+ * @fn state_machine_go_to_state_sparse
+ * @brief Same as "state_machine_go_to_state" for the sparse state machines (the target is materialized).
+ */
+static bool state_machine_go_to_state_sparse (fsm_t *fsm, uint32_t target_id);
 
-    /* Set the space needed by states array */
-    fsm->states = (fsm_state_t*)malloc(fsm->state_nr * sizeof(fsm_state_t));
+/**
+ * @fn state_machine_enter
+ * @brief Call the hook and the "enter" callback of the new actual state of a state machine.
+ * @param fsm The target state machine.
+ * @param exit_state_id The state left.
+ * @param arg Parameter "passed" to the callback.
+ */
+static void state_machine_enter (fsm_t *fsm, uint32_t exit_state_id, void *arg);
 
-    /* Initialize the state machine */
-    for (cntr = 0; cntr <state_nr; cntr++)
-    {
-        fsm->states[cntr].id = cntr;
-        fsm->states[cntr].valid_target = 0;
+/**
+ * @fn state_machine_state
+ * @brief Get a state of a state machine (a state of a sparse state machine is materialized).
+ * @param fsm The target state machine.
+ * @param id The ID of the state (valid).
+ * @return The state, NULL if the memory is not available.
+ */
+static fsm_state_t* state_machine_state (fsm_t *fsm, uint32_t id);
 
-        private_data = (state_private_t*)malloc(sizeof(state_private_t));
-        private_data->enabled = false;
+/**
+ * @fn state_machine_sparse_find
+ * @brief Find the item of the hash table of a state of a sparse state machine.
+ * @return The item of the state, or the free item where it can be added.
+ */
+static fsm_state_t** state_machine_sparse_find (const fsm_sparse_t *sparse, uint32_t id);
 
-        fsm->states[cntr].private_data = (state_private_t*)private_data;
-    }
+/**
+ * @fn state_machine_sparse_grow
+ * @brief Double the size of the hash table of a sparse state machine.
+ * @return true if the table was resized, false if the memory is not available.
+ */
+static bool state_machine_sparse_grow (fsm_t *fsm);
 
-    /* Set the value of  initial state */
-    fsm->actual_state = &fsm->states[initial_state];
-    fsm->target_state = initial_state;
+/**
+ * @fn state_machine_sparse_release
+ * @brief Release the states and the hash table of a sparse state machine.
+ */
+static void state_machine_sparse_release (fsm_t *fsm);
 
-    /* Set the default function to be called to run the state machine */
-    fsm->sm_run = state_machine_run;
-    fsm->get_state = state_machine_get_state;
+/**
+ * @fn state_machine_find_target
+ * @brief Search a target in the sorted list of the targets of a state.
+ * @param private_data Private data of the state.
+ * @param target_id The target.
+ * @return true if the target is in the list, false if not.
+ */
+static bool state_machine_find_target (const state_private_t *private_data, uint32_t target_id);
 
-    /* Set the functions used to configure the state machine */
-    fsm->add_state = state_machine_add_state;
-    fsm->add_transition = state_machine_add_transition;
+/**
+ * @fn state_machine_create
+ * @brief Create and initialize a state machine (see "state_machine_init_ex").
+ * @param state_nr Number of states.
+ * @param initial_state Initial state.
+ * @param region_nr Number of regions (0 for a state machine without regions).
+ * @param sparse true to materialize the states when used (see "state_machine_init_sparse").
+ * @param attr Options of the state machine (can be NULL).
+ * @return The new state machine, NULL if the parameters are not valid or the memory is not available.
+ */
+static fsm_t* state_machine_create (uint32_t state_nr, uint32_t initial_state, uint32_t region_nr, bool sparse, const fsm_attr_t *attr);
 
-    /* Set the function used to require a transition of the state machine */
-    fsm->go_to_state = state_machine_go_to_state;
+/**
+ * @fn state_machine_layout
+ * @brief Compute the position of the parts of a state machine in its block of memory.
+ * @param state_nr Number of states of the state machine.
+ * @param region_nr Number of regions of the state machine.
+ * @param flags Options of the state machine.
+ * @param layout The layout to be filled.
+ */
+static void state_machine_layout (uint32_t state_nr, uint32_t region_nr, uint32_t flags, fsm_layout_t *layout);
 
-    /* Return the pointer to the state machine */
-    return(fsm);
-}
+/**
+ * @fn state_machine_flags
+ * @brief Get the options of a state machine from its attributes.
+ * @param attr Options given by the user (can be NULL).
+ * @return The options, internal ones included.
+ */
+static uint32_t state_machine_flags (const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_rebase
+ * @brief Move the internal pointers of a copy of a state machine to its block.
+ * The hooks linked by "state_machine_hook_link" are removed from the copy: their data
+ * belongs to the bindings of the original.
+ * @param copy The copy (the whole block of the original was copied).
+ * @param fsm The original state machine.
+ */
+static void state_machine_rebase (fsm_t *copy, const fsm_t *fsm);
+
+/**
+ * @fn state_machine_malloc
+ * @brief Default allocator: see "fsm_alloc_t" for details.
+ */
+static void* state_machine_malloc (void *ctx, size_t size, size_t align);
 
+/**
+ * @fn state_machine_free
+ * @brief Default allocator: see "fsm_free_t" for details.
+ */
+static void state_machine_free (void *ctx, void *ptr);
 
 
-void state_machine_deinit (fsm_t *fsm)
+
+const fsm_allocator_t state_machine_malloc_allocator = {
+    state_machine_malloc,
+    state_machine_free,
+    NULL
+};
+
+
+
+fsm_t* state_machine_init (uint32_t state_nr, uint32_t initial_state, void *arg)
 {
-    free(fsm->states);
-    fsm->states = NULL;
+    return(state_machine_init_ex(state_nr, initial_state, NULL));
+}
+
 
-    free(fsm);
-    fsm = NULL;
+
+fsm_t* state_machine_init_ex (uint32_t state_nr, uint32_t initial_state, const fsm_attr_t *attr)
+{
+    return(state_machine_create(state_nr, initial_state, 0, false, attr));
 }
 
 
 
-static bool state_machine_add_state (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_t enter)
+fsm_t* state_machine_init_regions (uint32_t state_nr, uint32_t region_nr, const uint32_t *first_states, const uint32_t *initial_states, const fsm_attr_t *attr)
 {
-    state_private_t *private_data;
+    fsm_t *fsm;
+    uint32_t *region_of;
+    uint32_t last;
+    uint32_t cntr;
+    uint32_t id;
 
-    /* Check for valid state machine */
-    if (fsm == NULL)
+    if ((region_nr == 0) || (first_states[0] != 0))
     {
-        return(-1);
+        return(NULL);
     }
 
-    /* Check if the required target state for the transition is valid */
-    if (id >= fsm->state_nr)
+    /* The regions must be ordered, not empty and contain their initial state */
+    for (cntr = 0; cntr < region_nr; cntr++)
     {
-        return(false);
+        last = (cntr + 1 < region_nr) ? first_states[cntr + 1] : state_nr;
+
+        if ((first_states[cntr] >= last) || (initial_states[cntr] < first_states[cntr]) || (initial_states[cntr] >= last))
+        {
+            return(NULL);
+        }
     }
 
-    /* Set the pointer to the private fields of the structure */
-    private_data = (state_private_t*)fsm->states[id].private_data;
+    fsm = state_machine_create(state_nr, initial_states[0], region_nr, false, attr);
+    if (fsm == NULL)
+    {
+        return(NULL);
+    }
 
-    /* Check if the state has already been enabled */
-    if (private_data->enabled == false)
+    region_of = (uint32_t *)(fsm->regions + region_nr);
+
+    for (cntr = 0; cntr < region_nr; cntr++)
     {
-        private_data->enabled = true;
-        private_data->run = run;
-        private_data->enter = enter;
+        last = (cntr + 1 < region_nr) ? first_states[cntr + 1] : state_nr;
 
-        return(true);
+        fsm->regions[cntr].actual_state = &fsm->states[STATE_MACHINE_INDEX(fsm, initial_states[cntr])];
+        fsm->regions[cntr].target_state = STATE_MACHINE_INDEX(fsm, initial_states[cntr]);
+        fsm->regions[cntr].first_state = first_states[cntr];
+
+        for (id = first_states[cntr]; id < last; id++)
+        {
+            region_of[id] = cntr;
+        }
     }
 
-    return(false);
+    fsm->sm_run = state_machine_run_regions;
+    fsm->add_transition = state_machine_add_transition_regions;
+    fsm->go_to_state = state_machine_go_to_state_regions;
+
+    return(fsm);
 }
 
 
 
-static bool state_machine_add_transition (fsm_t *fsm, uint32_t state_id, uint32_t target_id)
+uint32_t state_machine_get_region_state (const fsm_t *fsm, uint32_t region)
 {
-    uint32_t target_reg;
-
-    /* Check if both states are valid */
-    if ((state_id >= fsm->state_nr) || (target_id >= fsm->state_nr))
+    if (fsm->regions == NULL)
     {
-        return(false);
+        return(fsm->actual_state->id);
     }
 
-    /* Update the "Valid Targes" register of the state */
-    target_reg = fsm->states[state_id].valid_target;
-    target_reg |= (0x1 << target_id);
-    fsm->states[state_id].valid_target = target_reg;
+    return(fsm->regions[region].actual_state->id);
+}
 
-    return(true);
+
+
+fsm_t* state_machine_init_sparse (uint32_t state_nr, uint32_t initial_state, const fsm_attr_t *attr)
+{
+    return(state_machine_create(state_nr, initial_state, 0, true, attr));
 }
 
 
 
-static uint32_t state_machine_run (fsm_t *fsm, void *arg)
+uint32_t state_machine_get_target (const fsm_t *fsm)
 {
-    fsm_t *sm;
-    state_private_t *private_data;
-    uint32_t id;
+    /* The sparse state machines have no layout: the target is the ID */
+    return(((fsm->sparse != NULL) || (fsm->id_map == NULL)) ? fsm->target_state : fsm->states[fsm->target_state].id);
+}
 
-    /* Check for valid state machine */
-    if (fsm == NULL)
-    {
-        return(-1);
-    }
 
-    /* Set the pointer to the state machine to be handled */
-    sm = (fsm_t *)fsm;
 
-    /*
-     Check for the callback function to be called. Available options are:
-     - standard callback: the state is not changed.
-     - exit callback: the state is changed and the exit callback must be executed.
-     */
-    if (sm->actual_state->id == sm->target_state)
-    {
-        /* Set the pointer to the private data of the state */
-        private_data = (state_private_t*)sm->actual_state->private_data;
+uint32_t state_machine_materialized (const fsm_t *fsm)
+{
+    return((fsm->sparse != NULL) ? fsm->sparse->count : fsm->state_nr);
+}
 
-        if (private_data->run != NULL)
+
+
+void state_machine_hook_link (fsm_t *fsm, fsm_transition_hook_t hook, fsm_hook_link_t *link)
+{
+    link->on_transition = fsm->on_transition;
+    link->hook_data = fsm->hook_data;
+    link->chained = ((fsm->flags & STATE_MACHINE_HOOK_CHAIN) != 0);
+
+    fsm->on_transition = hook;
+    fsm->hook_data = link;
+    fsm->flags |= STATE_MACHINE_HOOK_CHAIN;
+}
+
+
+
+fsm_hook_link_t* state_machine_hook_find (const fsm_t *fsm, fsm_transition_hook_t hook)
+{
+    fsm_transition_hook_t current;
+    fsm_hook_link_t *link;
+    bool chained;
+
+    current = fsm->on_transition;
+    link = (fsm_hook_link_t *)fsm->hook_data;
+    chained = ((fsm->flags & STATE_MACHINE_HOOK_CHAIN) != 0);
+
+    /* The walk stops at the first hook not set by "state_machine_hook_link" */
+    while (chained == true)
+    {
+        if (current == hook)
         {
-            private_data->run(arg);
+            return(link);
         }
+
+        current = link->on_transition;
+        chained = link->chained;
+        link = (fsm_hook_link_t *)link->hook_data;
     }
-    else
-    {
-        id = fsm->get_state(fsm);
 
-        fsm->actual_state = &fsm->states[fsm->target_state];
+    return(NULL);
+}
 
-        /* Set the pointer to the private data of the state */
-        private_data = (state_private_t*)sm->actual_state->private_data;
 
-        if (private_data->enter != NULL)
+
+fsm_hook_link_t* state_machine_hook_unlink (fsm_t *fsm, fsm_transition_hook_t hook, const fsm_hook_link_t *data)
+{
+    fsm_transition_hook_t current;
+    fsm_hook_link_t *above;
+    fsm_hook_link_t *link;
+    bool chained;
+
+    above = NULL;
+    current = fsm->on_transition;
+    link = (fsm_hook_link_t *)fsm->hook_data;
+    chained = ((fsm->flags & STATE_MACHINE_HOOK_CHAIN) != 0);
+
+    while (chained == true)
+    {
+        if ((current == hook) && ((data == NULL) || (data == link)))
         {
-            private_data->enter(id, arg);
+            /* The hook set before takes the place of the removed one */
+            if (above == NULL)
+            {
+                fsm->on_transition = link->on_transition;
+                fsm->hook_data = link->hook_data;
+                fsm->flags = (link->chained == true) ? (fsm->flags | STATE_MACHINE_HOOK_CHAIN) :
+                                                       (fsm->flags & ~(uint32_t)STATE_MACHINE_HOOK_CHAIN);
+            }
+            else
+            {
+                above->on_transition = link->on_transition;
+                above->hook_data = link->hook_data;
+                above->chained = link->chained;
+            }
+
+            return(link);
         }
+
+        above = link;
+        current = link->on_transition;
+        chained = link->chained;
+        link = (fsm_hook_link_t *)link->hook_data;
     }
 
+    return(NULL);
+}
 
-    return(sm->actual_state->id);
+
+
+size_t state_machine_size (uint32_t state_nr, const fsm_attr_t *attr)
+{
+    fsm_layout_t layout;
+
+    state_machine_layout(state_nr, 0, state_machine_flags(attr), &layout);
+
+    return(layout.size);
 }
 
 
 
-static bool state_machine_go_to_state (fsm_t *fsm, uint32_t target_id)
+fsm_t* state_machine_clone (const fsm_t *fsm, const fsm_attr_t *attr)
 {
-    fsm_state_t *state;
-    uint32_t state_mask;
+    const fsm_allocator_t *allocator;
+    fsm_layout_t layout;
+    fsm_t *copy;
+    char *block;
 
-    /* Check if the state machine is valid */
-    if (fsm == NULL)
+    /* The states of a sparse state machine are not in its block */
+    if ((fsm == NULL) || (fsm->sparse != NULL))
     {
-        return(-1);
+        return(NULL);
     }
 
-    /* Check for valid state */
-    if (target_id >= fsm->state_nr)
-    {
-        return(false);
-    }
+    allocator = ((attr != NULL) && (attr->allocator != NULL)) ? attr->allocator : &state_machine_malloc_allocator;
 
-    /* Set the pointer to the state "in use" */
-    state = fsm->actual_state;
-    state_mask = state->valid_target;
+    /* The copy has the same layout of the original */
+    state_machine_layout(fsm->state_nr, fsm->region_nr, fsm->flags, &layout);
 
-    if ((state_mask & (0x1 << target_id)) != 0)
+    block = (char *)allocator->alloc(allocator->ctx, layout.size, layout.align);
+    if (block == NULL)
     {
-        /* Update the target state */
-        fsm->target_state = target_id;
-        return(true);
+        return(NULL);
     }
 
-    return(false);
+    /* Copy the whole block and move the internal pointers to the new one */
+    memcpy(block, (const char *)fsm - layout.fsm_offset, layout.size);
+
+    copy = (fsm_t *)(block + layout.fsm_offset);
+    state_machine_rebase(copy, fsm);
+    copy->allocator = *allocator;
+    copy->flags &= ~(uint32_t)(STATE_MACHINE_BULK | STATE_MACHINE_BULK_FIRST);
+
+    return(copy);
+}
+
+
+
+bool state_machine_clone_many (const fsm_t *fsm, uint32_t count, fsm_t **fsms, const fsm_attr_t *attr)
+{
+    const fsm_allocator_t *allocator;
+    fsm_layout_t layout;
+    fsm_t *copy;
+    char *block;
+    size_t stride;
+    uint32_t cntr;
+
+    if ((fsm == NULL) || (count == 0) || (fsm->sparse != NULL))
+    {
+        return(false);
+    }
+
+    allocator = ((attr != NULL) && (attr->allocator != NULL)) ? attr->allocator : &state_machine_malloc_allocator;
+
+    /* The copies have the layout of the original, one after the other */
+    state_machine_layout(fsm->state_nr, fsm->region_nr, fsm->flags, &layout);
+    stride = (layout.size + layout.align - 1) & ~(layout.align - 1);
+
+    if (stride > SIZE_MAX / count)
+    {
+        return(false);
+    }
+
+    block = (char *)allocator->alloc(allocator->ctx, stride * count, layout.align);
+    if (block == NULL)
+    {
+        return(false);
+    }
+
+    /* The first copy is made from the original, the others from the first one */
+    memcpy(block, (const char *)fsm - layout.fsm_offset, layout.size);
+
+    copy = (fsm_t *)(block + layout.fsm_offset);
+    state_machine_rebase(copy, fsm);
+    copy->allocator = *allocator;
+    copy->flags |= STATE_MACHINE_BULK;
+    copy->flags &= ~(uint32_t)STATE_MACHINE_BULK_FIRST;
+    fsms[0] = copy;
+
+    for (cntr = 1; cntr < count; cntr++)
+    {
+        memcpy(block + cntr * stride, block, layout.size);
+
+        fsms[cntr] = (fsm_t *)(block + cntr * stride + layout.fsm_offset);
+        state_machine_rebase(fsms[cntr], copy);
+    }
+
+    copy->flags |= STATE_MACHINE_BULK_FIRST;
+
+    return(true);
+}
+
+
+
+bool state_machine_add_state_async (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_async_t enter)
+{
+    state_private_t *private_data;
+
+    /* The regions have no "pending" substate */
+    if ((fsm == NULL) || (fsm->regions != NULL) || (state_machine_add_state(fsm, id, run, NULL) == false))
+    {
+        return(false);
+    }
+
+    private_data = (state_private_t*)state_machine_state(fsm, id)->private_data;
+    private_data->enter_async = enter;
+
+    return(true);
+}
+
+
+
+bool state_machine_set_targets (fsm_t *fsm, uint32_t id, const uint32_t *targets, uint32_t target_nr)
+{
+    state_private_t *private_data;
+    fsm_state_t *state;
+    uint32_t cntr;
+
+    if ((fsm == NULL) || (id >= fsm->state_nr))
+    {
+        return(false);
+    }
+
+    /* The list must be sorted and contain valid states only */
+    for (cntr = 0; cntr < target_nr; cntr++)
+    {
+        if ((targets[cntr] >= fsm->state_nr) || ((cntr > 0) && (targets[cntr] <= targets[cntr - 1])))
+        {
+            return(false);
+        }
+    }
+
+    state = state_machine_state(fsm, id);
+    if (state == NULL)
+    {
+        return(false);
+    }
+
+    private_data = (state_private_t*)state->private_data;
+    private_data->targets = targets;
+    private_data->target_nr = target_nr;
+
+    return(true);
+}
+
+
+
+bool state_machine_complete (fsm_t *fsm)
+{
+    uint32_t expected = 1;
+
+    if (fsm == NULL)
+    {
+        return(false);
+    }
+
+    return(__atomic_compare_exchange_n(&fsm->pending, &expected, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+
+void state_machine_complete_cb (void *fsm)
+{
+    state_machine_complete((fsm_t *)fsm);
+}
+
+
+
+bool state_machine_is_pending (const fsm_t *fsm)
+{
+    return(__atomic_load_n(&fsm->pending, __ATOMIC_ACQUIRE) != 0);
+}
+
+
+
+bool state_machine_restore_state (fsm_t *fsm, uint32_t state_id)
+{
+    fsm_region_t *region;
+    fsm_state_t *state;
+
+    if (state_id >= fsm->state_nr)
+    {
+        return(false);
+    }
+
+    if (fsm->regions != NULL)
+    {
+        region = &fsm->regions[((const uint32_t *)(fsm->regions + fsm->region_nr))[state_id]];
+        region->target_state = STATE_MACHINE_INDEX(fsm, state_id);
+        region->actual_state = &fsm->states[region->target_state];
+
+        /* The first region is also the state of the whole state machine */
+        fsm->actual_state = fsm->regions[0].actual_state;
+        fsm->target_state = fsm->regions[0].target_state;
+    }
+    else
+    {
+        state = state_machine_state(fsm, state_id);
+        if (state == NULL)
+        {
+            return(false);
+        }
+
+        fsm->actual_state = state;
+        fsm->target_state = (fsm->sparse != NULL) ? state_id : STATE_MACHINE_INDEX(fsm, state_id);
+    }
+
+    __atomic_store_n(&fsm->pending, 0, __ATOMIC_RELEASE);
+
+    return(true);
+}
+
+
+
+void state_machine_deinit (fsm_t *fsm)
+{
+    fsm_allocator_t allocator;
+    fsm_layout_t layout;
+
+    /* The state machines of a block are released by "state_machine_deinit_many" */
+    if ((fsm == NULL) || (fsm->flags & STATE_MACHINE_BULK))
+    {
+        return;
+    }
+
+    /* States and private data are in the same block of the state machine (unless it is sparse) */
+    if (fsm->sparse != NULL)
+    {
+        state_machine_sparse_release(fsm);
+    }
+
+    state_machine_layout((fsm->flags & STATE_MACHINE_SPARSE) ? 0 : fsm->state_nr, fsm->region_nr, fsm->flags, &layout);
+
+    allocator = fsm->allocator;
+    allocator.free(allocator.ctx, (char *)fsm - layout.fsm_offset);
+}
+
+
+
+void state_machine_deinit_many (fsm_t **fsms)
+{
+    fsm_allocator_t allocator;
+    fsm_layout_t layout;
+
+    if ((fsms == NULL) || (fsms[0] == NULL) || ((fsms[0]->flags & STATE_MACHINE_BULK_FIRST) == 0))
+    {
+        return;
+    }
+
+    /* The whole block starts with the first state machine */
+    state_machine_layout(fsms[0]->state_nr, fsms[0]->region_nr, fsms[0]->flags, &layout);
+
+    allocator = fsms[0]->allocator;
+    allocator.free(allocator.ctx, (char *)fsms[0] - layout.fsm_offset);
+}
+
+
+
+static fsm_t* state_machine_create (uint32_t state_nr, uint32_t initial_state, uint32_t region_nr, bool sparse, const fsm_attr_t *attr)
+{
+    uint32_t cntr;
+    fsm_t *fsm;
+    const fsm_allocator_t *allocator;
+    state_private_t *private_data;
+    fsm_layout_t layout;
+    uint32_t flags;
+    char *block;
+
+    /* Check for valid states */
+    if ((state_nr == 0) || (initial_state >= state_nr))
+    {
+        return(NULL);
+    }
+
+    /* Select the allocator */
+    allocator = ((attr != NULL) && (attr->allocator != NULL)) ? attr->allocator : &state_machine_malloc_allocator;
+    flags = state_machine_flags(attr);
+
+    /* The states of a sparse state machine are allocated when used, so there is no layout */
+    if (sparse == true)
+    {
+        if (flags & STATE_MACHINE_ID_MAP)
+        {
+            return(NULL);
+        }
+
+        flags |= STATE_MACHINE_SPARSE;
+    }
+
+    /* Allocate the memory needed by state machine, states and private data */
+    state_machine_layout((sparse == true) ? 0 : state_nr, region_nr, flags, &layout);
+
+    block = (char *)allocator->alloc(allocator->ctx, layout.size, layout.align);
+    if (block == NULL)
+    {
+        return(NULL);
+    }
+
+    if (flags & STATE_MACHINE_CACHE_ALIGNED)
+    {
+        /* Clear the padding, so no uninitialized memory is shared by the copies */
+        memset(block, 0, layout.size);
+    }
+
+    fsm = (fsm_t *)(block + layout.fsm_offset);
+    fsm->allocator = *allocator;
+    fsm->flags = flags;
+    fsm->id_map = NULL;
+    fsm->on_transition = NULL;
+    fsm->hook_data = NULL;
+    fsm->regions = (region_nr > 0) ? (fsm_region_t *)(block + layout.region_offset) : NULL;
+    fsm->region_nr = region_nr;
+    fsm->sparse = NULL;
+
+    /* Set the number of states of the state machine */
+    fsm->state_nr = state_nr;
+
+    if (sparse == true)
+    {
+        fsm->states = NULL;
+        fsm->sparse = (fsm_sparse_t *)allocator->alloc(allocator->ctx, sizeof(fsm_sparse_t), STATE_MACHINE_ALIGN);
+        if (fsm->sparse == NULL)
+        {
+            allocator->free(allocator->ctx, block);
+            return(NULL);
+        }
+        memset(fsm->sparse, 0, sizeof(fsm_sparse_t));
+
+        /* Only the initial state is materialized */
+        fsm->actual_state = state_machine_state(fsm, initial_state);
+        if (fsm->actual_state == NULL)
+        {
+            state_machine_sparse_release(fsm);
+            allocator->free(allocator->ctx, block);
+            return(NULL);
+        }
+
+        fsm->target_state = initial_state;
+        fsm->pending = 0;
+
+        fsm->sm_run = state_machine_run_sparse;
+        fsm->get_state = state_machine_get_state;
+        fsm->add_state = state_machine_add_state;
+        fsm->add_transition = state_machine_add_transition;
+        fsm->go_to_state = state_machine_go_to_state_sparse;
+
+        return(fsm);
+    }
+
+    /* Set the space needed by states array */
+    fsm->states = (fsm_state_t *)(block + layout.states_offset);
+    private_data = (state_private_t *)(block + layout.private_offset);
+
+    /* Place the states in the required order */
+    if (flags & STATE_MACHINE_ID_MAP)
+    {
+        fsm->id_map = (uint32_t *)(block + layout.map_offset);
+
+        for (cntr = 0; cntr < state_nr; cntr++)
+        {
+            fsm->id_map[cntr] = state_nr;
+        }
+
+        for (cntr = 0; cntr < state_nr; cntr++)
+        {
+            /* The layout must contain every state once */
+            if ((attr->layout[cntr] >= state_nr) || (fsm->id_map[attr->layout[cntr]] != state_nr))
+            {
+                allocator->free(allocator->ctx, block);
+                return(NULL);
+            }
+
+            fsm->id_map[attr->layout[cntr]] = cntr;
+        }
+    }
+
+    /* Initialize the state machine */
+    for (cntr = 0; cntr <state_nr; cntr++)
+    {
+        fsm->states[cntr].id = (fsm->id_map != NULL) ? attr->layout[cntr] : cntr;
+        fsm->states[cntr].valid_target = 0;
+
+        private_data[cntr].enabled = false;
+        private_data[cntr].run = NULL;
+        private_data[cntr].enter = NULL;
+        private_data[cntr].enter_async = NULL;
+        private_data[cntr].targets = NULL;
+        private_data[cntr].target_nr = 0;
+
+        fsm->states[cntr].private_data = &private_data[cntr];
+    }
+
+    /* Set the value of  initial state */
+    fsm->target_state = STATE_MACHINE_INDEX(fsm, initial_state);
+    fsm->actual_state = &fsm->states[fsm->target_state];
+    fsm->pending = 0;
+
+    /* Set the default function to be called to run the state machine */
+    fsm->sm_run = state_machine_run;
+    fsm->get_state = state_machine_get_state;
+
+    /* Set the functions used to configure the state machine */
+    fsm->add_state = state_machine_add_state;
+    fsm->add_transition = state_machine_add_transition;
+
+    /* Set the function used to require a transition of the state machine */
+    fsm->go_to_state = state_machine_go_to_state;
+
+    /* Return the pointer to the state machine */
+    return(fsm);
+}
+
+
+
+static void state_machine_layout (uint32_t state_nr, uint32_t region_nr, uint32_t flags, fsm_layout_t *layout)
+{
+    size_t line;
+    size_t hot;
+    size_t regions;
+
+    /* The regions are followed by the region of every state ID */
+    regions = (region_nr > 0) ? (region_nr * sizeof(fsm_region_t) + state_nr * sizeof(uint32_t)) : 0;
+
+    if ((flags & STATE_MACHINE_CACHE_ALIGNED) == 0)
+    {
+        /* Compact layout: state machine, states and private data */
+        layout->align = STATE_MACHINE_ALIGN;
+        layout->fsm_offset = 0;
+        layout->states_offset = (sizeof(fsm_t) + STATE_MACHINE_ALIGN - 1) & ~(size_t)(STATE_MACHINE_ALIGN - 1);
+        layout->private_offset = layout->states_offset + state_nr * sizeof(fsm_state_t);
+        layout->map_offset = layout->private_offset + state_nr * sizeof(state_private_t);
+        layout->region_offset = layout->map_offset + ((flags & STATE_MACHINE_ID_MAP) ? state_nr * sizeof(uint32_t) : 0);
+        layout->region_offset = (layout->region_offset + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        layout->size = layout->region_offset + regions;
+
+        return;
+    }
+
+    /*
+     Cache aligned layout: the "fsm_t" structure is placed so that its last fields (the
+     ones written by the transitions) start a cache line, the states start on the next
+     cache line, the regions (also written by the transitions) start a cache line and the
+     size is rounded to whole cache lines.
+     */
+    line = STATE_MACHINE_CACHE_LINE;
+    hot = offsetof(fsm_t, actual_state);
+
+    layout->align = line;
+    layout->fsm_offset = ((hot + line - 1) & ~(line - 1)) - hot;
+    layout->states_offset = (layout->fsm_offset + sizeof(fsm_t) + line - 1) & ~(line - 1);
+    layout->private_offset = layout->states_offset + state_nr * sizeof(fsm_state_t);
+    layout->map_offset = layout->private_offset + state_nr * sizeof(state_private_t);
+    layout->region_offset = layout->map_offset + ((flags & STATE_MACHINE_ID_MAP) ? state_nr * sizeof(uint32_t) : 0);
+    layout->region_offset = (layout->region_offset + line - 1) & ~(line - 1);
+    layout->size = layout->region_offset + regions;
+    layout->size = (layout->size + line - 1) & ~(line - 1);
+}
+
+
+
+static uint32_t state_machine_flags (const fsm_attr_t *attr)
+{
+    uint32_t flags;
+
+    if (attr == NULL)
+    {
+        return(0);
+    }
+
+    flags = attr->flags & ~(uint32_t)STATE_MACHINE_INTERNAL;
+
+    if (attr->layout != NULL)
+    {
+        flags |= STATE_MACHINE_ID_MAP;
+    }
+
+    return(flags);
+}
+
+
+
+static void state_machine_rebase (fsm_t *copy, const fsm_t *fsm)
+{
+    const fsm_hook_link_t *link;
+    ptrdiff_t offset;
+    uint32_t cntr;
+
+    offset = (const char *)copy - (const char *)fsm;
+
+    copy->states = (fsm_state_t *)((char *)fsm->states + offset);
+    copy->actual_state = (fsm_state_t *)((char *)fsm->actual_state + offset);
+
+    if (fsm->id_map != NULL)
+    {
+        copy->id_map = (uint32_t *)((char *)fsm->id_map + offset);
+    }
+
+    if (fsm->regions != NULL)
+    {
+        copy->regions = (fsm_region_t *)((char *)fsm->regions + offset);
+
+        for (cntr = 0; cntr < copy->region_nr; cntr++)
+        {
+            copy->regions[cntr].actual_state = (fsm_state_t *)((char *)fsm->regions[cntr].actual_state + offset);
+        }
+    }
+
+    for (cntr = 0; cntr < copy->state_nr; cntr++)
+    {
+        copy->states[cntr].private_data = (char *)fsm->states[cntr].private_data + offset;
+    }
+
+    /* The copy keeps the hook set directly, if any */
+    while ((copy->flags & STATE_MACHINE_HOOK_CHAIN) != 0)
+    {
+        link = (const fsm_hook_link_t *)copy->hook_data;
+
+        copy->on_transition = link->on_transition;
+        copy->hook_data = link->hook_data;
+        if (link->chained == false)
+        {
+            copy->flags &= ~(uint32_t)STATE_MACHINE_HOOK_CHAIN;
+        }
+    }
+}
+
+
+
+static void* state_machine_malloc (void *ctx, size_t size, size_t align)
+{
+    void *ptr;
+
+    (void)ctx;
+
+    if (align <= STATE_MACHINE_ALIGN)
+    {
+        return(malloc(size));
+    }
+
+    if (posix_memalign(&ptr, align, size) != 0)
+    {
+        return(NULL);
+    }
+
+    return(ptr);
+}
+
+
+
+static void state_machine_free (void *ctx, void *ptr)
+{
+    (void)ctx;
+
+    free(ptr);
+}
+
+
+
+static bool state_machine_add_state (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_t enter)
+{
+    state_private_t *private_data;
+    fsm_state_t *state;
+
+    /* Check for valid state machine */
+    if (fsm == NULL)
+    {
+        return(-1);
+    }
+
+    /* Check if the required target state for the transition is valid */
+    if (id >= fsm->state_nr)
+    {
+        return(false);
+    }
+
+    /* A state of a sparse state machine is materialized here */
+    state = state_machine_state(fsm, id);
+    if (state == NULL)
+    {
+        return(false);
+    }
+
+    /* Set the pointer to the private fields of the structure */
+    private_data = (state_private_t*)state->private_data;
+
+    /* Check if the state has already been enabled */
+    if (private_data->enabled == false)
+    {
+        private_data->enabled = true;
+        private_data->run = run;
+        private_data->enter = enter;
+
+        return(true);
+    }
+
+    return(false);
+}
+
+
+
+static bool state_machine_add_transition (fsm_t *fsm, uint32_t state_id, uint32_t target_id)
+{
+    fsm_state_t *state;
+
+    /* Check if both states are valid */
+    if ((state_id >= fsm->state_nr) || (target_id >= fsm->state_nr))
+    {
+        return(false);
+    }
+
+    /* The mask handles the first states only (see "state_machine_set_targets") */
+    if (target_id >= STATE_MACHINE_MASK_SIZE)
+    {
+        return(false);
+    }
+
+    state = state_machine_state(fsm, state_id);
+    if (state == NULL)
+    {
+        return(false);
+    }
+
+    /* Update the "Valid Targes" register of the state */
+    state->valid_target |= (0x1U << target_id);
+
+    return(true);
+}
+
+
+
+static uint32_t state_machine_run (fsm_t *fsm, void *arg)
+{
+    fsm_t *sm;
+    state_private_t *private_data;
+    uint32_t id;
+
+    /* Check for valid state machine */
+    if (fsm == NULL)
+    {
+        return(-1);
+    }
+
+    /* Set the pointer to the state machine to be handled */
+    sm = (fsm_t *)fsm;
+
+    /* The state machine is parked until the asynchronous transition is completed */
+    if (__atomic_load_n(&sm->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        return(sm->actual_state->id);
+    }
+
+    /*
+     Check for the callback function to be called. Available options are:
+     - standard callback: the state is not changed.
+     - exit callback: the state is changed and the exit callback must be executed.
+     */
+    if (sm->actual_state == &sm->states[sm->target_state])
+    {
+        /* Set the pointer to the private data of the state */
+        private_data = (state_private_t*)sm->actual_state->private_data;
+
+        if (private_data->run != NULL)
+        {
+            private_data->run(arg);
+        }
+    }
+    else
+    {
+        id = fsm->get_state(fsm);
+
+        /* The target was translated by "go_to_state": no lookup of the layout here */
+        fsm->actual_state = &fsm->states[fsm->target_state];
+
+        state_machine_enter(sm, id, arg);
+    }
+
+
+    return(sm->actual_state->id);
+}
+
+
+
+static bool state_machine_go_to_state (fsm_t *fsm, uint32_t target_id)
+{
+    fsm_state_t *state;
+    uint32_t state_mask;
+
+    /* Check if the state machine is valid */
+    if (fsm == NULL)
+    {
+        return(-1);
+    }
+
+    /* Check for valid state */
+    if (target_id >= fsm->state_nr)
+    {
+        return(false);
+    }
+
+    /* No transitions are accepted during an asynchronous transition */
+    if (__atomic_load_n(&fsm->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        return(false);
+    }
+
+    /* Set the pointer to the state "in use" */
+    state = fsm->actual_state;
+    state_mask = state->valid_target;
+
+    if ((target_id < STATE_MACHINE_MASK_SIZE) && ((state_mask & (0x1U << target_id)) != 0))
+    {
+        /* Update the target state (position in "states") */
+        fsm->target_state = STATE_MACHINE_INDEX(fsm, target_id);
+        return(true);
+    }
+
+    /* Search the sorted list of the targets */
+    if (state_machine_find_target((state_private_t*)state->private_data, target_id) == true)
+    {
+        fsm->target_state = STATE_MACHINE_INDEX(fsm, target_id);
+        return(true);
+    }
+
+    return(false);
 }
 
 
@@ -270,3 +1284,394 @@ static uint32_t state_machine_get_state (fsm_t *fsm)
 {
     return(fsm->actual_state->id);
 }
+
+
+
+static uint32_t state_machine_run_regions (fsm_t *fsm, void *arg)
+{
+    fsm_region_t *region;
+    state_private_t *private_data;
+    uint32_t cntr;
+    uint32_t id;
+
+    for (cntr = 0; cntr < fsm->region_nr; cntr++)
+    {
+        region = &fsm->regions[cntr];
+
+        if (region->actual_state == &fsm->states[region->target_state])
+        {
+            private_data = (state_private_t*)region->actual_state->private_data;
+
+            if (private_data->run != NULL)
+            {
+                private_data->run(arg);
+            }
+            continue;
+        }
+
+        id = region->actual_state->id;
+        region->actual_state = &fsm->states[region->target_state];
+
+        if (fsm->on_transition != NULL)
+        {
+            fsm->on_transition(fsm, id, region->actual_state->id, fsm->hook_data);
+        }
+
+        private_data = (state_private_t*)region->actual_state->private_data;
+
+        if (private_data->enter != NULL)
+        {
+            private_data->enter(id, arg);
+        }
+    }
+
+    /* The first region is also the state of the whole state machine */
+    fsm->actual_state = fsm->regions[0].actual_state;
+
+    return(fsm->actual_state->id);
+}
+
+
+
+static bool state_machine_add_transition_regions (fsm_t *fsm, uint32_t state_id, uint32_t target_id)
+{
+    const uint32_t *region_of;
+    uint32_t bit;
+
+    if ((state_id >= fsm->state_nr) || (target_id >= fsm->state_nr))
+    {
+        return(false);
+    }
+
+    /* The masks are local to the regions */
+    region_of = (const uint32_t *)(fsm->regions + fsm->region_nr);
+    if (region_of[state_id] != region_of[target_id])
+    {
+        return(false);
+    }
+
+    bit = target_id - fsm->regions[region_of[target_id]].first_state;
+    if (bit >= STATE_MACHINE_MASK_SIZE)
+    {
+        return(false);
+    }
+
+    fsm->states[STATE_MACHINE_INDEX(fsm, state_id)].valid_target |= (0x1U << bit);
+
+    return(true);
+}
+
+
+
+static bool state_machine_go_to_state_regions (fsm_t *fsm, uint32_t target_id)
+{
+    fsm_region_t *region;
+    fsm_state_t *state;
+    uint32_t bit;
+
+    if (target_id >= fsm->state_nr)
+    {
+        return(false);
+    }
+
+    /* The target selects the region */
+    region = &fsm->regions[((const uint32_t *)(fsm->regions + fsm->region_nr))[target_id]];
+    state = region->actual_state;
+    bit = target_id - region->first_state;
+
+    if (((bit < STATE_MACHINE_MASK_SIZE) && ((state->valid_target & (0x1U << bit)) != 0)) ||
+        (state_machine_find_target((state_private_t*)state->private_data, target_id) == true))
+    {
+        region->target_state = STATE_MACHINE_INDEX(fsm, target_id);
+
+        if (region == fsm->regions)
+        {
+            fsm->target_state = region->target_state;
+        }
+        return(true);
+    }
+
+    return(false);
+}
+
+
+
+static bool state_machine_find_target (const state_private_t *private_data, uint32_t target_id)
+{
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    low = 0;
+    high = private_data->target_nr;
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+
+        if (private_data->targets[middle] < target_id)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return((low < private_data->target_nr) && (private_data->targets[low] == target_id));
+}
+
+
+
+static uint32_t state_machine_run_sparse (fsm_t *fsm, void *arg)
+{
+    state_private_t *private_data;
+    uint32_t id;
+
+    /* The state machine is parked until the asynchronous transition is completed */
+    if (__atomic_load_n(&fsm->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        return(fsm->actual_state->id);
+    }
+
+    if (fsm->actual_state->id == fsm->target_state)
+    {
+        private_data = (state_private_t*)fsm->actual_state->private_data;
+
+        if (private_data->run != NULL)
+        {
+            private_data->run(arg);
+        }
+    }
+    else
+    {
+        id = fsm->actual_state->id;
+
+        /* The target was materialized when it was accepted */
+        fsm->actual_state = *state_machine_sparse_find(fsm->sparse, fsm->target_state);
+
+        state_machine_enter(fsm, id, arg);
+    }
+
+    return(fsm->actual_state->id);
+}
+
+
+
+static bool state_machine_go_to_state_sparse (fsm_t *fsm, uint32_t target_id)
+{
+    fsm_state_t *state;
+
+    if (target_id >= fsm->state_nr)
+    {
+        return(false);
+    }
+
+    /* No transitions are accepted during an asynchronous transition */
+    if (__atomic_load_n(&fsm->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        return(false);
+    }
+
+    state = fsm->actual_state;
+
+    if (((target_id < STATE_MACHINE_MASK_SIZE) && ((state->valid_target & (0x1U << target_id)) != 0)) ||
+        (state_machine_find_target((state_private_t*)state->private_data, target_id) == true))
+    {
+        /* The target is materialized here, so "sm_run" never allocates */
+        if (state_machine_state(fsm, target_id) == NULL)
+        {
+            return(false);
+        }
+
+        fsm->target_state = target_id;
+        return(true);
+    }
+
+    return(false);
+}
+
+
+
+static void state_machine_enter (fsm_t *fsm, uint32_t exit_state_id, void *arg)
+{
+    state_private_t *private_data;
+
+    if (fsm->on_transition != NULL)
+    {
+        fsm->on_transition(fsm, exit_state_id, fsm->actual_state->id, fsm->hook_data);
+    }
+
+    /* Set the pointer to the private data of the state */
+    private_data = (state_private_t*)fsm->actual_state->private_data;
+
+    if (private_data->enter_async != NULL)
+    {
+        /* The completion can be posted before the callback returns */
+        __atomic_store_n(&fsm->pending, 1, __ATOMIC_RELAXED);
+
+        if (private_data->enter_async(fsm, exit_state_id, arg) == FSM_ENTER_DONE)
+        {
+            __atomic_store_n(&fsm->pending, 0, __ATOMIC_RELAXED);
+        }
+    }
+    else if (private_data->enter != NULL)
+    {
+        private_data->enter(exit_state_id, arg);
+    }
+}
+
+
+
+static fsm_state_t* state_machine_state (fsm_t *fsm, uint32_t id)
+{
+    fsm_sparse_t *sparse = fsm->sparse;
+    fsm_sparse_chunk_t *chunk;
+    fsm_sparse_node_t *node;
+    fsm_state_t **item;
+
+    if (sparse == NULL)
+    {
+        return(&fsm->states[STATE_MACHINE_INDEX(fsm, id)]);
+    }
+
+    if (sparse->size > 0)
+    {
+        item = state_machine_sparse_find(sparse, id);
+        if (*item != NULL)
+        {
+            return(*item);
+        }
+    }
+
+    /* At most 3/4 of the table is used */
+    if (((uint64_t)sparse->count + 1) * 4 > (uint64_t)sparse->size * 3)
+    {
+        if (state_machine_sparse_grow(fsm) == false)
+        {
+            return(NULL);
+        }
+    }
+
+    if ((sparse->chunks == NULL) || (sparse->used == STATE_MACHINE_SPARSE_CHUNK))
+    {
+        chunk = (fsm_sparse_chunk_t *)fsm->allocator.alloc(fsm->allocator.ctx, sizeof(fsm_sparse_chunk_t), STATE_MACHINE_ALIGN);
+        if (chunk == NULL)
+        {
+            return(NULL);
+        }
+
+        chunk->next = sparse->chunks;
+        sparse->chunks = chunk;
+        sparse->used = 0;
+    }
+
+    node = &sparse->chunks->nodes[sparse->used++];
+    node->state.id = id;
+    node->state.valid_target = 0;
+    node->state.private_data = &node->private_data;
+    node->private_data.enabled = false;
+    node->private_data.run = NULL;
+    node->private_data.enter = NULL;
+    node->private_data.enter_async = NULL;
+    node->private_data.targets = NULL;
+    node->private_data.target_nr = 0;
+
+    *state_machine_sparse_find(sparse, id) = &node->state;
+    sparse->count++;
+
+    return(&node->state);
+}
+
+
+
+static fsm_state_t** state_machine_sparse_find (const fsm_sparse_t *sparse, uint32_t id)
+{
+    uint32_t hash;
+    uint32_t index;
+
+    /* Mix of the bits of the ID (the generated IDs are often regular) */
+    hash = id;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6B;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35;
+    hash ^= hash >> 16;
+
+    /* Linear probing: the table is never full */
+    for (index = hash & (sparse->size - 1); ; index = (index + 1) & (sparse->size - 1))
+    {
+        if ((sparse->table[index] == NULL) || (sparse->table[index]->id == id))
+        {
+            return(&sparse->table[index]);
+        }
+    }
+}
+
+
+
+static bool state_machine_sparse_grow (fsm_t *fsm)
+{
+    fsm_sparse_t *sparse = fsm->sparse;
+    fsm_state_t **table;
+    uint32_t size;
+    uint32_t cntr;
+
+    if (sparse->size > 0x40000000)
+    {
+        return(false);
+    }
+
+    size = (sparse->size > 0) ? sparse->size * 2 : STATE_MACHINE_SPARSE_MIN_SIZE;
+
+    table = (fsm_state_t **)fsm->allocator.alloc(fsm->allocator.ctx, size * sizeof(fsm_state_t *), STATE_MACHINE_ALIGN);
+    if (table == NULL)
+    {
+        return(false);
+    }
+    memset(table, 0, size * sizeof(fsm_state_t *));
+
+    /* The states are added again to the new table */
+    for (cntr = 0; cntr < sparse->size; cntr++)
+    {
+        if (sparse->table[cntr] != NULL)
+        {
+            fsm_sparse_t resized = { table, size, 0, NULL, 0 };
+
+            *state_machine_sparse_find(&resized, sparse->table[cntr]->id) = sparse->table[cntr];
+        }
+    }
+
+    if (sparse->table != NULL)
+    {
+        fsm->allocator.free(fsm->allocator.ctx, sparse->table);
+    }
+
+    sparse->table = table;
+    sparse->size = size;
+
+    return(true);
+}
+
+
+
+static void state_machine_sparse_release (fsm_t *fsm)
+{
+    fsm_sparse_t *sparse = fsm->sparse;
+    fsm_sparse_chunk_t *chunk;
+
+    while (sparse->chunks != NULL)
+    {
+        chunk = sparse->chunks;
+        sparse->chunks = chunk->next;
+        fsm->allocator.free(fsm->allocator.ctx, chunk);
+    }
+
+    if (sparse->table != NULL)
+    {
+        fsm->allocator.free(fsm->allocator.ctx, sparse->table);
+    }
+
+    fsm->allocator.free(fsm->allocator.ctx, sparse);
+    fsm->sparse = NULL;
+}
@@ -9,10 +9,29 @@
 #define STATE_MACHINE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
 
+/**
+ * @def STATE_MACHINE_CACHE_LINE
+ * @brief Size of a cache line.
+ */
+#define STATE_MACHINE_CACHE_LINE        64
+
+/**
+ * @def STATE_MACHINE_CACHE_ALIGNED
+ * @brief Option of "fsm_attr_t": the memory of the state machine is made of whole cache lines
+ * and the fields written by the transitions ("actual_state" and "target_state") have a cache
+ * line on their own. State machines owned by different threads never share a cache line and
+ * the configuration (function pointers, states) is never invalidated by the transitions.
+ * INFO: The pools of the state machines must use "STATE_MACHINE_CACHE_LINE" as alignment.
+ */
+#define STATE_MACHINE_CACHE_ALIGNED     0x00000001
+
+
+
 /**
  * @typedef fsm_t
  * @brief Data type used to create the main structure of the state machine.
@@ -25,6 +44,30 @@ typedef struct _fsm_t fsm_t;
  */
 typedef struct _fsm_state_t fsm_state_t;
 
+/**
+ * @typedef fsm_region_t
+ * @brief Data type used to store the actual state of a region (see "state_machine_init_regions").
+ */
+typedef struct _fsm_region_t fsm_region_t;
+
+/**
+ * @typedef fsm_sparse_t
+ * @brief Data type used to store the states of a sparse state machine (see "state_machine_init_sparse").
+ */
+typedef struct _fsm_sparse_t fsm_sparse_t;
+
+/**
+ * @typedef fsm_allocator_t
+ * @brief Data type used to provide the memory needed by a state machine.
+ */
+typedef struct _fsm_allocator_t fsm_allocator_t;
+
+/**
+ * @typedef fsm_attr_t
+ * @brief Data type used to configure the creation of a state machine.
+ */
+typedef struct _fsm_attr_t fsm_attr_t;
+
 
 /**
  * @typedef fsm_run_t
@@ -57,6 +100,48 @@ typedef void (*fsm_state_run_t) (void *par);
  */
 typedef void (*fsm_state_enter_t) (uint32_t exit_state_id, void *par);
 
+/**
+ * @typedef fsm_enter_status_t
+ * @brief Result of an asynchronous "enter" callback.
+ */
+typedef enum {
+    FSM_ENTER_DONE = 0,         /**< The transition is completed */
+    FSM_ENTER_PENDING           /**< The transition is completed by "state_machine_complete" */
+} fsm_enter_status_t;
+
+/**
+ * @typedef fsm_state_enter_async_t
+ * @brief Pointer to the callback function called by "fsm_run_t" when a transition
+ * is required, for states that start an asynchronous operation (e.g. I/O).
+ * If the callback returns "FSM_ENTER_PENDING", the state machine stays in the
+ * "transitioning" substate: the "run" callback is not called and no transitions are
+ * accepted until "state_machine_complete" is called (by any thread).
+ * INFO: "state_machine_complete" can be called before the callback returns.
+ * @param fsm The state machine, used to post the completion.
+ * @param exit_state_id The exit state of the state machine (i.e. the old state).
+ * @param par Optional parametr "passed" directly from "fsm_run_t" function.
+ * @return The status of the transition.
+ */
+typedef fsm_enter_status_t (*fsm_state_enter_async_t) (fsm_t *fsm, uint32_t exit_state_id, void *par);
+
+/**
+ * @typedef fsm_transition_hook_t
+ * @brief Pointer to the function called by "fsm_run_t" when the state is changed, before
+ * the "enter" callback of the new state.
+ * Example: It is used to count the transitions (see "state_machine_profile.h").
+ * @param fsm The state machine.
+ * @param exit_state_id The exit state of the state machine (i.e. the old state).
+ * @param enter_state_id The new state of the state machine.
+ * @param data Parameter stored in the state machine together with the hook.
+ */
+typedef void (*fsm_transition_hook_t) (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+/**
+ * @typedef fsm_hook_link_t
+ * @brief Data type used to keep the hook set before another one (see "state_machine_hook_link").
+ */
+typedef struct _fsm_hook_link_t fsm_hook_link_t;
+
 /**
  * @typedef state_machine_add_state_t
  * @brief Add a new state to the given state machine.
@@ -88,6 +173,62 @@ typedef bool (*state_machine_add_transition_t) (fsm_t *fsm, uint32_t state_id, u
  */
 typedef bool (*state_machine_go_to_state_t) (fsm_t *fsm, uint32_t target_id);
 
+/**
+ * @typedef fsm_alloc_t
+ * @brief Pointer to the function used to allocate the memory of a state machine.
+ * @param ctx Context of the allocator.
+ * @param size Number of bytes required.
+ * @param align Required alignment of the memory (power of 2).
+ * @return Pointer to the memory, NULL if not available.
+ */
+typedef void* (*fsm_alloc_t) (void *ctx, size_t size, size_t align);
+
+/**
+ * @typedef fsm_free_t
+ * @brief Pointer to the function used to release the memory of a state machine.
+ * @param ctx Context of the allocator.
+ * @param ptr Pointer returned by "fsm_alloc_t".
+ */
+typedef void (*fsm_free_t) (void *ctx, void *ptr);
+
+
+
+/**
+ * @struct _fsm_allocator_t
+ * @brief Allocator used by a state machine.
+ */
+struct _fsm_allocator_t {
+    fsm_alloc_t alloc;          /**< Function used to allocate the memory */
+    fsm_free_t free;            /**< Function used to release the memory */
+    void *ctx;                  /**< Context passed to the functions */
+};
+
+/**
+ * @struct _fsm_attr_t
+ * @brief Options used by "state_machine_init_ex".
+ * INFO: A cleared structure selects the default options.
+ */
+struct _fsm_attr_t {
+    const fsm_allocator_t *allocator;   /**< Allocator of the state machine (NULL to use malloc) */
+    uint32_t flags;                     /**< Options of the state machine (e.g. "STATE_MACHINE_CACHE_ALIGNED") */
+    const uint32_t *layout;             /**< Order of the states in memory ("state_nr" state IDs), NULL to use
+                                             the order of the IDs. The IDs used by the API do not change. */
+};
+
+
+
+/**
+ * @struct _fsm_hook_link_t
+ * @brief See "fsm_hook_link_t" for details.
+ * It is the first field of the data of the hooks that call the hook set before them
+ * (profile, observers, trace, replica, journal), so the hooks form a chain.
+ */
+struct _fsm_hook_link_t {
+    fsm_transition_hook_t on_transition;    /**< Hook set before (NULL if none) */
+    void *hook_data;                        /**< Parameter of the hook set before */
+    bool chained;                           /**< true if the hook set before is also a link of the chain */
+};
+
 
 
 /**
@@ -106,11 +247,6 @@ struct _fsm_state_t {
  * @brief Main struct used for the definition of a state machine.
  */
 struct _fsm_t {
-    fsm_state_t *actual_state;  /**< Actual state of the state machine */
-    uint32_t target_state;      /**< Target state of the state machine
-                                     i.e. if "target state" is different from "actual state",
-                                     a transition is executed. */
-
     fsm_state_t *states;        /**< List of the valid states */
     uint32_t state_nr;          /**< Number of states of the state machine */
     fsm_run_t sm_run;           /**< Update the state machine and execute its transitions */
@@ -120,19 +256,256 @@ struct _fsm_t {
     state_machine_add_state_t add_state;            /** Function called to add a state to the state machine */
     state_machine_add_transition_t add_transition;  /** Add a valid transition to the state machine */
     state_machine_go_to_state_t go_to_state;        /** Update the state of the given state machine */
+
+    fsm_allocator_t allocator;  /**< Allocator used to release the state machine */
+    uint32_t flags;             /**< Options of the state machine (see "fsm_attr_t") */
+    uint32_t *id_map;           /**< Position of every state ID in "states" (NULL if the states are in ID order) */
+
+    fsm_transition_hook_t on_transition;    /**< Function called when the state is changed (NULL if not used) */
+    void *hook_data;                        /**< Parameter passed to "on_transition" */
+
+    fsm_region_t *regions;      /**< Actual states of the regions (NULL if the state machine has no regions) */
+    uint32_t region_nr;         /**< Number of regions (0 if the state machine has no regions) */
+
+    fsm_sparse_t *sparse;       /**< Materialized states of a sparse state machine ("states" is NULL), NULL if not sparse */
+
+    /*
+     Fields written by the transitions: they are the last ones, so with the option
+     "STATE_MACHINE_CACHE_ALIGNED" they start a cache line not shared with the configuration.
+     */
+    fsm_state_t *actual_state;  /**< Actual state of the state machine */
+    uint32_t target_state;      /**< Target state of the state machine, as position in "states" (the ID
+                                     unless "fsm_attr_t.layout" is used, see "state_machine_get_target")
+                                     i.e. if "target state" is different from "actual state",
+                                     a transition is executed. */
+    uint32_t pending;           /**< Not 0 while an asynchronous transition is in progress */
 };
 
 
 
+/**
+ * @var state_machine_malloc_allocator
+ * @brief Allocator based on "malloc" and "free", used when no allocator is given.
+ */
+extern const fsm_allocator_t state_machine_malloc_allocator;
+
+
+
 /**
  * @fn state_machine_init
  * @brief Create and initialize a state machine.
  * @param state_nr Maximum number of states that can be added to the state machine.
  * @param initial_state Initial state of the state machine.
  * @param arg Not used at the moment.
+ * @return The new state machine, NULL if the parameters are not valid or the memory is not available.
  */
 fsm_t* state_machine_init (uint32_t state_nr, uint32_t initial_state, void *arg);
 
+/**
+ * @fn state_machine_init_ex
+ * @brief Create and initialize a state machine with the given options.
+ * The state machine, its states and their private data are stored in a single
+ * block of memory provided by the allocator.
+ * @param state_nr Maximum number of states that can be added to the state machine.
+ * @param initial_state Initial state of the state machine.
+ * @param attr Options of the state machine (NULL to use the default ones).
+ * @return The new state machine, NULL if the parameters are not valid or the memory is not available.
+ */
+fsm_t* state_machine_init_ex (uint32_t state_nr, uint32_t initial_state, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_init_regions
+ * @brief Create a state machine made of orthogonal regions.
+ * The states are split in regions of consecutive IDs and every region has its own actual
+ * state: "go_to_state" plans a transition of the region of the target (a single lookup
+ * finds the region and checks the target), "sm_run" executes the transitions (or the "run"
+ * callbacks) of all the regions, in order, and "get_state" returns the state of the first
+ * region. "add_transition" accepts only transitions inside a region and its mask is local
+ * to the region, so every region can have 32 states handled by the mask.
+ * INFO: The states can not be asynchronous (see "state_machine_add_state_async").
+ * @param state_nr Number of states of all the regions.
+ * @param region_nr Number of regions.
+ * @param first_states First state ID of every region ("region_nr" items, ascending, the first one is 0).
+ * @param initial_states Initial state of every region ("region_nr" items).
+ * @param attr Options of the state machine (NULL to use the default ones).
+ * @return The new state machine, NULL if the parameters are not valid or the memory is not available.
+ */
+fsm_t* state_machine_init_regions (uint32_t state_nr, uint32_t region_nr, const uint32_t *first_states, const uint32_t *initial_states, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_init_sparse
+ * @brief Create a state machine whose states are materialized when used.
+ * The memory of a state is allocated (with the allocator of the state machine) the first
+ * time it is added, configured, or accepted as target by "go_to_state", and found with a
+ * hash table: the memory depends on the states used, not on "state_nr". The transitions
+ * need a lookup of the target, so the state machines with few states should not be sparse.
+ * INFO: The sparse state machines can not be copied ("state_machine_clone" and
+ * "state_machine_clone_many" fail) and do not accept "fsm_attr_t.layout".
+ * @param state_nr Maximum number of states (the IDs are 0 ... state_nr - 1).
+ * @param initial_state Initial state of the state machine.
+ * @param attr Options of the state machine (NULL to use the default ones).
+ * @return The new state machine, NULL if the parameters are not valid or the memory is not available.
+ */
+fsm_t* state_machine_init_sparse (uint32_t state_nr, uint32_t initial_state, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_get_target
+ * @brief Get the ID of the target state (the actual state if no transition is planned).
+ */
+uint32_t state_machine_get_target (const fsm_t *fsm);
+
+/**
+ * @fn state_machine_materialized
+ * @brief Get the number of states in memory (all the states if the state machine is not sparse).
+ */
+uint32_t state_machine_materialized (const fsm_t *fsm);
+
+/**
+ * @fn state_machine_get_region_state
+ * @brief Get the ID of the actual state of a region.
+ * @param fsm The target state machine.
+ * @param region Index of the region (0 for the state machines without regions).
+ * @return The ID of the actual state.
+ */
+uint32_t state_machine_get_region_state (const fsm_t *fsm, uint32_t region);
+
+/**
+ * @fn state_machine_size
+ * @brief Get the size of the block of memory required by a state machine (without regions).
+ * Example: It can be used to configure the size of the blocks of a pool.
+ * @param state_nr Number of states of the state machine.
+ * @param attr Options of the state machine (NULL to use the default ones).
+ * @return The size of the block.
+ */
+size_t state_machine_size (uint32_t state_nr, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_clone
+ * @brief Create a copy of the given state machine (configuration and actual state).
+ * The hooks attached by the modules (profile, observers, trace, ...) are not copied: the
+ * copy keeps only the hook set directly ("on_transition"), if any.
+ * Example: It is used to move a state machine to a different allocator.
+ * @param fsm The state machine to be copied.
+ * @param attr Options of the copy (NULL to use the default ones).
+ * @return The copy of the state machine, NULL if the memory is not available (or the state machine is sparse).
+ */
+fsm_t* state_machine_clone (const fsm_t *fsm, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_clone_many
+ * @brief Create several copies of the given state machine in a single block of memory.
+ * The copies are placed one after the other (e.g. with "STATE_MACHINE_CACHE_ALIGNED" every
+ * copy starts a cache line) and are made with block copies, without the initialization of
+ * the states. The copies can be used as the ones of "state_machine_clone".
+ * WARNING: The copies must be released together by "state_machine_deinit_many"
+ * ("state_machine_deinit" ignores them). The allocator must provide a block of "count"
+ * times the size of a state machine (see "state_machine_size").
+ * @param fsm The state machine to be copied.
+ * @param count Number of copies.
+ * @param fsms Destination of the copies ("count" items).
+ * @param attr Options of the copies (only the allocator is used, NULL to use the default one).
+ * @return true if the copies were created, false if the memory is not available (or the state machine is sparse).
+ */
+bool state_machine_clone_many (const fsm_t *fsm, uint32_t count, fsm_t **fsms, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_add_state_async
+ * @brief Add a new state whose "enter" callback can complete asynchronously.
+ * See "state_machine_add_state_t" and "fsm_state_enter_async_t" for details.
+ */
+bool state_machine_add_state_async (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_async_t enter);
+
+/**
+ * @fn state_machine_set_targets
+ * @brief Set the valid targets of a state with a sorted list of state IDs.
+ * Unlike "add_transition", that handles the targets with ID lower than 32 only, any state
+ * can be a target; "go_to_state" checks the list with a binary search.
+ * WARNING: The list is not copied and must be valid until the state machine is released.
+ * @param fsm The target state machine.
+ * @param id The ID of the state.
+ * @param targets List of the targets, in ascending order and without duplicates.
+ * @param target_nr Number of targets.
+ * @return true if the list was set, false if it is not valid.
+ */
+bool state_machine_set_targets (fsm_t *fsm, uint32_t id, const uint32_t *targets, uint32_t target_nr);
+
+/**
+ * @fn state_machine_complete
+ * @brief Complete the asynchronous transition of a state machine.
+ * INFO: It can be called by any thread; the state machine resumes at the next call of "sm_run".
+ * @param fsm The target state machine.
+ * @return true if a transition was pending, false if not.
+ */
+bool state_machine_complete (fsm_t *fsm);
+
+/**
+ * @fn state_machine_complete_cb
+ * @brief Same as "state_machine_complete", with the signature of a generic completion callback.
+ * Example: It can be given to an I/O library together with the state machine as context.
+ * @param fsm The target state machine.
+ */
+void state_machine_complete_cb (void *fsm);
+
+/**
+ * @fn state_machine_is_pending
+ * @brief Check if an asynchronous transition of the state machine is in progress.
+ */
+bool state_machine_is_pending (const fsm_t *fsm);
+
+/**
+ * @fn state_machine_restore_state
+ * @brief Set the actual state of a state machine without a transition (e.g. to apply a replica or a snapshot).
+ * No callbacks and no hook are called, the planned transition and the asynchronous one are dropped;
+ * with regions only the region of the state is changed.
+ * @param fsm The target state machine.
+ * @param state_id The ID of the state.
+ * @return true if the state was set, false if the ID is not valid.
+ */
+bool state_machine_restore_state (fsm_t *fsm, uint32_t state_id);
+
+/**
+ * @fn state_machine_hook_link
+ * @brief Set a hook that calls the one set before ("link" keeps it, "data" of the hook is "link").
+ * WARNING: A hook set directly ("on_transition") must be set before the linked ones: it
+ * ends the chain.
+ * @param fsm The state machine.
+ * @param hook The new hook.
+ * @param link First field of the data of the new hook.
+ */
+void state_machine_hook_link (fsm_t *fsm, fsm_transition_hook_t hook, fsm_hook_link_t *link);
+
+/**
+ * @fn state_machine_hook_find
+ * @brief Find a linked hook in the chain of a state machine.
+ * @return The data of the hook, NULL if the hook is not linked.
+ */
+fsm_hook_link_t* state_machine_hook_find (const fsm_t *fsm, fsm_transition_hook_t hook);
+
+/**
+ * @fn state_machine_hook_unlink
+ * @brief Remove a linked hook from the chain of a state machine (at any position).
+ * @param fsm The state machine.
+ * @param hook The hook.
+ * @param data Data of the hook to remove, if the hook is linked several times (NULL for the last one linked).
+ * @return The data of the hook, NULL if the hook is not linked.
+ */
+fsm_hook_link_t* state_machine_hook_unlink (fsm_t *fsm, fsm_transition_hook_t hook, const fsm_hook_link_t *data);
+
+/**
+ * @fn state_machine_deinit
+ * @brief Release a state machine created by "state_machine_init" or "state_machine_init_ex".
+ * @param fsm Pointer to the state machine to be released.
+ */
+void state_machine_deinit (fsm_t *fsm);
+
+/**
+ * @fn state_machine_deinit_many
+ * @brief Release all the state machines created by a call of "state_machine_clone_many"
+ * (or "state_machine_def_instantiate_many") with a single release of their block.
+ * @param fsms The array filled by the call.
+ */
+void state_machine_deinit_many (fsm_t **fsms);
+
 
 
 #endif
@@ -0,0 +1,359 @@
+/**
+ * @file state_machine_analysis.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_machine_analysis.h"
+
+
+
+/**
+ * @def STATE_MACHINE_ANALYSIS_NONE
+ * @brief Value of the indexes not assigned yet.
+ */
+#define STATE_MACHINE_ANALYSIS_NONE     0xFFFFFFFF
+
+/**
+ * @def STATE_MACHINE_ANALYSIS_WORD_NR
+ * @brief Number of 64 bits words of a set of "n" states.
+ */
+#define STATE_MACHINE_ANALYSIS_WORD_NR(n)   (((n) + 63) / 64)
+
+
+
+/**
+ * @fn state_machine_analysis_bfs
+ * @brief Compute the depth of the states, the reachable ones and the layout.
+ * The visit proceeds by levels: the frontier and the visited states are sets of bits,
+ * so every level is merged into the visited states 64 states at a time.
+ * @param scratch Memory for three sets of "state_nr" bits.
+ */
+static void state_machine_analysis_bfs (const fsm_def_t *def, fsm_analysis_t *analysis, uint64_t *scratch);
+
+/**
+ * @fn state_machine_analysis_scc
+ * @brief Compute the strongly connected components (Tarjan's algorithm without recursion).
+ * @param scratch Memory for five arrays of "state_nr" items.
+ */
+static void state_machine_analysis_scc (const fsm_def_t *def, fsm_analysis_t *analysis, uint32_t *scratch);
+
+
+
+fsm_analysis_t* state_machine_analyze (const fsm_def_t *def)
+{
+    fsm_analysis_t *analysis;
+    const fsm_def_state_t *state;
+    void *scratch;
+    size_t words_size;
+    size_t arrays_size;
+    uint32_t cntr;
+    uint32_t target;
+    char *block;
+
+    if ((def == NULL) || (def->state_nr == 0) || (def->initial_state >= def->state_nr))
+    {
+        return(NULL);
+    }
+
+    /* The results are stored in a single block */
+    arrays_size = (size_t)def->state_nr * sizeof(uint32_t);
+    block = (char *)calloc(1, sizeof(fsm_analysis_t) + 3 * arrays_size + def->state_nr);
+    if (block == NULL)
+    {
+        return(NULL);
+    }
+
+    analysis = (fsm_analysis_t *)block;
+    analysis->state_nr = def->state_nr;
+    analysis->component = (uint32_t *)(block + sizeof(fsm_analysis_t));
+    analysis->depth = (uint32_t *)(block + sizeof(fsm_analysis_t) + arrays_size);
+    analysis->layout = (uint32_t *)(block + sizeof(fsm_analysis_t) + 2 * arrays_size);
+    analysis->flags = (uint8_t *)(block + sizeof(fsm_analysis_t) + 3 * arrays_size);
+
+    /* The scratch memory is shared by the two visits */
+    words_size = 3 * STATE_MACHINE_ANALYSIS_WORD_NR((size_t)def->state_nr) * sizeof(uint64_t);
+    scratch = malloc((words_size > 5 * arrays_size) ? words_size : 5 * arrays_size);
+    if (scratch == NULL)
+    {
+        free(block);
+        return(NULL);
+    }
+
+    state_machine_analysis_bfs(def, analysis, (uint64_t *)scratch);
+    state_machine_analysis_scc(def, analysis, (uint32_t *)scratch);
+
+    free(scratch);
+
+    /* Terminal and dead states */
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        for (target = 0; target < state->target_nr; target++)
+        {
+            if (def->targets[state->first_target + target] != cntr)
+            {
+                break;
+            }
+        }
+
+        if (target < state->target_nr)
+        {
+            continue;
+        }
+
+        analysis->flags[cntr] |= STATE_MACHINE_ANALYSIS_TERMINAL;
+        analysis->terminal_nr++;
+
+        /* The definitions loaded without symbol table have only the name of the callback */
+        if ((state->run == NULL) && (state->run_name == NULL))
+        {
+            analysis->flags[cntr] |= STATE_MACHINE_ANALYSIS_DEAD;
+            analysis->dead_nr++;
+        }
+    }
+
+    return(analysis);
+}
+
+
+
+void state_machine_analysis_free (fsm_analysis_t *analysis)
+{
+    free(analysis);
+}
+
+
+
+uint32_t state_machine_analysis_report (const fsm_def_t *def, const fsm_analysis_t *analysis, FILE *out)
+{
+    const char *name;
+    uint32_t problem_nr;
+    uint32_t cntr;
+
+    problem_nr = 0;
+
+    for (cntr = 0; cntr < analysis->state_nr; cntr++)
+    {
+        name = (def->states[cntr].name != NULL) ? def->states[cntr].name : "-";
+
+        if ((analysis->flags[cntr] & STATE_MACHINE_ANALYSIS_REACHABLE) == 0)
+        {
+            fprintf(out, "state %u (%s): not reachable from the initial state\n", cntr, name);
+            problem_nr++;
+        }
+        else if ((analysis->flags[cntr] & STATE_MACHINE_ANALYSIS_DEAD) != 0)
+        {
+            fprintf(out, "state %u (%s): dead state (no transitions and no run callback)\n", cntr, name);
+            problem_nr++;
+        }
+    }
+
+    return(problem_nr);
+}
+
+
+
+static void state_machine_analysis_bfs (const fsm_def_t *def, fsm_analysis_t *analysis, uint64_t *scratch)
+{
+    const fsm_def_state_t *state;
+    uint64_t *visited;
+    uint64_t *frontier;
+    uint64_t *next;
+    uint64_t *swap;
+    uint64_t bits;
+    uint64_t found;
+    uint32_t word_nr;
+    uint32_t word;
+    uint32_t level;
+    uint32_t cntr;
+    uint32_t id;
+    uint32_t target;
+
+    word_nr = STATE_MACHINE_ANALYSIS_WORD_NR(def->state_nr);
+    visited = scratch;
+    frontier = scratch + word_nr;
+    next = scratch + 2 * word_nr;
+
+    memset(scratch, 0, 2 * (size_t)word_nr * sizeof(uint64_t));
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        analysis->depth[cntr] = STATE_MACHINE_ANALYSIS_NONE;
+    }
+
+    visited[def->initial_state / 64] = 1ULL << (def->initial_state % 64);
+    frontier[def->initial_state / 64] = visited[def->initial_state / 64];
+    analysis->depth[def->initial_state] = 0;
+    analysis->layout[0] = def->initial_state;
+    analysis->reachable_nr = 1;
+
+    for (level = 1, found = 1; found != 0; level++)
+    {
+        memset(next, 0, (size_t)word_nr * sizeof(uint64_t));
+
+        /* Mark the targets of the frontier */
+        for (word = 0; word < word_nr; word++)
+        {
+            for (bits = frontier[word]; bits != 0; bits &= bits - 1)
+            {
+                state = &def->states[word * 64 + (uint32_t)__builtin_ctzll(bits)];
+
+                for (cntr = 0; cntr < state->target_nr; cntr++)
+                {
+                    target = def->targets[state->first_target + cntr];
+                    next[target / 64] |= 1ULL << (target % 64);
+                }
+            }
+        }
+
+        /* Keep the new states only */
+        found = 0;
+        for (word = 0; word < word_nr; word++)
+        {
+            next[word] &= ~visited[word];
+            visited[word] |= next[word];
+            found |= next[word];
+
+            for (bits = next[word]; bits != 0; bits &= bits - 1)
+            {
+                id = word * 64 + (uint32_t)__builtin_ctzll(bits);
+
+                analysis->depth[id] = level;
+                analysis->layout[analysis->reachable_nr++] = id;
+            }
+        }
+
+        swap = frontier;
+        frontier = next;
+        next = swap;
+    }
+
+    /* The states not reachable are placed at the end of the layout */
+    cntr = analysis->reachable_nr;
+    for (id = 0; id < def->state_nr; id++)
+    {
+        if (analysis->depth[id] != STATE_MACHINE_ANALYSIS_NONE)
+        {
+            analysis->flags[id] |= STATE_MACHINE_ANALYSIS_REACHABLE;
+        }
+        else
+        {
+            analysis->layout[cntr++] = id;
+        }
+    }
+}
+
+
+
+static void state_machine_analysis_scc (const fsm_def_t *def, fsm_analysis_t *analysis, uint32_t *scratch)
+{
+    const fsm_def_state_t *state;
+    uint32_t *index;
+    uint32_t *low;
+    uint32_t *stack;
+    uint32_t *call;
+    uint32_t *edge;
+    uint32_t stack_nr;
+    uint32_t call_nr;
+    uint32_t counter;
+    uint32_t root;
+    uint32_t id;
+    uint32_t target;
+    uint32_t member;
+    uint32_t size;
+
+    index = scratch;
+    low = scratch + def->state_nr;
+    stack = scratch + 2 * def->state_nr;
+    call = scratch + 3 * def->state_nr;
+    edge = scratch + 4 * def->state_nr;
+
+    for (id = 0; id < def->state_nr; id++)
+    {
+        index[id] = STATE_MACHINE_ANALYSIS_NONE;
+        analysis->component[id] = STATE_MACHINE_ANALYSIS_NONE;
+    }
+
+    counter = 0;
+    stack_nr = 0;
+
+    for (root = 0; root < def->state_nr; root++)
+    {
+        if (index[root] != STATE_MACHINE_ANALYSIS_NONE)
+        {
+            continue;
+        }
+
+        index[root] = low[root] = counter++;
+        stack[stack_nr++] = root;
+        call[0] = root;
+        edge[0] = 0;
+        call_nr = 1;
+
+        while (call_nr > 0)
+        {
+            id = call[call_nr - 1];
+            state = &def->states[id];
+
+            /* Visit the next target of the state */
+            if (edge[call_nr - 1] < state->target_nr)
+            {
+                target = def->targets[state->first_target + edge[call_nr - 1]];
+                edge[call_nr - 1]++;
+
+                if (index[target] == STATE_MACHINE_ANALYSIS_NONE)
+                {
+                    index[target] = low[target] = counter++;
+                    stack[stack_nr++] = target;
+                    call[call_nr] = target;
+                    edge[call_nr] = 0;
+                    call_nr++;
+                }
+                else if ((analysis->component[target] == STATE_MACHINE_ANALYSIS_NONE) && (index[target] < low[id]))
+                {
+                    /* The target is still on the stack */
+                    low[id] = index[target];
+                }
+
+                if (target == id)
+                {
+                    analysis->flags[id] |= STATE_MACHINE_ANALYSIS_CYCLIC;
+                }
+
+                continue;
+            }
+
+            /* All the targets are visited: the state can be the root of a component */
+            call_nr--;
+
+            if (low[id] == index[id])
+            {
+                size = 0;
+                do
+                {
+                    member = stack[--stack_nr];
+                    analysis->component[member] = analysis->component_nr;
+                    size++;
+                }
+                while (member != id);
+
+                if (size > 1)
+                {
+                    for (member = stack_nr; member < stack_nr + size; member++)
+                    {
+                        analysis->flags[stack[member]] |= STATE_MACHINE_ANALYSIS_CYCLIC;
+                    }
+                }
+
+                analysis->component_nr++;
+            }
+
+            if ((call_nr > 0) && (low[id] < low[call[call_nr - 1]]))
+            {
+                low[call[call_nr - 1]] = low[id];
+            }
+        }
+    }
+}
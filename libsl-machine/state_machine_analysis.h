@@ -0,0 +1,98 @@
+/**
+ * @file state_machine_analysis.h
+ * @brief Static analysis of the definition of a state machine.
+ * The analysis finds the states not reachable from the initial state, the strongly
+ * connected components of the transitions, the terminal states and the dead states
+ * (terminal states without "run" callback, where an instance stops forever). It also
+ * computes a layout of the states that places the reachable ones contiguously.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_ANALYSIS_H
+#define STATE_MACHINE_ANALYSIS_H
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @def STATE_MACHINE_ANALYSIS_REACHABLE
+ * @brief Flag of the states reachable from the initial state.
+ */
+#define STATE_MACHINE_ANALYSIS_REACHABLE    0x01
+
+/**
+ * @def STATE_MACHINE_ANALYSIS_TERMINAL
+ * @brief Flag of the states without outgoing transitions (self transitions excluded).
+ */
+#define STATE_MACHINE_ANALYSIS_TERMINAL     0x02
+
+/**
+ * @def STATE_MACHINE_ANALYSIS_DEAD
+ * @brief Flag of the terminal states without "run" callback (neither the function nor its name).
+ */
+#define STATE_MACHINE_ANALYSIS_DEAD         0x04
+
+/**
+ * @def STATE_MACHINE_ANALYSIS_CYCLIC
+ * @brief Flag of the states that belong to a cycle of transitions.
+ */
+#define STATE_MACHINE_ANALYSIS_CYCLIC       0x08
+
+
+
+/**
+ * @typedef fsm_analysis_t
+ * @brief Data type used to store the results of the analysis of a definition.
+ */
+typedef struct _fsm_analysis_t fsm_analysis_t;
+
+
+
+/**
+ * @struct _fsm_analysis_t
+ * @brief Results of the analysis of a definition.
+ */
+struct _fsm_analysis_t {
+    uint32_t state_nr;          /**< Number of states of the definition */
+    uint32_t reachable_nr;      /**< Number of states reachable from the initial state */
+    uint32_t terminal_nr;       /**< Number of terminal states */
+    uint32_t dead_nr;           /**< Number of dead states */
+    uint32_t component_nr;      /**< Number of strongly connected components */
+
+    uint8_t *flags;             /**< Flags of every state ("STATE_MACHINE_ANALYSIS_*") */
+    uint32_t *component;        /**< Strongly connected component of every state (in reverse topological order) */
+    uint32_t *depth;            /**< Minimum number of transitions from the initial state (0xFFFFFFFF if not reachable) */
+    uint32_t *layout;           /**< State IDs in layout order: reachable states by depth, then the others */
+};
+
+
+
+/**
+ * @fn state_machine_analyze
+ * @brief Analyze the given definition.
+ * @param def The definition to be analyzed.
+ * @return The results of the analysis (see "state_machine_analysis_free"), NULL if an error occurred.
+ */
+fsm_analysis_t* state_machine_analyze (const fsm_def_t *def);
+
+/**
+ * @fn state_machine_analysis_free
+ * @brief Release the results of an analysis.
+ */
+void state_machine_analysis_free (fsm_analysis_t *analysis);
+
+/**
+ * @fn state_machine_analysis_report
+ * @brief Write a readable report of the problems found by the analysis.
+ * @param def The analyzed definition.
+ * @param analysis The results of the analysis.
+ * @param out Destination file.
+ * @return The number of problems reported (unreachable and dead states).
+ */
+uint32_t state_machine_analysis_report (const fsm_def_t *def, const fsm_analysis_t *analysis, FILE *out);
+
+
+
+#endif
@@ -0,0 +1,381 @@
+/**
+ * @file state_machine_builder.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "state_machine_builder.h"
+
+
+
+/**
+ * @def STATE_MACHINE_BUILDER_MAX_THREADS
+ * @brief Maximum number of threads used by a build.
+ */
+#define STATE_MACHINE_BUILDER_MAX_THREADS   64
+
+/**
+ * @def STATE_MACHINE_BUILDER_MIN_EDGES
+ * @brief Minimum number of transitions handled by every thread (smaller builds use fewer threads).
+ */
+#define STATE_MACHINE_BUILDER_MIN_EDGES     65536
+
+
+
+/**
+ * @typedef fsm_builder_phase_t
+ * @brief Steps of a build executed by all the threads.
+ */
+typedef enum {
+    FSM_BUILDER_COUNT_TARGETS = 0,  /**< Count the transitions of every target */
+    FSM_BUILDER_SORT_TARGETS,       /**< Sort the transitions by target */
+    FSM_BUILDER_COUNT_STATES,       /**< Count the transitions of every starting state */
+    FSM_BUILDER_SORT_STATES,        /**< Sort the transitions by starting state (rows) */
+    FSM_BUILDER_UNIQUE,             /**< Remove the duplicates of every row */
+    FSM_BUILDER_COPY                /**< Copy the rows into the definition */
+} fsm_builder_phase_t;
+
+/**
+ * @typedef fsm_builder_t
+ * @brief Data shared by the threads of a build.
+ */
+typedef struct _fsm_builder_t fsm_builder_t;
+
+/**
+ * @typedef fsm_builder_worker_t
+ * @brief Data of a thread of a build.
+ */
+typedef struct _fsm_builder_worker_t fsm_builder_worker_t;
+
+/**
+ * @struct _fsm_builder_t
+ * @brief See "fsm_builder_t" for details.
+ * INFO: Thread "i" handles the "i"-th slice of the transitions and the "i"-th slice of the states.
+ */
+struct _fsm_builder_t {
+    uint32_t state_nr;          /**< Number of states */
+    uint32_t thread_nr;         /**< Number of threads */
+    const fsm_edge_t *edges;    /**< Transitions given by the user */
+    uint32_t edge_nr;           /**< Number of transitions */
+    fsm_builder_phase_t phase;  /**< Step in progress */
+    uint32_t error;             /**< Not 0 if a transition is not valid */
+
+    fsm_edge_t *by_target;      /**< Transitions sorted by target */
+    uint32_t *rows;             /**< Targets sorted by starting state and target */
+    uint32_t *counts;           /**< Counters (then positions) of every thread ("state_nr" items each) */
+    uint32_t *row_start;        /**< First item of every row in "rows" ("state_nr" + 1 items) */
+    fsm_def_t *def;             /**< The definition */
+};
+
+/**
+ * @struct _fsm_builder_worker_t
+ * @brief See "fsm_builder_worker_t" for details.
+ */
+struct _fsm_builder_worker_t {
+    fsm_builder_t *builder;     /**< The build */
+    uint32_t index;             /**< Index of the thread */
+};
+
+
+
+/**
+ * @fn state_machine_builder_run
+ * @brief Execute a step of the build with all the threads.
+ * INFO: If a thread can not be started its work is done by the calling thread.
+ */
+static void state_machine_builder_run (fsm_builder_t *builder, fsm_builder_phase_t phase);
+
+/**
+ * @fn state_machine_builder_worker
+ * @brief Execute the part of a thread of the actual step.
+ * @param arg The "fsm_builder_worker_t" of the thread.
+ */
+static void* state_machine_builder_worker (void *arg);
+
+/**
+ * @fn state_machine_builder_prefix
+ * @brief Change the counters of the threads into positions: for every state the items of
+ * thread 0 come first, then the ones of thread 1 and so on (the sorts are stable).
+ * @param builder The build.
+ * @param row_start Destination of the first position of every state (NULL if not needed).
+ */
+static void state_machine_builder_prefix (fsm_builder_t *builder, uint32_t *row_start);
+
+
+
+fsm_def_t* state_machine_def_build (uint32_t state_nr, uint32_t initial_state, const fsm_edge_t *edges, size_t edge_nr, uint32_t thread_nr)
+{
+    fsm_builder_t builder;
+    fsm_def_t *def;
+    uint32_t transition_nr;
+    uint32_t cntr;
+    long cpu_nr;
+    char *block;
+
+    /* Check for valid parameters */
+    if ((state_nr == 0) || (initial_state >= state_nr) || ((edges == NULL) && (edge_nr > 0)) || (edge_nr > 0xFFFFFFFF))
+    {
+        return(NULL);
+    }
+
+    /* Select the number of threads */
+    if (thread_nr == 0)
+    {
+        cpu_nr = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_nr = (cpu_nr > 0) ? (uint32_t)cpu_nr : 1;
+    }
+
+    if (thread_nr > edge_nr / STATE_MACHINE_BUILDER_MIN_EDGES + 1)
+    {
+        thread_nr = (uint32_t)(edge_nr / STATE_MACHINE_BUILDER_MIN_EDGES + 1);
+    }
+
+    if (thread_nr > STATE_MACHINE_BUILDER_MAX_THREADS)
+    {
+        thread_nr = STATE_MACHINE_BUILDER_MAX_THREADS;
+    }
+
+    memset(&builder, 0, sizeof(fsm_builder_t));
+    builder.state_nr = state_nr;
+    builder.thread_nr = thread_nr;
+    builder.edges = edges;
+    builder.edge_nr = (uint32_t)edge_nr;
+
+    /* Scratch memory: sorted transitions, rows, counters of the threads and start of the rows */
+    block = (char *)malloc(edge_nr * (sizeof(fsm_edge_t) + sizeof(uint32_t)) +
+                           ((size_t)thread_nr + 1) * state_nr * sizeof(uint32_t) + sizeof(uint32_t));
+    if (block == NULL)
+    {
+        return(NULL);
+    }
+
+    builder.by_target = (fsm_edge_t *)block;
+    builder.rows = (uint32_t *)(block + edge_nr * sizeof(fsm_edge_t));
+    builder.counts = builder.rows + edge_nr;
+    builder.row_start = builder.counts + (size_t)thread_nr * state_nr;
+
+    /* First sort by target, then (stable) by starting state: the rows are sorted */
+    state_machine_builder_run(&builder, FSM_BUILDER_COUNT_TARGETS);
+    if (builder.error != 0)
+    {
+        free(block);
+        return(NULL);
+    }
+
+    state_machine_builder_prefix(&builder, NULL);
+    state_machine_builder_run(&builder, FSM_BUILDER_SORT_TARGETS);
+
+    state_machine_builder_run(&builder, FSM_BUILDER_COUNT_STATES);
+    state_machine_builder_prefix(&builder, builder.row_start);
+    builder.row_start[state_nr] = builder.edge_nr;
+    state_machine_builder_run(&builder, FSM_BUILDER_SORT_STATES);
+
+    /* The counters of the first thread store the length of the rows without duplicates */
+    state_machine_builder_run(&builder, FSM_BUILDER_UNIQUE);
+
+    transition_nr = 0;
+    for (cntr = 0; cntr < state_nr; cntr++)
+    {
+        transition_nr += builder.counts[cntr];
+    }
+
+    def = state_machine_def_create(state_nr, transition_nr, 0);
+    if (def == NULL)
+    {
+        free(block);
+        return(NULL);
+    }
+
+    def->initial_state = initial_state;
+
+    transition_nr = 0;
+    for (cntr = 0; cntr < state_nr; cntr++)
+    {
+        def->states[cntr].first_target = transition_nr;
+        def->states[cntr].target_nr = builder.counts[cntr];
+        transition_nr += builder.counts[cntr];
+    }
+
+    builder.def = def;
+    state_machine_builder_run(&builder, FSM_BUILDER_COPY);
+
+    free(block);
+
+    return(def);
+}
+
+
+
+static void state_machine_builder_run (fsm_builder_t *builder, fsm_builder_phase_t phase)
+{
+    fsm_builder_worker_t workers[STATE_MACHINE_BUILDER_MAX_THREADS];
+    pthread_t threads[STATE_MACHINE_BUILDER_MAX_THREADS];
+    bool started[STATE_MACHINE_BUILDER_MAX_THREADS];
+    uint32_t cntr;
+
+    builder->phase = phase;
+
+    for (cntr = 0; cntr < builder->thread_nr; cntr++)
+    {
+        workers[cntr].builder = builder;
+        workers[cntr].index = cntr;
+    }
+
+    /* The calling thread is the thread 0 */
+    for (cntr = 1; cntr < builder->thread_nr; cntr++)
+    {
+        started[cntr] = (pthread_create(&threads[cntr], NULL, state_machine_builder_worker, &workers[cntr]) == 0);
+    }
+
+    state_machine_builder_worker(&workers[0]);
+
+    for (cntr = 1; cntr < builder->thread_nr; cntr++)
+    {
+        if (started[cntr] == true)
+        {
+            pthread_join(threads[cntr], NULL);
+        }
+        else
+        {
+            state_machine_builder_worker(&workers[cntr]);
+        }
+    }
+}
+
+
+
+static void* state_machine_builder_worker (void *arg)
+{
+    fsm_builder_worker_t *worker = (fsm_builder_worker_t *)arg;
+    fsm_builder_t *builder = worker->builder;
+    const fsm_edge_t *edge;
+    uint32_t *counts;
+    uint32_t *row;
+    uint32_t first_edge;
+    uint32_t last_edge;
+    uint32_t first_state;
+    uint32_t last_state;
+    uint32_t length;
+    uint32_t unique;
+    uint32_t cntr;
+    uint32_t item;
+
+    counts = builder->counts + (size_t)worker->index * builder->state_nr;
+
+    first_edge = (uint32_t)(((uint64_t)builder->edge_nr * worker->index) / builder->thread_nr);
+    last_edge = (uint32_t)(((uint64_t)builder->edge_nr * (worker->index + 1)) / builder->thread_nr);
+    first_state = (uint32_t)(((uint64_t)builder->state_nr * worker->index) / builder->thread_nr);
+    last_state = (uint32_t)(((uint64_t)builder->state_nr * (worker->index + 1)) / builder->thread_nr);
+
+    switch (builder->phase)
+    {
+        case FSM_BUILDER_COUNT_TARGETS:
+            memset(counts, 0, builder->state_nr * sizeof(uint32_t));
+
+            for (cntr = first_edge; cntr < last_edge; cntr++)
+            {
+                edge = &builder->edges[cntr];
+
+                if ((edge->state_id >= builder->state_nr) || (edge->target_id >= builder->state_nr))
+                {
+                    __atomic_store_n(&builder->error, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+
+                counts[edge->target_id]++;
+            }
+            break;
+
+        case FSM_BUILDER_SORT_TARGETS:
+            for (cntr = first_edge; cntr < last_edge; cntr++)
+            {
+                edge = &builder->edges[cntr];
+                builder->by_target[counts[edge->target_id]++] = *edge;
+            }
+            break;
+
+        case FSM_BUILDER_COUNT_STATES:
+            memset(counts, 0, builder->state_nr * sizeof(uint32_t));
+
+            for (cntr = first_edge; cntr < last_edge; cntr++)
+            {
+                counts[builder->by_target[cntr].state_id]++;
+            }
+            break;
+
+        case FSM_BUILDER_SORT_STATES:
+            for (cntr = first_edge; cntr < last_edge; cntr++)
+            {
+                edge = &builder->by_target[cntr];
+                builder->rows[counts[edge->state_id]++] = edge->target_id;
+            }
+            break;
+
+        case FSM_BUILDER_UNIQUE:
+            /* The rows are sorted: the duplicates are adjacent */
+            for (cntr = first_state; cntr < last_state; cntr++)
+            {
+                row = &builder->rows[builder->row_start[cntr]];
+                length = builder->row_start[cntr + 1] - builder->row_start[cntr];
+
+                unique = 0;
+                for (item = 0; item < length; item++)
+                {
+                    if ((unique == 0) || (row[item] != row[unique - 1]))
+                    {
+                        row[unique++] = row[item];
+                    }
+                }
+
+                builder->counts[cntr] = unique;
+            }
+            break;
+
+        case FSM_BUILDER_COPY:
+            for (cntr = first_state; cntr < last_state; cntr++)
+            {
+                memcpy(&builder->def->targets[builder->def->states[cntr].first_target],
+                       &builder->rows[builder->row_start[cntr]],
+                       builder->def->states[cntr].target_nr * sizeof(uint32_t));
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return(NULL);
+}
+
+
+
+static void state_machine_builder_prefix (fsm_builder_t *builder, uint32_t *row_start)
+{
+    uint32_t position;
+    uint32_t count;
+    uint32_t state;
+    uint32_t thread;
+    uint32_t *counter;
+
+    position = 0;
+
+    for (state = 0; state < builder->state_nr; state++)
+    {
+        if (row_start != NULL)
+        {
+            row_start[state] = position;
+        }
+
+        for (thread = 0; thread < builder->thread_nr; thread++)
+        {
+            counter = &builder->counts[(size_t)thread * builder->state_nr + state];
+
+            count = *counter;
+            *counter = position;
+            position += count;
+        }
+    }
+}
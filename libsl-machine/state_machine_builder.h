@@ -0,0 +1,58 @@
+/**
+ * @file state_machine_builder.h
+ * @brief Parallel construction of large definitions from arrays of transitions.
+ *
+ * Adding the transitions one at a time is too slow for generated state machines with
+ * tens of thousands of states (e.g. lexers and protocol validators). The builder takes
+ * all the transitions at once and creates the compressed rows of the definition using
+ * several threads: the transitions are sorted by counting (first by target and then by
+ * starting state), so every row is sorted without comparisons and the duplicates are
+ * adjacent.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_BUILDER_H
+#define STATE_MACHINE_BUILDER_H
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @typedef fsm_edge_t
+ * @brief Data type used to describe a transition.
+ */
+typedef struct _fsm_edge_t fsm_edge_t;
+
+
+
+/**
+ * @struct _fsm_edge_t
+ * @brief Transition between two states.
+ */
+struct _fsm_edge_t {
+    uint32_t state_id;          /**< Starting state of the transition */
+    uint32_t target_id;         /**< Target state of the transition */
+};
+
+
+
+/**
+ * @fn state_machine_def_build
+ * @brief Create a definition from an array of transitions.
+ * The transitions can be in any order and can contain duplicates. The states of the
+ * definition have no names and no callbacks: they can be set in "states" after the call.
+ * @param state_nr Number of states.
+ * @param initial_state Initial state.
+ * @param edges The transitions.
+ * @param edge_nr Number of transitions.
+ * @param thread_nr Number of threads used (0 to use all the online CPUs).
+ * @return The new definition (see "state_machine_def_free"), NULL if the transitions are
+ * not valid or the memory is not available.
+ */
+fsm_def_t* state_machine_def_build (uint32_t state_nr, uint32_t initial_state, const fsm_edge_t *edges, size_t edge_nr, uint32_t thread_nr);
+
+
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * @file state_machine_codegen.c
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "state_machine_codegen.h"
+
+
+
+/**
+ * @fn state_machine_codegen_emit_header
+ * @brief Write the header of the dispatcher.
+ * See "state_machine_codegen_emit" for details.
+ */
+static void state_machine_codegen_emit_header (const fsm_def_t *def, const char *prefix, const char *guard, FILE *out);
+
+/**
+ * @fn state_machine_codegen_emit_source
+ * @brief Write the source of the dispatcher.
+ * See "state_machine_codegen_emit" for details.
+ * @return true if the source was written, false if the memory is not available.
+ */
+static bool state_machine_codegen_emit_source (const fsm_def_t *def, const char *prefix, const char *macro, const char *header_name, FILE *out);
+
+/**
+ * @fn state_machine_codegen_upper
+ * @brief Copy a string converting it to upper case.
+ * @param dst Destination buffer.
+ * @param src The string to be converted.
+ * @param size Size of the destination buffer.
+ * @return true if the string fits the buffer, false if not.
+ */
+static bool state_machine_codegen_upper (char *dst, const char *src, size_t size);
+
+
+
+bool state_machine_codegen_emit (const fsm_def_t *def, const char *prefix, const char *header_name, FILE *header, FILE *source)
+{
+    const fsm_def_state_t *state;
+    char macro[128];
+    uint32_t cntr;
+
+    /* Check for valid parameters */
+    if ((def == NULL) || (prefix == NULL) || (header_name == NULL) || (header == NULL) || (source == NULL))
+    {
+        return(false);
+    }
+
+    if ((def->state_nr == 0) || (def->initial_state >= def->state_nr) ||
+        (state_machine_codegen_upper(macro, prefix, sizeof(macro)) == false))
+    {
+        return(false);
+    }
+
+    /* States and callbacks are referenced by name */
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        if ((state->name == NULL) ||
+            ((state->run != NULL) && (state->run_name == NULL)) ||
+            ((state->enter != NULL) && (state->enter_name == NULL)))
+        {
+            return(false);
+        }
+    }
+
+    /* A name used by "run" and "enter" callbacks would be declared and called with two signatures */
+    if (state_machine_def_check_callbacks(def, NULL) == false)
+    {
+        return(false);
+    }
+
+    state_machine_codegen_emit_header(def, prefix, macro, header);
+    if (state_machine_codegen_emit_source(def, prefix, macro, header_name, source) == false)
+    {
+        return(false);
+    }
+
+    return((ferror(header) == 0) && (ferror(source) == 0));
+}
+
+
+
+static void state_machine_codegen_emit_header (const fsm_def_t *def, const char *prefix, const char *guard, FILE *out)
+{
+    uint32_t cntr;
+
+    fprintf(out, "/* Generated by libsl-machine: do not edit. */\n\n");
+    fprintf(out, "#ifndef %s_H\n#define %s_H\n\n", guard, guard);
+    fprintf(out, "#include \"state_machine.h\"\n\n\n\n");
+
+    /* IDs of the states */
+    fprintf(out, "enum {\n");
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        fprintf(out, "    %s_%s = %u,\n", prefix, def->states[cntr].name, cntr);
+    }
+    fprintf(out, "    %s_STATE_NR = %u\n};\n\n\n\n", prefix, def->state_nr);
+
+    fprintf(out, "/**\n");
+    fprintf(out, " * @fn %s_init\n", prefix);
+    fprintf(out, " * @brief Create and initialize a \"%s\" state machine.\n", prefix);
+    fprintf(out, " * INFO: States and transitions are fixed: \"add_state\" and \"add_transition\" always fail.\n");
+    fprintf(out, " * @param attr Options of the state machine (see \"state_machine_init_ex\").\n");
+    fprintf(out, " */\n");
+    fprintf(out, "fsm_t* %s_init (const fsm_attr_t *attr);\n\n\n\n", prefix);
+    fprintf(out, "#endif\n");
+}
+
+
+
+static bool state_machine_codegen_emit_source (const fsm_def_t *def, const char *prefix, const char *macro, const char *header_name, FILE *out)
+{
+    const fsm_def_state_t *state;
+    uint32_t cntr;
+    uint32_t target;
+
+    fprintf(out, "/* Generated by libsl-machine: do not edit. */\n\n");
+    fprintf(out, "#include <stddef.h>\n\n");
+    fprintf(out, "#include \"%s\"\n\n", header_name);
+
+    /* Callbacks: declared here or provided by a user header (e.g. "static inline" functions) */
+    fprintf(out, "#ifdef %s_CALLBACKS_HEADER\n", macro);
+    fprintf(out, "#include %s_CALLBACKS_HEADER\n", macro);
+    fprintf(out, "#else\n");
+    if (state_machine_def_emit_callbacks(def, out) == false)
+    {
+        return(false);
+    }
+    fprintf(out, "#endif\n\n\n\n");
+
+    /* Run: one "switch" for the standard callbacks and one for the transitions */
+    fprintf(out, "static uint32_t %s_run (fsm_t *fsm, void *arg)\n{\n", prefix);
+    fprintf(out, "    uint32_t id;\n\n");
+    fprintf(out, "    (void)arg;\n\n");
+    fprintf(out, "    id = (uint32_t)(fsm->actual_state - fsm->states);\n\n");
+    fprintf(out, "    if (id == fsm->target_state)\n    {\n");
+    fprintf(out, "        switch (id)\n        {\n");
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        if (state->run_name != NULL)
+        {
+            fprintf(out, "            case %s_%s:\n", prefix, state->name);
+            fprintf(out, "                %s(arg);\n", state->run_name);
+            fprintf(out, "                break;\n");
+        }
+    }
+    fprintf(out, "            default:\n                break;\n");
+    fprintf(out, "        }\n\n");
+    fprintf(out, "        return(id);\n    }\n\n");
+
+    fprintf(out, "    fsm->actual_state = &fsm->states[fsm->target_state];\n\n");
+    fprintf(out, "    if (fsm->on_transition != NULL)\n    {\n");
+    fprintf(out, "        fsm->on_transition(fsm, id, fsm->target_state, fsm->hook_data);\n    }\n\n");
+    fprintf(out, "    switch (fsm->target_state)\n    {\n");
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        if (state->enter_name != NULL)
+        {
+            fprintf(out, "        case %s_%s:\n", prefix, state->name);
+            fprintf(out, "            %s(id, arg);\n", state->enter_name);
+            fprintf(out, "            break;\n");
+        }
+    }
+    fprintf(out, "        default:\n            break;\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    return(fsm->target_state);\n}\n\n\n\n");
+
+    /* Go to state: the valid targets of each state are "case" labels */
+    fprintf(out, "static bool %s_go_to_state (fsm_t *fsm, uint32_t target_id)\n{\n", prefix);
+    fprintf(out, "    bool valid;\n\n");
+    fprintf(out, "    if (fsm == NULL)\n    {\n        return(false);\n    }\n\n");
+    fprintf(out, "    valid = false;\n\n");
+    fprintf(out, "    switch (fsm->actual_state - fsm->states)\n    {\n");
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        if (state->target_nr == 0)
+        {
+            continue;
+        }
+
+        fprintf(out, "        case %s_%s:\n", prefix, state->name);
+        fprintf(out, "            switch (target_id)\n            {\n");
+        for (target = 0; target < state->target_nr; target++)
+        {
+            fprintf(out, "                case %s_%s:\n", prefix,
+                    def->states[def->targets[state->first_target + target]].name);
+        }
+        fprintf(out, "                    valid = true;\n");
+        fprintf(out, "                    break;\n");
+        fprintf(out, "                default:\n                    break;\n");
+        fprintf(out, "            }\n");
+        fprintf(out, "            break;\n");
+    }
+    fprintf(out, "        default:\n            break;\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    if (valid == true)\n    {\n        fsm->target_state = target_id;\n    }\n\n");
+    fprintf(out, "    return(valid);\n}\n\n\n\n");
+
+    /* The definition is fixed */
+    fprintf(out, "static bool %s_add_state (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_t enter)\n{\n", prefix);
+    fprintf(out, "    (void)fsm;\n    (void)id;\n    (void)run;\n    (void)enter;\n\n");
+    fprintf(out, "    return(false);\n}\n\n\n\n");
+
+    fprintf(out, "static bool %s_add_transition (fsm_t *fsm, uint32_t state_id, uint32_t target_id)\n{\n", prefix);
+    fprintf(out, "    (void)fsm;\n    (void)state_id;\n    (void)target_id;\n\n");
+    fprintf(out, "    return(false);\n}\n\n\n\n");
+
+    /* Init: a standard state machine with the specialized functions */
+    fprintf(out, "fsm_t* %s_init (const fsm_attr_t *attr)\n{\n", prefix);
+    fprintf(out, "    fsm_t *fsm;\n\n");
+    fprintf(out, "    /* The state IDs are the positions of the states */\n");
+    fprintf(out, "    if ((attr != NULL) && (attr->layout != NULL))\n    {\n        return(NULL);\n    }\n\n");
+    fprintf(out, "    fsm = state_machine_init_ex(%s_STATE_NR, %s_%s, attr);\n", prefix, prefix,
+            def->states[def->initial_state].name);
+    fprintf(out, "    if (fsm == NULL)\n    {\n        return(NULL);\n    }\n\n");
+    fprintf(out, "    fsm->sm_run = %s_run;\n", prefix);
+    fprintf(out, "    fsm->go_to_state = %s_go_to_state;\n", prefix);
+    fprintf(out, "    fsm->add_state = %s_add_state;\n", prefix);
+    fprintf(out, "    fsm->add_transition = %s_add_transition;\n\n", prefix);
+    fprintf(out, "    return(fsm);\n}\n");
+
+    return(true);
+}
+
+
+
+static bool state_machine_codegen_upper (char *dst, const char *src, size_t size)
+{
+    size_t len;
+    size_t cntr;
+
+    len = strlen(src);
+    if (len >= size)
+    {
+        return(false);
+    }
+
+    for (cntr = 0; cntr <= len; cntr++)
+    {
+        dst[cntr] = (char)toupper((unsigned char)src[cntr]);
+    }
+
+    return(true);
+}
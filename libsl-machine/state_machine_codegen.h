@@ -0,0 +1,44 @@
+/**
+ * @file state_machine_codegen.h
+ * @brief Generator of C code specialized for a given state machine definition.
+ *
+ * The generated code replaces "sm_run" and "go_to_state" of a standard state machine
+ * with functions that call the callbacks directly (i.e. without the indirection of the
+ * private data of the states), so the compiler is able to inline them.
+ * The machines created by the generated code are standard "fsm_t" objects.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_CODEGEN_H
+#define STATE_MACHINE_CODEGEN_H
+
+#include <stdio.h>
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @fn state_machine_codegen_emit
+ * @brief Write the header and the source file of a dispatcher specialized for the given definition.
+ * The header declares the IDs of the states ("<prefix>_<state name>") and the function
+ * "fsm_t* <prefix>_init (const fsm_attr_t *attr)" that creates a new instance of the state machine.
+ * The callbacks are referenced by name: if the macro "<PREFIX>_CALLBACKS_HEADER" is defined when
+ * the source is compiled, the given header is included instead of the declarations of the callbacks
+ * (e.g. to provide "static inline" callbacks).
+ * INFO: All the states must have a name and all the callbacks must have a name, used either
+ * as "run" or as "enter" callback (see "state_machine_def_check_callbacks").
+ * INFO: The generated dispatcher uses the order of the IDs: "fsm_attr_t.layout" is not supported.
+ * @param def The definition of the state machine.
+ * @param prefix Prefix of the generated symbols (must be a valid C identifier).
+ * @param header_name Name of the header file, used by the source to include the header.
+ * @param header Destination of the header.
+ * @param source Destination of the source.
+ * @return true if the code was written, false if not.
+ */
+bool state_machine_codegen_emit (const fsm_def_t *def, const char *prefix, const char *header_name, FILE *header, FILE *source);
+
+
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * @file state_machine_coro.h
+ * @brief Completion of the asynchronous transitions awaited by C++20 coroutines.
+ *
+ * A "fsm_completion_t" is given to the asynchronous operation started by an "enter"
+ * callback (see "fsm_state_enter_async_t") in place of "state_machine_complete_cb". The
+ * coroutine that drives the state machine awaits it: it is suspended while the
+ * transition is pending and resumed by the thread that completes the operation, so it
+ * can run the state machine again.
+ * INFO: The header is empty for the C compilers and for the C++ ones without coroutines.
+ *
+ * Example:
+ *     fsm_enter_status_t state_read (fsm_t *fsm, uint32_t exit_state_id, void *par)
+ *     {
+ *         io_read(socket, buffer, fsm_completion_t::callback, par);
+ *         return(FSM_ENTER_PENDING);
+ *     }
+ *
+ *     task session (fsm_t *fsm)
+ *     {
+ *         fsm_completion_t completion(fsm);
+ *
+ *         fsm->go_to_state(fsm, STATE_READ);
+ *         fsm->sm_run(fsm, &completion);
+ *         co_await completion;
+ *         fsm->sm_run(fsm, NULL);
+ *     }
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_CORO_H
+#define STATE_MACHINE_CORO_H
+
+#if defined(__cplusplus) && defined(__cpp_impl_coroutine)
+
+#include <atomic>
+#include <coroutine>
+
+extern "C" {
+#include "state_machine.h"
+}
+
+
+
+/**
+ * @struct fsm_completion_t
+ * @brief Awaitable completion of the asynchronous transition of a state machine.
+ * The completion can be used for a single transition (it can be called before the
+ * coroutine awaits it). A transition not pending is not awaited.
+ * WARNING: The coroutine is resumed by the thread that calls "complete", inside the call.
+ */
+struct fsm_completion_t {
+    /**
+     * @fn fsm_completion_t
+     * @brief Create the completion of the next asynchronous transition of a state machine.
+     */
+    explicit fsm_completion_t (fsm_t *fsm) noexcept : fsm(fsm), status(FSM_COMPLETION_WAITING)
+    {
+    }
+
+    fsm_completion_t (const fsm_completion_t &) = delete;
+    fsm_completion_t& operator= (const fsm_completion_t &) = delete;
+
+    /**
+     * @fn complete
+     * @brief Complete the transition (see "state_machine_complete") and resume the coroutine that awaits it.
+     * INFO: It can be called by any thread.
+     */
+    void complete (void) noexcept
+    {
+        state_machine_complete(fsm);
+
+        if (status.exchange(FSM_COMPLETION_DONE, std::memory_order_acq_rel) == FSM_COMPLETION_SUSPENDED)
+        {
+            coroutine.resume();
+        }
+    }
+
+    /**
+     * @fn callback
+     * @brief Same as "complete", with the signature of a generic completion callback (see "state_machine_complete_cb").
+     * @param completion The completion.
+     */
+    static void callback (void *completion) noexcept
+    {
+        static_cast<fsm_completion_t *>(completion)->complete();
+    }
+
+    /**
+     * @fn await_ready
+     * @brief The coroutine is not suspended if the transition is not pending (or already completed).
+     */
+    bool await_ready (void) const noexcept
+    {
+        return(state_machine_is_pending(fsm) == false);
+    }
+
+    /**
+     * @fn await_suspend
+     * @brief Store the coroutine resumed by "complete".
+     * @return false if the transition was completed meanwhile (the coroutine is not suspended).
+     */
+    bool await_suspend (std::coroutine_handle<> handle) noexcept
+    {
+        int expected = FSM_COMPLETION_WAITING;
+
+        coroutine = handle;
+
+        return(status.compare_exchange_strong(expected, FSM_COMPLETION_SUSPENDED, std::memory_order_acq_rel, std::memory_order_acquire));
+    }
+
+    /**
+     * @fn await_resume
+     * @brief Nothing to return: the state machine is run by the coroutine.
+     */
+    void await_resume (void) const noexcept
+    {
+    }
+
+private:
+    enum {
+        FSM_COMPLETION_WAITING = 0, /**< Not completed, no coroutine suspended */
+        FSM_COMPLETION_SUSPENDED,   /**< Not completed, the coroutine is suspended */
+        FSM_COMPLETION_DONE         /**< Completed */
+    };
+
+    fsm_t *fsm;                     /**< The state machine */
+    std::atomic<int> status;        /**< "FSM_COMPLETION_WAITING", "FSM_COMPLETION_SUSPENDED" or "FSM_COMPLETION_DONE" */
+    std::coroutine_handle<> coroutine;  /**< The coroutine suspended */
+};
+
+
+
+#endif
+
+#endif
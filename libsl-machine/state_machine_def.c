@@ -0,0 +1,479 @@
+/**
+ * @file state_machine_def.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @def STATE_MACHINE_MASK_SIZE
+ * @brief Maximum number of states handled by the "valid_target" mask of a state.
+ */
+#define STATE_MACHINE_MASK_SIZE     32
+
+
+
+/**
+ * @typedef fsm_def_callback_t
+ * @brief Callback name already visited.
+ */
+typedef struct _fsm_def_callback_t fsm_def_callback_t;
+
+/**
+ * @struct _fsm_def_callback_t
+ * @brief See "fsm_def_callback_t" for details.
+ */
+struct _fsm_def_callback_t {
+    const char *name;           /**< The name (NULL if the item is free) */
+    bool enter;                 /**< true if it is an "enter" callback, false if a "run" one */
+};
+
+
+
+/**
+ * @fn state_machine_def_alloc
+ * @brief Allocate a cleared definition with the given allocator.
+ * See "state_machine_def_create" for details.
+ */
+static fsm_def_t* state_machine_def_alloc (uint32_t state_nr, uint32_t transition_nr, size_t string_size, const fsm_allocator_t *allocator);
+
+/**
+ * @fn state_machine_def_copy_string
+ * @brief Copy a string in the storage of a definition.
+ * @param str The string to be copied (can be NULL).
+ * @param pos Pointer to the first free byte of the storage, updated after the copy.
+ * @return The copy of the string.
+ */
+static const char* state_machine_def_copy_string (const char *str, char **pos);
+
+/**
+ * @fn state_machine_def_callbacks
+ * @brief Visit the callbacks of a definition once per name, checking that every name has a single role.
+ * @param def The definition.
+ * @param out Destination of the declarations (NULL to check the names only).
+ * @param state_id Filled with the state that uses a name with the other role ("state_nr" if the memory is not available).
+ * @return true if the names are consistent, false if not or the memory is not available.
+ */
+static bool state_machine_def_callbacks (const fsm_def_t *def, FILE *out, uint32_t *state_id);
+
+/**
+ * @fn state_machine_def_hash
+ * @brief Hash of a callback name (FNV-1a).
+ */
+static uint32_t state_machine_def_hash (const char *name);
+
+/**
+ * @fn state_machine_def_emit_string
+ * @brief Write a string as a C literal (or NULL).
+ * @param str The string to be written.
+ * @param out Destination file.
+ */
+static void state_machine_def_emit_string (const char *str, FILE *out);
+
+
+
+fsm_def_t* state_machine_def_create (uint32_t state_nr, uint32_t transition_nr, size_t string_size)
+{
+    return(state_machine_def_alloc(state_nr, transition_nr, string_size, &state_machine_malloc_allocator));
+}
+
+
+
+fsm_def_t* state_machine_def_clone (const fsm_def_t *def, const fsm_allocator_t *allocator)
+{
+    fsm_def_t *copy;
+    const fsm_def_state_t *state;
+    size_t string_size;
+    char *pos;
+    uint32_t cntr;
+
+    if (def == NULL)
+    {
+        return(NULL);
+    }
+
+    /* Space needed by the names */
+    string_size = 0;
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        string_size += (state->name != NULL) ? (strlen(state->name) + 1) : 0;
+        string_size += (state->run_name != NULL) ? (strlen(state->run_name) + 1) : 0;
+        string_size += (state->enter_name != NULL) ? (strlen(state->enter_name) + 1) : 0;
+    }
+
+    copy = state_machine_def_alloc(def->state_nr, def->transition_nr, string_size,
+                                   (allocator != NULL) ? allocator : &state_machine_malloc_allocator);
+    if (copy == NULL)
+    {
+        return(NULL);
+    }
+
+    copy->initial_state = def->initial_state;
+    memcpy(copy->states, def->states, def->state_nr * sizeof(fsm_def_state_t));
+    memcpy(copy->targets, def->targets, def->transition_nr * sizeof(uint32_t));
+
+    /* The names are moved to the storage of the copy */
+    pos = copy->strings;
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        copy->states[cntr].name = state_machine_def_copy_string(def->states[cntr].name, &pos);
+        copy->states[cntr].run_name = state_machine_def_copy_string(def->states[cntr].run_name, &pos);
+        copy->states[cntr].enter_name = state_machine_def_copy_string(def->states[cntr].enter_name, &pos);
+    }
+
+    return(copy);
+}
+
+
+
+void state_machine_def_free (fsm_def_t *def)
+{
+    if ((def == NULL) || (def->allocator.free == NULL))
+    {
+        return;
+    }
+
+    def->allocator.free(def->allocator.ctx, def);
+}
+
+
+
+fsm_t* state_machine_def_instantiate (const fsm_def_t *def, const fsm_attr_t *attr)
+{
+    fsm_t *fsm;
+    const fsm_def_state_t *state;
+    uint32_t cntr;
+    uint32_t target;
+
+    /* Check for valid definition */
+    if ((def == NULL) || (def->initial_state >= def->state_nr))
+    {
+        return(NULL);
+    }
+
+    fsm = state_machine_init_ex(def->state_nr, def->initial_state, attr);
+    if (fsm == NULL)
+    {
+        return(NULL);
+    }
+
+    /* Add the states and their transitions */
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        fsm->add_state(fsm, cntr, state->run, state->enter);
+
+        /* Large state machines use the rows of the definition */
+        if (def->state_nr > STATE_MACHINE_MASK_SIZE)
+        {
+            state_machine_set_targets(fsm, cntr, &def->targets[state->first_target], state->target_nr);
+            continue;
+        }
+
+        for (target = 0; target < state->target_nr; target++)
+        {
+            fsm->add_transition(fsm, cntr, def->targets[state->first_target + target]);
+        }
+    }
+
+    return(fsm);
+}
+
+
+
+bool state_machine_def_instantiate_many (const fsm_def_t *def, const fsm_attr_t *attr, uint32_t count, fsm_t **fsms)
+{
+    fsm_attr_t proto_attr;
+    fsm_t *proto;
+    bool result;
+
+    /* The prototype is a temporary one: it uses the default allocator */
+    memset(&proto_attr, 0, sizeof(fsm_attr_t));
+    if (attr != NULL)
+    {
+        proto_attr = *attr;
+        proto_attr.allocator = NULL;
+    }
+
+    proto = state_machine_def_instantiate(def, &proto_attr);
+    if (proto == NULL)
+    {
+        return(false);
+    }
+
+    result = state_machine_clone_many(proto, count, fsms, attr);
+    state_machine_deinit(proto);
+
+    return(result);
+}
+
+
+
+bool state_machine_def_emit_tables (const fsm_def_t *def, const char *prefix, FILE *out)
+{
+    const fsm_def_state_t *state;
+    uint32_t cntr;
+
+    /* Check for valid parameters */
+    if ((def == NULL) || (prefix == NULL) || (out == NULL))
+    {
+        return(false);
+    }
+
+    /* The states are referenced by name and every callback is declared once */
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        if (def->states[cntr].name == NULL)
+        {
+            return(false);
+        }
+    }
+
+    if (state_machine_def_check_callbacks(def, NULL) == false)
+    {
+        return(false);
+    }
+
+    fprintf(out, "/* Generated by libsl-machine: do not edit. */\n\n");
+    fprintf(out, "#include \"state_machine_def.h\"\n\n\n\n");
+
+    /* IDs of the states */
+    fprintf(out, "enum {\n");
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        fprintf(out, "    %s_%s = %u,\n", prefix, def->states[cntr].name, cntr);
+    }
+    fprintf(out, "    %s_STATE_NR = %u\n};\n\n\n\n", prefix, def->state_nr);
+
+    /* Declaration of the callbacks */
+    state_machine_def_emit_callbacks(def, out);
+    fprintf(out, "\n\n\n");
+
+    /* Valid transitions */
+    fprintf(out, "static uint32_t %s_targets[] = {", prefix);
+    for (cntr = 0; cntr < def->transition_nr; cntr++)
+    {
+        fprintf(out, "%s%u,", ((cntr % 16) == 0) ? "\n    " : " ", def->targets[cntr]);
+    }
+    fprintf(out, "%s};\n\n", (def->transition_nr == 0) ? "0" : "\n");
+
+    /* States */
+    fprintf(out, "static fsm_def_state_t %s_states[] = {\n", prefix);
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+
+        fprintf(out, "    { ");
+        state_machine_def_emit_string(state->name, out);
+        fprintf(out, ", ");
+        state_machine_def_emit_string(state->run_name, out);
+        fprintf(out, ", ");
+        state_machine_def_emit_string(state->enter_name, out);
+        fprintf(out, ", %s, %s, %u, %u },\n",
+                (state->run_name != NULL) ? state->run_name : "NULL",
+                (state->enter_name != NULL) ? state->enter_name : "NULL",
+                state->first_target, state->target_nr);
+    }
+    fprintf(out, "};\n\n");
+
+    /* Definition */
+    fprintf(out, "const fsm_def_t %s_def = {\n", prefix);
+    fprintf(out, "    %u, %u, %u, %s_states, %s_targets, NULL\n",
+            def->state_nr, def->initial_state, def->transition_nr, prefix, prefix);
+    fprintf(out, "};\n");
+
+    return(ferror(out) == 0);
+}
+
+
+
+bool state_machine_def_emit_callbacks (const fsm_def_t *def, FILE *out)
+{
+    /* Nothing is written if a name has two roles */
+    if (state_machine_def_callbacks(def, NULL, NULL) == false)
+    {
+        return(false);
+    }
+
+    return(state_machine_def_callbacks(def, out, NULL));
+}
+
+
+
+bool state_machine_def_check_callbacks (const fsm_def_t *def, uint32_t *state_id)
+{
+    if (def == NULL)
+    {
+        return(false);
+    }
+
+    return(state_machine_def_callbacks(def, NULL, state_id));
+}
+
+
+
+static bool state_machine_def_callbacks (const fsm_def_t *def, FILE *out, uint32_t *state_id)
+{
+    fsm_def_callback_t *names;
+    const char *name;
+    uint64_t size;
+    uint64_t slot;
+    uint64_t cntr;
+    bool enter;
+
+    /* Hash set of the names (2 callbacks per state, at most half full) */
+    for (size = 1; size < 4 * (uint64_t)def->state_nr; size <<= 1);
+
+    names = (fsm_def_callback_t *)calloc(size, sizeof(fsm_def_callback_t));
+    if (names == NULL)
+    {
+        if (state_id != NULL)
+        {
+            *state_id = def->state_nr;
+        }
+        return(false);
+    }
+
+    for (cntr = 0; cntr < 2 * (uint64_t)def->state_nr; cntr++)
+    {
+        enter = ((cntr & 1) != 0);
+        name = (enter == true) ? def->states[cntr / 2].enter_name : def->states[cntr / 2].run_name;
+        if (name == NULL)
+        {
+            continue;
+        }
+
+        slot = state_machine_def_hash(name) & (size - 1);
+        while ((names[slot].name != NULL) && (strcmp(names[slot].name, name) != 0))
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+
+        if (names[slot].name != NULL)
+        {
+            /* Declared by a previous state: the signature must be the same */
+            if (names[slot].enter != enter)
+            {
+                if (state_id != NULL)
+                {
+                    *state_id = (uint32_t)(cntr / 2);
+                }
+                free(names);
+                return(false);
+            }
+
+            continue;
+        }
+
+        names[slot].name = name;
+        names[slot].enter = enter;
+
+        if (out == NULL)
+        {
+            continue;
+        }
+
+        if (enter == true)
+        {
+            fprintf(out, "extern void %s (uint32_t exit_state_id, void *par);\n", name);
+        }
+        else
+        {
+            fprintf(out, "extern void %s (void *par);\n", name);
+        }
+    }
+
+    free(names);
+
+    return(true);
+}
+
+
+
+static uint32_t state_machine_def_hash (const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *name != '\0'; name++)
+    {
+        hash = (hash ^ (uint8_t)*name) * 16777619U;
+    }
+
+    return(hash);
+}
+
+
+
+static fsm_def_t* state_machine_def_alloc (uint32_t state_nr, uint32_t transition_nr, size_t string_size, const fsm_allocator_t *allocator)
+{
+    fsm_def_t *def;
+    size_t states_size;
+    size_t targets_size;
+    size_t size;
+    char *block;
+
+    states_size = (size_t)state_nr * sizeof(fsm_def_state_t);
+    targets_size = (size_t)transition_nr * sizeof(uint32_t);
+    size = sizeof(fsm_def_t) + states_size + targets_size + string_size;
+
+    /* Allocate the definition, the states, the transitions and the strings in a single block */
+    block = (char *)allocator->alloc(allocator->ctx, size, sizeof(void *));
+    if (block == NULL)
+    {
+        return(NULL);
+    }
+
+    memset(block, 0, size);
+
+    def = (fsm_def_t *)block;
+    def->state_nr = state_nr;
+    def->transition_nr = transition_nr;
+    def->allocator = *allocator;
+
+    def->states = (fsm_def_state_t *)(block + sizeof(fsm_def_t));
+    def->targets = (uint32_t *)(block + sizeof(fsm_def_t) + states_size);
+    def->strings = block + sizeof(fsm_def_t) + states_size + targets_size;
+
+    return(def);
+}
+
+
+
+static const char* state_machine_def_copy_string (const char *str, char **pos)
+{
+    char *copy;
+    size_t len;
+
+    if (str == NULL)
+    {
+        return(NULL);
+    }
+
+    len = strlen(str) + 1;
+    copy = *pos;
+    memcpy(copy, str, len);
+    *pos += len;
+
+    return(copy);
+}
+
+
+
+static void state_machine_def_emit_string (const char *str, FILE *out)
+{
+    if (str == NULL)
+    {
+        fprintf(out, "NULL");
+    }
+    else
+    {
+        fprintf(out, "\"%s\"", str);
+    }
+}
@@ -0,0 +1,164 @@
+/**
+ * @file state_machine_def.h
+ * @brief Definition of a state machine independent from its instances.
+ * A definition stores the states, the callbacks and the valid transitions of a
+ * state machine and it is used to create new instances or to generate C code.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_DEF_H
+#define STATE_MACHINE_DEF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "state_machine.h"
+
+
+
+/**
+ * @typedef fsm_def_t
+ * @brief Data type used to store the definition of a state machine.
+ */
+typedef struct _fsm_def_t fsm_def_t;
+
+/**
+ * @typedef fsm_def_state_t
+ * @brief Data type used to store a state of a definition.
+ */
+typedef struct _fsm_def_state_t fsm_def_state_t;
+
+
+
+/**
+ * @struct _fsm_def_state_t
+ * @brief Definition of a state: name, callbacks and outgoing transitions.
+ */
+struct _fsm_def_state_t {
+    const char *name;           /**< Name of the state (NULL if not available) */
+    const char *run_name;       /**< Name of the "run" callback (NULL if not set) */
+    const char *enter_name;     /**< Name of the "enter" callback (NULL if not set) */
+
+    fsm_state_run_t run;        /**< Callback called when no transitions are planned */
+    fsm_state_enter_t enter;    /**< Callback called when the state machine enter into the state */
+
+    uint32_t first_target;      /**< Index of the first target of the state in "targets" */
+    uint32_t target_nr;         /**< Number of valid targets of the state */
+};
+
+/**
+ * @struct _fsm_def_t
+ * @brief Definition of a state machine.
+ * The valid transitions are stored in compressed rows: the targets of the state "i"
+ * are "targets[states[i].first_target]" ... "targets[states[i].first_target + states[i].target_nr - 1]",
+ * sorted in ascending order and without duplicates.
+ */
+struct _fsm_def_t {
+    uint32_t state_nr;          /**< Number of states of the definition */
+    uint32_t initial_state;     /**< Initial state of the instances */
+    uint32_t transition_nr;     /**< Number of valid transitions */
+
+    fsm_def_state_t *states;    /**< List of the states (indexed by state ID) */
+    uint32_t *targets;          /**< Targets of the transitions, grouped by starting state */
+    char *strings;              /**< Storage used by the names of states and callbacks */
+
+    fsm_allocator_t allocator;  /**< Allocator used to release the definition (cleared if static) */
+};
+
+
+
+/**
+ * @fn state_machine_def_create
+ * @brief Allocate an empty definition in a single block of memory.
+ * All the states are cleared and "targets" can store "transition_nr" items.
+ * @param state_nr Number of states of the definition.
+ * @param transition_nr Number of transitions of the definition.
+ * @param string_size Number of bytes reserved to "strings".
+ * @return The new definition, NULL if the memory is not available.
+ */
+fsm_def_t* state_machine_def_create (uint32_t state_nr, uint32_t transition_nr, size_t string_size);
+
+/**
+ * @fn state_machine_def_clone
+ * @brief Create a copy of the given definition in a single block of memory.
+ * Example: It is used to place a copy of the definition on every NUMA node.
+ * @param def The definition to be copied.
+ * @param allocator Allocator of the copy (NULL to use "state_machine_malloc_allocator").
+ * @return The copy, NULL if the memory is not available.
+ */
+fsm_def_t* state_machine_def_clone (const fsm_def_t *def, const fsm_allocator_t *allocator);
+
+/**
+ * @fn state_machine_def_free
+ * @brief Release a definition created by the library.
+ * WARNING: Definitions generated by "state_machine_def_emit_tables" are static and must
+ * not be released.
+ * @param def The definition to be released.
+ */
+void state_machine_def_free (fsm_def_t *def);
+
+/**
+ * @fn state_machine_def_instantiate
+ * @brief Create a new state machine from the given definition.
+ * WARNING: State machines with more than 32 states use the transitions stored in the definition
+ * (see "state_machine_set_targets"): the definition must be valid until they are released.
+ * @param def The definition of the state machine.
+ * @param attr Options of the state machine (see "state_machine_init_ex").
+ * @return The new state machine, NULL if the definition can not be handled.
+ */
+fsm_t* state_machine_def_instantiate (const fsm_def_t *def, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_def_instantiate_many
+ * @brief Create several state machines from the given definition in a single block of memory.
+ * The states are initialized once and copied to every state machine (see "state_machine_clone_many").
+ * WARNING: The state machines must be released by "state_machine_deinit_many".
+ * @param def The definition of the state machines.
+ * @param attr Options of the state machines (see "state_machine_init_ex").
+ * @param count Number of state machines.
+ * @param fsms Destination of the state machines ("count" items).
+ * @return true if the state machines were created, false if the definition can not be
+ * handled or the memory is not available.
+ */
+bool state_machine_def_instantiate_many (const fsm_def_t *def, const fsm_attr_t *attr, uint32_t count, fsm_t **fsms);
+
+/**
+ * @fn state_machine_def_emit_tables
+ * @brief Write the C source code of a static copy of the given definition.
+ * The generated code declares the callbacks by name and defines the constant
+ * "<prefix>_def" that can be passed to "state_machine_def_instantiate".
+ * INFO: All the states must have a name and a callback name can not be used both as
+ * "run" and as "enter" callback (see "state_machine_def_check_callbacks").
+ * @param def The definition to be written.
+ * @param prefix Prefix of the generated symbols.
+ * @param out Destination file.
+ * @return true if the code was written, false if not.
+ */
+bool state_machine_def_emit_tables (const fsm_def_t *def, const char *prefix, FILE *out);
+
+/**
+ * @fn state_machine_def_emit_callbacks
+ * @brief Write the declarations of the callbacks used by the given definition.
+ * Every callback is declared once, even if it is used by several states.
+ * @param def The definition.
+ * @param out Destination file.
+ * @return true if the declarations were written, false if a name is used both as "run"
+ * and as "enter" callback (nothing is written) or the memory is not available.
+ */
+bool state_machine_def_emit_callbacks (const fsm_def_t *def, FILE *out);
+
+/**
+ * @fn state_machine_def_check_callbacks
+ * @brief Check that no callback name is used both as "run" and as "enter" callback.
+ * The two roles have different signatures, so the generated code can not declare such a name.
+ * @param def The definition.
+ * @param state_id Filled with the first state that uses a name with the other role,
+ * "state_nr" if the memory is not available (can be NULL).
+ * @return true if every name has a single role, false if not or the memory is not available.
+ */
+bool state_machine_def_check_callbacks (const fsm_def_t *def, uint32_t *state_id);
+
+
+
+#endif
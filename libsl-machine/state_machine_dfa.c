@@ -0,0 +1,1119 @@
+/**
+ * @file state_machine_dfa.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "state_machine_dfa.h"
+
+
+
+/**
+ * @def STATE_MACHINE_DFA_MARK
+ * @brief Flag of the table entries whose target state has a callback.
+ */
+#define STATE_MACHINE_DFA_MARK          0x80000000
+
+/**
+ * @def STATE_MACHINE_DFA_SKIP
+ * @brief Flag of the table entries whose target state can skip ahead.
+ */
+#define STATE_MACHINE_DFA_SKIP          0x40000000
+
+/**
+ * @def STATE_MACHINE_DFA_FLAGS
+ * @brief All the flags of the table entries.
+ */
+#define STATE_MACHINE_DFA_FLAGS         (STATE_MACHINE_DFA_MARK | STATE_MACHINE_DFA_SKIP)
+
+/**
+ * @def STATE_MACHINE_DFA_REJECT
+ * @brief Table entry of the bytes without transition (and target of the bytes not labeled).
+ */
+#define STATE_MACHINE_DFA_REJECT        0xFFFFFFFF
+
+/**
+ * @def STATE_MACHINE_DFA_SKIP_MAX
+ * @brief Maximum number of bytes that leave a state that skips ahead.
+ */
+#define STATE_MACHINE_DFA_SKIP_MAX      4
+
+/**
+ * @def STATE_MACHINE_DFA_LANES
+ * @brief Number of streams advanced in lockstep by "state_machine_dfa_feed_many".
+ */
+#define STATE_MACHINE_DFA_LANES         8
+
+/**
+ * @def STATE_MACHINE_DFA_MAX_THREADS
+ * @brief Maximum number of threads used by "state_machine_dfa_feed_parallel".
+ */
+#define STATE_MACHINE_DFA_MAX_THREADS   64
+
+/**
+ * @def STATE_MACHINE_DFA_MIN_CHUNK
+ * @brief Minimum size of the chunks of "state_machine_dfa_feed_parallel".
+ */
+#define STATE_MACHINE_DFA_MIN_CHUNK     65536
+
+/**
+ * @def STATE_MACHINE_DFA_MERGE_STEP
+ * @brief Number of bytes run before the first merge of the runs of a chunk (doubled after every merge).
+ */
+#define STATE_MACHINE_DFA_MERGE_STEP    16
+
+/**
+ * @def STATE_MACHINE_DFA_SPECULATE_LEN
+ * @brief Number of bytes after which a chunk whose runs did not converge is no longer run from all the states.
+ */
+#define STATE_MACHINE_DFA_SPECULATE_LEN 4096
+
+/**
+ * @def STATE_MACHINE_DFA_HASH_SIZE
+ * @brief Size of the hash table used to split the byte classes (power of 2, more than 2 x 256).
+ */
+#define STATE_MACHINE_DFA_HASH_SIZE     1024
+
+
+
+/**
+ * @typedef fsm_dfa_range_t
+ * @brief Range of bytes of a transition.
+ */
+typedef struct _fsm_dfa_range_t fsm_dfa_range_t;
+
+/**
+ * @typedef fsm_dfa_state_t
+ * @brief Data of a state of the DFA.
+ */
+typedef struct _fsm_dfa_state_t fsm_dfa_state_t;
+
+/**
+ * @typedef fsm_dfa_chunk_t
+ * @brief Chunk of the input of "state_machine_dfa_feed_parallel".
+ */
+typedef struct _fsm_dfa_chunk_t fsm_dfa_chunk_t;
+
+/**
+ * @struct _fsm_dfa_range_t
+ * @brief See "fsm_dfa_range_t" for details.
+ */
+struct _fsm_dfa_range_t {
+    uint32_t state_id;          /**< Starting state */
+    uint32_t target_id;         /**< Target state */
+    uint8_t first;              /**< First byte */
+    uint8_t last;               /**< Last byte */
+};
+
+/**
+ * @struct _fsm_dfa_state_t
+ * @brief See "fsm_dfa_state_t" for details.
+ */
+struct _fsm_dfa_state_t {
+    fsm_dfa_callback_t callback;    /**< Callback of the state (NULL if not marked) */
+    bool accepting;                 /**< The state accepts the input */
+    bool skip;                      /**< The state skips ahead to the next byte in "exits" */
+    uint8_t exit_nr;                /**< Number of bytes that leave the state */
+    uint8_t exits[STATE_MACHINE_DFA_SKIP_MAX];  /**< Bytes that leave the state */
+};
+
+/**
+ * @struct _fsm_dfa_chunk_t
+ * @brief See "fsm_dfa_chunk_t" for details.
+ */
+struct _fsm_dfa_chunk_t {
+    const fsm_dfa_t *dfa;       /**< The DFA */
+    const uint8_t *buf;         /**< The input of the chunk */
+    size_t len;                 /**< Number of bytes of the chunk */
+    uint32_t *map;              /**< Final row offset for every starting state (STATE_MACHINE_DFA_REJECT if rejected) */
+    uint32_t *scratch;          /**< Memory for three arrays of "state_nr" items */
+    uint32_t run_max;           /**< Maximum number of runs left after "STATE_MACHINE_DFA_SPECULATE_LEN" bytes */
+    bool aborted;               /**< true if the runs did not converge (the map is not valid, the chunk is run sequentially) */
+};
+
+/**
+ * @struct _fsm_dfa_t
+ * @brief See "fsm_dfa_t" for details.
+ * INFO: The entries of the table store the offset of the row of the target state
+ * ("target_id * class_nr") and the flags of the target, so the loop needs neither
+ * a multiplication nor a second lookup.
+ */
+struct _fsm_dfa_t {
+    const fsm_def_t *def;       /**< The definition (used until the compilation) */
+    uint32_t state_nr;          /**< Number of states */
+    uint32_t initial_state;     /**< Initial state */
+    fsm_dfa_state_t *states;    /**< Data of the states */
+
+    fsm_dfa_range_t *ranges;    /**< Ranges added */
+    uint32_t range_nr;          /**< Number of ranges */
+    uint32_t range_size;        /**< Capacity of "ranges" */
+
+    uint8_t classes[256];       /**< Class of every byte */
+    uint32_t class_nr;          /**< Number of classes */
+    uint32_t *table;            /**< Transitions ("state_nr" rows of "class_nr" entries), NULL if not compiled */
+};
+
+
+
+/**
+ * @fn state_machine_dfa_is_transition
+ * @brief Check if a transition is in the definition of the DFA.
+ */
+static bool state_machine_dfa_is_transition (const fsm_def_t *def, uint32_t state_id, uint32_t target_id);
+
+/**
+ * @fn state_machine_dfa_expand
+ * @brief Get the target of every byte of a state (STATE_MACHINE_DFA_REJECT if none).
+ * @param dfa The DFA.
+ * @param order Ranges grouped by starting state (in order of addition).
+ * @param first Position of the first range of the state in "order".
+ * @param last Position after the last range of the state in "order".
+ * @param row Destination of the targets (256 items).
+ */
+static void state_machine_dfa_expand (const fsm_dfa_t *dfa, const uint32_t *order, uint32_t first, uint32_t last, uint32_t *row);
+
+/**
+ * @fn state_machine_dfa_skip
+ * @brief Find the next byte that leaves a state that skips ahead.
+ * @return The position of the byte, "len" if not found.
+ */
+static size_t state_machine_dfa_skip (const fsm_dfa_state_t *state, const uint8_t *buf, size_t pos, size_t len);
+
+/**
+ * @fn state_machine_dfa_run
+ * @brief Run the DFA from a row offset without calling the callbacks.
+ * @param dfa The DFA.
+ * @param offset The row offset of the actual state, updated with the one reached.
+ * @param buf The input.
+ * @param len Number of bytes of the input.
+ * @return The number of bytes consumed.
+ */
+static size_t state_machine_dfa_run (const fsm_dfa_t *dfa, uint32_t *offset, const uint8_t *buf, size_t len);
+
+/**
+ * @fn state_machine_dfa_enumerate
+ * @brief Compute the map of a chunk running it from all the states (thread function).
+ * The enumeration is aborted if more than "run_max" runs are left after "STATE_MACHINE_DFA_SPECULATE_LEN" bytes.
+ * @param arg The "fsm_dfa_chunk_t" of the chunk.
+ */
+static void* state_machine_dfa_enumerate (void *arg);
+
+
+
+fsm_dfa_t* state_machine_dfa_create (const fsm_def_t *def)
+{
+    fsm_dfa_t *dfa;
+
+    /* The table entries store the state in 30 bits */
+    if ((def == NULL) || (def->state_nr == 0) || (def->state_nr > ~STATE_MACHINE_DFA_FLAGS))
+    {
+        return(NULL);
+    }
+
+    dfa = (fsm_dfa_t *)calloc(1, sizeof(fsm_dfa_t) + def->state_nr * sizeof(fsm_dfa_state_t));
+    if (dfa == NULL)
+    {
+        return(NULL);
+    }
+
+    dfa->def = def;
+    dfa->state_nr = def->state_nr;
+    dfa->initial_state = def->initial_state;
+    dfa->states = (fsm_dfa_state_t *)(dfa + 1);
+
+    return(dfa);
+}
+
+
+
+void state_machine_dfa_destroy (fsm_dfa_t *dfa)
+{
+    if (dfa == NULL)
+    {
+        return;
+    }
+
+    free(dfa->ranges);
+    free(dfa->table);
+    free(dfa);
+}
+
+
+
+bool state_machine_dfa_add_range (fsm_dfa_t *dfa, uint32_t state_id, uint8_t first, uint8_t last, uint32_t target_id)
+{
+    fsm_dfa_range_t *ranges;
+    uint32_t size;
+
+    if ((state_id >= dfa->state_nr) || (target_id >= dfa->state_nr) || (first > last))
+    {
+        return(false);
+    }
+
+    if (state_machine_dfa_is_transition(dfa->def, state_id, target_id) == false)
+    {
+        return(false);
+    }
+
+    if (dfa->range_nr == dfa->range_size)
+    {
+        size = (dfa->range_size > 0) ? 2 * dfa->range_size : 64;
+
+        ranges = (fsm_dfa_range_t *)realloc(dfa->ranges, size * sizeof(fsm_dfa_range_t));
+        if (ranges == NULL)
+        {
+            return(false);
+        }
+
+        dfa->ranges = ranges;
+        dfa->range_size = size;
+    }
+
+    dfa->ranges[dfa->range_nr].state_id = state_id;
+    dfa->ranges[dfa->range_nr].target_id = target_id;
+    dfa->ranges[dfa->range_nr].first = first;
+    dfa->ranges[dfa->range_nr].last = last;
+    dfa->range_nr++;
+
+    return(true);
+}
+
+
+
+bool state_machine_dfa_set_callback (fsm_dfa_t *dfa, uint32_t state_id, fsm_dfa_callback_t callback)
+{
+    if (state_id >= dfa->state_nr)
+    {
+        return(false);
+    }
+
+    dfa->states[state_id].callback = callback;
+
+    return(true);
+}
+
+
+
+bool state_machine_dfa_set_accepting (fsm_dfa_t *dfa, uint32_t state_id, bool accepting)
+{
+    if (state_id >= dfa->state_nr)
+    {
+        return(false);
+    }
+
+    dfa->states[state_id].accepting = accepting;
+
+    return(true);
+}
+
+
+
+bool state_machine_dfa_compile (fsm_dfa_t *dfa)
+{
+    fsm_dfa_state_t *state;
+    uint32_t *order;
+    uint32_t *start;
+    uint32_t *table;
+    uint64_t *keys;
+    uint32_t *stamps;
+    uint8_t *values;
+    uint32_t row[256];
+    uint8_t classes[256];
+    uint32_t class_nr;
+    uint32_t target;
+    uint32_t cntr;
+    uint32_t byte;
+    uint32_t pos;
+    uint64_t key;
+    char *block;
+
+    /* Scratch: ranges grouped by state, first range of every state and the hash table of the classes */
+    block = (char *)calloc(1, (size_t)dfa->range_nr * sizeof(uint32_t) + ((size_t)dfa->state_nr + 1) * sizeof(uint32_t) +
+                              STATE_MACHINE_DFA_HASH_SIZE * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t)));
+    if (block == NULL)
+    {
+        return(false);
+    }
+
+    keys = (uint64_t *)block;
+    stamps = (uint32_t *)(keys + STATE_MACHINE_DFA_HASH_SIZE);
+    order = stamps + STATE_MACHINE_DFA_HASH_SIZE;
+    start = order + dfa->range_nr;
+    values = (uint8_t *)(start + dfa->state_nr + 1);
+
+    /* Group the ranges by state, keeping the order of addition */
+    for (cntr = 0; cntr < dfa->range_nr; cntr++)
+    {
+        start[dfa->ranges[cntr].state_id + 1]++;
+    }
+
+    for (cntr = 0; cntr < dfa->state_nr; cntr++)
+    {
+        start[cntr + 1] += start[cntr];
+    }
+
+    for (cntr = 0; cntr < dfa->range_nr; cntr++)
+    {
+        order[start[dfa->ranges[cntr].state_id]++] = cntr;
+    }
+
+    for (cntr = dfa->state_nr; cntr > 0; cntr--)
+    {
+        start[cntr] = start[cntr - 1];
+    }
+    start[0] = 0;
+
+    /*
+     Split the classes state by state: two bytes stay in the same class only if they
+     have the same target in every state. The states that leave their self transitions
+     with a few bytes only can skip ahead.
+     */
+    memset(classes, 0, sizeof(classes));
+    class_nr = 1;
+
+    for (cntr = 0; cntr < dfa->state_nr; cntr++)
+    {
+        state = &dfa->states[cntr];
+        state_machine_dfa_expand(dfa, order, start[cntr], start[cntr + 1], row);
+
+        state->exit_nr = 0;
+        state->skip = (state->callback == NULL);
+
+        for (byte = 0; byte < 256; byte++)
+        {
+            if (row[byte] == cntr)
+            {
+                continue;
+            }
+
+            if (state->exit_nr == STATE_MACHINE_DFA_SKIP_MAX)
+            {
+                state->skip = false;
+                break;
+            }
+
+            state->exits[state->exit_nr++] = (uint8_t)byte;
+        }
+
+        /* Stamps: the hash table is cleared for every state without writing it */
+        class_nr = 0;
+        for (byte = 0; byte < 256; byte++)
+        {
+            key = ((uint64_t)classes[byte] << 32) | row[byte];
+            pos = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 54) & (STATE_MACHINE_DFA_HASH_SIZE - 1);
+
+            while ((stamps[pos] == cntr + 1) && (keys[pos] != key))
+            {
+                pos = (pos + 1) & (STATE_MACHINE_DFA_HASH_SIZE - 1);
+            }
+
+            if (stamps[pos] != cntr + 1)
+            {
+                stamps[pos] = cntr + 1;
+                keys[pos] = key;
+                values[pos] = (uint8_t)class_nr++;
+            }
+
+            classes[byte] = values[pos];
+        }
+    }
+
+    /* Fill the table (the offsets of the rows must fit the entries) */
+    table = NULL;
+    if ((uint64_t)dfa->state_nr * class_nr <= ~STATE_MACHINE_DFA_FLAGS)
+    {
+        table = (uint32_t *)malloc((size_t)dfa->state_nr * class_nr * sizeof(uint32_t));
+    }
+
+    if (table == NULL)
+    {
+        free(block);
+        return(false);
+    }
+
+    for (cntr = 0; cntr < dfa->state_nr; cntr++)
+    {
+        state_machine_dfa_expand(dfa, order, start[cntr], start[cntr + 1], row);
+
+        for (byte = 0; byte < 256; byte++)
+        {
+            target = row[byte];
+
+            if (target == STATE_MACHINE_DFA_REJECT)
+            {
+                table[cntr * class_nr + classes[byte]] = STATE_MACHINE_DFA_REJECT;
+                continue;
+            }
+
+            table[cntr * class_nr + classes[byte]] = (target * class_nr) |
+                ((dfa->states[target].callback != NULL) ? STATE_MACHINE_DFA_MARK : 0) |
+                ((dfa->states[target].skip == true) ? STATE_MACHINE_DFA_SKIP : 0);
+        }
+    }
+
+    free(block);
+    free(dfa->table);
+
+    memcpy(dfa->classes, classes, sizeof(classes));
+    dfa->class_nr = class_nr;
+    dfa->table = table;
+    dfa->def = NULL;
+
+    return(true);
+}
+
+
+
+uint32_t state_machine_dfa_class_nr (const fsm_dfa_t *dfa)
+{
+    return(dfa->class_nr);
+}
+
+
+
+uint32_t state_machine_dfa_initial_state (const fsm_dfa_t *dfa)
+{
+    return(dfa->initial_state);
+}
+
+
+
+size_t state_machine_dfa_feed (const fsm_dfa_t *dfa, uint32_t *state_id, const uint8_t *buf, size_t len, void *par)
+{
+    const uint32_t *table;
+    const uint8_t *classes;
+    uint32_t offset;
+    uint32_t next;
+    uint32_t id;
+    size_t pos;
+
+    if ((dfa->table == NULL) || (*state_id >= dfa->state_nr))
+    {
+        return(0);
+    }
+
+    table = dfa->table;
+    classes = dfa->classes;
+    offset = *state_id * dfa->class_nr;
+    pos = 0;
+
+    if (dfa->states[*state_id].skip == true)
+    {
+        pos = state_machine_dfa_skip(&dfa->states[*state_id], buf, pos, len);
+    }
+
+    while (pos < len)
+    {
+        next = table[offset + classes[buf[pos]]];
+
+        /* Fast path: a plain transition */
+        if ((next & STATE_MACHINE_DFA_FLAGS) == 0)
+        {
+            offset = next;
+            pos++;
+            continue;
+        }
+
+        if (next == STATE_MACHINE_DFA_REJECT)
+        {
+            break;
+        }
+
+        offset = next & ~STATE_MACHINE_DFA_FLAGS;
+        id = offset / dfa->class_nr;
+
+        if (((next & STATE_MACHINE_DFA_MARK) != 0) && (dfa->states[id].callback(id, pos, par) == false))
+        {
+            pos++;
+            break;
+        }
+
+        pos++;
+
+        if ((next & STATE_MACHINE_DFA_SKIP) != 0)
+        {
+            pos = state_machine_dfa_skip(&dfa->states[id], buf, pos, len);
+        }
+    }
+
+    *state_id = offset / dfa->class_nr;
+
+    return(pos);
+}
+
+
+
+void state_machine_dfa_feed_many (const fsm_dfa_t *dfa, fsm_dfa_stream_t *streams, uint32_t stream_nr)
+{
+    fsm_dfa_stream_t *lane_stream[STATE_MACHINE_DFA_LANES];
+    const uint8_t *pos[STATE_MACHINE_DFA_LANES];
+    const uint8_t *end[STATE_MACHINE_DFA_LANES];
+    uint32_t offset[STATE_MACHINE_DFA_LANES];
+    bool done[STATE_MACHINE_DFA_LANES];
+    const uint32_t *table;
+    const uint8_t *classes;
+    fsm_dfa_stream_t *stream;
+    uint32_t lane_nr;
+    uint32_t next_stream;
+    uint32_t lane;
+    uint32_t next;
+    uint32_t id;
+    size_t step;
+    size_t cntr;
+    bool rebalance;
+
+    table = dfa->table;
+    classes = dfa->classes;
+    lane_nr = 0;
+    next_stream = 0;
+
+    for (;;)
+    {
+        /* Give the free lanes to the next streams */
+        while ((lane_nr < STATE_MACHINE_DFA_LANES) && (next_stream < stream_nr))
+        {
+            stream = &streams[next_stream++];
+            stream->consumed = 0;
+
+            if ((table == NULL) || (stream->state_id >= dfa->state_nr))
+            {
+                continue;
+            }
+
+            pos[lane_nr] = stream->buf;
+            end[lane_nr] = stream->buf + stream->len;
+
+            if (dfa->states[stream->state_id].skip == true)
+            {
+                pos[lane_nr] = stream->buf + state_machine_dfa_skip(&dfa->states[stream->state_id], stream->buf, 0, stream->len);
+            }
+
+            if (pos[lane_nr] == end[lane_nr])
+            {
+                stream->consumed = stream->len;
+                continue;
+            }
+
+            lane_stream[lane_nr] = stream;
+            offset[lane_nr] = stream->state_id * dfa->class_nr;
+            done[lane_nr] = false;
+            lane_nr++;
+        }
+
+        if (lane_nr == 0)
+        {
+            break;
+        }
+
+        /* All the lanes can advance by the length of the shortest one */
+        step = (size_t)(end[0] - pos[0]);
+        for (lane = 1; lane < lane_nr; lane++)
+        {
+            if ((size_t)(end[lane] - pos[lane]) < step)
+            {
+                step = (size_t)(end[lane] - pos[lane]);
+            }
+        }
+
+        /* The loads of the lanes are independent: they overlap in the pipeline */
+        rebalance = false;
+        for (cntr = 0; (cntr < step) && (rebalance == false); cntr++)
+        {
+            for (lane = 0; lane < lane_nr; lane++)
+            {
+                next = table[offset[lane] + classes[*pos[lane]]];
+
+                if ((next & STATE_MACHINE_DFA_FLAGS) == 0)
+                {
+                    offset[lane] = next;
+                    pos[lane]++;
+                    continue;
+                }
+
+                /* Slow path: the lanes are checked again after the end of the round */
+                rebalance = true;
+
+                if (next == STATE_MACHINE_DFA_REJECT)
+                {
+                    done[lane] = true;
+                    continue;
+                }
+
+                offset[lane] = next & ~STATE_MACHINE_DFA_FLAGS;
+                id = offset[lane] / dfa->class_nr;
+                stream = lane_stream[lane];
+
+                if (((next & STATE_MACHINE_DFA_MARK) != 0) &&
+                    (dfa->states[id].callback(id, (size_t)(pos[lane] - stream->buf), stream->par) == false))
+                {
+                    done[lane] = true;
+                }
+
+                pos[lane]++;
+
+                if (((next & STATE_MACHINE_DFA_SKIP) != 0) && (done[lane] == false))
+                {
+                    pos[lane] = stream->buf + state_machine_dfa_skip(&dfa->states[id], stream->buf,
+                                                                     (size_t)(pos[lane] - stream->buf), stream->len);
+                }
+            }
+        }
+
+        /* Release the lanes of the streams completed */
+        for (lane = 0; lane < lane_nr; )
+        {
+            if ((done[lane] == false) && (pos[lane] != end[lane]))
+            {
+                lane++;
+                continue;
+            }
+
+            stream = lane_stream[lane];
+            stream->state_id = offset[lane] / dfa->class_nr;
+            stream->consumed = (size_t)(pos[lane] - stream->buf);
+
+            lane_nr--;
+            lane_stream[lane] = lane_stream[lane_nr];
+            pos[lane] = pos[lane_nr];
+            end[lane] = end[lane_nr];
+            offset[lane] = offset[lane_nr];
+            done[lane] = done[lane_nr];
+        }
+    }
+}
+
+
+
+size_t state_machine_dfa_feed_parallel (const fsm_dfa_t *dfa, uint32_t *state_id, const uint8_t *buf, size_t len, uint32_t thread_nr)
+{
+    fsm_dfa_chunk_t chunks[STATE_MACHINE_DFA_MAX_THREADS];
+    pthread_t threads[STATE_MACHINE_DFA_MAX_THREADS];
+    bool started[STATE_MACHINE_DFA_MAX_THREADS];
+    uint32_t offset;
+    uint32_t next;
+    uint32_t cntr;
+    uint32_t *block;
+    size_t consumed;
+    size_t run;
+    long cpu_nr;
+
+    if ((dfa->table == NULL) || (*state_id >= dfa->state_nr))
+    {
+        return(0);
+    }
+
+    /* Select the number of chunks (one per thread) */
+    if (thread_nr == 0)
+    {
+        cpu_nr = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_nr = (cpu_nr > 0) ? (uint32_t)cpu_nr : 1;
+    }
+
+    if (thread_nr > len / STATE_MACHINE_DFA_MIN_CHUNK + 1)
+    {
+        thread_nr = (uint32_t)(len / STATE_MACHINE_DFA_MIN_CHUNK + 1);
+    }
+
+    if (thread_nr > STATE_MACHINE_DFA_MAX_THREADS)
+    {
+        thread_nr = STATE_MACHINE_DFA_MAX_THREADS;
+    }
+
+    offset = *state_id * dfa->class_nr;
+
+    block = NULL;
+    if (thread_nr > 1)
+    {
+        /* Map and scratch memory of the chunks run from all the states */
+        block = (uint32_t *)malloc((size_t)(thread_nr - 1) * 4 * dfa->state_nr * sizeof(uint32_t));
+    }
+
+    if (block == NULL)
+    {
+        consumed = state_machine_dfa_run(dfa, &offset, buf, len);
+        *state_id = offset / dfa->class_nr;
+
+        return(consumed);
+    }
+
+    for (cntr = 0; cntr < thread_nr; cntr++)
+    {
+        chunks[cntr].dfa = dfa;
+        chunks[cntr].buf = buf + (len / thread_nr) * cntr;
+        chunks[cntr].len = (cntr < thread_nr - 1) ? (len / thread_nr) : (len - (len / thread_nr) * cntr);
+        chunks[cntr].map = NULL;
+        chunks[cntr].scratch = NULL;
+        chunks[cntr].run_max = (thread_nr / 2 > 1) ? (thread_nr / 2) : 1;
+        chunks[cntr].aborted = false;
+
+        if (cntr > 0)
+        {
+            chunks[cntr].map = block + (size_t)(cntr - 1) * 4 * dfa->state_nr;
+            chunks[cntr].scratch = chunks[cntr].map + dfa->state_nr;
+
+            started[cntr] = (pthread_create(&threads[cntr], NULL, state_machine_dfa_enumerate, &chunks[cntr]) == 0);
+        }
+    }
+
+    /* The first chunk is run from the actual state by the calling thread */
+    consumed = state_machine_dfa_run(dfa, &offset, chunks[0].buf, chunks[0].len);
+
+    for (cntr = 1; cntr < thread_nr; cntr++)
+    {
+        if (started[cntr] == true)
+        {
+            pthread_join(threads[cntr], NULL);
+        }
+        else
+        {
+            state_machine_dfa_enumerate(&chunks[cntr]);
+        }
+    }
+
+    /*
+     Join the maps: a rejected chunk is run again to find the position of the byte, a chunk
+     whose enumeration was aborted is run from the state reached
+     */
+    if (consumed == chunks[0].len)
+    {
+        for (cntr = 1; cntr < thread_nr; cntr++)
+        {
+            if (chunks[cntr].aborted == true)
+            {
+                run = state_machine_dfa_run(dfa, &offset, chunks[cntr].buf, chunks[cntr].len);
+                consumed += run;
+
+                if (run < chunks[cntr].len)
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            next = chunks[cntr].map[offset / dfa->class_nr];
+
+            if (next == STATE_MACHINE_DFA_REJECT)
+            {
+                consumed += state_machine_dfa_run(dfa, &offset, chunks[cntr].buf, chunks[cntr].len);
+                break;
+            }
+
+            offset = next;
+            consumed += chunks[cntr].len;
+        }
+    }
+
+    free(block);
+
+    *state_id = offset / dfa->class_nr;
+
+    return(consumed);
+}
+
+
+
+bool state_machine_dfa_match (const fsm_dfa_t *dfa, const uint8_t *buf, size_t len)
+{
+    uint32_t state_id;
+
+    state_id = dfa->initial_state;
+
+    if (state_machine_dfa_feed(dfa, &state_id, buf, len, NULL) != len)
+    {
+        return(false);
+    }
+
+    return(dfa->states[state_id].accepting);
+}
+
+
+
+static bool state_machine_dfa_is_transition (const fsm_def_t *def, uint32_t state_id, uint32_t target_id)
+{
+    const uint32_t *targets;
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    if (def == NULL)
+    {
+        return(false);
+    }
+
+    /* The rows of the definitions are sorted */
+    targets = &def->targets[def->states[state_id].first_target];
+    low = 0;
+    high = def->states[state_id].target_nr;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+
+        if (targets[middle] < target_id)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return((low < def->states[state_id].target_nr) && (targets[low] == target_id));
+}
+
+
+
+static void state_machine_dfa_expand (const fsm_dfa_t *dfa, const uint32_t *order, uint32_t first, uint32_t last, uint32_t *row)
+{
+    const fsm_dfa_range_t *range;
+    uint32_t cntr;
+    uint32_t byte;
+
+    for (byte = 0; byte < 256; byte++)
+    {
+        row[byte] = STATE_MACHINE_DFA_REJECT;
+    }
+
+    for (cntr = first; cntr < last; cntr++)
+    {
+        range = &dfa->ranges[order[cntr]];
+
+        for (byte = range->first; byte <= range->last; byte++)
+        {
+            row[byte] = range->target_id;
+        }
+    }
+}
+
+
+
+static size_t state_machine_dfa_skip (const fsm_dfa_state_t *state, const uint8_t *buf, size_t pos, size_t len)
+{
+    const uint8_t *found;
+    uint32_t cntr;
+
+    /* The state never changes */
+    if (state->exit_nr == 0)
+    {
+        return(len);
+    }
+
+    if (state->exit_nr == 1)
+    {
+        found = (const uint8_t *)memchr(buf + pos, state->exits[0], len - pos);
+        return((found != NULL) ? (size_t)(found - buf) : len);
+    }
+
+#ifdef __SSE2__
+    /* Compare 16 bytes at a time with every byte that leaves the state */
+    for (; pos + 16 <= len; pos += 16)
+    {
+        __m128i data;
+        __m128i hits;
+        int mask;
+
+        data = _mm_loadu_si128((const __m128i *)(buf + pos));
+        hits = _mm_setzero_si128();
+
+        for (cntr = 0; cntr < state->exit_nr; cntr++)
+        {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(data, _mm_set1_epi8((char)state->exits[cntr])));
+        }
+
+        mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+        {
+            return(pos + (size_t)__builtin_ctz((unsigned int)mask));
+        }
+    }
+#endif
+
+    for (; pos < len; pos++)
+    {
+        for (cntr = 0; cntr < state->exit_nr; cntr++)
+        {
+            if (buf[pos] == state->exits[cntr])
+            {
+                return(pos);
+            }
+        }
+    }
+
+    return(len);
+}
+
+
+
+static size_t state_machine_dfa_run (const fsm_dfa_t *dfa, uint32_t *offset, const uint8_t *buf, size_t len)
+{
+    uint32_t next;
+    uint32_t actual;
+    size_t pos;
+
+    actual = *offset;
+    pos = 0;
+
+    if (dfa->states[actual / dfa->class_nr].skip == true)
+    {
+        pos = state_machine_dfa_skip(&dfa->states[actual / dfa->class_nr], buf, pos, len);
+    }
+
+    while (pos < len)
+    {
+        next = dfa->table[actual + dfa->classes[buf[pos]]];
+
+        if ((next & STATE_MACHINE_DFA_FLAGS) == 0)
+        {
+            actual = next;
+            pos++;
+            continue;
+        }
+
+        if (next == STATE_MACHINE_DFA_REJECT)
+        {
+            break;
+        }
+
+        actual = next & ~STATE_MACHINE_DFA_FLAGS;
+        pos++;
+
+        if ((next & STATE_MACHINE_DFA_SKIP) != 0)
+        {
+            pos = state_machine_dfa_skip(&dfa->states[actual / dfa->class_nr], buf, pos, len);
+        }
+    }
+
+    *offset = actual;
+
+    return(pos);
+}
+
+
+
+static void* state_machine_dfa_enumerate (void *arg)
+{
+    fsm_dfa_chunk_t *chunk = (fsm_dfa_chunk_t *)arg;
+    const fsm_dfa_t *dfa = chunk->dfa;
+    uint32_t *run_of;
+    uint32_t *runs;
+    uint32_t *merged;
+    uint32_t *remap;
+    uint32_t run_nr;
+    uint32_t merged_nr;
+    uint32_t next;
+    uint32_t cntr;
+    uint32_t state;
+    size_t pos;
+    size_t merge_pos;
+    size_t merge_step;
+
+    /*
+     "runs" stores the row offset of every distinct run and "run_of" the run of every
+     starting state. During a merge "merged" maps the states to the new runs and "remap"
+     (the map of the chunk, written only at the end) the old runs to the new ones.
+     */
+    run_of = chunk->scratch;
+    runs = chunk->scratch + dfa->state_nr;
+    merged = chunk->scratch + 2 * dfa->state_nr;
+    remap = chunk->map;
+
+    for (cntr = 0; cntr < dfa->state_nr; cntr++)
+    {
+        run_of[cntr] = cntr;
+        runs[cntr] = cntr * dfa->class_nr;
+    }
+
+    run_nr = dfa->state_nr;
+    merge_step = STATE_MACHINE_DFA_MERGE_STEP;
+    merge_pos = merge_step;
+
+    for (pos = 0; (pos < chunk->len) && (run_nr > 1); pos++)
+    {
+        for (cntr = 0; cntr < run_nr; cntr++)
+        {
+            if (runs[cntr] != STATE_MACHINE_DFA_REJECT)
+            {
+                next = dfa->table[runs[cntr] + dfa->classes[chunk->buf[pos]]];
+                runs[cntr] = (next == STATE_MACHINE_DFA_REJECT) ? next : (next & ~STATE_MACHINE_DFA_FLAGS);
+            }
+        }
+
+        if ((pos + 1 < merge_pos) && (pos + 1 < chunk->len))
+        {
+            continue;
+        }
+
+        /* Merge the runs that reached the same state and drop the rejected ones */
+        merge_step *= 2;
+        merge_pos = pos + 1 + merge_step;
+
+        for (cntr = 0; cntr < run_nr; cntr++)
+        {
+            if (runs[cntr] != STATE_MACHINE_DFA_REJECT)
+            {
+                merged[runs[cntr] / dfa->class_nr] = STATE_MACHINE_DFA_REJECT;
+            }
+        }
+
+        merged_nr = 0;
+        for (cntr = 0; cntr < run_nr; cntr++)
+        {
+            if (runs[cntr] == STATE_MACHINE_DFA_REJECT)
+            {
+                remap[cntr] = STATE_MACHINE_DFA_REJECT;
+                continue;
+            }
+
+            state = runs[cntr] / dfa->class_nr;
+            if (merged[state] == STATE_MACHINE_DFA_REJECT)
+            {
+                merged[state] = merged_nr;
+                runs[merged_nr++] = runs[cntr];
+            }
+
+            remap[cntr] = merged[state];
+        }
+
+        for (cntr = 0; cntr < dfa->state_nr; cntr++)
+        {
+            if (run_of[cntr] != STATE_MACHINE_DFA_REJECT)
+            {
+                run_of[cntr] = remap[run_of[cntr]];
+            }
+        }
+
+        run_nr = merged_nr;
+
+        /* The runs do not converge (e.g. counters): stepping all of them is slower than a single run */
+        if ((run_nr > chunk->run_max) && (pos + 1 >= STATE_MACHINE_DFA_SPECULATE_LEN) && (pos + 1 < chunk->len))
+        {
+            chunk->aborted = true;
+            return(NULL);
+        }
+    }
+
+    /* All the runs left reached the same state: the rest of the chunk is run once */
+    if ((run_nr == 1) && (pos < chunk->len))
+    {
+        if (state_machine_dfa_run(dfa, &runs[0], chunk->buf + pos, chunk->len - pos) < chunk->len - pos)
+        {
+            runs[0] = STATE_MACHINE_DFA_REJECT;
+        }
+    }
+
+    for (cntr = 0; cntr < dfa->state_nr; cntr++)
+    {
+        chunk->map[cntr] = (run_of[cntr] == STATE_MACHINE_DFA_REJECT) ? STATE_MACHINE_DFA_REJECT : runs[run_of[cntr]];
+    }
+
+    return(NULL);
+}
@@ -0,0 +1,183 @@
+/**
+ * @file state_machine_dfa.h
+ * @brief DFA mode: state machines driven by the bytes of an input stream.
+ *
+ * The transitions of a definition are labeled with ranges of bytes and compiled into a
+ * table indexed by state and byte class (bytes with the same transitions in every state
+ * share a class, so the table has usually far fewer than 256 columns). "feed" runs the
+ * whole buffer in a single loop with one table lookup per byte and calls the callbacks
+ * only when a marked state is entered. States that loop on most bytes (e.g. the body of
+ * a string or a comment) skip ahead to the next byte that leaves them, with SSE2 when
+ * available.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_DFA_H
+#define STATE_MACHINE_DFA_H
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @typedef fsm_dfa_t
+ * @brief Data type used to handle a DFA.
+ */
+typedef struct _fsm_dfa_t fsm_dfa_t;
+
+/**
+ * @typedef fsm_dfa_stream_t
+ * @brief Data type used to describe an input stream of "state_machine_dfa_feed_many".
+ */
+typedef struct _fsm_dfa_stream_t fsm_dfa_stream_t;
+
+/**
+ * @typedef fsm_dfa_callback_t
+ * @brief Pointer to the function called when the DFA enters a marked state.
+ * @param state_id The state entered.
+ * @param offset Offset in the buffer of the byte that caused the transition.
+ * @param par Optional parameter "passed" directly from "state_machine_dfa_feed".
+ * @return true to continue, false to stop the feed after the byte.
+ */
+typedef bool (*fsm_dfa_callback_t) (uint32_t state_id, size_t offset, void *par);
+
+
+
+/**
+ * @struct _fsm_dfa_stream_t
+ * @brief Input stream and state of an instance of the DFA.
+ */
+struct _fsm_dfa_stream_t {
+    const uint8_t *buf;         /**< The input */
+    size_t len;                 /**< Number of bytes of the input */
+    void *par;                  /**< Optional parameter "passed" to the callbacks */
+    uint32_t state_id;          /**< The actual state, updated with the state reached */
+    size_t consumed;            /**< Number of bytes consumed (see "state_machine_dfa_feed") */
+};
+
+
+
+/**
+ * @fn state_machine_dfa_create
+ * @brief Create an empty DFA with the states of a definition.
+ * WARNING: The definition is used to check the transitions and must be valid until
+ * "state_machine_dfa_compile" is called.
+ * @param def The definition.
+ * @return The new DFA, NULL if the memory is not available or the definition has too many states.
+ */
+fsm_dfa_t* state_machine_dfa_create (const fsm_def_t *def);
+
+/**
+ * @fn state_machine_dfa_destroy
+ * @brief Release a DFA.
+ */
+void state_machine_dfa_destroy (fsm_dfa_t *dfa);
+
+/**
+ * @fn state_machine_dfa_add_range
+ * @brief Label a transition of the definition with a range of bytes.
+ * Bytes without transitions stop the DFA (see "state_machine_dfa_feed"). If ranges
+ * of the same state overlap, the last one added is used.
+ * @param dfa The DFA.
+ * @param state_id Starting state of the transition.
+ * @param first First byte of the range.
+ * @param last Last byte of the range.
+ * @param target_id Target state of the transition.
+ * @return true if the range was added, false if the transition is not in the definition
+ * or the memory is not available.
+ */
+bool state_machine_dfa_add_range (fsm_dfa_t *dfa, uint32_t state_id, uint8_t first, uint8_t last, uint32_t target_id);
+
+/**
+ * @fn state_machine_dfa_set_callback
+ * @brief Mark a state: the callback is called every time the state is entered (self transitions included).
+ * @return true if the state was marked, false if the state is not valid.
+ */
+bool state_machine_dfa_set_callback (fsm_dfa_t *dfa, uint32_t state_id, fsm_dfa_callback_t callback);
+
+/**
+ * @fn state_machine_dfa_set_accepting
+ * @brief Set whether a state accepts the input (see "state_machine_dfa_match").
+ * @return true if the state was updated, false if the state is not valid.
+ */
+bool state_machine_dfa_set_accepting (fsm_dfa_t *dfa, uint32_t state_id, bool accepting);
+
+/**
+ * @fn state_machine_dfa_compile
+ * @brief Build the byte classes and the transition table.
+ * INFO: It must be called after the last change of the DFA and before "state_machine_dfa_feed".
+ * @return true if the table was built, false if the memory is not available.
+ */
+bool state_machine_dfa_compile (fsm_dfa_t *dfa);
+
+/**
+ * @fn state_machine_dfa_class_nr
+ * @brief Get the number of byte classes of a compiled DFA.
+ */
+uint32_t state_machine_dfa_class_nr (const fsm_dfa_t *dfa);
+
+/**
+ * @fn state_machine_dfa_initial_state
+ * @brief Get the initial state of the DFA.
+ */
+uint32_t state_machine_dfa_initial_state (const fsm_dfa_t *dfa);
+
+/**
+ * @fn state_machine_dfa_feed
+ * @brief Run the DFA over a buffer.
+ * The feed stops at the first byte without transition (the byte is not consumed) or after
+ * a byte whose callback returns false.
+ * @param dfa The compiled DFA.
+ * @param state_id The actual state, updated with the state reached.
+ * @param buf The input.
+ * @param len Number of bytes of the input.
+ * @param par Optional parameter "passed" to the callbacks.
+ * @return The number of bytes consumed.
+ */
+size_t state_machine_dfa_feed (const fsm_dfa_t *dfa, uint32_t *state_id, const uint8_t *buf, size_t len, void *par);
+
+/**
+ * @fn state_machine_dfa_feed_many
+ * @brief Run the DFA over several independent streams.
+ * The streams are advanced in lockstep, several at a time, so the table lookups of
+ * different streams overlap instead of waiting one for the other. The result of every
+ * stream is the one of "state_machine_dfa_feed".
+ * INFO: The callbacks of different streams are called in interleaved order.
+ * @param dfa The compiled DFA.
+ * @param streams The streams (e.g. one per connection).
+ * @param stream_nr Number of streams.
+ */
+void state_machine_dfa_feed_many (const fsm_dfa_t *dfa, fsm_dfa_stream_t *streams, uint32_t stream_nr);
+
+/**
+ * @fn state_machine_dfa_feed_parallel
+ * @brief Run the DFA over a large buffer with several threads.
+ * The buffer is split in chunks: the first one is run from the actual state, the others
+ * from all the states at the same time (the runs that reach the same state are merged,
+ * usually after a few bytes), giving for every chunk the map from starting state to final
+ * state. The maps are then joined in order.
+ * If more than half of "thread_nr" runs of a chunk are still distinct after a few KiB (the DFA
+ * does not converge, e.g. counters or permutations), the speculation is aborted and the chunk
+ * is run sequentially during the join: the worst case is close to "state_machine_dfa_feed".
+ * INFO: The callbacks are not called; the result is the one of "state_machine_dfa_feed"
+ * without callbacks.
+ * @param dfa The compiled DFA.
+ * @param state_id The actual state, updated with the state reached.
+ * @param buf The input.
+ * @param len Number of bytes of the input.
+ * @param thread_nr Number of threads used (0 to use all the online CPUs).
+ * @return The number of bytes consumed.
+ */
+size_t state_machine_dfa_feed_parallel (const fsm_dfa_t *dfa, uint32_t *state_id, const uint8_t *buf, size_t len, uint32_t thread_nr);
+
+/**
+ * @fn state_machine_dfa_match
+ * @brief Check if the whole buffer is accepted starting from the initial state.
+ * INFO: The callbacks are called with a NULL parameter.
+ */
+bool state_machine_dfa_match (const fsm_dfa_t *dfa, const uint8_t *buf, size_t len);
+
+
+
+#endif
@@ -0,0 +1,978 @@
+/**
+ * @file state_machine_journal.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "state_machine_journal.h"
+
+
+
+/**
+ * @def STATE_MACHINE_JOURNAL_BATCH_MAGIC
+ * @brief Identifier of the batches of the log ("SLJB").
+ */
+#define STATE_MACHINE_JOURNAL_BATCH_MAGIC   0x424A4C53
+
+/**
+ * @def STATE_MACHINE_JOURNAL_SNAP_MAGIC
+ * @brief Identifier of the snapshots ("SLJS").
+ */
+#define STATE_MACHINE_JOURNAL_SNAP_MAGIC    0x534A4C53
+
+
+
+/**
+ * @typedef fsm_journal_record_t
+ * @brief State entered by a state machine.
+ */
+typedef struct _fsm_journal_record_t fsm_journal_record_t;
+
+/**
+ * @typedef fsm_journal_batch_t
+ * @brief Header of a batch of the log or of a snapshot (followed by the records).
+ */
+typedef struct _fsm_journal_batch_t fsm_journal_batch_t;
+
+/**
+ * @typedef fsm_journal_binding_t
+ * @brief State machine attached to a journal.
+ */
+typedef struct _fsm_journal_binding_t fsm_journal_binding_t;
+
+/**
+ * @struct _fsm_journal_record_t
+ * @brief See "fsm_journal_record_t" for details.
+ */
+struct _fsm_journal_record_t {
+    uint32_t machine_id;        /**< The state machine */
+    uint32_t state_id;          /**< The state entered */
+};
+
+/**
+ * @struct _fsm_journal_batch_t
+ * @brief See "fsm_journal_batch_t" for details.
+ */
+struct _fsm_journal_batch_t {
+    uint32_t magic;             /**< "STATE_MACHINE_JOURNAL_BATCH_MAGIC" or "STATE_MACHINE_JOURNAL_SNAP_MAGIC" */
+    uint32_t record_nr;         /**< Number of records */
+    uint64_t first_seq;         /**< Sequence number of the first record (for a snapshot:
+                                     the first record of the log not included) */
+    uint64_t checksum;          /**< FNV-1a of "record_nr", "first_seq" and the records */
+};
+
+/**
+ * @struct _fsm_journal_binding_t
+ * @brief See "fsm_journal_binding_t" for details.
+ */
+struct _fsm_journal_binding_t {
+    fsm_hook_link_t link;                   /**< Hook set before the attach (first field, see "state_machine_hook_link") */
+    fsm_journal_t *journal;                 /**< The journal */
+    uint32_t machine_id;                    /**< ID of the state machine */
+};
+
+/**
+ * @struct _fsm_journal_t
+ * @brief See "fsm_journal_t" for details.
+ */
+struct _fsm_journal_t {
+    char *log_path;             /**< Path of the log */
+    char *snap_path;            /**< Path of the snapshot */
+    char *tmp_path;             /**< Path of the snapshot being written */
+    int fd;                     /**< The log */
+    pthread_t thread;           /**< The committer */
+    pthread_mutex_t lock;       /**< Lock of the fields below */
+    pthread_cond_t work;        /**< Signalled to the committer */
+    pthread_cond_t done;        /**< Signalled by the committer (batch written, buffer free, snapshot written) */
+    uint32_t window_us;         /**< Maximum time before a batch is written */
+    uint32_t batch_size;        /**< Number of records of a batch */
+    uint64_t log_max;           /**< Size of the log that starts a snapshot (0 if none) */
+    uint64_t log_size;          /**< Size of the log */
+    fsm_journal_batch_t *active;    /**< Batch being filled (the records follow the header) */
+    fsm_journal_batch_t *spare;     /**< Batch being written */
+    uint32_t count;             /**< Number of records of "active" */
+    uint64_t open_seq;          /**< Sequence number of the first record after the open */
+    uint64_t next_seq;          /**< Sequence number of the next record */
+    uint64_t durable_seq;       /**< Sequence number of the first record not written */
+    uint64_t snapshot_req;      /**< Number of snapshots requested */
+    uint64_t snapshot_done;     /**< Number of snapshot requests served */
+    bool snapshot_ok;           /**< Result of the last snapshot */
+    bool failed;                /**< true if a write failed */
+    bool stop;                  /**< true when the journal is closed */
+    fsm_t **machines;           /**< Attached state machines, by ID */
+    uint32_t machine_nr;        /**< Number of items of "machines" */
+};
+
+
+
+/**
+ * @fn state_machine_journal_hook
+ * @brief Hook of the attached state machines: it records the transition and calls the hook set before the attach.
+ */
+static void state_machine_journal_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+/**
+ * @fn state_machine_journal_committer
+ * @brief Thread that writes the batches and the snapshots.
+ */
+static void* state_machine_journal_committer (void *arg);
+
+/**
+ * @fn state_machine_journal_write_snapshot
+ * @brief Write the snapshot of the attached state machines and truncate the log (lock taken).
+ */
+static bool state_machine_journal_write_snapshot (fsm_journal_t *journal);
+
+/**
+ * @fn state_machine_journal_scan
+ * @brief Read the complete batches of a log, optionally applying them.
+ * @param fd The log.
+ * @param from_seq First sequence number applied.
+ * @param fsms The state machines (NULL to apply nothing).
+ * @param fsm_nr Number of state machines.
+ * @param end Filled with the size of the complete batches.
+ * @param next_seq Filled with the sequence number after the last record (not changed if the log is empty).
+ * @param applied Incremented by the number of records applied.
+ * @return true if the log was read, false if a read failed.
+ */
+static bool state_machine_journal_scan (int fd, uint64_t from_seq, fsm_t *const *fsms, uint32_t fsm_nr, uint64_t *end, uint64_t *next_seq, uint64_t *applied);
+
+/**
+ * @fn state_machine_journal_load
+ * @brief Read a snapshot, optionally applying it.
+ * @param path Path of the snapshot.
+ * @param fsms The state machines (NULL to apply nothing).
+ * @param fsm_nr Number of state machines.
+ * @param seq Filled with the first sequence number not included (0 if there is no snapshot).
+ * @param applied Incremented by the number of records applied.
+ * @return true if the snapshot was read (or does not exist), false if it cannot be read or is not valid.
+ */
+static bool state_machine_journal_load (const char *path, fsm_t *const *fsms, uint32_t fsm_nr, uint64_t *seq, uint64_t *applied);
+
+/**
+ * @fn state_machine_journal_apply
+ * @brief Apply records to the state machines.
+ * @return The number of records applied.
+ */
+static uint64_t state_machine_journal_apply (const fsm_journal_record_t *records, uint32_t record_nr, fsm_t *const *fsms, uint32_t fsm_nr);
+
+/**
+ * @fn state_machine_journal_checksum
+ * @brief Compute the checksum of a batch (the header must be filled).
+ */
+static uint64_t state_machine_journal_checksum (const fsm_journal_batch_t *batch, const fsm_journal_record_t *records);
+
+/**
+ * @fn state_machine_journal_write
+ * @brief Write a buffer completely.
+ * @return true if the buffer was written.
+ */
+static bool state_machine_journal_write (int fd, const void *buf, size_t size);
+
+/**
+ * @fn state_machine_journal_path
+ * @brief Build a path from the path of the journal and an extension.
+ * @return The path (to be released with "free"), NULL if the memory is not available.
+ */
+static char* state_machine_journal_path (const char *path, const char *extension);
+
+
+
+fsm_journal_t* state_machine_journal_open (const char *path, uint32_t window_us, uint32_t batch_size, uint64_t log_max)
+{
+    fsm_journal_t *journal;
+    uint64_t snap_seq;
+    uint64_t next_seq;
+    uint64_t end;
+    size_t size;
+
+    if ((path == NULL) || (batch_size == 0) || (batch_size > 0x10000000))
+    {
+        return(NULL);
+    }
+
+    journal = (fsm_journal_t *)calloc(1, sizeof(fsm_journal_t));
+    if (journal == NULL)
+    {
+        return(NULL);
+    }
+
+    journal->fd = -1;
+    journal->window_us = window_us;
+    journal->batch_size = batch_size;
+    journal->log_max = log_max;
+
+    size = sizeof(fsm_journal_batch_t) + batch_size * sizeof(fsm_journal_record_t);
+    journal->active = (fsm_journal_batch_t *)malloc(size);
+    journal->spare = (fsm_journal_batch_t *)malloc(size);
+    journal->log_path = state_machine_journal_path(path, ".log");
+    journal->snap_path = state_machine_journal_path(path, ".snap");
+    journal->tmp_path = state_machine_journal_path(path, ".snap.tmp");
+    if ((journal->active == NULL) || (journal->spare == NULL) || (journal->log_path == NULL) ||
+        (journal->snap_path == NULL) || (journal->tmp_path == NULL))
+    {
+        goto fail;
+    }
+
+    /* The sequence numbers continue the ones of the snapshot and of the log */
+    if (state_machine_journal_load(journal->snap_path, NULL, 0, &snap_seq, NULL) == false)
+    {
+        goto fail;
+    }
+
+    journal->fd = open(journal->log_path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (journal->fd < 0)
+    {
+        goto fail;
+    }
+
+    next_seq = snap_seq;
+    if (state_machine_journal_scan(journal->fd, 0, NULL, 0, &end, &next_seq, NULL) == false)
+    {
+        goto fail;
+    }
+
+    /* The batches cut by a crash are removed, as the log already included in the snapshot */
+    if (next_seq <= snap_seq)
+    {
+        end = 0;
+        next_seq = snap_seq;
+    }
+
+    if ((ftruncate(journal->fd, (off_t)end) != 0) || (fdatasync(journal->fd) != 0))
+    {
+        goto fail;
+    }
+
+    journal->log_size = end;
+    journal->open_seq = next_seq;
+    journal->next_seq = next_seq;
+    journal->durable_seq = next_seq;
+
+    if (pthread_mutex_init(&journal->lock, NULL) != 0)
+    {
+        goto fail;
+    }
+
+    if (pthread_cond_init(&journal->work, NULL) != 0)
+    {
+        pthread_mutex_destroy(&journal->lock);
+        goto fail;
+    }
+
+    if (pthread_cond_init(&journal->done, NULL) != 0)
+    {
+        pthread_cond_destroy(&journal->work);
+        pthread_mutex_destroy(&journal->lock);
+        goto fail;
+    }
+
+    if (pthread_create(&journal->thread, NULL, state_machine_journal_committer, journal) != 0)
+    {
+        pthread_cond_destroy(&journal->done);
+        pthread_cond_destroy(&journal->work);
+        pthread_mutex_destroy(&journal->lock);
+        goto fail;
+    }
+
+    return(journal);
+
+fail:
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+    free(journal->tmp_path);
+    free(journal->snap_path);
+    free(journal->log_path);
+    free(journal->spare);
+    free(journal->active);
+    free(journal);
+
+    return(NULL);
+}
+
+
+
+void state_machine_journal_close (fsm_journal_t *journal)
+{
+    if (journal == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = true;
+    pthread_cond_signal(&journal->work);
+    pthread_mutex_unlock(&journal->lock);
+
+    pthread_join(journal->thread, NULL);
+
+    pthread_cond_destroy(&journal->done);
+    pthread_cond_destroy(&journal->work);
+    pthread_mutex_destroy(&journal->lock);
+
+    close(journal->fd);
+    free(journal->machines);
+    free(journal->tmp_path);
+    free(journal->snap_path);
+    free(journal->log_path);
+    free(journal->spare);
+    free(journal->active);
+    free(journal);
+}
+
+
+
+bool state_machine_journal_attach (fsm_journal_t *journal, fsm_t *fsm, uint32_t machine_id)
+{
+    fsm_journal_binding_t *binding;
+    fsm_t **machines;
+    uint32_t machine_nr;
+
+    if ((state_machine_hook_find(fsm, state_machine_journal_hook) != NULL) || (machine_id == 0xFFFFFFFF))
+    {
+        return(false);
+    }
+
+    binding = (fsm_journal_binding_t *)malloc(sizeof(fsm_journal_binding_t));
+    if (binding == NULL)
+    {
+        return(false);
+    }
+
+    pthread_mutex_lock(&journal->lock);
+
+    /* The snapshots include the attached state machines */
+    if (machine_id >= journal->machine_nr)
+    {
+        machine_nr = (machine_id >= 2 * journal->machine_nr) ? machine_id + 1 : 2 * journal->machine_nr;
+
+        machines = (fsm_t **)realloc(journal->machines, machine_nr * sizeof(fsm_t *));
+        if (machines == NULL)
+        {
+            pthread_mutex_unlock(&journal->lock);
+            free(binding);
+            return(false);
+        }
+
+        memset(machines + journal->machine_nr, 0, (machine_nr - journal->machine_nr) * sizeof(fsm_t *));
+        journal->machines = machines;
+        journal->machine_nr = machine_nr;
+    }
+    journal->machines[machine_id] = fsm;
+
+    pthread_mutex_unlock(&journal->lock);
+
+    binding->journal = journal;
+    binding->machine_id = machine_id;
+
+    state_machine_hook_link(fsm, state_machine_journal_hook, &binding->link);
+
+    return(true);
+}
+
+
+
+void state_machine_journal_detach (fsm_t *fsm)
+{
+    fsm_journal_binding_t *binding;
+    fsm_journal_t *journal;
+
+    binding = (fsm_journal_binding_t *)state_machine_hook_unlink(fsm, state_machine_journal_hook, NULL);
+    if (binding == NULL)
+    {
+        return;
+    }
+
+    journal = binding->journal;
+
+    pthread_mutex_lock(&journal->lock);
+    if (journal->machines[binding->machine_id] == fsm)
+    {
+        journal->machines[binding->machine_id] = NULL;
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    free(binding);
+}
+
+
+
+bool state_machine_journal_sync (fsm_journal_t *journal)
+{
+    uint64_t seq;
+    bool result;
+
+    pthread_mutex_lock(&journal->lock);
+
+    seq = journal->next_seq;
+    while ((journal->durable_seq < seq) && (journal->failed == false))
+    {
+        pthread_cond_wait(&journal->done, &journal->lock);
+    }
+    result = (journal->failed == false);
+
+    pthread_mutex_unlock(&journal->lock);
+
+    return(result);
+}
+
+
+
+bool state_machine_journal_snapshot (fsm_journal_t *journal)
+{
+    uint64_t request;
+    bool result;
+
+    pthread_mutex_lock(&journal->lock);
+
+    request = ++journal->snapshot_req;
+    pthread_cond_signal(&journal->work);
+    while (journal->snapshot_done < request)
+    {
+        pthread_cond_wait(&journal->done, &journal->lock);
+    }
+    result = journal->snapshot_ok;
+
+    pthread_mutex_unlock(&journal->lock);
+
+    return(result);
+}
+
+
+
+uint64_t state_machine_journal_durable (fsm_journal_t *journal)
+{
+    uint64_t durable;
+
+    pthread_mutex_lock(&journal->lock);
+    durable = journal->durable_seq - journal->open_seq;
+    pthread_mutex_unlock(&journal->lock);
+
+    return(durable);
+}
+
+
+
+bool state_machine_journal_recover (const char *path, fsm_t *const *fsms, uint32_t fsm_nr, uint64_t *record_nr)
+{
+    char *log_path;
+    char *snap_path;
+    uint64_t applied;
+    uint64_t snap_seq;
+    uint64_t next_seq;
+    uint64_t end;
+    bool result;
+    int fd;
+
+    applied = 0;
+    log_path = state_machine_journal_path(path, ".log");
+    snap_path = state_machine_journal_path(path, ".snap");
+
+    result = ((log_path != NULL) && (snap_path != NULL) &&
+              (state_machine_journal_load(snap_path, fsms, fsm_nr, &snap_seq, &applied) == true));
+
+    /* The records of the log already included in the snapshot are skipped */
+    if (result == true)
+    {
+        fd = open(log_path, O_RDONLY);
+        if (fd >= 0)
+        {
+            result = state_machine_journal_scan(fd, snap_seq, fsms, fsm_nr, &end, &next_seq, &applied);
+            close(fd);
+        }
+        else if (errno != ENOENT)
+        {
+            result = false;
+        }
+    }
+
+    free(snap_path);
+    free(log_path);
+
+    if (record_nr != NULL)
+    {
+        *record_nr = applied;
+    }
+
+    return(result);
+}
+
+
+
+static void state_machine_journal_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data)
+{
+    fsm_journal_binding_t *binding = (fsm_journal_binding_t *)data;
+    fsm_journal_t *journal = binding->journal;
+    fsm_journal_record_t *record;
+
+    pthread_mutex_lock(&journal->lock);
+
+    /* No transition is lost: the hook waits for the committer when the batch is full */
+    while (journal->count == journal->batch_size)
+    {
+        pthread_cond_signal(&journal->work);
+        pthread_cond_wait(&journal->done, &journal->lock);
+    }
+
+    record = (fsm_journal_record_t *)(journal->active + 1) + journal->count++;
+    record->machine_id = binding->machine_id;
+    record->state_id = enter_state_id;
+    journal->next_seq++;
+
+    /* The first record starts the window, a full batch is written at once */
+    if ((journal->count == 1) || (journal->count == journal->batch_size))
+    {
+        pthread_cond_signal(&journal->work);
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+
+    if (binding->link.on_transition != NULL)
+    {
+        binding->link.on_transition(fsm, exit_state_id, enter_state_id, binding->link.hook_data);
+    }
+}
+
+
+
+static void* state_machine_journal_committer (void *arg)
+{
+    fsm_journal_t *journal = (fsm_journal_t *)arg;
+    fsm_journal_batch_t *batch;
+    struct timespec deadline;
+    uint64_t size;
+    bool written;
+
+    pthread_mutex_lock(&journal->lock);
+
+    for (;;)
+    {
+        while ((journal->count == 0) && (journal->stop == false) && (journal->snapshot_req == journal->snapshot_done))
+        {
+            pthread_cond_wait(&journal->work, &journal->lock);
+        }
+
+        /* Group commit: the records of the window are written together */
+        if ((journal->count > 0) && (journal->count < journal->batch_size) && (journal->stop == false) &&
+            (journal->snapshot_req == journal->snapshot_done) && (journal->window_us > 0))
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += journal->window_us / 1000000;
+            deadline.tv_nsec += (long)(journal->window_us % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            while ((journal->count < journal->batch_size) && (journal->stop == false) &&
+                   (journal->snapshot_req == journal->snapshot_done))
+            {
+                if (pthread_cond_timedwait(&journal->work, &journal->lock, &deadline) == ETIMEDOUT)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (journal->count > 0)
+        {
+            /* The hooks fill the other buffer during the write */
+            batch = journal->active;
+            batch->magic = STATE_MACHINE_JOURNAL_BATCH_MAGIC;
+            batch->record_nr = journal->count;
+            batch->first_seq = journal->next_seq - journal->count;
+            batch->checksum = state_machine_journal_checksum(batch, (const fsm_journal_record_t *)(batch + 1));
+
+            journal->active = journal->spare;
+            journal->spare = batch;
+            journal->count = 0;
+            pthread_cond_broadcast(&journal->done);
+
+            pthread_mutex_unlock(&journal->lock);
+
+            size = sizeof(fsm_journal_batch_t) + batch->record_nr * sizeof(fsm_journal_record_t);
+            written = ((state_machine_journal_write(journal->fd, batch, size) == true) && (fdatasync(journal->fd) == 0));
+
+            pthread_mutex_lock(&journal->lock);
+
+            if (written == false)
+            {
+                journal->failed = true;
+            }
+            journal->durable_seq = batch->first_seq + batch->record_nr;
+            journal->log_size += size;
+            pthread_cond_broadcast(&journal->done);
+        }
+
+        if ((journal->snapshot_req != journal->snapshot_done) ||
+            ((journal->log_max > 0) && (journal->log_size >= journal->log_max) && (journal->failed == false)))
+        {
+            journal->snapshot_ok = state_machine_journal_write_snapshot(journal);
+            journal->snapshot_done = journal->snapshot_req;
+            pthread_cond_broadcast(&journal->done);
+        }
+
+        if ((journal->stop == true) && (journal->count == 0))
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+
+    return(NULL);
+}
+
+
+
+static bool state_machine_journal_write_snapshot (fsm_journal_t *journal)
+{
+    fsm_journal_batch_t *batch;
+    fsm_journal_record_t *records;
+    fsm_t *fsm;
+    char *dir;
+    char *slash;
+    uint32_t record_nr;
+    uint32_t region_nr;
+    uint32_t cntr;
+    uint32_t region;
+    bool result;
+    int fd;
+
+    if (journal->failed == true)
+    {
+        return(false);
+    }
+
+    record_nr = 0;
+    for (cntr = 0; cntr < journal->machine_nr; cntr++)
+    {
+        if (journal->machines[cntr] != NULL)
+        {
+            record_nr += (journal->machines[cntr]->region_nr > 0) ? journal->machines[cntr]->region_nr : 1;
+        }
+    }
+
+    batch = (fsm_journal_batch_t *)malloc(sizeof(fsm_journal_batch_t) + record_nr * sizeof(fsm_journal_record_t));
+    if (batch == NULL)
+    {
+        return(false);
+    }
+    records = (fsm_journal_record_t *)(batch + 1);
+
+    /*
+     The hooks wait for the lock, so the transitions executed meanwhile are recorded after
+     "durable_seq" and applied again by the recovery (with the same result).
+     */
+    record_nr = 0;
+    for (cntr = 0; cntr < journal->machine_nr; cntr++)
+    {
+        fsm = journal->machines[cntr];
+        if (fsm == NULL)
+        {
+            continue;
+        }
+
+        region_nr = (fsm->region_nr > 0) ? fsm->region_nr : 1;
+        for (region = 0; region < region_nr; region++)
+        {
+            records[record_nr].machine_id = cntr;
+            records[record_nr].state_id = state_machine_get_region_state(fsm, region);
+            record_nr++;
+        }
+    }
+
+    batch->magic = STATE_MACHINE_JOURNAL_SNAP_MAGIC;
+    batch->record_nr = record_nr;
+    batch->first_seq = journal->durable_seq;
+    batch->checksum = state_machine_journal_checksum(batch, records);
+
+    /* The new snapshot replaces the old one only when complete */
+    result = false;
+    fd = open(journal->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0)
+    {
+        result = ((state_machine_journal_write(fd, batch, sizeof(fsm_journal_batch_t) + record_nr * sizeof(fsm_journal_record_t)) == true) &&
+                  (fsync(fd) == 0));
+        close(fd);
+    }
+    free(batch);
+
+    if ((result == false) || (rename(journal->tmp_path, journal->snap_path) != 0))
+    {
+        unlink(journal->tmp_path);
+        return(false);
+    }
+
+    /* The rename is durable with the directory */
+    dir = strdup(journal->snap_path);
+    if (dir != NULL)
+    {
+        slash = strrchr(dir, '/');
+        if (slash == dir)
+        {
+            slash[1] = '\0';
+        }
+        else if (slash != NULL)
+        {
+            slash[0] = '\0';
+        }
+
+        fd = open((slash != NULL) ? dir : ".", O_RDONLY);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+        free(dir);
+    }
+
+    /* The log is included in the snapshot */
+    if (ftruncate(journal->fd, 0) != 0)
+    {
+        return(false);
+    }
+    journal->log_size = 0;
+
+    return(true);
+}
+
+
+
+static bool state_machine_journal_scan (int fd, uint64_t from_seq, fsm_t *const *fsms, uint32_t fsm_nr, uint64_t *end, uint64_t *next_seq, uint64_t *applied)
+{
+    fsm_journal_batch_t header;
+    fsm_journal_record_t *records;
+    fsm_journal_record_t *buffer;
+    struct stat info;
+    uint64_t offset;
+    uint64_t expected;
+    uint32_t skip;
+    size_t size;
+    size_t buffer_nr;
+    ssize_t done;
+
+    *end = 0;
+    if (fstat(fd, &info) != 0)
+    {
+        return(false);
+    }
+
+    records = NULL;
+    buffer_nr = 0;
+    expected = 0;
+    offset = 0;
+
+    while (offset + sizeof(fsm_journal_batch_t) <= (uint64_t)info.st_size)
+    {
+        done = pread(fd, &header, sizeof(fsm_journal_batch_t), (off_t)offset);
+        if (done < 0)
+        {
+            free(records);
+            return(false);
+        }
+
+        /* The log ends at the first batch not complete (or not following the previous one) */
+        size = (size_t)header.record_nr * sizeof(fsm_journal_record_t);
+        if (((size_t)done < sizeof(fsm_journal_batch_t)) || (header.magic != STATE_MACHINE_JOURNAL_BATCH_MAGIC) ||
+            (offset + sizeof(fsm_journal_batch_t) + size > (uint64_t)info.st_size) ||
+            ((offset > 0) && (header.first_seq != expected)))
+        {
+            break;
+        }
+
+        if (header.record_nr > buffer_nr)
+        {
+            buffer = (fsm_journal_record_t *)realloc(records, size);
+            if (buffer == NULL)
+            {
+                free(records);
+                return(false);
+            }
+            records = buffer;
+            buffer_nr = header.record_nr;
+        }
+
+        done = pread(fd, records, size, (off_t)(offset + sizeof(fsm_journal_batch_t)));
+        if (done < 0)
+        {
+            free(records);
+            return(false);
+        }
+
+        if (((size_t)done < size) || (state_machine_journal_checksum(&header, records) != header.checksum))
+        {
+            break;
+        }
+
+        if ((fsms != NULL) && (header.first_seq + header.record_nr > from_seq))
+        {
+            skip = (header.first_seq < from_seq) ? (uint32_t)(from_seq - header.first_seq) : 0;
+            *applied += state_machine_journal_apply(records + skip, header.record_nr - skip, fsms, fsm_nr);
+        }
+
+        expected = header.first_seq + header.record_nr;
+        offset += sizeof(fsm_journal_batch_t) + size;
+    }
+
+    free(records);
+
+    *end = offset;
+    if (offset > 0)
+    {
+        *next_seq = expected;
+    }
+
+    return(true);
+}
+
+
+
+static bool state_machine_journal_load (const char *path, fsm_t *const *fsms, uint32_t fsm_nr, uint64_t *seq, uint64_t *applied)
+{
+    fsm_journal_batch_t header;
+    fsm_journal_record_t *records;
+    size_t size;
+    bool result;
+    FILE *file;
+
+    *seq = 0;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return(errno == ENOENT);
+    }
+
+    result = false;
+    records = NULL;
+    if ((fread(&header, sizeof(fsm_journal_batch_t), 1, file) == 1) && (header.magic == STATE_MACHINE_JOURNAL_SNAP_MAGIC))
+    {
+        size = (size_t)header.record_nr * sizeof(fsm_journal_record_t);
+        records = (fsm_journal_record_t *)malloc((size > 0) ? size : 1);
+
+        if ((records != NULL) && ((size == 0) || (fread(records, size, 1, file) == 1)) &&
+            (state_machine_journal_checksum(&header, records) == header.checksum))
+        {
+            *seq = header.first_seq;
+            if (fsms != NULL)
+            {
+                *applied += state_machine_journal_apply(records, header.record_nr, fsms, fsm_nr);
+            }
+            result = true;
+        }
+    }
+
+    free(records);
+    fclose(file);
+
+    return(result);
+}
+
+
+
+static uint64_t state_machine_journal_apply (const fsm_journal_record_t *records, uint32_t record_nr, fsm_t *const *fsms, uint32_t fsm_nr)
+{
+    uint64_t applied;
+    uint32_t cntr;
+
+    applied = 0;
+    for (cntr = 0; cntr < record_nr; cntr++)
+    {
+        if ((records[cntr].machine_id < fsm_nr) && (fsms[records[cntr].machine_id] != NULL) &&
+            (state_machine_restore_state(fsms[records[cntr].machine_id], records[cntr].state_id) == true))
+        {
+            applied++;
+        }
+    }
+
+    return(applied);
+}
+
+
+
+static uint64_t state_machine_journal_checksum (const fsm_journal_batch_t *batch, const fsm_journal_record_t *records)
+{
+    const uint8_t *bytes;
+    uint64_t hash;
+    size_t size;
+    size_t cntr;
+
+    hash = 0xCBF29CE484222325ULL;
+
+    bytes = (const uint8_t *)&batch->record_nr;
+    for (cntr = 0; cntr < sizeof(batch->record_nr); cntr++)
+    {
+        hash = (hash ^ bytes[cntr]) * 0x100000001B3ULL;
+    }
+
+    bytes = (const uint8_t *)&batch->first_seq;
+    for (cntr = 0; cntr < sizeof(batch->first_seq); cntr++)
+    {
+        hash = (hash ^ bytes[cntr]) * 0x100000001B3ULL;
+    }
+
+    bytes = (const uint8_t *)records;
+    size = (size_t)batch->record_nr * sizeof(fsm_journal_record_t);
+    for (cntr = 0; cntr < size; cntr++)
+    {
+        hash = (hash ^ bytes[cntr]) * 0x100000001B3ULL;
+    }
+
+    return(hash);
+}
+
+
+
+static bool state_machine_journal_write (int fd, const void *buf, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)buf;
+    ssize_t done;
+    size_t pos;
+
+    pos = 0;
+    while (pos < size)
+    {
+        done = write(fd, bytes + pos, size - pos);
+        if (done < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return(false);
+        }
+        pos += (size_t)done;
+    }
+
+    return(true);
+}
+
+
+
+static char* state_machine_journal_path (const char *path, const char *extension)
+{
+    char *result;
+    size_t len;
+
+    len = strlen(path);
+    result = (char *)malloc(len + strlen(extension) + 1);
+    if (result != NULL)
+    {
+        memcpy(result, path, len);
+        strcpy(result + len, extension);
+    }
+
+    return(result);
+}
@@ -0,0 +1,116 @@
+/**
+ * @file state_machine_journal.h
+ * @brief Durable journal of the transitions of state machines (write-ahead log with group commit).
+ *
+ * The transitions of the attached state machines are appended to a buffer by the hook
+ * and written to "<path>.log" by a committer thread: the records collected during a
+ * window are written together and made durable with a single "fdatasync" (group
+ * commit). "state_machine_journal_sync" waits until the transitions executed before
+ * the call are on disk.
+ *
+ * When the log is larger than a limit (or on request), the states of all the attached
+ * state machines are written to "<path>.snap" and the log is truncated. The records
+ * store the state entered (not the transition), so applying a record twice does not
+ * change the result: "state_machine_journal_recover" applies the snapshot and then the
+ * log, up to the last complete batch (a batch cut by a crash is ignored).
+ *
+ * Example:
+ *     state_machine_journal_recover("/var/lib/app/billing", fsms, fsm_nr, NULL);
+ *     journal = state_machine_journal_open("/var/lib/app/billing", 1000, 65536, 64 << 20);
+ *     for (cntr = 0; cntr < fsm_nr; cntr++)
+ *         state_machine_journal_attach(journal, fsms[cntr], cntr);
+ *     ...
+ *     fsm->go_to_state(fsm, STATE_CHARGED);
+ *     fsm->sm_run(fsm, NULL);
+ *     state_machine_journal_sync(journal);    // STATE_CHARGED survives a crash
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_JOURNAL_H
+#define STATE_MACHINE_JOURNAL_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @typedef fsm_journal_t
+ * @brief Data type used to handle a journal.
+ */
+typedef struct _fsm_journal_t fsm_journal_t;
+
+
+
+/**
+ * @fn state_machine_journal_open
+ * @brief Open (or create) a journal and start its committer thread.
+ * The end of the log not complete (e.g. cut by a crash) is removed, so the recovery
+ * must be executed first.
+ * @param path Path of the journal, without extension.
+ * @param window_us Maximum time between a transition and the write of its batch (µs).
+ * @param batch_size Number of records of a batch (the hooks wait when the batch is full).
+ * @param log_max Size of the log that starts a snapshot (0 for no automatic snapshots).
+ * @return The journal, NULL if the parameters are not valid or the files cannot be opened.
+ */
+fsm_journal_t* state_machine_journal_open (const char *path, uint32_t window_us, uint32_t batch_size, uint64_t log_max);
+
+/**
+ * @fn state_machine_journal_close
+ * @brief Write the last records, stop the committer thread and release the journal.
+ * WARNING: The state machines must be detached first.
+ */
+void state_machine_journal_close (fsm_journal_t *journal);
+
+/**
+ * @fn state_machine_journal_attach
+ * @brief Record the transitions of a state machine.
+ * The hook set before is kept and called by the one of the journal.
+ * @param journal The journal.
+ * @param fsm The state machine.
+ * @param machine_id ID of the state machine (index of the array given to "state_machine_journal_recover").
+ * @return true if the state machine was attached, false if it is already attached or the memory is not available.
+ */
+bool state_machine_journal_attach (fsm_journal_t *journal, fsm_t *fsm, uint32_t machine_id);
+
+/**
+ * @fn state_machine_journal_detach
+ * @brief Stop recording the transitions of a state machine (the hook set before the attach is restored).
+ */
+void state_machine_journal_detach (fsm_t *fsm);
+
+/**
+ * @fn state_machine_journal_sync
+ * @brief Wait until the transitions recorded before the call are durable.
+ * @return true if they are durable, false if a write failed (the journal is no longer durable).
+ */
+bool state_machine_journal_sync (fsm_journal_t *journal);
+
+/**
+ * @fn state_machine_journal_snapshot
+ * @brief Write a snapshot of the attached state machines and truncate the log.
+ * The transitions are suspended while the snapshot is written.
+ * @return true if the snapshot was written.
+ */
+bool state_machine_journal_snapshot (fsm_journal_t *journal);
+
+/**
+ * @fn state_machine_journal_durable
+ * @brief Get the number of records made durable since the creation of the journal.
+ */
+uint64_t state_machine_journal_durable (fsm_journal_t *journal);
+
+/**
+ * @fn state_machine_journal_recover
+ * @brief Apply the snapshot and the log of a journal to the state machines (with "state_machine_restore_state").
+ * @param path Path of the journal, without extension.
+ * @param fsms The state machines (addressed by the IDs given to "state_machine_journal_attach").
+ * @param fsm_nr Number of state machines.
+ * @param record_nr Filled with the number of records applied (can be NULL).
+ * @return true if the journal was applied (or does not exist), false if a file cannot be read.
+ */
+bool state_machine_journal_recover (const char *path, fsm_t *const *fsms, uint32_t fsm_nr, uint64_t *record_nr);
+
+
+
+#endif
@@ -0,0 +1,876 @@
+/**
+ * @file state_machine_loader.c
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_machine_loader.h"
+
+
+
+/**
+ * @typedef fsm_loader_ref_t
+ * @brief Reference to a name found in the text, resolved after the parsing.
+ */
+typedef struct _fsm_loader_ref_t fsm_loader_ref_t;
+
+/**
+ * @typedef fsm_loader_t
+ * @brief Status of the loader.
+ */
+typedef struct _fsm_loader_t fsm_loader_t;
+
+/**
+ * @struct _fsm_loader_ref_t
+ * @brief See "fsm_loader_ref_t" for details.
+ */
+struct _fsm_loader_ref_t {
+    const char *name;           /**< Pointer to the name in the text */
+    uint32_t len;               /**< Length of the name */
+    uint32_t line;              /**< Line of the name */
+    uint32_t column;            /**< Column of the name */
+};
+
+/**
+ * @struct _fsm_loader_t
+ * @brief See "fsm_loader_t" for details.
+ * INFO: The text is parsed twice: the first pass counts the items and checks the syntax,
+ * the second one fills the definition allocated with the result of the first pass.
+ */
+struct _fsm_loader_t {
+    const char *text;               /**< Text to be parsed */
+    size_t len;                     /**< Length of the text */
+    const fsm_symbol_t *symbols;    /**< List of the available callbacks */
+    fsm_load_error_t *error;        /**< Destination of the error description */
+
+    uint32_t state_nr;              /**< Number of states */
+    uint32_t transition_nr;         /**< Number of transitions */
+    uint32_t symbol_nr;             /**< Number of symbols */
+    size_t string_size;             /**< Space needed by the names */
+    bool initial_found;             /**< Check if the initial state was declared */
+
+    fsm_def_t *def;                 /**< Definition filled by the second pass (NULL during the first one) */
+    char *string_pos;               /**< First free byte of "def->strings" */
+    uint32_t state_cntr;            /**< Number of states stored in the definition */
+    uint32_t transition_cntr;       /**< Number of transitions stored in the scratch area */
+
+    uint32_t *state_hash;           /**< Hash of the state names (index + 1, 0 if empty) */
+    uint32_t state_hash_mask;       /**< Size of "state_hash" - 1 */
+    uint32_t *symbol_hash;          /**< Hash of the symbol names (index + 1, 0 if empty) */
+    uint32_t symbol_hash_mask;      /**< Size of "symbol_hash" - 1 */
+    fsm_loader_ref_t *sources;      /**< Starting states of the transitions */
+    fsm_loader_ref_t *targets;      /**< Target states of the transitions */
+    fsm_loader_ref_t initial;       /**< Initial state */
+};
+
+
+
+/**
+ * @fn state_machine_loader_error
+ * @brief Fill the error description.
+ * @param loader The loader.
+ * @param line Line of the error.
+ * @param column Column of the error.
+ * @param format Format of the message (see "printf").
+ * @return Always false.
+ */
+static bool state_machine_loader_error (fsm_loader_t *loader, uint32_t line, uint32_t column, const char *format, ...);
+
+/**
+ * @fn state_machine_loader_parse
+ * @brief Parse the text. The action depends on the pass (see "fsm_loader_t").
+ * @param loader The loader.
+ * @return true if the text is valid, false if not.
+ */
+static bool state_machine_loader_parse (fsm_loader_t *loader);
+
+/**
+ * @fn state_machine_loader_parse_line
+ * @brief Parse a line of the text.
+ * @param loader The loader.
+ * @param start First character of the line.
+ * @param end End of the line (comments excluded).
+ * @param line Number of the line.
+ * @return true if the line is valid, false if not.
+ */
+static bool state_machine_loader_parse_line (fsm_loader_t *loader, const char *start, const char *end, uint32_t line);
+
+/**
+ * @fn state_machine_loader_token
+ * @brief Get the next token of a line.
+ * @param pos Pointer to the current position, updated to the end of the token.
+ * @param end End of the line.
+ * @param len Length of the token.
+ * @return Pointer to the token, NULL if the line is ended.
+ */
+static const char* state_machine_loader_token (const char **pos, const char *end, uint32_t *len);
+
+/**
+ * @fn state_machine_loader_is_name
+ * @brief Check if a token is a valid name (i.e. a C identifier).
+ */
+static bool state_machine_loader_is_name (const char *token, uint32_t len);
+
+/**
+ * @fn state_machine_loader_add_state
+ * @brief Store a state during the second pass.
+ * @return true if the state was stored, false if not.
+ */
+static bool state_machine_loader_add_state (fsm_loader_t *loader, const fsm_loader_ref_t *name, const fsm_loader_ref_t *run, const fsm_loader_ref_t *enter);
+
+/**
+ * @fn state_machine_loader_add_callback
+ * @brief Store and resolve the callback of a state.
+ * @return true if the callback is valid, false if not.
+ */
+static bool state_machine_loader_add_callback (fsm_loader_t *loader, fsm_def_state_t *state, const fsm_loader_ref_t *ref, bool enter);
+
+/**
+ * @fn state_machine_loader_copy
+ * @brief Copy a name in the storage of the definition.
+ * @return Pointer to the copy.
+ */
+static const char* state_machine_loader_copy (fsm_loader_t *loader, const fsm_loader_ref_t *ref);
+
+/**
+ * @fn state_machine_loader_hash
+ * @brief Compute the hash of a name (FNV-1a).
+ */
+static uint32_t state_machine_loader_hash (const char *name, uint32_t len);
+
+/**
+ * @fn state_machine_loader_find_state
+ * @brief Get the ID of the state with the given name.
+ * @return The ID of the state, "state_nr" if not found.
+ */
+static uint32_t state_machine_loader_find_state (fsm_loader_t *loader, const fsm_loader_ref_t *ref);
+
+/**
+ * @fn state_machine_loader_link
+ * @brief Resolve the initial state and the transitions and build the rows of targets.
+ * @return true if all the names are valid, false if not.
+ */
+static bool state_machine_loader_link (fsm_loader_t *loader);
+
+/**
+ * @fn state_machine_loader_compare
+ * @brief Compare two targets (see "qsort").
+ */
+static int state_machine_loader_compare (const void *a, const void *b);
+
+
+
+fsm_def_t* state_machine_load_string (const char *text, size_t len, const fsm_symbol_t *symbols, fsm_load_error_t *error)
+{
+    fsm_loader_t loader;
+    uint32_t state_hash_size;
+    uint32_t symbol_hash_size;
+    uint32_t cntr;
+    char *scratch;
+
+    memset(&loader, 0, sizeof(fsm_loader_t));
+    loader.text = text;
+    loader.len = len;
+    loader.symbols = symbols;
+    loader.error = error;
+
+    if (text == NULL)
+    {
+        state_machine_loader_error(&loader, 0, 0, "missing text");
+        return(NULL);
+    }
+
+    /* First pass: check the syntax and count the items */
+    if (state_machine_loader_parse(&loader) == false)
+    {
+        return(NULL);
+    }
+
+    if (loader.state_nr == 0)
+    {
+        state_machine_loader_error(&loader, 0, 0, "no states declared");
+        return(NULL);
+    }
+
+    if (symbols != NULL)
+    {
+        for (loader.symbol_nr = 0; symbols[loader.symbol_nr].name != NULL; loader.symbol_nr++);
+    }
+
+    /* Size of the hash tables: at least twice the number of items */
+    for (state_hash_size = 1; state_hash_size < (2 * loader.state_nr); state_hash_size <<= 1);
+    for (symbol_hash_size = 1; symbol_hash_size < (2 * loader.symbol_nr); symbol_hash_size <<= 1);
+
+    /* Allocate the definition and the scratch area used to resolve the names */
+    loader.def = state_machine_def_create(loader.state_nr, loader.transition_nr, loader.string_size);
+    scratch = (char *)calloc(1, (state_hash_size + symbol_hash_size) * sizeof(uint32_t) +
+                                2 * (size_t)loader.transition_nr * sizeof(fsm_loader_ref_t));
+
+    if ((loader.def == NULL) || (scratch == NULL))
+    {
+        state_machine_def_free(loader.def);
+        free(scratch);
+        state_machine_loader_error(&loader, 0, 0, "out of memory");
+        return(NULL);
+    }
+
+    loader.sources = (fsm_loader_ref_t *)scratch;
+    loader.targets = &loader.sources[loader.transition_nr];
+    loader.state_hash = (uint32_t *)&loader.targets[loader.transition_nr];
+    loader.state_hash_mask = state_hash_size - 1;
+    loader.symbol_hash = &loader.state_hash[state_hash_size];
+    loader.symbol_hash_mask = symbol_hash_size - 1;
+    loader.string_pos = loader.def->strings;
+
+    /* Hash of the symbols: the first symbol wins in case of duplicated names */
+    for (cntr = 0; cntr < loader.symbol_nr; cntr++)
+    {
+        uint32_t len_symbol = (uint32_t)strlen(symbols[cntr].name);
+        uint32_t slot = state_machine_loader_hash(symbols[cntr].name, len_symbol) & loader.symbol_hash_mask;
+
+        while ((loader.symbol_hash[slot] != 0) &&
+               (strcmp(symbols[loader.symbol_hash[slot] - 1].name, symbols[cntr].name) != 0))
+        {
+            slot = (slot + 1) & loader.symbol_hash_mask;
+        }
+
+        if (loader.symbol_hash[slot] == 0)
+        {
+            loader.symbol_hash[slot] = cntr + 1;
+        }
+    }
+
+    /* Second pass: fill the definition */
+    if ((state_machine_loader_parse(&loader) == false) || (state_machine_loader_link(&loader) == false))
+    {
+        state_machine_def_free(loader.def);
+        free(scratch);
+        return(NULL);
+    }
+
+    free(scratch);
+
+    /* A callback name has a single signature in the generated code */
+    if (state_machine_def_check_callbacks(loader.def, &cntr) == false)
+    {
+        if (cntr < loader.def->state_nr)
+        {
+            state_machine_loader_error(&loader, 0, 0, "state '%s': callback used both as run and as enter", loader.def->states[cntr].name);
+        }
+        else
+        {
+            state_machine_loader_error(&loader, 0, 0, "out of memory");
+        }
+
+        state_machine_def_free(loader.def);
+        return(NULL);
+    }
+
+    return(loader.def);
+}
+
+
+
+fsm_def_t* state_machine_load_file (const char *path, const fsm_symbol_t *symbols, fsm_load_error_t *error)
+{
+    fsm_def_t *def;
+    FILE *file;
+    char *text;
+    long size;
+    size_t len;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        if (error != NULL)
+        {
+            memset(error, 0, sizeof(fsm_load_error_t));
+            snprintf(error->message, sizeof(error->message), "unable to open the file");
+        }
+        return(NULL);
+    }
+
+    /* Read the whole file */
+    text = NULL;
+    len = 0;
+    if ((fseek(file, 0, SEEK_END) == 0) && ((size = ftell(file)) >= 0) && (fseek(file, 0, SEEK_SET) == 0))
+    {
+        text = (char *)malloc((size_t)size + 1);
+        if (text != NULL)
+        {
+            len = fread(text, 1, (size_t)size, file);
+        }
+    }
+    fclose(file);
+
+    if (text == NULL)
+    {
+        if (error != NULL)
+        {
+            memset(error, 0, sizeof(fsm_load_error_t));
+            snprintf(error->message, sizeof(error->message), "unable to read the file");
+        }
+        return(NULL);
+    }
+
+    def = state_machine_load_string(text, len, symbols, error);
+    free(text);
+
+    return(def);
+}
+
+
+
+static bool state_machine_loader_error (fsm_loader_t *loader, uint32_t line, uint32_t column, const char *format, ...)
+{
+    va_list args;
+
+    if (loader->error != NULL)
+    {
+        loader->error->line = line;
+        loader->error->column = column;
+
+        va_start(args, format);
+        vsnprintf(loader->error->message, sizeof(loader->error->message), format, args);
+        va_end(args);
+    }
+
+    return(false);
+}
+
+
+
+static bool state_machine_loader_parse (fsm_loader_t *loader)
+{
+    const char *pos;
+    const char *end;
+    const char *line_end;
+    const char *comment;
+    uint32_t line;
+
+    pos = loader->text;
+    end = loader->text + loader->len;
+    line = 1;
+
+    while (pos < end)
+    {
+        /* Find the end of the line and strip the comment */
+        line_end = memchr(pos, '\n', (size_t)(end - pos));
+        if (line_end == NULL)
+        {
+            line_end = end;
+        }
+
+        comment = memchr(pos, '#', (size_t)(line_end - pos));
+
+        if (state_machine_loader_parse_line(loader, pos, (comment != NULL) ? comment : line_end, line) == false)
+        {
+            return(false);
+        }
+
+        pos = line_end + 1;
+        line++;
+    }
+
+    return(true);
+}
+
+
+
+static bool state_machine_loader_parse_line (fsm_loader_t *loader, const char *start, const char *end, uint32_t line)
+{
+    fsm_loader_ref_t refs[3];
+    fsm_loader_ref_t *callback;
+    const char *pos;
+    const char *token;
+    uint32_t len;
+    uint32_t cntr;
+
+    pos = start;
+
+    token = state_machine_loader_token(&pos, end, &len);
+    if (token == NULL)
+    {
+        /* Empty line */
+        return(true);
+    }
+
+    if ((len == 5) && (memcmp(token, "state", 5) == 0))
+    {
+        /* state <name> [run=<callback>] [enter=<callback>] */
+        memset(refs, 0, sizeof(refs));
+
+        token = state_machine_loader_token(&pos, end, &len);
+        if ((token == NULL) || (state_machine_loader_is_name(token, len) == false))
+        {
+            return(state_machine_loader_error(loader, line, (uint32_t)((token ? token : end) - start) + 1,
+                                              "expected the name of the state"));
+        }
+        refs[0].name = token;
+        refs[0].len = len;
+        refs[0].line = line;
+        refs[0].column = (uint32_t)(token - start) + 1;
+
+        while ((token = state_machine_loader_token(&pos, end, &len)) != NULL)
+        {
+            if ((len > 4) && (memcmp(token, "run=", 4) == 0))
+            {
+                callback = &refs[1];
+                cntr = 4;
+            }
+            else if ((len > 6) && (memcmp(token, "enter=", 6) == 0))
+            {
+                callback = &refs[2];
+                cntr = 6;
+            }
+            else
+            {
+                return(state_machine_loader_error(loader, line, (uint32_t)(token - start) + 1,
+                                                  "unexpected '%.*s', expected run=<callback> or enter=<callback>", (int)len, token));
+            }
+
+            if (callback->name != NULL)
+            {
+                return(state_machine_loader_error(loader, line, (uint32_t)(token - start) + 1, "callback already set"));
+            }
+
+            if (state_machine_loader_is_name(token + cntr, len - cntr) == false)
+            {
+                return(state_machine_loader_error(loader, line, (uint32_t)(token - start) + cntr + 1,
+                                                  "invalid callback name '%.*s'", (int)(len - cntr), token + cntr));
+            }
+
+            callback->name = token + cntr;
+            callback->len = len - cntr;
+            callback->line = line;
+            callback->column = (uint32_t)(token - start) + cntr + 1;
+        }
+
+        if (loader->def == NULL)
+        {
+            loader->state_nr++;
+            for (cntr = 0; cntr < 3; cntr++)
+            {
+                loader->string_size += (refs[cntr].name != NULL) ? (refs[cntr].len + 1) : 0;
+            }
+
+            return(true);
+        }
+
+        return(state_machine_loader_add_state(loader, &refs[0], &refs[1], &refs[2]));
+    }
+
+    if ((len == 7) && (memcmp(token, "initial", 7) == 0))
+    {
+        /* initial <name> */
+        token = state_machine_loader_token(&pos, end, &len);
+        if ((token == NULL) || (state_machine_loader_is_name(token, len) == false))
+        {
+            return(state_machine_loader_error(loader, line, (uint32_t)((token ? token : end) - start) + 1,
+                                              "expected the name of the initial state"));
+        }
+
+        if ((loader->def == NULL) && (loader->initial_found == true))
+        {
+            return(state_machine_loader_error(loader, line, 1, "initial state already declared"));
+        }
+
+        loader->initial_found = true;
+        loader->initial.name = token;
+        loader->initial.len = len;
+        loader->initial.line = line;
+        loader->initial.column = (uint32_t)(token - start) + 1;
+
+        token = state_machine_loader_token(&pos, end, &len);
+        if (token != NULL)
+        {
+            return(state_machine_loader_error(loader, line, (uint32_t)(token - start) + 1,
+                                              "unexpected '%.*s'", (int)len, token));
+        }
+
+        return(true);
+    }
+
+    if ((len == 10) && (memcmp(token, "transition", 10) == 0))
+    {
+        /* transition <name> -> <target> [<target> ...] */
+        token = state_machine_loader_token(&pos, end, &len);
+        if ((token == NULL) || (state_machine_loader_is_name(token, len) == false))
+        {
+            return(state_machine_loader_error(loader, line, (uint32_t)((token ? token : end) - start) + 1,
+                                              "expected the starting state of the transition"));
+        }
+        refs[0].name = token;
+        refs[0].len = len;
+        refs[0].line = line;
+        refs[0].column = (uint32_t)(token - start) + 1;
+
+        token = state_machine_loader_token(&pos, end, &len);
+        if ((token == NULL) || (len != 2) || (memcmp(token, "->", 2) != 0))
+        {
+            return(state_machine_loader_error(loader, line, (uint32_t)((token ? token : end) - start) + 1, "expected '->'"));
+        }
+
+        cntr = 0;
+        while ((token = state_machine_loader_token(&pos, end, &len)) != NULL)
+        {
+            if (state_machine_loader_is_name(token, len) == false)
+            {
+                return(state_machine_loader_error(loader, line, (uint32_t)(token - start) + 1,
+                                                  "invalid state name '%.*s'", (int)len, token));
+            }
+
+            if (loader->def != NULL)
+            {
+                loader->sources[loader->transition_cntr] = refs[0];
+                loader->targets[loader->transition_cntr].name = token;
+                loader->targets[loader->transition_cntr].len = len;
+                loader->targets[loader->transition_cntr].line = line;
+                loader->targets[loader->transition_cntr].column = (uint32_t)(token - start) + 1;
+                loader->transition_cntr++;
+            }
+            else
+            {
+                loader->transition_nr++;
+            }
+
+            cntr++;
+        }
+
+        if (cntr == 0)
+        {
+            return(state_machine_loader_error(loader, line, (uint32_t)(end - start) + 1, "expected the target state of the transition"));
+        }
+
+        return(true);
+    }
+
+    return(state_machine_loader_error(loader, line, (uint32_t)(token - start) + 1,
+                                      "unknown keyword '%.*s'", (int)len, token));
+}
+
+
+
+static const char* state_machine_loader_token (const char **pos, const char *end, uint32_t *len)
+{
+    const char *token;
+    const char *cursor;
+
+    cursor = *pos;
+
+    /* Skip the blanks */
+    while ((cursor < end) && ((*cursor == ' ') || (*cursor == '\t') || (*cursor == '\r')))
+    {
+        cursor++;
+    }
+
+    if (cursor >= end)
+    {
+        *pos = end;
+        return(NULL);
+    }
+
+    token = cursor;
+    while ((cursor < end) && (*cursor != ' ') && (*cursor != '\t') && (*cursor != '\r'))
+    {
+        cursor++;
+    }
+
+    *len = (uint32_t)(cursor - token);
+    *pos = cursor;
+
+    return(token);
+}
+
+
+
+static bool state_machine_loader_is_name (const char *token, uint32_t len)
+{
+    uint32_t cntr;
+    char c;
+
+    if (len == 0)
+    {
+        return(false);
+    }
+
+    for (cntr = 0; cntr < len; cntr++)
+    {
+        c = token[cntr];
+
+        if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_'))
+        {
+            continue;
+        }
+
+        if ((c >= '0') && (c <= '9') && (cntr > 0))
+        {
+            continue;
+        }
+
+        return(false);
+    }
+
+    return(true);
+}
+
+
+
+static bool state_machine_loader_add_state (fsm_loader_t *loader, const fsm_loader_ref_t *name, const fsm_loader_ref_t *run, const fsm_loader_ref_t *enter)
+{
+    fsm_def_state_t *state;
+    uint32_t slot;
+    uint32_t id;
+
+    id = loader->state_cntr;
+    state = &loader->def->states[id];
+
+    /* Insert the name in the hash table */
+    slot = state_machine_loader_hash(name->name, name->len) & loader->state_hash_mask;
+    while (loader->state_hash[slot] != 0)
+    {
+        const char *other = loader->def->states[loader->state_hash[slot] - 1].name;
+
+        if ((strncmp(other, name->name, name->len) == 0) && (other[name->len] == '\0'))
+        {
+            return(state_machine_loader_error(loader, name->line, name->column,
+                                              "state '%.*s' already declared", (int)name->len, name->name));
+        }
+
+        slot = (slot + 1) & loader->state_hash_mask;
+    }
+
+    state->name = state_machine_loader_copy(loader, name);
+    loader->state_hash[slot] = id + 1;
+    loader->state_cntr++;
+
+    if ((state_machine_loader_add_callback(loader, state, run, false) == false) ||
+        (state_machine_loader_add_callback(loader, state, enter, true) == false))
+    {
+        return(false);
+    }
+
+    return(true);
+}
+
+
+
+static bool state_machine_loader_add_callback (fsm_loader_t *loader, fsm_def_state_t *state, const fsm_loader_ref_t *ref, bool enter)
+{
+    const fsm_symbol_t *symbol;
+    uint32_t slot;
+
+    if (ref->name == NULL)
+    {
+        return(true);
+    }
+
+    if (enter == true)
+    {
+        state->enter_name = state_machine_loader_copy(loader, ref);
+    }
+    else
+    {
+        state->run_name = state_machine_loader_copy(loader, ref);
+    }
+
+    /* Callbacks are resolved only if the list of symbols is available */
+    if (loader->symbols == NULL)
+    {
+        return(true);
+    }
+
+    symbol = NULL;
+    slot = state_machine_loader_hash(ref->name, ref->len) & loader->symbol_hash_mask;
+    while (loader->symbol_hash[slot] != 0)
+    {
+        symbol = &loader->symbols[loader->symbol_hash[slot] - 1];
+
+        if ((strncmp(symbol->name, ref->name, ref->len) == 0) && (symbol->name[ref->len] == '\0'))
+        {
+            break;
+        }
+
+        symbol = NULL;
+        slot = (slot + 1) & loader->symbol_hash_mask;
+    }
+
+    if ((symbol == NULL) || ((enter == true) && (symbol->enter == NULL)) || ((enter == false) && (symbol->run == NULL)))
+    {
+        return(state_machine_loader_error(loader, ref->line, ref->column, "unknown %s callback '%.*s'",
+                                          (enter == true) ? "enter" : "run", (int)ref->len, ref->name));
+    }
+
+    if (enter == true)
+    {
+        state->enter = symbol->enter;
+    }
+    else
+    {
+        state->run = symbol->run;
+    }
+
+    return(true);
+}
+
+
+
+static const char* state_machine_loader_copy (fsm_loader_t *loader, const fsm_loader_ref_t *ref)
+{
+    char *copy;
+
+    copy = loader->string_pos;
+    memcpy(copy, ref->name, ref->len);
+    copy[ref->len] = '\0';
+    loader->string_pos += ref->len + 1;
+
+    return(copy);
+}
+
+
+
+static uint32_t state_machine_loader_hash (const char *name, uint32_t len)
+{
+    uint32_t hash;
+    uint32_t cntr;
+
+    hash = 2166136261u;
+    for (cntr = 0; cntr < len; cntr++)
+    {
+        hash ^= (uint8_t)name[cntr];
+        hash *= 16777619u;
+    }
+
+    return(hash);
+}
+
+
+
+static uint32_t state_machine_loader_find_state (fsm_loader_t *loader, const fsm_loader_ref_t *ref)
+{
+    const char *other;
+    uint32_t slot;
+
+    slot = state_machine_loader_hash(ref->name, ref->len) & loader->state_hash_mask;
+    while (loader->state_hash[slot] != 0)
+    {
+        other = loader->def->states[loader->state_hash[slot] - 1].name;
+
+        if ((strncmp(other, ref->name, ref->len) == 0) && (other[ref->len] == '\0'))
+        {
+            return(loader->state_hash[slot] - 1);
+        }
+
+        slot = (slot + 1) & loader->state_hash_mask;
+    }
+
+    return(loader->def->state_nr);
+}
+
+
+
+static bool state_machine_loader_link (fsm_loader_t *loader)
+{
+    fsm_def_t *def;
+    fsm_def_state_t *state;
+    uint32_t cntr;
+    uint32_t id;
+    uint32_t first;
+    uint32_t pos;
+    uint32_t nr;
+
+    def = loader->def;
+
+    /* Resolve the initial state */
+    if (loader->initial_found == true)
+    {
+        def->initial_state = state_machine_loader_find_state(loader, &loader->initial);
+        if (def->initial_state >= def->state_nr)
+        {
+            return(state_machine_loader_error(loader, loader->initial.line, loader->initial.column,
+                                              "unknown state '%.*s'", (int)loader->initial.len, loader->initial.name));
+        }
+    }
+
+    /* Resolve the transitions: the IDs of the states replace the length of the names */
+    for (cntr = 0; cntr < loader->transition_nr; cntr++)
+    {
+        id = state_machine_loader_find_state(loader, &loader->sources[cntr]);
+        if (id >= def->state_nr)
+        {
+            return(state_machine_loader_error(loader, loader->sources[cntr].line, loader->sources[cntr].column, "unknown state '%.*s'",
+                                              (int)loader->sources[cntr].len, loader->sources[cntr].name));
+        }
+        loader->sources[cntr].len = id;
+
+        id = state_machine_loader_find_state(loader, &loader->targets[cntr]);
+        if (id >= def->state_nr)
+        {
+            return(state_machine_loader_error(loader, loader->targets[cntr].line, loader->targets[cntr].column, "unknown state '%.*s'",
+                                              (int)loader->targets[cntr].len, loader->targets[cntr].name));
+        }
+        loader->targets[cntr].len = id;
+    }
+
+    /* Count the transitions of each state and compute the first target of each row */
+    for (cntr = 0; cntr < loader->transition_nr; cntr++)
+    {
+        def->states[loader->sources[cntr].len].target_nr++;
+    }
+
+    pos = 0;
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        def->states[cntr].first_target = pos;
+        pos += def->states[cntr].target_nr;
+        def->states[cntr].target_nr = 0;
+    }
+
+    /* Fill the rows */
+    for (cntr = 0; cntr < loader->transition_nr; cntr++)
+    {
+        state = &def->states[loader->sources[cntr].len];
+        def->targets[state->first_target + state->target_nr] = loader->targets[cntr].len;
+        state->target_nr++;
+    }
+
+    /* Sort the rows and remove the duplicated transitions */
+    pos = 0;
+    for (cntr = 0; cntr < def->state_nr; cntr++)
+    {
+        state = &def->states[cntr];
+        first = state->first_target;
+
+        qsort(&def->targets[first], state->target_nr, sizeof(uint32_t), state_machine_loader_compare);
+
+        nr = 0;
+        for (id = 0; id < state->target_nr; id++)
+        {
+            if ((nr == 0) || (def->targets[pos + nr - 1] != def->targets[first + id]))
+            {
+                def->targets[pos + nr] = def->targets[first + id];
+                nr++;
+            }
+        }
+
+        state->first_target = pos;
+        state->target_nr = nr;
+        pos += nr;
+    }
+
+    def->transition_nr = pos;
+
+    return(true);
+}
+
+
+
+static int state_machine_loader_compare (const void *a, const void *b)
+{
+    uint32_t first = *(const uint32_t *)a;
+    uint32_t second = *(const uint32_t *)b;
+
+    return((first > second) - (first < second));
+}
@@ -0,0 +1,86 @@
+/**
+ * @file state_machine_loader.h
+ * @brief Loader of state machine definitions written in a text file.
+ *
+ * The file is made of lines with the following format (empty lines and the text
+ * after a '#' are ignored):
+ *
+ *     state <name> [run=<callback>] [enter=<callback>]
+ *     initial <name>
+ *     transition <name> -> <target> [<target> ...]
+ *
+ * The IDs of the states follow the order of declaration. States can be used by
+ * transitions before their declaration. If "initial" is missing, the first state
+ * is the initial one.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_LOADER_H
+#define STATE_MACHINE_LOADER_H
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @typedef fsm_symbol_t
+ * @brief Data type used to bind the name of a callback to its function.
+ */
+typedef struct _fsm_symbol_t fsm_symbol_t;
+
+/**
+ * @typedef fsm_load_error_t
+ * @brief Data type used to report the errors found by the loader.
+ */
+typedef struct _fsm_load_error_t fsm_load_error_t;
+
+
+
+/**
+ * @struct _fsm_symbol_t
+ * @brief A callback that can be referenced by a definition.
+ * INFO: Arrays of symbols are terminated by an item with "name" set to NULL.
+ */
+struct _fsm_symbol_t {
+    const char *name;           /**< Name of the callback */
+    fsm_state_run_t run;        /**< Function used when the symbol is a "run" callback */
+    fsm_state_enter_t enter;    /**< Function used when the symbol is an "enter" callback */
+};
+
+/**
+ * @struct _fsm_load_error_t
+ * @brief Description of a loading error.
+ */
+struct _fsm_load_error_t {
+    uint32_t line;              /**< Line of the error (starting from 1, 0 if not related to a line) */
+    uint32_t column;            /**< Column of the error (starting from 1) */
+    char message[96];           /**< Description of the error */
+};
+
+
+
+/**
+ * @fn state_machine_load_string
+ * @brief Create a definition from the given text.
+ * @param text The text of the definition.
+ * @param len Length of the text.
+ * @param symbols List of the available callbacks. If NULL, the names of the callbacks
+ * are stored but the functions are not resolved.
+ * @param error Optional pointer filled with the description of the error.
+ * @return The new definition (see "state_machine_def_free"), NULL if an error occurred.
+ * INFO: A callback name can not be used both as "run" and as "enter" callback, even if its
+ * symbol provides both functions (see "state_machine_def_check_callbacks").
+ */
+fsm_def_t* state_machine_load_string (const char *text, size_t len, const fsm_symbol_t *symbols, fsm_load_error_t *error);
+
+/**
+ * @fn state_machine_load_file
+ * @brief Create a definition from the given file.
+ * See "state_machine_load_string" for details.
+ */
+fsm_def_t* state_machine_load_file (const char *path, const fsm_symbol_t *symbols, fsm_load_error_t *error);
+
+
+
+#endif
@@ -0,0 +1,363 @@
+/**
+ * @file state_machine_loop.c
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "state_machine_loop.h"
+
+
+
+/**
+ * @struct _fsm_loop_binding_t
+ * @brief See "fsm_loop_binding_t" for details.
+ */
+struct _fsm_loop_binding_t {
+    fsm_hook_link_t link;       /**< Hook set before the bind (first field, see "state_machine_hook_link") */
+    fsm_loop_t *loop;           /**< The event loop */
+    fsm_t *fsm;                 /**< The state machine */
+    int fd;                     /**< The file descriptor */
+    const fsm_loop_interest_t *interest;    /**< Interest of every state */
+    void *arg;                  /**< Parameter passed to "sm_run" */
+
+    uint32_t registered;        /**< Events registered in epoll (0 if the descriptor is not registered) */
+    uint32_t ready;             /**< Events collected during the current batch */
+    uint64_t batch;             /**< Last batch that woke the state machine */
+    bool stale;                 /**< true if the registration could not be updated (retried by the next run) */
+    bool parked;                /**< true if the update failed for good (retried only by "state_machine_loop_rearm" and the transitions) */
+    fsm_loop_binding_t *next_stale; /**< Next binding of the list of the stale ones */
+};
+
+/**
+ * @struct _fsm_loop_t
+ * @brief See "fsm_loop_t" for details.
+ */
+struct _fsm_loop_t {
+    int epoll_fd;               /**< The epoll instance */
+    uint32_t batch_size;        /**< Maximum number of events of a batch */
+    uint64_t batch;             /**< Counter of the batches */
+
+    struct epoll_event *events; /**< Events of the current batch */
+    fsm_loop_binding_t **woken; /**< State machines woken by the current batch */
+    fsm_loop_binding_t *stale;  /**< Bindings whose registration could not be updated */
+    uint64_t errors;            /**< Number of updates of the registrations that failed */
+};
+
+
+
+/**
+ * @fn state_machine_loop_update
+ * @brief Align the events registered in epoll with the interest of the actual state.
+ * @return true if the registration is updated, false if an error occurred.
+ */
+static bool state_machine_loop_update (fsm_loop_t *loop, fsm_loop_binding_t *binding);
+
+/**
+ * @fn state_machine_loop_sync
+ * @brief Update the registration of a binding, adding it to the stale ones if the update fails
+ * for a temporary reason (e.g. ENOMEM) or parking it if the failure is permanent (e.g. EBADF
+ * after the descriptor was closed).
+ * @return true if the registration is updated, false if an error occurred.
+ */
+static bool state_machine_loop_sync (fsm_loop_t *loop, fsm_loop_binding_t *binding);
+
+/**
+ * @fn state_machine_loop_hook
+ * @brief Hook of the bound state machines: it updates the registration to the interest of the
+ * new state (whoever requested the transition) and calls the hook set before the bind.
+ */
+static void state_machine_loop_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+
+
+fsm_loop_t* state_machine_loop_create (uint32_t batch_size)
+{
+    fsm_loop_t *loop;
+
+    if (batch_size == 0)
+    {
+        return(NULL);
+    }
+
+    loop = (fsm_loop_t *)calloc(1, sizeof(fsm_loop_t));
+    if (loop == NULL)
+    {
+        return(NULL);
+    }
+
+    loop->batch_size = batch_size;
+    loop->events = (struct epoll_event *)calloc(batch_size, sizeof(struct epoll_event));
+    loop->woken = (fsm_loop_binding_t **)calloc(batch_size, sizeof(fsm_loop_binding_t *));
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if ((loop->events == NULL) || (loop->woken == NULL) || (loop->epoll_fd < 0))
+    {
+        state_machine_loop_destroy(loop);
+        return(NULL);
+    }
+
+    return(loop);
+}
+
+
+
+void state_machine_loop_destroy (fsm_loop_t *loop)
+{
+    if (loop == NULL)
+    {
+        return;
+    }
+
+    if (loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+    }
+
+    free(loop->events);
+    free(loop->woken);
+    free(loop);
+}
+
+
+
+int state_machine_loop_fd (const fsm_loop_t *loop)
+{
+    return(loop->epoll_fd);
+}
+
+
+
+fsm_loop_binding_t* state_machine_loop_bind (fsm_loop_t *loop, fsm_t *fsm, int fd, const fsm_loop_interest_t *interest, void *arg)
+{
+    fsm_loop_binding_t *binding;
+
+    if ((loop == NULL) || (fsm == NULL) || (fd < 0) || (interest == NULL))
+    {
+        return(NULL);
+    }
+
+    binding = (fsm_loop_binding_t *)calloc(1, sizeof(fsm_loop_binding_t));
+    if (binding == NULL)
+    {
+        return(NULL);
+    }
+
+    binding->loop = loop;
+    binding->fsm = fsm;
+    binding->fd = fd;
+    binding->interest = interest;
+    binding->arg = arg;
+
+    if (state_machine_loop_update(loop, binding) == false)
+    {
+        free(binding);
+        return(NULL);
+    }
+
+    state_machine_hook_link(fsm, state_machine_loop_hook, &binding->link);
+
+    return(binding);
+}
+
+
+
+void state_machine_loop_unbind (fsm_loop_t *loop, fsm_loop_binding_t *binding)
+{
+    fsm_loop_binding_t **link;
+
+    if (binding == NULL)
+    {
+        return;
+    }
+
+    state_machine_hook_unlink(binding->fsm, state_machine_loop_hook, &binding->link);
+
+    if (binding->stale == true)
+    {
+        for (link = &loop->stale; *link != binding; link = &(*link)->next_stale)
+        {
+        }
+
+        *link = binding->next_stale;
+    }
+
+    if (binding->registered != 0)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, binding->fd, NULL);
+    }
+
+    free(binding);
+}
+
+
+
+bool state_machine_loop_rearm (fsm_loop_t *loop, fsm_loop_binding_t *binding)
+{
+    return(state_machine_loop_sync(loop, binding));
+}
+
+
+
+bool state_machine_loop_is_parked (const fsm_loop_binding_t *binding)
+{
+    return(binding->parked);
+}
+
+
+
+uint64_t state_machine_loop_errors (const fsm_loop_t *loop)
+{
+    return(loop->errors);
+}
+
+
+
+int state_machine_loop_run (fsm_loop_t *loop, int timeout_ms)
+{
+    fsm_loop_binding_t *binding;
+    const fsm_loop_interest_t *interest;
+    fsm_loop_binding_t *stale;
+    uint32_t woken_nr;
+    int event_nr;
+    int cntr;
+
+    /* Retry the registrations that failed before (once per run: the failures are queued again) */
+    stale = loop->stale;
+    loop->stale = NULL;
+
+    while (stale != NULL)
+    {
+        binding = stale;
+        stale = binding->next_stale;
+        binding->stale = false;
+
+        state_machine_loop_sync(loop, binding);
+    }
+
+    event_nr = epoll_wait(loop->epoll_fd, loop->events, (int)loop->batch_size, timeout_ms);
+    if (event_nr < 0)
+    {
+        return(-1);
+    }
+
+    loop->batch++;
+
+    /* Collect the events of every state machine (a machine is run once per batch) */
+    woken_nr = 0;
+    for (cntr = 0; cntr < event_nr; cntr++)
+    {
+        binding = (fsm_loop_binding_t *)loop->events[cntr].data.ptr;
+
+        if (binding->batch != loop->batch)
+        {
+            binding->batch = loop->batch;
+            binding->ready = 0;
+            loop->woken[woken_nr++] = binding;
+        }
+
+        binding->ready |= loop->events[cntr].events;
+    }
+
+    /* Translate the events into transitions and run the state machines */
+    for (cntr = 0; cntr < (int)woken_nr; cntr++)
+    {
+        binding = loop->woken[cntr];
+        interest = &binding->interest[binding->fsm->get_state(binding->fsm)];
+
+        if ((binding->ready & interest->events) != 0)
+        {
+            if (interest->target_state != binding->fsm->get_state(binding->fsm))
+            {
+                binding->fsm->go_to_state(binding->fsm, interest->target_state);
+            }
+
+            binding->fsm->sm_run(binding->fsm, binding->arg);
+        }
+
+        /* The hook updates the registration, unless the state was restored without transition */
+        state_machine_loop_sync(loop, binding);
+    }
+
+    return((int)woken_nr);
+}
+
+
+
+static bool state_machine_loop_update (fsm_loop_t *loop, fsm_loop_binding_t *binding)
+{
+    struct epoll_event event;
+    uint32_t events;
+    int op;
+
+    events = binding->interest[binding->fsm->get_state(binding->fsm)].events;
+    if (events == binding->registered)
+    {
+        return(true);
+    }
+
+    /* Descriptors without interest are removed, so errors and hang-ups do not wake the machine */
+    if (events == 0)
+    {
+        op = EPOLL_CTL_DEL;
+    }
+    else
+    {
+        op = (binding->registered == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    }
+
+    event.events = events;
+    event.data.ptr = binding;
+
+    if (epoll_ctl(loop->epoll_fd, op, binding->fd, &event) != 0)
+    {
+        return(false);
+    }
+
+    binding->registered = events;
+
+    return(true);
+}
+
+
+
+static bool state_machine_loop_sync (fsm_loop_t *loop, fsm_loop_binding_t *binding)
+{
+    if (state_machine_loop_update(loop, binding) == true)
+    {
+        binding->parked = false;
+        return(true);
+    }
+
+    loop->errors++;
+
+    /* A descriptor closed or not supported fails for good: it is not retried by every run */
+    if ((errno != ENOMEM) && (errno != ENOSPC))
+    {
+        binding->parked = true;
+    }
+    else if (binding->stale == false)
+    {
+        binding->stale = true;
+        binding->next_stale = loop->stale;
+        loop->stale = binding;
+    }
+
+    return(false);
+}
+
+
+
+static void state_machine_loop_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data)
+{
+    fsm_loop_binding_t *binding = (fsm_loop_binding_t *)data;
+
+    state_machine_loop_sync(binding->loop, binding);
+
+    if (binding->link.on_transition != NULL)
+    {
+        binding->link.on_transition(fsm, exit_state_id, enter_state_id, binding->link.hook_data);
+    }
+}
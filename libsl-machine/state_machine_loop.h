@@ -0,0 +1,134 @@
+/**
+ * @file state_machine_loop.h
+ * @brief Event loop that drives state machines with the readiness of file descriptors.
+ *
+ * A file descriptor is bound to a state machine together with an interest table that
+ * says, for every state, which events (e.g. EPOLLIN, EPOLLOUT) are expected and which
+ * transition they trigger. The loop waits on a single epoll instance and, for every
+ * batch of events, requests the transitions of the woken machines and runs each of
+ * them once. Machines whose descriptors are not ready are never touched. The registration
+ * follows the transitions of the machines, also the ones requested outside the loop.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_LOOP_H
+#define STATE_MACHINE_LOOP_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @typedef fsm_loop_t
+ * @brief Data type used to handle an event loop.
+ */
+typedef struct _fsm_loop_t fsm_loop_t;
+
+/**
+ * @typedef fsm_loop_binding_t
+ * @brief Data type used to handle the binding between a file descriptor and a state machine.
+ */
+typedef struct _fsm_loop_binding_t fsm_loop_binding_t;
+
+/**
+ * @typedef fsm_loop_interest_t
+ * @brief Data type used to describe the interest of a state in the events of a file descriptor.
+ */
+typedef struct _fsm_loop_interest_t fsm_loop_interest_t;
+
+
+
+/**
+ * @struct _fsm_loop_interest_t
+ * @brief Interest of a state in the events of a file descriptor.
+ */
+struct _fsm_loop_interest_t {
+    uint32_t events;            /**< Events expected in the state (epoll flags, 0 if none) */
+    uint32_t target_state;      /**< State required when the events fire (the state itself to run it) */
+};
+
+
+
+/**
+ * @fn state_machine_loop_create
+ * @brief Create a new event loop.
+ * @param batch_size Maximum number of events handled by a single wait.
+ * @return The new event loop, NULL if an error occurred.
+ */
+fsm_loop_t* state_machine_loop_create (uint32_t batch_size);
+
+/**
+ * @fn state_machine_loop_destroy
+ * @brief Release the event loop.
+ * WARNING: All the bindings must be removed first (file descriptors and state machines are not closed).
+ */
+void state_machine_loop_destroy (fsm_loop_t *loop);
+
+/**
+ * @fn state_machine_loop_fd
+ * @brief Get the epoll file descriptor of the loop (e.g. to nest it into another loop).
+ */
+int state_machine_loop_fd (const fsm_loop_t *loop);
+
+/**
+ * @fn state_machine_loop_bind
+ * @brief Bind a file descriptor to a state machine.
+ * A hook is linked to the state machine (see "state_machine_hook_link"), so the events
+ * registered follow the transitions executed by any caller.
+ * @param loop The event loop.
+ * @param fsm The state machine.
+ * @param fd The file descriptor.
+ * @param interest Interest of every state of the state machine ("state_nr" items). The table
+ * is not copied and must be valid until the binding is removed.
+ * @param arg Parameter passed to "sm_run".
+ * @return The binding, NULL if an error occurred.
+ */
+fsm_loop_binding_t* state_machine_loop_bind (fsm_loop_t *loop, fsm_t *fsm, int fd, const fsm_loop_interest_t *interest, void *arg);
+
+/**
+ * @fn state_machine_loop_unbind
+ * @brief Remove a binding.
+ * WARNING: It must not be called by the callbacks of the state machines during "state_machine_loop_run".
+ */
+void state_machine_loop_unbind (fsm_loop_t *loop, fsm_loop_binding_t *binding);
+
+/**
+ * @fn state_machine_loop_rearm
+ * @brief Align the registration of a binding with the actual state of its state machine.
+ * Example: It is needed after "state_machine_restore_state" (no hook is called).
+ * INFO: It retries also the parked bindings (see "state_machine_loop_is_parked").
+ * @return true if the registration is updated, false if "epoll_ctl" failed (retried by "state_machine_loop_run"
+ * if the error is temporary, e.g. ENOMEM, see "errno").
+ */
+bool state_machine_loop_rearm (fsm_loop_t *loop, fsm_loop_binding_t *binding);
+
+/**
+ * @fn state_machine_loop_is_parked
+ * @brief Check if the registration of a binding failed for good (e.g. EBADF or ENOENT after the
+ * descriptor was closed). A parked binding is not retried by "state_machine_loop_run", only by
+ * "state_machine_loop_rearm" and by the transitions of its state machine.
+ */
+bool state_machine_loop_is_parked (const fsm_loop_binding_t *binding);
+
+/**
+ * @fn state_machine_loop_errors
+ * @brief Get the number of updates of the registrations that failed (the failures do not stop "state_machine_loop_run").
+ */
+uint64_t state_machine_loop_errors (const fsm_loop_t *loop);
+
+/**
+ * @fn state_machine_loop_run
+ * @brief Wait for events and dispatch them to the state machines.
+ * The registrations that could not be updated before for a temporary reason are retried
+ * first (once per run). The updates that fail do not stop the run: they are counted by
+ * "state_machine_loop_errors", so a broken binding does not starve the other ones.
+ * @param loop The event loop.
+ * @param timeout_ms Maximum wait in milliseconds (-1 to wait forever, 0 to poll).
+ * @return The number of state machines run, -1 if the wait failed (see "errno").
+ */
+int state_machine_loop_run (fsm_loop_t *loop, int timeout_ms);
+
+
+
+#endif
@@ -0,0 +1,514 @@
+/**
+ * @file state_machine_network.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_machine_network.h"
+
+
+
+/**
+ * @def STATE_MACHINE_NETWORK_NONE
+ * @brief Worker of the threads that are not running a worker.
+ */
+#define STATE_MACHINE_NETWORK_NONE      0xFFFFFFFF
+
+
+
+/**
+ * @typedef fsm_message_t
+ * @brief Message between state machines.
+ */
+typedef struct _fsm_message_t fsm_message_t;
+
+/**
+ * @typedef fsm_network_ring_t
+ * @brief Ring with a single producer and a single consumer.
+ */
+typedef struct _fsm_network_ring_t fsm_network_ring_t;
+
+/**
+ * @typedef fsm_network_outbox_t
+ * @brief Messages collected by a worker for another one.
+ */
+typedef struct _fsm_network_outbox_t fsm_network_outbox_t;
+
+/**
+ * @typedef fsm_network_worker_t
+ * @brief Rings and batches of a worker.
+ */
+typedef struct _fsm_network_worker_t fsm_network_worker_t;
+
+/**
+ * @typedef fsm_network_group_t
+ * @brief Group of state machines.
+ */
+typedef struct _fsm_network_group_t fsm_network_group_t;
+
+/**
+ * @typedef fsm_network_context_t
+ * @brief Delivery in progress in the calling thread.
+ */
+typedef struct _fsm_network_context_t fsm_network_context_t;
+
+/**
+ * @struct _fsm_message_t
+ * @brief See "fsm_message_t" for details.
+ */
+struct _fsm_message_t {
+    fsm_address_t to;           /**< The destination */
+    fsm_address_t from;         /**< The sender ("STATE_MACHINE_ADDRESS_NONE" if not a state machine) */
+    uint32_t target_id;         /**< The transition required */
+};
+
+/**
+ * @struct _fsm_network_ring_t
+ * @brief See "fsm_network_ring_t" for details.
+ * INFO: The two counters are on different cache lines, so producer and consumer do not
+ * write the same line.
+ */
+struct _fsm_network_ring_t {
+    uint64_t tail;              /**< Number of messages written (written by the producer) */
+    char tail_pad[STATE_MACHINE_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t head;              /**< Number of messages read (written by the consumer) */
+    char head_pad[STATE_MACHINE_CACHE_LINE - sizeof(uint64_t)];
+};
+
+/**
+ * @struct _fsm_network_outbox_t
+ * @brief See "fsm_network_outbox_t" for details.
+ */
+struct _fsm_network_outbox_t {
+    uint32_t count;             /**< Number of messages */
+    fsm_message_t messages[STATE_MACHINE_NETWORK_BATCH];    /**< The messages */
+};
+
+/**
+ * @struct _fsm_network_worker_t
+ * @brief See "fsm_network_worker_t" for details.
+ */
+struct _fsm_network_worker_t {
+    fsm_network_ring_t *rings;  /**< Rings of the messages received ("worker_nr" + 1 items: one for each
+                                     worker and the last one for the other threads) */
+    fsm_message_t *messages;    /**< Messages of the rings */
+    fsm_network_outbox_t *outboxes;     /**< Messages sent to every worker */
+    pthread_mutex_t lock;       /**< Lock of the ring of the other threads */
+    uint64_t rejected;          /**< Number of messages not accepted */
+};
+
+/**
+ * @struct _fsm_network_group_t
+ * @brief See "fsm_network_group_t" for details.
+ */
+struct _fsm_network_group_t {
+    fsm_t *const *fsms;         /**< The state machines */
+    uint32_t count;             /**< Number of state machines */
+};
+
+/**
+ * @struct _fsm_network_t
+ * @brief See "fsm_network_t" for details.
+ */
+struct _fsm_network_t {
+    uint32_t worker_nr;         /**< Number of workers */
+    uint32_t ring_size;         /**< Number of messages of every ring (power of 2) */
+    fsm_network_worker_t *workers;      /**< The workers */
+    pthread_mutex_t lock;       /**< Lock of the addition of the groups */
+    uint32_t group_max;         /**< Maximum number of groups */
+    uint32_t group_nr;          /**< Number of groups (published after the group) */
+    fsm_network_group_t groups[];       /**< The groups */
+};
+
+/**
+ * @struct _fsm_network_context_t
+ * @brief See "fsm_network_context_t" for details.
+ */
+struct _fsm_network_context_t {
+    fsm_network_t *network;     /**< Network of the worker run (NULL if none) */
+    uint32_t worker;            /**< The worker */
+    fsm_address_t self;         /**< Destination of the message being delivered */
+    fsm_address_t sender;       /**< Sender of the message being delivered */
+};
+
+
+
+/**
+ * @var state_machine_network_context
+ * @brief Delivery in progress in the calling thread.
+ */
+static __thread fsm_network_context_t state_machine_network_context = { NULL, STATE_MACHINE_NETWORK_NONE, STATE_MACHINE_ADDRESS_NONE, STATE_MACHINE_ADDRESS_NONE };
+
+
+
+/**
+ * @fn state_machine_network_push
+ * @brief Write messages to a ring (producer side).
+ * @param network The network.
+ * @param worker The consumer.
+ * @param producer The ring of the consumer.
+ * @param messages The messages.
+ * @param message_nr Number of messages.
+ * @return The number of messages written (they are written in order until the ring is full).
+ */
+static uint32_t state_machine_network_push (fsm_network_t *network, uint32_t worker, uint32_t producer, const fsm_message_t *messages, uint32_t message_nr);
+
+/**
+ * @fn state_machine_network_flush
+ * @brief Publish the batch of a worker for another one.
+ * @return true if the batch was published, false if the ring is full (the messages not published are kept).
+ */
+static bool state_machine_network_flush (fsm_network_t *network, uint32_t worker, uint32_t destination);
+
+/**
+ * @fn state_machine_network_worker_init
+ * @brief Allocate the rings and batches of a worker.
+ * @return true if the worker is ready, false if the memory is not available.
+ */
+static bool state_machine_network_worker_init (fsm_network_t *network, fsm_network_worker_t *worker);
+
+/**
+ * @fn state_machine_network_worker_free
+ * @brief Release the rings and batches of a worker.
+ */
+static void state_machine_network_worker_free (fsm_network_worker_t *worker);
+
+
+
+fsm_network_t* state_machine_network_create (uint32_t worker_nr, uint32_t group_max, uint32_t ring_size)
+{
+    fsm_network_t *network;
+    uint32_t size;
+    uint32_t cntr;
+
+    if ((worker_nr == 0) || (group_max == 0) || (ring_size > 0x80000000))
+    {
+        return(NULL);
+    }
+
+    for (size = STATE_MACHINE_NETWORK_BATCH; size < ring_size; size <<= 1);
+
+    network = (fsm_network_t *)calloc(1, sizeof(fsm_network_t) + group_max * sizeof(fsm_network_group_t));
+    if (network == NULL)
+    {
+        return(NULL);
+    }
+
+    network->worker_nr = worker_nr;
+    network->ring_size = size;
+    network->group_max = group_max;
+
+    network->workers = (fsm_network_worker_t *)calloc(worker_nr, sizeof(fsm_network_worker_t));
+    if ((network->workers == NULL) || (pthread_mutex_init(&network->lock, NULL) != 0))
+    {
+        free(network->workers);
+        free(network);
+        return(NULL);
+    }
+
+    for (cntr = 0; cntr < worker_nr; cntr++)
+    {
+        if (state_machine_network_worker_init(network, &network->workers[cntr]) == false)
+        {
+            network->worker_nr = cntr;
+            state_machine_network_destroy(network);
+            return(NULL);
+        }
+    }
+
+    return(network);
+}
+
+
+
+void state_machine_network_destroy (fsm_network_t *network)
+{
+    uint32_t cntr;
+
+    if (network == NULL)
+    {
+        return;
+    }
+
+    for (cntr = 0; cntr < network->worker_nr; cntr++)
+    {
+        state_machine_network_worker_free(&network->workers[cntr]);
+    }
+
+    pthread_mutex_destroy(&network->lock);
+    free(network->workers);
+    free(network);
+}
+
+
+
+bool state_machine_network_add_group (fsm_network_t *network, fsm_t *const *fsms, uint32_t count, uint32_t *group_id)
+{
+    pthread_mutex_lock(&network->lock);
+
+    if (network->group_nr == network->group_max)
+    {
+        pthread_mutex_unlock(&network->lock);
+        return(false);
+    }
+
+    network->groups[network->group_nr].fsms = fsms;
+    network->groups[network->group_nr].count = count;
+    *group_id = network->group_nr;
+
+    /* The senders see the group only after it is complete */
+    __atomic_store_n(&network->group_nr, network->group_nr + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&network->lock);
+
+    return(true);
+}
+
+
+
+bool state_machine_network_send (fsm_network_t *network, fsm_address_t to, uint32_t target_id)
+{
+    fsm_network_context_t *context = &state_machine_network_context;
+    fsm_network_outbox_t *outbox;
+    fsm_network_worker_t *worker;
+    fsm_message_t message;
+    uint32_t destination;
+    uint32_t group;
+    uint32_t pushed;
+
+    group = (uint32_t)(to >> 32);
+    if ((group >= __atomic_load_n(&network->group_nr, __ATOMIC_ACQUIRE)) || ((uint32_t)to >= network->groups[group].count))
+    {
+        return(false);
+    }
+
+    destination = (uint32_t)to % network->worker_nr;
+
+    message.to = to;
+    message.from = (context->network == network) ? context->self : STATE_MACHINE_ADDRESS_NONE;
+    message.target_id = target_id;
+
+    /* Other threads write the last ring of the destination */
+    if (context->network != network)
+    {
+        worker = &network->workers[destination];
+
+        pthread_mutex_lock(&worker->lock);
+        pushed = state_machine_network_push(network, destination, network->worker_nr, &message, 1);
+        pthread_mutex_unlock(&worker->lock);
+
+        return(pushed == 1);
+    }
+
+    outbox = &network->workers[context->worker].outboxes[destination];
+
+    if ((outbox->count == STATE_MACHINE_NETWORK_BATCH) && (state_machine_network_flush(network, context->worker, destination) == false) &&
+        (outbox->count == STATE_MACHINE_NETWORK_BATCH))
+    {
+        return(false);
+    }
+
+    outbox->messages[outbox->count++] = message;
+
+    return(true);
+}
+
+
+
+uint32_t state_machine_network_run (fsm_network_t *network, uint32_t worker, void *par)
+{
+    fsm_network_context_t *context = &state_machine_network_context;
+    fsm_network_context_t saved;
+    fsm_network_worker_t *owner;
+    fsm_network_ring_t *ring;
+    const fsm_message_t *messages;
+    const fsm_message_t *message;
+    fsm_t *fsm;
+    uint64_t head;
+    uint64_t tail;
+    uint32_t delivered;
+    uint32_t producer;
+    uint32_t cntr;
+
+    if (worker >= network->worker_nr)
+    {
+        return(0);
+    }
+
+    owner = &network->workers[worker];
+
+    saved = *context;
+    context->network = network;
+    context->worker = worker;
+
+    delivered = 0;
+    for (producer = 0; producer <= network->worker_nr; producer++)
+    {
+        ring = &owner->rings[producer];
+        messages = &owner->messages[(size_t)producer * network->ring_size];
+
+        /* The messages sent during the delivery are delivered by the next run */
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        for (head = ring->head; head != tail; head++)
+        {
+            message = &messages[head & (network->ring_size - 1)];
+
+            fsm = network->groups[message->to >> 32].fsms[(uint32_t)message->to];
+
+            context->self = message->to;
+            context->sender = message->from;
+
+            if (fsm->go_to_state(fsm, message->target_id) == true)
+            {
+                fsm->sm_run(fsm, par);
+            }
+            else
+            {
+                __atomic_store_n(&owner->rejected, owner->rejected + 1, __ATOMIC_RELAXED);
+            }
+
+            /* The slot can be reused (e.g. by the messages sent to this worker) */
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+            delivered++;
+        }
+    }
+
+    context->self = STATE_MACHINE_ADDRESS_NONE;
+    context->sender = STATE_MACHINE_ADDRESS_NONE;
+
+    for (cntr = 0; cntr < network->worker_nr; cntr++)
+    {
+        if (owner->outboxes[cntr].count > 0)
+        {
+            state_machine_network_flush(network, worker, cntr);
+        }
+    }
+
+    *context = saved;
+
+    return(delivered);
+}
+
+
+
+fsm_address_t state_machine_network_self (void)
+{
+    return(state_machine_network_context.self);
+}
+
+
+
+fsm_address_t state_machine_network_sender (void)
+{
+    return(state_machine_network_context.sender);
+}
+
+
+
+uint64_t state_machine_network_rejected (const fsm_network_t *network)
+{
+    uint64_t rejected;
+    uint32_t cntr;
+
+    rejected = 0;
+    for (cntr = 0; cntr < network->worker_nr; cntr++)
+    {
+        rejected += __atomic_load_n(&network->workers[cntr].rejected, __ATOMIC_RELAXED);
+    }
+
+    return(rejected);
+}
+
+
+
+static uint32_t state_machine_network_push (fsm_network_t *network, uint32_t worker, uint32_t producer, const fsm_message_t *messages, uint32_t message_nr)
+{
+    fsm_network_ring_t *ring;
+    fsm_message_t *slots;
+    uint64_t head;
+    uint64_t tail;
+    uint32_t cntr;
+
+    ring = &network->workers[worker].rings[producer];
+    slots = &network->workers[worker].messages[(size_t)producer * network->ring_size];
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = ring->tail;
+
+    if (message_nr > network->ring_size - (tail - head))
+    {
+        message_nr = (uint32_t)(network->ring_size - (tail - head));
+    }
+
+    for (cntr = 0; cntr < message_nr; cntr++)
+    {
+        slots[(tail + cntr) & (network->ring_size - 1)] = messages[cntr];
+    }
+
+    /* A single store publishes the whole batch */
+    __atomic_store_n(&ring->tail, tail + message_nr, __ATOMIC_RELEASE);
+
+    return(message_nr);
+}
+
+
+
+static bool state_machine_network_flush (fsm_network_t *network, uint32_t worker, uint32_t destination)
+{
+    fsm_network_outbox_t *outbox;
+    uint32_t pushed;
+
+    outbox = &network->workers[worker].outboxes[destination];
+
+    pushed = state_machine_network_push(network, destination, worker, outbox->messages, outbox->count);
+
+    /* The messages not published are kept in order */
+    if (pushed < outbox->count)
+    {
+        memmove(outbox->messages, &outbox->messages[pushed], (outbox->count - pushed) * sizeof(fsm_message_t));
+    }
+    outbox->count -= pushed;
+
+    return(outbox->count == 0);
+}
+
+
+
+static bool state_machine_network_worker_init (fsm_network_t *network, fsm_network_worker_t *worker)
+{
+    void *rings;
+
+    if (posix_memalign(&rings, STATE_MACHINE_CACHE_LINE, (network->worker_nr + 1) * sizeof(fsm_network_ring_t)) != 0)
+    {
+        return(false);
+    }
+
+    memset(rings, 0, (network->worker_nr + 1) * sizeof(fsm_network_ring_t));
+    worker->rings = (fsm_network_ring_t *)rings;
+
+    worker->messages = (fsm_message_t *)malloc((size_t)(network->worker_nr + 1) * network->ring_size * sizeof(fsm_message_t));
+    worker->outboxes = (fsm_network_outbox_t *)calloc(network->worker_nr, sizeof(fsm_network_outbox_t));
+
+    if ((worker->messages == NULL) || (worker->outboxes == NULL) || (pthread_mutex_init(&worker->lock, NULL) != 0))
+    {
+        free(worker->rings);
+        free(worker->messages);
+        free(worker->outboxes);
+        return(false);
+    }
+
+    return(true);
+}
+
+
+
+static void state_machine_network_worker_free (fsm_network_worker_t *worker)
+{
+    pthread_mutex_destroy(&worker->lock);
+    free(worker->rings);
+    free(worker->messages);
+    free(worker->outboxes);
+}
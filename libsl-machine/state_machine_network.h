@@ -0,0 +1,144 @@
+/**
+ * @file state_machine_network.h
+ * @brief Messages between the state machines of a large network.
+ *
+ * The state machines are registered in groups (e.g. the arrays created by
+ * "state_machine_clone_many") and addressed by group and index. A message asks the
+ * destination to execute a transition ("go_to_state" followed by "sm_run").
+ *
+ * Every state machine is owned by a worker (index modulo the number of workers) and
+ * only the owner runs it. Every worker has a ring for each other worker, with a single
+ * producer and a single consumer, so no lock is shared by the workers: the messages sent
+ * by a worker (e.g. from the "enter" callbacks) are collected per destination worker and
+ * published with a single store when the batch is full or at the end of the run.
+ *
+ * Example:
+ *     state_machine_network_add_group(net, fsms, 10000, &group);
+ *     state_machine_network_send(net, STATE_MACHINE_ADDRESS(group, 42), STATE_CONNECTING);
+ *
+ *     // Thread of the worker "worker"
+ *     while (running)
+ *         state_machine_network_run(net, worker, NULL);
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_NETWORK_H
+#define STATE_MACHINE_NETWORK_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_ADDRESS
+ * @brief Address of the state machine with the given index in a group.
+ */
+#define STATE_MACHINE_ADDRESS(group, index)     (((uint64_t)(group) << 32) | (uint32_t)(index))
+
+/**
+ * @def STATE_MACHINE_ADDRESS_NONE
+ * @brief Address used when no state machine is available (e.g. messages sent by other threads).
+ */
+#define STATE_MACHINE_ADDRESS_NONE      0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * @def STATE_MACHINE_NETWORK_BATCH
+ * @brief Number of messages collected by a worker for another one before they are published.
+ */
+#define STATE_MACHINE_NETWORK_BATCH     64
+
+
+
+/**
+ * @typedef fsm_address_t
+ * @brief Data type used to address a state machine of a network (group in the high 32 bits, index in the low ones).
+ */
+typedef uint64_t fsm_address_t;
+
+/**
+ * @typedef fsm_network_t
+ * @brief Data type used to handle a network of state machines.
+ */
+typedef struct _fsm_network_t fsm_network_t;
+
+
+
+/**
+ * @fn state_machine_network_create
+ * @brief Create a network.
+ * @param worker_nr Number of workers.
+ * @param group_max Maximum number of groups.
+ * @param ring_size Number of messages of every ring (rounded up to a power of 2, at least "STATE_MACHINE_NETWORK_BATCH").
+ * @return The new network, NULL if the parameters are not valid or the memory is not available.
+ */
+fsm_network_t* state_machine_network_create (uint32_t worker_nr, uint32_t group_max, uint32_t ring_size);
+
+/**
+ * @fn state_machine_network_destroy
+ * @brief Release a network (the messages not delivered are dropped, the state machines are not released).
+ * WARNING: The workers must be stopped first.
+ */
+void state_machine_network_destroy (fsm_network_t *network);
+
+/**
+ * @fn state_machine_network_add_group
+ * @brief Add a group of state machines to the network.
+ * WARNING: The array is not copied and must be valid until the network is released.
+ * @param network The network.
+ * @param fsms The state machines of the group.
+ * @param count Number of state machines.
+ * @param group_id Filled with the ID of the group.
+ * @return true if the group was added, false if there are too many groups.
+ */
+bool state_machine_network_add_group (fsm_network_t *network, fsm_t *const *fsms, uint32_t count, uint32_t *group_id);
+
+/**
+ * @fn state_machine_network_send
+ * @brief Send a message to a state machine.
+ * From a worker (e.g. in a callback of the state machines it runs) the message is added
+ * to the batch of the destination worker, published when full or at the end of the run;
+ * from other threads it is published at once (with the lock of the destination worker).
+ * @param network The network.
+ * @param to Address of the destination.
+ * @param target_id Transition required to the destination.
+ * @return true if the message was sent, false if the address is not valid or the ring of
+ * the destination worker is full.
+ */
+bool state_machine_network_send (fsm_network_t *network, fsm_address_t to, uint32_t target_id);
+
+/**
+ * @fn state_machine_network_run
+ * @brief Deliver the messages received by a worker and publish the ones it sent.
+ * Every message is delivered with "go_to_state" and, if accepted, "sm_run".
+ * WARNING: A worker must be run by a single thread at a time.
+ * @param network The network.
+ * @param worker The worker.
+ * @param par Parameter "passed" to "sm_run".
+ * @return The number of messages delivered.
+ */
+uint32_t state_machine_network_run (fsm_network_t *network, uint32_t worker, void *par);
+
+/**
+ * @fn state_machine_network_self
+ * @brief Get the address of the state machine that is receiving a message (e.g. from its "enter" callback).
+ * @return The address, "STATE_MACHINE_ADDRESS_NONE" outside of the delivery.
+ */
+fsm_address_t state_machine_network_self (void);
+
+/**
+ * @fn state_machine_network_sender
+ * @brief Get the address of the state machine that sent the message being delivered.
+ * @return The address, "STATE_MACHINE_ADDRESS_NONE" outside of the delivery or if the message was not sent by a state machine.
+ */
+fsm_address_t state_machine_network_sender (void);
+
+/**
+ * @fn state_machine_network_rejected
+ * @brief Get the number of messages delivered but not accepted by "go_to_state".
+ */
+uint64_t state_machine_network_rejected (const fsm_network_t *network);
+
+
+
+#endif
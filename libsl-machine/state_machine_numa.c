@@ -0,0 +1,488 @@
+/**
+ * @file state_machine_numa.c
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "state_machine_numa.h"
+#include "state_machine_pool.h"
+
+
+
+/**
+ * @def STATE_MACHINE_NUMA_MAX_NODES
+ * @brief Maximum number of NUMA nodes handled.
+ */
+#define STATE_MACHINE_NUMA_MAX_NODES    64
+
+/**
+ * @def STATE_MACHINE_NUMA_MPOL_BIND
+ * @brief Memory policy used to bind the memory to a node (see "mbind").
+ */
+#define STATE_MACHINE_NUMA_MPOL_BIND    2
+
+/**
+ * @def STATE_MACHINE_NUMA_ALIGN
+ * @brief Alignment of the state machines allocated by the pools (i.e. a cache line).
+ */
+#define STATE_MACHINE_NUMA_ALIGN        STATE_MACHINE_CACHE_LINE
+
+
+
+/**
+ * @typedef fsm_numa_node_t
+ * @brief Data of a NUMA node.
+ */
+typedef struct _fsm_numa_node_t fsm_numa_node_t;
+
+/**
+ * @struct _fsm_numa_node_t
+ * @brief See "fsm_numa_node_t" for details.
+ */
+struct _fsm_numa_node_t {
+    uint32_t id;                /**< ID of the node */
+    fsm_allocator_t memory;     /**< Allocator of pages bound to the node */
+    fsm_pool_t *pool;           /**< Pool of state machines of the node */
+    fsm_allocator_t allocator;  /**< Allocator of the pool */
+    uint64_t unbound;           /**< Number of slabs not bound to the node */
+};
+
+/**
+ * @struct _fsm_numa_t
+ * @brief See "fsm_numa_t" for details.
+ */
+struct _fsm_numa_t {
+    uint32_t node_nr;           /**< Number of nodes */
+    fsm_numa_node_t *nodes;     /**< Data of the nodes */
+};
+
+/**
+ * @struct _fsm_numa_def_t
+ * @brief See "fsm_numa_def_t" for details.
+ */
+struct _fsm_numa_def_t {
+    const fsm_numa_t *numa;     /**< Pools used for the copies */
+    fsm_def_t **defs;           /**< Copy of the definition stored on every node */
+};
+
+
+
+/**
+ * @fn state_machine_numa_detect
+ * @brief Get the number of NUMA nodes of the system.
+ */
+static uint32_t state_machine_numa_detect (void);
+
+/**
+ * @fn state_machine_numa_node
+ * @brief Translate a node value ("STATE_MACHINE_NUMA_LOCAL" included) to a valid node.
+ * @return The node, "node_nr" if not valid.
+ */
+static uint32_t state_machine_numa_node (const fsm_numa_t *numa, uint32_t node);
+
+/**
+ * @fn state_machine_numa_alloc_pages
+ * @brief Allocator of pages bound to a node: see "fsm_alloc_t" for details.
+ * The context is the "fsm_numa_node_t" of the node.
+ */
+static void* state_machine_numa_alloc_pages (void *ctx, size_t size, size_t align);
+
+/**
+ * @fn state_machine_numa_free_pages
+ * @brief Allocator of pages bound to a node: see "fsm_free_t" for details.
+ */
+static void state_machine_numa_free_pages (void *ctx, void *ptr);
+
+
+
+fsm_numa_t* state_machine_numa_create (size_t block_size, uint32_t blocks_per_slab)
+{
+    fsm_numa_t *numa;
+    fsm_numa_node_t *node;
+    uint32_t cntr;
+
+    numa = (fsm_numa_t *)calloc(1, sizeof(fsm_numa_t));
+    if (numa == NULL)
+    {
+        return(NULL);
+    }
+
+    numa->node_nr = state_machine_numa_detect();
+    numa->nodes = (fsm_numa_node_t *)calloc(numa->node_nr, sizeof(fsm_numa_node_t));
+    if (numa->nodes == NULL)
+    {
+        free(numa);
+        return(NULL);
+    }
+
+    /* Create a pool for every node, taking the slabs from the memory of the node */
+    for (cntr = 0; cntr < numa->node_nr; cntr++)
+    {
+        node = &numa->nodes[cntr];
+
+        node->id = cntr;
+        node->memory.alloc = state_machine_numa_alloc_pages;
+        node->memory.free = state_machine_numa_free_pages;
+        node->memory.ctx = node;
+
+        node->pool = state_machine_pool_create_ex(block_size, STATE_MACHINE_NUMA_ALIGN, blocks_per_slab, &node->memory);
+        if (node->pool == NULL)
+        {
+            state_machine_numa_destroy(numa);
+            return(NULL);
+        }
+
+        state_machine_pool_allocator(node->pool, &node->allocator);
+    }
+
+    return(numa);
+}
+
+
+
+void state_machine_numa_destroy (fsm_numa_t *numa)
+{
+    uint32_t cntr;
+
+    if (numa == NULL)
+    {
+        return;
+    }
+
+    for (cntr = 0; cntr < numa->node_nr; cntr++)
+    {
+        state_machine_pool_destroy(numa->nodes[cntr].pool);
+    }
+
+    free(numa->nodes);
+    free(numa);
+}
+
+
+
+uint32_t state_machine_numa_node_nr (const fsm_numa_t *numa)
+{
+    return(numa->node_nr);
+}
+
+
+
+uint32_t state_machine_numa_current_node (const fsm_numa_t *numa)
+{
+    unsigned int cpu;
+    unsigned int node;
+
+    node = 0;
+
+#ifdef SYS_getcpu
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    {
+        node = 0;
+    }
+#else
+    (void)cpu;
+#endif
+
+    return((node < numa->node_nr) ? node : 0);
+}
+
+
+
+const fsm_allocator_t* state_machine_numa_allocator (const fsm_numa_t *numa, uint32_t node)
+{
+    node = state_machine_numa_node(numa, node);
+    if (node >= numa->node_nr)
+    {
+        return(NULL);
+    }
+
+    return(&numa->nodes[node].allocator);
+}
+
+
+
+uint64_t state_machine_numa_unbound (const fsm_numa_t *numa, uint32_t node)
+{
+    node = state_machine_numa_node(numa, node);
+    if (node >= numa->node_nr)
+    {
+        return(0);
+    }
+
+    return(__atomic_load_n(&numa->nodes[node].unbound, __ATOMIC_RELAXED));
+}
+
+
+
+fsm_t* state_machine_numa_init (fsm_numa_t *numa, uint32_t node, uint32_t state_nr, uint32_t initial_state, const fsm_attr_t *attr)
+{
+    fsm_attr_t local_attr;
+
+    memset(&local_attr, 0, sizeof(fsm_attr_t));
+    if (attr != NULL)
+    {
+        local_attr = *attr;
+    }
+
+    local_attr.allocator = state_machine_numa_allocator(numa, node);
+    if (local_attr.allocator == NULL)
+    {
+        return(NULL);
+    }
+
+    return(state_machine_init_ex(state_nr, initial_state, &local_attr));
+}
+
+
+
+fsm_t* state_machine_numa_migrate (fsm_numa_t *numa, fsm_t *fsm, uint32_t node)
+{
+    fsm_attr_t attr;
+    fsm_t *copy;
+
+    memset(&attr, 0, sizeof(fsm_attr_t));
+
+    attr.allocator = state_machine_numa_allocator(numa, node);
+    if ((fsm == NULL) || (attr.allocator == NULL))
+    {
+        return(NULL);
+    }
+
+    /* The bindings of the hooks refer to the old pointer */
+    if (fsm->on_transition != NULL)
+    {
+        return(NULL);
+    }
+
+    /* The state machine is already on the required node */
+    if ((fsm->allocator.ctx == attr.allocator->ctx) && (fsm->allocator.alloc == attr.allocator->alloc))
+    {
+        return(fsm);
+    }
+
+    copy = state_machine_clone(fsm, &attr);
+    if (copy == NULL)
+    {
+        return(NULL);
+    }
+
+    state_machine_deinit(fsm);
+
+    return(copy);
+}
+
+
+
+fsm_numa_def_t* state_machine_numa_def_create (fsm_numa_t *numa, const fsm_def_t *def)
+{
+    fsm_numa_def_t *defs;
+    uint32_t cntr;
+
+    if ((numa == NULL) || (def == NULL))
+    {
+        return(NULL);
+    }
+
+    defs = (fsm_numa_def_t *)calloc(1, sizeof(fsm_numa_def_t) + numa->node_nr * sizeof(fsm_def_t *));
+    if (defs == NULL)
+    {
+        return(NULL);
+    }
+
+    defs->numa = numa;
+    defs->defs = (fsm_def_t **)(defs + 1);
+
+    /* Every copy is stored in pages bound to its node */
+    for (cntr = 0; cntr < numa->node_nr; cntr++)
+    {
+        defs->defs[cntr] = state_machine_def_clone(def, &numa->nodes[cntr].memory);
+        if (defs->defs[cntr] == NULL)
+        {
+            state_machine_numa_def_destroy(defs);
+            return(NULL);
+        }
+    }
+
+    return(defs);
+}
+
+
+
+const fsm_def_t* state_machine_numa_def_get (const fsm_numa_def_t *defs, uint32_t node)
+{
+    node = state_machine_numa_node(defs->numa, node);
+    if (node >= defs->numa->node_nr)
+    {
+        return(NULL);
+    }
+
+    return(defs->defs[node]);
+}
+
+
+
+void state_machine_numa_def_destroy (fsm_numa_def_t *defs)
+{
+    uint32_t cntr;
+
+    if (defs == NULL)
+    {
+        return;
+    }
+
+    for (cntr = 0; cntr < defs->numa->node_nr; cntr++)
+    {
+        state_machine_def_free(defs->defs[cntr]);
+    }
+
+    free(defs);
+}
+
+
+
+fsm_t* state_machine_numa_instantiate (fsm_numa_t *numa, const fsm_numa_def_t *defs, uint32_t node, const fsm_attr_t *attr)
+{
+    fsm_attr_t local_attr;
+
+    node = state_machine_numa_node(numa, node);
+    if ((defs == NULL) || (node >= numa->node_nr))
+    {
+        return(NULL);
+    }
+
+    memset(&local_attr, 0, sizeof(fsm_attr_t));
+    if (attr != NULL)
+    {
+        local_attr = *attr;
+    }
+
+    local_attr.allocator = &numa->nodes[node].allocator;
+
+    return(state_machine_def_instantiate(defs->defs[node], &local_attr));
+}
+
+
+
+static uint32_t state_machine_numa_detect (void)
+{
+    FILE *file;
+    char line[256];
+    char *pos;
+    char *end;
+    unsigned long value;
+    unsigned long max;
+
+    /* The file lists the online nodes, e.g. "0-1" or "0,2-3" */
+    file = fopen("/sys/devices/system/node/online", "r");
+    if (file == NULL)
+    {
+        return(1);
+    }
+
+    max = 0;
+    if (fgets(line, sizeof(line), file) != NULL)
+    {
+        for (pos = line; *pos != '\0'; pos = end)
+        {
+            value = strtoul(pos, &end, 10);
+            if (end == pos)
+            {
+                end = pos + 1;
+                continue;
+            }
+
+            if (value > max)
+            {
+                max = value;
+            }
+        }
+    }
+    fclose(file);
+
+    return((max < STATE_MACHINE_NUMA_MAX_NODES) ? (uint32_t)(max + 1) : STATE_MACHINE_NUMA_MAX_NODES);
+}
+
+
+
+static uint32_t state_machine_numa_node (const fsm_numa_t *numa, uint32_t node)
+{
+    if (node == STATE_MACHINE_NUMA_LOCAL)
+    {
+        return(state_machine_numa_current_node(numa));
+    }
+
+    return((node < numa->node_nr) ? node : numa->node_nr);
+}
+
+
+
+static void* state_machine_numa_alloc_pages (void *ctx, size_t size, size_t align)
+{
+    fsm_numa_node_t *node = (fsm_numa_node_t *)ctx;
+    unsigned long mask;
+    size_t header;
+    char *block;
+
+    /* The header stores the size of the mapping and must fit the first page */
+    if (align > (size_t)sysconf(_SC_PAGESIZE))
+    {
+        return(NULL);
+    }
+
+    header = (align > sizeof(size_t)) ? align : sizeof(size_t);
+    size += header;
+
+    block = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+    {
+        return(NULL);
+    }
+
+    /* Bind the pages to the node before they are touched (if refused, they are placed by the default policy) */
+#ifdef SYS_mbind
+    mask = 1UL << node->id;
+    if (syscall(SYS_mbind, block, size, STATE_MACHINE_NUMA_MPOL_BIND, &mask, sizeof(mask) * 8, 0) != 0)
+    {
+        __atomic_add_fetch(&node->unbound, 1, __ATOMIC_RELAXED);
+    }
+#else
+    (void)mask;
+    __atomic_add_fetch(&node->unbound, 1, __ATOMIC_RELAXED);
+#endif
+
+    *(size_t *)block = size;
+
+    return(block + header);
+}
+
+
+
+static void state_machine_numa_free_pages (void *ctx, void *ptr)
+{
+    char *block;
+    size_t header;
+
+    (void)ctx;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    /* The header is always smaller than a page: the mapping starts at the page of the pointer */
+    block = (char *)((uintptr_t)ptr & ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1));
+    header = (size_t)((char *)ptr - block);
+    if (header == 0)
+    {
+        block -= sysconf(_SC_PAGESIZE);
+    }
+
+    munmap(block, *(size_t *)block);
+}
@@ -0,0 +1,150 @@
+/**
+ * @file state_machine_numa.h
+ * @brief NUMA-aware placement of state machines.
+ *
+ * Every NUMA node has its own pool (see "state_machine_pool.h") whose slabs are bound
+ * to the memory of the node. State machines are allocated on the node of the worker
+ * that owns them and can be moved to a different node when the owner changes.
+ * Definitions (see "state_machine_def.h") can be replicated on every node, so the
+ * instances are always created from a local copy.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_NUMA_H
+#define STATE_MACHINE_NUMA_H
+
+#include "state_machine_def.h"
+
+
+
+/**
+ * @def STATE_MACHINE_NUMA_LOCAL
+ * @brief Node value that selects the node of the calling thread.
+ */
+#define STATE_MACHINE_NUMA_LOCAL    0xFFFFFFFF
+
+
+
+/**
+ * @typedef fsm_numa_t
+ * @brief Data type used to handle the pools of the NUMA nodes.
+ */
+typedef struct _fsm_numa_t fsm_numa_t;
+
+/**
+ * @typedef fsm_numa_def_t
+ * @brief Data type used to store the copies of a definition on every node.
+ */
+typedef struct _fsm_numa_def_t fsm_numa_def_t;
+
+
+
+/**
+ * @fn state_machine_numa_create
+ * @brief Create the pools of all the NUMA nodes of the system.
+ * INFO: On systems without NUMA support a single node is used.
+ * @param block_size Size of the state machines (see "state_machine_size").
+ * @param blocks_per_slab Number of state machines allocated every time a pool grows.
+ * @return The new set of pools, NULL if the memory is not available.
+ */
+fsm_numa_t* state_machine_numa_create (size_t block_size, uint32_t blocks_per_slab);
+
+/**
+ * @fn state_machine_numa_destroy
+ * @brief Release the pools and all the state machines allocated from them.
+ * @param numa The pools to be released.
+ */
+void state_machine_numa_destroy (fsm_numa_t *numa);
+
+/**
+ * @fn state_machine_numa_node_nr
+ * @brief Get the number of NUMA nodes handled.
+ */
+uint32_t state_machine_numa_node_nr (const fsm_numa_t *numa);
+
+/**
+ * @fn state_machine_numa_current_node
+ * @brief Get the NUMA node of the CPU running the calling thread.
+ */
+uint32_t state_machine_numa_current_node (const fsm_numa_t *numa);
+
+/**
+ * @fn state_machine_numa_allocator
+ * @brief Get the allocator of the given node.
+ * @param numa The pools.
+ * @param node The NUMA node (or "STATE_MACHINE_NUMA_LOCAL").
+ * @return The allocator, NULL if the node is not valid.
+ */
+const fsm_allocator_t* state_machine_numa_allocator (const fsm_numa_t *numa, uint32_t node);
+
+/**
+ * @fn state_machine_numa_unbound
+ * @brief Get the number of slabs of a node that the system did not bind to it (e.g. "mbind" not
+ * available): their pages are placed by the default policy (the node of the first thread that uses them).
+ * @param numa The pools.
+ * @param node The NUMA node (or "STATE_MACHINE_NUMA_LOCAL").
+ * @return The number of slabs, 0 if the node is not valid.
+ */
+uint64_t state_machine_numa_unbound (const fsm_numa_t *numa, uint32_t node);
+
+/**
+ * @fn state_machine_numa_init
+ * @brief Create a state machine on the given node.
+ * See "state_machine_init_ex" for details: the allocator of "attr" is replaced by the one of the node.
+ * @param node The NUMA node (or "STATE_MACHINE_NUMA_LOCAL").
+ */
+fsm_t* state_machine_numa_init (fsm_numa_t *numa, uint32_t node, uint32_t state_nr, uint32_t initial_state, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_numa_migrate
+ * @brief Move a state machine to the given node.
+ * The state machine is copied and the original released, so every registration of the
+ * old pointer (journal, network, shared memory and replica arrays, loop bindings, ...)
+ * must be removed before and made again with the new pointer. A state machine with a
+ * hook (profile, observers, trace, loop, ...) is not moved: the hooks must be detached first.
+ * WARNING: The state machine must not be used by other threads during the migration and
+ * the old pointer is not valid anymore after the call.
+ * @param numa The pools.
+ * @param fsm The state machine to be moved.
+ * @param node The destination node (or "STATE_MACHINE_NUMA_LOCAL").
+ * @return The pointer to the moved state machine, NULL if the migration failed or a hook
+ * is set (the original state machine is still valid).
+ */
+fsm_t* state_machine_numa_migrate (fsm_numa_t *numa, fsm_t *fsm, uint32_t node);
+
+/**
+ * @fn state_machine_numa_def_create
+ * @brief Create a read-only copy of the given definition on every node.
+ * @param numa The pools.
+ * @param def The definition to be copied.
+ * @return The copies of the definition, NULL if the memory is not available.
+ */
+fsm_numa_def_t* state_machine_numa_def_create (fsm_numa_t *numa, const fsm_def_t *def);
+
+/**
+ * @fn state_machine_numa_def_get
+ * @brief Get the copy of a definition stored on the given node.
+ * @param defs The copies of the definition.
+ * @param node The NUMA node (or "STATE_MACHINE_NUMA_LOCAL").
+ * @return The local copy of the definition, NULL if the node is not valid.
+ */
+const fsm_def_t* state_machine_numa_def_get (const fsm_numa_def_t *defs, uint32_t node);
+
+/**
+ * @fn state_machine_numa_def_destroy
+ * @brief Release the copies of a definition.
+ */
+void state_machine_numa_def_destroy (fsm_numa_def_t *defs);
+
+/**
+ * @fn state_machine_numa_instantiate
+ * @brief Create a state machine on the given node from the local copy of a definition.
+ * See "state_machine_def_instantiate" for details.
+ * @param node The NUMA node (or "STATE_MACHINE_NUMA_LOCAL").
+ */
+fsm_t* state_machine_numa_instantiate (fsm_numa_t *numa, const fsm_numa_def_t *defs, uint32_t node, const fsm_attr_t *attr);
+
+
+
+#endif
@@ -0,0 +1,574 @@
+/**
+ * @file state_machine_observer.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_machine_observer.h"
+
+
+
+/**
+ * @def STATE_MACHINE_OBSERVER_MIN_SIZE
+ * @brief Initial number of subscriptions of a registry.
+ */
+#define STATE_MACHINE_OBSERVER_MIN_SIZE 8
+
+/**
+ * @def STATE_MACHINE_OBSERVER_NONE
+ * @brief End of the lists of subscriptions.
+ */
+#define STATE_MACHINE_OBSERVER_NONE     0xFFFFFFFF
+
+
+
+/**
+ * @typedef fsm_subscription_t
+ * @brief Subscription of an observer.
+ */
+typedef struct _fsm_subscription_t fsm_subscription_t;
+
+/**
+ * @typedef fsm_subscription_list_t
+ * @brief List of the subscriptions of a bucket of the index.
+ */
+typedef struct _fsm_subscription_list_t fsm_subscription_list_t;
+
+/**
+ * @typedef fsm_observer_binding_t
+ * @brief State machine attached to a registry.
+ */
+typedef struct _fsm_observer_binding_t fsm_observer_binding_t;
+
+/**
+ * @typedef fsm_observer_entry_t
+ * @brief Notification stored in the batch of a thread.
+ */
+typedef struct _fsm_observer_entry_t fsm_observer_entry_t;
+
+/**
+ * @typedef fsm_observer_batch_t
+ * @brief Batch of the notifications of a thread.
+ */
+typedef struct _fsm_observer_batch_t fsm_observer_batch_t;
+
+/**
+ * @struct _fsm_subscription_t
+ * @brief See "fsm_subscription_t" for details.
+ */
+struct _fsm_subscription_t {
+    uint32_t exit_state_id;     /**< Exit state ("STATE_MACHINE_OBSERVER_ANY" for any state) */
+    uint32_t enter_state_id;    /**< Enter state ("STATE_MACHINE_OBSERVER_ANY" for any state) */
+    fsm_observer_t observer;    /**< Function that receives the notifications */
+    void *data;                 /**< Parameter of the function */
+    uint32_t next;              /**< Next subscription of the same list ("STATE_MACHINE_OBSERVER_NONE" if last) */
+};
+
+/**
+ * @struct _fsm_subscription_list_t
+ * @brief See "fsm_subscription_list_t" for details.
+ */
+struct _fsm_subscription_list_t {
+    uint32_t head;              /**< First subscription ("STATE_MACHINE_OBSERVER_NONE" if empty) */
+    uint32_t tail;              /**< Last subscription */
+};
+
+/**
+ * @struct _fsm_observer_binding_t
+ * @brief See "fsm_observer_binding_t" for details.
+ */
+struct _fsm_observer_binding_t {
+    fsm_hook_link_t link;       /**< Hook set before the attach (first field, see "state_machine_hook_link") */
+    fsm_observers_t *observers; /**< The registry */
+};
+
+/**
+ * @struct _fsm_observers_t
+ * @brief See "fsm_observers_t" for details.
+ * INFO: Every subscription is in a single list: the one of its exit state, the one of its
+ * enter state if the exit state is "STATE_MACHINE_OBSERVER_ANY", or "any" if both are
+ * "STATE_MACHINE_OBSERVER_ANY". The lists of the states are in a hash table (the states
+ * of a bucket are mixed), so a flush does not check the subscriptions of other states.
+ */
+struct _fsm_observers_t {
+    pthread_rwlock_t lock;      /**< Lock of the subscriptions (taken for reading by the flushes) */
+    fsm_subscription_t *subscriptions;  /**< The subscriptions */
+    uint32_t subscription_nr;   /**< Number of subscriptions */
+    uint32_t size;              /**< Number of items of "subscriptions" */
+    fsm_subscription_list_t *buckets;   /**< Lists of the subscriptions of the states (2 * "size" items) */
+    fsm_subscription_list_t any;        /**< Subscriptions of any transition */
+};
+
+/**
+ * @struct _fsm_observer_entry_t
+ * @brief See "fsm_observer_entry_t" for details.
+ */
+struct _fsm_observer_entry_t {
+    fsm_observers_t *observers; /**< Registry of the state machine (NULL when delivered) */
+    fsm_notification_t note;    /**< The transition */
+};
+
+/**
+ * @struct _fsm_observer_batch_t
+ * @brief See "fsm_observer_batch_t" for details.
+ */
+struct _fsm_observer_batch_t {
+    fsm_observer_entry_t entries[STATE_MACHINE_OBSERVER_BATCH];     /**< Notifications not delivered */
+    fsm_observer_entry_t flushed[STATE_MACHINE_OBSERVER_BATCH];     /**< Notifications being delivered */
+    fsm_notification_t notes[STATE_MACHINE_OBSERVER_BATCH];         /**< Notifications of an observer */
+    uint64_t keys[STATE_MACHINE_OBSERVER_BATCH];                    /**< State (high 32 bits) and position of the notifications of a registry */
+    uint32_t count;             /**< Number of items of "entries" */
+    bool flushing;              /**< true during the delivery */
+};
+
+
+
+/**
+ * @var state_machine_observer_batch
+ * @brief Batch of the calling thread.
+ */
+static __thread fsm_observer_batch_t state_machine_observer_batch;
+
+
+
+/**
+ * @fn state_machine_observers_hook
+ * @brief Hook of the attached state machines: see "fsm_transition_hook_t" for details.
+ */
+static void state_machine_observers_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+/**
+ * @fn state_machine_observers_deliver
+ * @brief Deliver the notifications of a registry to its observers.
+ * @param observers The registry.
+ * @param entries The notifications being delivered (the ones of the registry are marked as delivered).
+ * @param entry_nr Number of notifications.
+ * @param batch The batch of the thread (memory used to collect the notifications of an observer).
+ */
+static void state_machine_observers_deliver (fsm_observers_t *observers, fsm_observer_entry_t *entries, uint32_t entry_nr, fsm_observer_batch_t *batch);
+
+/**
+ * @fn state_machine_observers_bucket
+ * @brief Get the list of the subscriptions of an exit state ("enter" false) or of an enter state ("enter" true).
+ */
+static fsm_subscription_list_t* state_machine_observers_bucket (const fsm_observers_t *observers, uint32_t state_id, bool enter);
+
+/**
+ * @fn state_machine_observers_index
+ * @brief Add a subscription at the end of its list.
+ */
+static void state_machine_observers_index (fsm_observers_t *observers, uint32_t index);
+
+/**
+ * @fn state_machine_observers_reindex
+ * @brief Rebuild all the lists (after a resize or a removal).
+ */
+static void state_machine_observers_reindex (fsm_observers_t *observers);
+
+/**
+ * @fn state_machine_observers_compare
+ * @brief Order the keys of the notifications (see "qsort").
+ */
+static int state_machine_observers_compare (const void *a, const void *b);
+
+
+
+fsm_observers_t* state_machine_observers_create (void)
+{
+    fsm_observers_t *observers;
+
+    observers = (fsm_observers_t *)calloc(1, sizeof(fsm_observers_t));
+    if (observers == NULL)
+    {
+        return(NULL);
+    }
+
+    if (pthread_rwlock_init(&observers->lock, NULL) != 0)
+    {
+        free(observers);
+        return(NULL);
+    }
+
+    observers->any.head = STATE_MACHINE_OBSERVER_NONE;
+
+    return(observers);
+}
+
+
+
+void state_machine_observers_destroy (fsm_observers_t *observers)
+{
+    if (observers == NULL)
+    {
+        return;
+    }
+
+    pthread_rwlock_destroy(&observers->lock);
+    free(observers->subscriptions);
+    free(observers->buckets);
+    free(observers);
+}
+
+
+
+bool state_machine_observers_subscribe (fsm_observers_t *observers, uint32_t exit_state_id, uint32_t enter_state_id, fsm_observer_t observer, void *data)
+{
+    fsm_subscription_t *subscriptions;
+    fsm_subscription_t *subscription;
+    fsm_subscription_list_t *buckets;
+    uint32_t size;
+
+    if (observer == NULL)
+    {
+        return(false);
+    }
+
+    pthread_rwlock_wrlock(&observers->lock);
+
+    if (observers->subscription_nr == observers->size)
+    {
+        size = (observers->size == 0) ? STATE_MACHINE_OBSERVER_MIN_SIZE : observers->size * 2;
+
+        buckets = (fsm_subscription_list_t *)malloc(2 * size * sizeof(fsm_subscription_list_t));
+        if (buckets == NULL)
+        {
+            pthread_rwlock_unlock(&observers->lock);
+            return(false);
+        }
+
+        subscriptions = (fsm_subscription_t *)realloc(observers->subscriptions, size * sizeof(fsm_subscription_t));
+        if (subscriptions == NULL)
+        {
+            free(buckets);
+            pthread_rwlock_unlock(&observers->lock);
+            return(false);
+        }
+
+        free(observers->buckets);
+        observers->buckets = buckets;
+        observers->subscriptions = subscriptions;
+        observers->size = size;
+        state_machine_observers_reindex(observers);
+    }
+
+    subscription = &observers->subscriptions[observers->subscription_nr];
+    subscription->exit_state_id = exit_state_id;
+    subscription->enter_state_id = enter_state_id;
+    subscription->observer = observer;
+    subscription->data = data;
+    state_machine_observers_index(observers, observers->subscription_nr);
+    observers->subscription_nr++;
+
+    pthread_rwlock_unlock(&observers->lock);
+
+    return(true);
+}
+
+
+
+uint32_t state_machine_observers_unsubscribe (fsm_observers_t *observers, fsm_observer_t observer, void *data)
+{
+    uint32_t removed;
+    uint32_t cntr;
+
+    pthread_rwlock_wrlock(&observers->lock);
+
+    /* The order of the other subscriptions is kept */
+    removed = 0;
+    for (cntr = 0; cntr < observers->subscription_nr; cntr++)
+    {
+        if ((observers->subscriptions[cntr].observer == observer) && (observers->subscriptions[cntr].data == data))
+        {
+            removed++;
+            continue;
+        }
+
+        observers->subscriptions[cntr - removed] = observers->subscriptions[cntr];
+    }
+    observers->subscription_nr -= removed;
+
+    if (removed > 0)
+    {
+        state_machine_observers_reindex(observers);
+    }
+
+    pthread_rwlock_unlock(&observers->lock);
+
+    return(removed);
+}
+
+
+
+bool state_machine_observers_attach (fsm_observers_t *observers, fsm_t *fsm)
+{
+    fsm_observer_binding_t *binding;
+
+    /* Attached to another registry: moved */
+    binding = (fsm_observer_binding_t *)state_machine_hook_find(fsm, state_machine_observers_hook);
+    if (binding != NULL)
+    {
+        binding->observers = observers;
+        return(true);
+    }
+
+    binding = (fsm_observer_binding_t *)malloc(sizeof(fsm_observer_binding_t));
+    if (binding == NULL)
+    {
+        return(false);
+    }
+
+    binding->observers = observers;
+
+    state_machine_hook_link(fsm, state_machine_observers_hook, &binding->link);
+
+    return(true);
+}
+
+
+
+void state_machine_observers_detach (fsm_t *fsm)
+{
+    free(state_machine_hook_unlink(fsm, state_machine_observers_hook, NULL));
+}
+
+
+
+void state_machine_observers_flush (void)
+{
+    fsm_observer_batch_t *batch = &state_machine_observer_batch;
+    uint32_t entry_nr;
+    uint32_t cntr;
+
+    if ((batch->flushing == true) || (batch->count == 0))
+    {
+        return;
+    }
+
+    /* The batch is free for the transitions executed by the observers */
+    batch->flushing = true;
+    entry_nr = batch->count;
+    memcpy(batch->flushed, batch->entries, entry_nr * sizeof(fsm_observer_entry_t));
+    batch->count = 0;
+
+    /* The registries are delivered in the order of their first notification */
+    for (cntr = 0; cntr < entry_nr; cntr++)
+    {
+        if (batch->flushed[cntr].observers != NULL)
+        {
+            state_machine_observers_deliver(batch->flushed[cntr].observers, &batch->flushed[cntr], entry_nr - cntr, batch);
+        }
+    }
+
+    batch->flushing = false;
+}
+
+
+
+static void state_machine_observers_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data)
+{
+    fsm_observer_batch_t *batch = &state_machine_observer_batch;
+    fsm_observer_binding_t *binding = (fsm_observer_binding_t *)data;
+    fsm_observer_entry_t *entry;
+
+    if (batch->count == STATE_MACHINE_OBSERVER_BATCH)
+    {
+        state_machine_observers_flush();
+    }
+
+    /* Lost if full during a flush */
+    if (batch->count < STATE_MACHINE_OBSERVER_BATCH)
+    {
+        entry = &batch->entries[batch->count++];
+        entry->observers = binding->observers;
+        entry->note.fsm = fsm;
+        entry->note.exit_state_id = exit_state_id;
+        entry->note.enter_state_id = enter_state_id;
+    }
+
+    if (binding->link.on_transition != NULL)
+    {
+        binding->link.on_transition(fsm, exit_state_id, enter_state_id, binding->link.hook_data);
+    }
+}
+
+
+
+static void state_machine_observers_deliver (fsm_observers_t *observers, fsm_observer_entry_t *entries, uint32_t entry_nr, fsm_observer_batch_t *batch)
+{
+    const fsm_subscription_t *subscription;
+    const fsm_notification_t *note;
+    uint32_t entry_id;
+    uint32_t state_id;
+    uint32_t key_nr;
+    uint32_t note_nr;
+    uint32_t first;
+    uint32_t last;
+    uint32_t index;
+    uint32_t pass;
+    uint32_t id;
+
+    pthread_rwlock_rdlock(&observers->lock);
+
+    /* Notifications of the registry */
+    key_nr = 0;
+    for (index = 0; index < entry_nr; index++)
+    {
+        if (entries[index].observers == observers)
+        {
+            batch->keys[key_nr++] = index;
+        }
+    }
+
+    /* Subscriptions of any transition: all the notifications */
+    if (observers->any.head != STATE_MACHINE_OBSERVER_NONE)
+    {
+        for (index = 0; index < key_nr; index++)
+        {
+            batch->notes[index] = entries[batch->keys[index]].note;
+        }
+
+        for (id = observers->any.head; id != STATE_MACHINE_OBSERVER_NONE; id = observers->subscriptions[id].next)
+        {
+            observers->subscriptions[id].observer(batch->notes, key_nr, observers->subscriptions[id].data);
+        }
+    }
+
+    /* Subscriptions by exit state (pass 0), then by enter state (pass 1) */
+    for (pass = 0; (pass < 2) && (observers->subscription_nr > 0); pass++)
+    {
+        /* The notifications of the same state become consecutive, in the order of execution */
+        for (index = 0; index < key_nr; index++)
+        {
+            entry_id = (uint32_t)batch->keys[index];
+            note = &entries[entry_id].note;
+            state_id = (pass == 0) ? note->exit_state_id : note->enter_state_id;
+            batch->keys[index] = ((uint64_t)state_id << 32) | entry_id;
+        }
+
+        qsort(batch->keys, key_nr, sizeof(uint64_t), state_machine_observers_compare);
+
+        for (first = 0; first < key_nr; first = last)
+        {
+            state_id = (uint32_t)(batch->keys[first] >> 32);
+            for (last = first + 1; (last < key_nr) && ((uint32_t)(batch->keys[last] >> 32) == state_id); last++)
+            {
+            }
+
+            for (id = state_machine_observers_bucket(observers, state_id, (pass == 1))->head; id != STATE_MACHINE_OBSERVER_NONE; id = subscription->next)
+            {
+                subscription = &observers->subscriptions[id];
+
+                /* A bucket holds the lists of several states */
+                if (((pass == 0) && (subscription->exit_state_id != state_id)) ||
+                    ((pass == 1) && ((subscription->exit_state_id != STATE_MACHINE_OBSERVER_ANY) || (subscription->enter_state_id != state_id))))
+                {
+                    continue;
+                }
+
+                note_nr = 0;
+                for (index = first; index < last; index++)
+                {
+                    note = &entries[(uint32_t)batch->keys[index]].note;
+
+                    if ((subscription->enter_state_id == STATE_MACHINE_OBSERVER_ANY) || (subscription->enter_state_id == note->enter_state_id))
+                    {
+                        batch->notes[note_nr++] = *note;
+                    }
+                }
+
+                if (note_nr > 0)
+                {
+                    subscription->observer(batch->notes, note_nr, subscription->data);
+                }
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&observers->lock);
+
+    for (index = 0; index < entry_nr; index++)
+    {
+        if (entries[index].observers == observers)
+        {
+            entries[index].observers = NULL;
+        }
+    }
+}
+
+
+
+static fsm_subscription_list_t* state_machine_observers_bucket (const fsm_observers_t *observers, uint32_t state_id, bool enter)
+{
+    uint64_t key;
+
+    /* Exit and enter lists of the same state in different buckets (2 * "size" buckets, power of 2) */
+    key = ((uint64_t)state_id << 1) | (enter ? 1 : 0);
+    key *= 0x9E3779B97F4A7C15ULL;
+
+    return(&observers->buckets[(key >> 32) & (2 * observers->size - 1)]);
+}
+
+
+
+static void state_machine_observers_index (fsm_observers_t *observers, uint32_t index)
+{
+    fsm_subscription_t *subscription;
+    fsm_subscription_list_t *list;
+
+    subscription = &observers->subscriptions[index];
+    subscription->next = STATE_MACHINE_OBSERVER_NONE;
+
+    if (subscription->exit_state_id != STATE_MACHINE_OBSERVER_ANY)
+    {
+        list = state_machine_observers_bucket(observers, subscription->exit_state_id, false);
+    }
+    else if (subscription->enter_state_id != STATE_MACHINE_OBSERVER_ANY)
+    {
+        list = state_machine_observers_bucket(observers, subscription->enter_state_id, true);
+    }
+    else
+    {
+        list = &observers->any;
+    }
+
+    /* The subscriptions of a list are called in the order they were added */
+    if (list->head == STATE_MACHINE_OBSERVER_NONE)
+    {
+        list->head = index;
+    }
+    else
+    {
+        observers->subscriptions[list->tail].next = index;
+    }
+    list->tail = index;
+}
+
+
+
+static void state_machine_observers_reindex (fsm_observers_t *observers)
+{
+    uint32_t cntr;
+
+    for (cntr = 0; cntr < 2 * observers->size; cntr++)
+    {
+        observers->buckets[cntr].head = STATE_MACHINE_OBSERVER_NONE;
+    }
+    observers->any.head = STATE_MACHINE_OBSERVER_NONE;
+
+    for (cntr = 0; cntr < observers->subscription_nr; cntr++)
+    {
+        state_machine_observers_index(observers, cntr);
+    }
+}
+
+
+
+static int state_machine_observers_compare (const void *a, const void *b)
+{
+    uint64_t key_a = *(const uint64_t *)a;
+    uint64_t key_b = *(const uint64_t *)b;
+
+    return((key_a > key_b) - (key_a < key_b));
+}
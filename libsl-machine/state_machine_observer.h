@@ -0,0 +1,133 @@
+/**
+ * @file state_machine_observer.h
+ * @brief Registry of observers of the transitions of state machines.
+ *
+ * Subsystems that do not own a state machine (e.g. metrics, audit, caches) subscribe
+ * to its transitions by exit state, enter state, edge or any transition. The
+ * transitions of the attached state machines are stored in a batch of the thread that
+ * runs them and delivered when the batch is flushed (e.g. at the end of a tick): every
+ * observer is called once per flush with all its notifications, instead of once per
+ * transition. The subscriptions are indexed by state, so a flush only checks the ones
+ * of the states it delivers (and the ones of any transition).
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_OBSERVER_H
+#define STATE_MACHINE_OBSERVER_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_OBSERVER_ANY
+ * @brief State of a subscription that matches any state.
+ */
+#define STATE_MACHINE_OBSERVER_ANY      0xFFFFFFFF
+
+/**
+ * @def STATE_MACHINE_OBSERVER_BATCH
+ * @brief Number of notifications stored by the batch of a thread (a full batch is flushed).
+ */
+#define STATE_MACHINE_OBSERVER_BATCH    256
+
+
+
+/**
+ * @typedef fsm_observers_t
+ * @brief Data type used to handle a registry of observers.
+ */
+typedef struct _fsm_observers_t fsm_observers_t;
+
+/**
+ * @typedef fsm_notification_t
+ * @brief Data type used to describe a transition to the observers.
+ */
+typedef struct _fsm_notification_t fsm_notification_t;
+
+/**
+ * @typedef fsm_observer_t
+ * @brief Pointer to the function that receives the notifications of a subscription.
+ * WARNING: The function must not change the subscriptions of the registry.
+ * @param notes The transitions, in the order they were executed by the thread.
+ * @param note_nr Number of transitions.
+ * @param data Parameter given with the subscription.
+ */
+typedef void (*fsm_observer_t) (const fsm_notification_t *notes, uint32_t note_nr, void *data);
+
+
+
+/**
+ * @struct _fsm_notification_t
+ * @brief Transition of a state machine.
+ */
+struct _fsm_notification_t {
+    fsm_t *fsm;                 /**< The state machine */
+    uint32_t exit_state_id;     /**< The old state */
+    uint32_t enter_state_id;    /**< The new state */
+};
+
+
+
+/**
+ * @fn state_machine_observers_create
+ * @brief Create an empty registry.
+ * @return The new registry, NULL if the memory is not available.
+ */
+fsm_observers_t* state_machine_observers_create (void);
+
+/**
+ * @fn state_machine_observers_destroy
+ * @brief Release a registry.
+ * WARNING: The state machines must be detached and the batches of the threads flushed first.
+ */
+void state_machine_observers_destroy (fsm_observers_t *observers);
+
+/**
+ * @fn state_machine_observers_subscribe
+ * @brief Add a subscription to the registry.
+ * Example: (ANY, ANY) receives all the transitions, (ANY, s) the ones entering s,
+ * (s, ANY) the ones leaving s and (a, b) the edge from a to b.
+ * @param observers The registry.
+ * @param exit_state_id Exit state of the transitions ("STATE_MACHINE_OBSERVER_ANY" for any state).
+ * @param enter_state_id Enter state of the transitions ("STATE_MACHINE_OBSERVER_ANY" for any state).
+ * @param observer Function that receives the notifications.
+ * @param data Parameter passed to the function.
+ * @return true if the subscription was added, false if the memory is not available.
+ */
+bool state_machine_observers_subscribe (fsm_observers_t *observers, uint32_t exit_state_id, uint32_t enter_state_id, fsm_observer_t observer, void *data);
+
+/**
+ * @fn state_machine_observers_unsubscribe
+ * @brief Remove all the subscriptions of a function with the given parameter.
+ * @return The number of subscriptions removed.
+ */
+uint32_t state_machine_observers_unsubscribe (fsm_observers_t *observers, fsm_observer_t observer, void *data);
+
+/**
+ * @fn state_machine_observers_attach
+ * @brief Notify the transitions of the given state machine to the registry (a state machine attached to another registry is moved).
+ * The hook set before is kept and called by the one of the registry (see "state_machine_hook_link").
+ * @return true if the state machine was attached, false if the memory is not available.
+ */
+bool state_machine_observers_attach (fsm_observers_t *observers, fsm_t *fsm);
+
+/**
+ * @fn state_machine_observers_detach
+ * @brief Stop notifying the transitions of the given state machine (the other hooks are kept).
+ * INFO: The transitions already in a batch are still delivered.
+ */
+void state_machine_observers_detach (fsm_t *fsm);
+
+/**
+ * @fn state_machine_observers_flush
+ * @brief Deliver the notifications stored in the batch of the calling thread.
+ * INFO: The transitions executed by the observers are delivered by the next flush. A
+ * transition that finds the batch full during a flush is lost.
+ */
+void state_machine_observers_flush (void);
+
+
+
+#endif
@@ -0,0 +1,500 @@
+/**
+ * @file state_machine_pool.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "state_machine_pool.h"
+
+
+
+/**
+ * @def STATE_MACHINE_POOL_SLOT_NR
+ * @brief Maximum number of pools that can use the thread caches at the same time.
+ * INFO: Pools created when all the slots are in use work without thread caches.
+ */
+#define STATE_MACHINE_POOL_SLOT_NR      16
+
+/**
+ * @def STATE_MACHINE_POOL_BATCH
+ * @brief Number of blocks moved between a thread cache and the pool with a single lock.
+ */
+#define STATE_MACHINE_POOL_BATCH        32
+
+/**
+ * @def STATE_MACHINE_POOL_CACHE_MAX
+ * @brief Maximum number of free blocks kept by a thread cache.
+ */
+#define STATE_MACHINE_POOL_CACHE_MAX    (2 * STATE_MACHINE_POOL_BATCH)
+
+/**
+ * @def STATE_MACHINE_POOL_NO_SLOT
+ * @brief Slot of the pools without thread caches.
+ */
+#define STATE_MACHINE_POOL_NO_SLOT      0xFFFFFFFF
+
+
+
+/**
+ * @typedef fsm_pool_cache_t
+ * @brief Free blocks of a pool cached by a thread.
+ */
+typedef struct _fsm_pool_cache_t fsm_pool_cache_t;
+
+/**
+ * @struct _fsm_pool_cache_t
+ * @brief See "fsm_pool_cache_t" for details.
+ */
+struct _fsm_pool_cache_t {
+    uint64_t pool_id;           /**< ID of the pool that owns the blocks */
+    void *head;                 /**< List of the free blocks */
+    uint32_t count;             /**< Number of free blocks */
+};
+
+/**
+ * @struct _fsm_pool_t
+ * @brief See "fsm_pool_t" for details.
+ * INFO: The first bytes of free blocks and slabs store the pointer to the next item of their list.
+ */
+struct _fsm_pool_t {
+    uint64_t id;                /**< Unique ID of the pool */
+    uint32_t slot;              /**< Index of the thread cache used by the pool */
+
+    size_t block_size;          /**< Size of the blocks (multiple of the alignment) */
+    size_t align;               /**< Alignment of the blocks */
+    size_t slab_header;         /**< Space reserved at the beginning of every slab */
+    uint32_t blocks_per_slab;   /**< Number of blocks of every slab */
+    fsm_allocator_t slab_allocator; /**< Allocator of the slabs */
+
+    pthread_mutex_t lock;       /**< Lock of the shared lists */
+    void *free_list;            /**< Free blocks not cached by threads */
+    void *slabs;                /**< Slabs allocated by the pool */
+};
+
+
+
+/**
+ * @var state_machine_pool_next_id
+ * @brief Last ID assigned to a pool.
+ */
+static uint64_t state_machine_pool_next_id = 0;
+
+/**
+ * @var state_machine_pool_slots
+ * @brief Pool that owns every slot of the thread caches (NULL if free).
+ */
+static fsm_pool_t *state_machine_pool_slots[STATE_MACHINE_POOL_SLOT_NR];
+
+/**
+ * @var state_machine_pool_slots_lock
+ * @brief Lock of "state_machine_pool_slots" (a pool is not destroyed while the caches of an exiting thread are flushed).
+ */
+static pthread_mutex_t state_machine_pool_slots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @var state_machine_pool_key
+ * @brief Key used to flush the caches of the threads when they exit.
+ */
+static pthread_key_t state_machine_pool_key;
+
+/**
+ * @var state_machine_pool_key_once
+ * @brief Creation of "state_machine_pool_key".
+ */
+static pthread_once_t state_machine_pool_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @var state_machine_pool_key_ready
+ * @brief true if "state_machine_pool_key" was created (the thread caches are used only if so).
+ */
+static bool state_machine_pool_key_ready = false;
+
+/**
+ * @var state_machine_pool_caches
+ * @brief Caches of the running thread.
+ */
+static __thread fsm_pool_cache_t state_machine_pool_caches[STATE_MACHINE_POOL_SLOT_NR];
+
+
+
+/**
+ * @fn state_machine_pool_cache
+ * @brief Get the cache of the running thread for the given pool.
+ * @param pool The pool.
+ * @return The cache, NULL if the pool does not use thread caches.
+ */
+static fsm_pool_cache_t* state_machine_pool_cache (fsm_pool_t *pool);
+
+/**
+ * @fn state_machine_pool_key_create
+ * @brief Create the key that flushes the caches of the exiting threads (see "pthread_once").
+ */
+static void state_machine_pool_key_create (void);
+
+/**
+ * @fn state_machine_pool_flush
+ * @brief Give the blocks cached by an exiting thread back to their pools (destructor of "state_machine_pool_key").
+ * @param caches The caches of the thread.
+ */
+static void state_machine_pool_flush (void *caches);
+
+/**
+ * @fn state_machine_pool_grow
+ * @brief Add a new slab to the free list of the pool.
+ * WARNING: It must be called with the lock of the pool.
+ * @param pool The pool.
+ * @return true if the slab was added, false if the memory is not available.
+ */
+static bool state_machine_pool_grow (fsm_pool_t *pool);
+
+/**
+ * @fn state_machine_pool_alloc_block
+ * @brief Allocator interface: see "fsm_alloc_t" for details.
+ */
+static void* state_machine_pool_alloc_block (void *ctx, size_t size, size_t align);
+
+/**
+ * @fn state_machine_pool_free_block
+ * @brief Allocator interface: see "fsm_free_t" for details.
+ */
+static void state_machine_pool_free_block (void *ctx, void *ptr);
+
+
+
+fsm_pool_t* state_machine_pool_create (size_t block_size, size_t align, uint32_t blocks_per_slab)
+{
+    return(state_machine_pool_create_ex(block_size, align, blocks_per_slab, NULL));
+}
+
+
+
+fsm_pool_t* state_machine_pool_create_ex (size_t block_size, size_t align, uint32_t blocks_per_slab, const fsm_allocator_t *slab_allocator)
+{
+    fsm_pool_t *pool;
+    uint32_t cntr;
+
+    /* Check for valid parameters */
+    if ((block_size == 0) || (blocks_per_slab == 0) || ((align & (align - 1)) != 0))
+    {
+        return(NULL);
+    }
+
+    pool = (fsm_pool_t *)calloc(1, sizeof(fsm_pool_t));
+    if (pool == NULL)
+    {
+        return(NULL);
+    }
+
+    /* Free blocks store a pointer */
+    if (align < sizeof(void *))
+    {
+        align = sizeof(void *);
+    }
+
+    pool->align = align;
+    pool->block_size = (block_size + align - 1) & ~(align - 1);
+    pool->slab_header = (sizeof(void *) + align - 1) & ~(align - 1);
+    pool->blocks_per_slab = blocks_per_slab;
+    pool->slab_allocator = (slab_allocator != NULL) ? *slab_allocator : state_machine_malloc_allocator;
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0)
+    {
+        free(pool);
+        return(NULL);
+    }
+
+    /* Reserve a slot of the thread caches (only if they can be flushed when the threads exit) */
+    pool->id = __atomic_add_fetch(&state_machine_pool_next_id, 1, __ATOMIC_RELAXED);
+    pool->slot = STATE_MACHINE_POOL_NO_SLOT;
+
+    pthread_once(&state_machine_pool_key_once, state_machine_pool_key_create);
+    if (state_machine_pool_key_ready == false)
+    {
+        return(pool);
+    }
+
+    pthread_mutex_lock(&state_machine_pool_slots_lock);
+
+    for (cntr = 0; cntr < STATE_MACHINE_POOL_SLOT_NR; cntr++)
+    {
+        if (state_machine_pool_slots[cntr] == NULL)
+        {
+            state_machine_pool_slots[cntr] = pool;
+            pool->slot = cntr;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&state_machine_pool_slots_lock);
+
+    return(pool);
+}
+
+
+
+void state_machine_pool_destroy (fsm_pool_t *pool)
+{
+    void *slab;
+    void *next;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    /*
+     Release the slot: the blocks still cached by the threads are discarded when
+     the slot is used by a new pool (see "state_machine_pool_cache").
+     */
+    if (pool->slot != STATE_MACHINE_POOL_NO_SLOT)
+    {
+        pthread_mutex_lock(&state_machine_pool_slots_lock);
+        state_machine_pool_slots[pool->slot] = NULL;
+        pthread_mutex_unlock(&state_machine_pool_slots_lock);
+    }
+
+    for (slab = pool->slabs; slab != NULL; slab = next)
+    {
+        next = *(void **)slab;
+        pool->slab_allocator.free(pool->slab_allocator.ctx, slab);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+
+
+void* state_machine_pool_alloc (fsm_pool_t *pool)
+{
+    fsm_pool_cache_t *cache;
+    void *block;
+    uint32_t cntr;
+
+    cache = state_machine_pool_cache(pool);
+
+    /* Fast path: the block is taken from the cache of the thread */
+    if ((cache != NULL) && (cache->count > 0))
+    {
+        block = cache->head;
+        cache->head = *(void **)block;
+        cache->count--;
+
+        return(block);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((pool->free_list == NULL) && (state_machine_pool_grow(pool) == false))
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return(NULL);
+    }
+
+    block = pool->free_list;
+    pool->free_list = *(void **)block;
+
+    /* Refill the cache of the thread */
+    if (cache != NULL)
+    {
+        for (cntr = 0; (cntr < STATE_MACHINE_POOL_BATCH) && (pool->free_list != NULL); cntr++)
+        {
+            void *item = pool->free_list;
+
+            pool->free_list = *(void **)item;
+            *(void **)item = cache->head;
+            cache->head = item;
+            cache->count++;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return(block);
+}
+
+
+
+void state_machine_pool_free (fsm_pool_t *pool, void *block)
+{
+    fsm_pool_cache_t *cache;
+    void *first;
+    void *last;
+    uint32_t cntr;
+
+    if (block == NULL)
+    {
+        return;
+    }
+
+    cache = state_machine_pool_cache(pool);
+
+    if (cache == NULL)
+    {
+        pthread_mutex_lock(&pool->lock);
+        *(void **)block = pool->free_list;
+        pool->free_list = block;
+        pthread_mutex_unlock(&pool->lock);
+
+        return;
+    }
+
+    /* Fast path: the block is stored in the cache of the thread */
+    *(void **)block = cache->head;
+    cache->head = block;
+    cache->count++;
+
+    if (cache->count <= STATE_MACHINE_POOL_CACHE_MAX)
+    {
+        return;
+    }
+
+    /* The cache is full: give a batch of blocks back to the pool */
+    first = cache->head;
+    last = first;
+    for (cntr = 1; cntr < STATE_MACHINE_POOL_BATCH; cntr++)
+    {
+        last = *(void **)last;
+    }
+
+    cache->head = *(void **)last;
+    cache->count -= STATE_MACHINE_POOL_BATCH;
+
+    pthread_mutex_lock(&pool->lock);
+    *(void **)last = pool->free_list;
+    pool->free_list = first;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+void state_machine_pool_allocator (fsm_pool_t *pool, fsm_allocator_t *allocator)
+{
+    allocator->alloc = state_machine_pool_alloc_block;
+    allocator->free = state_machine_pool_free_block;
+    allocator->ctx = pool;
+}
+
+
+
+static fsm_pool_cache_t* state_machine_pool_cache (fsm_pool_t *pool)
+{
+    fsm_pool_cache_t *cache;
+
+    if (pool->slot == STATE_MACHINE_POOL_NO_SLOT)
+    {
+        return(NULL);
+    }
+
+    cache = &state_machine_pool_caches[pool->slot];
+
+    /* The blocks of a cache owned by a different pool belong to a pool already destroyed */
+    if (cache->pool_id != pool->id)
+    {
+        cache->pool_id = pool->id;
+        cache->head = NULL;
+        cache->count = 0;
+
+        /* The destructor of the key is called at the exit of the thread only if a value is set */
+        pthread_setspecific(state_machine_pool_key, state_machine_pool_caches);
+    }
+
+    return(cache);
+}
+
+
+
+static void state_machine_pool_key_create (void)
+{
+    state_machine_pool_key_ready = (pthread_key_create(&state_machine_pool_key, state_machine_pool_flush) == 0);
+}
+
+
+
+static void state_machine_pool_flush (void *caches)
+{
+    fsm_pool_cache_t *cache;
+    fsm_pool_t *pool;
+    void *last;
+    uint32_t cntr;
+
+    pthread_mutex_lock(&state_machine_pool_slots_lock);
+
+    for (cntr = 0; cntr < STATE_MACHINE_POOL_SLOT_NR; cntr++)
+    {
+        cache = &((fsm_pool_cache_t *)caches)[cntr];
+        pool = state_machine_pool_slots[cntr];
+
+        /* The blocks of a pool already destroyed are discarded */
+        if ((cache->count > 0) && (pool != NULL) && (pool->id == cache->pool_id))
+        {
+            for (last = cache->head; *(void **)last != NULL; last = *(void **)last)
+            {
+            }
+
+            pthread_mutex_lock(&pool->lock);
+            *(void **)last = pool->free_list;
+            pool->free_list = cache->head;
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        cache->pool_id = 0;
+        cache->head = NULL;
+        cache->count = 0;
+    }
+
+    pthread_mutex_unlock(&state_machine_pool_slots_lock);
+}
+
+
+
+static bool state_machine_pool_grow (fsm_pool_t *pool)
+{
+    char *slab;
+    char *block;
+    uint32_t cntr;
+
+    slab = (char *)pool->slab_allocator.alloc(pool->slab_allocator.ctx,
+                                              pool->slab_header + pool->blocks_per_slab * pool->block_size, pool->align);
+    if (slab == NULL)
+    {
+        return(false);
+    }
+
+    /* Add the slab to the list of the pool */
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+
+    /* Add the blocks to the free list (in ascending order of address) */
+    block = slab + pool->slab_header + (size_t)(pool->blocks_per_slab - 1) * pool->block_size;
+    for (cntr = 0; cntr < pool->blocks_per_slab; cntr++)
+    {
+        *(void **)block = pool->free_list;
+        pool->free_list = block;
+        block -= pool->block_size;
+    }
+
+    return(true);
+}
+
+
+
+static void* state_machine_pool_alloc_block (void *ctx, size_t size, size_t align)
+{
+    fsm_pool_t *pool = (fsm_pool_t *)ctx;
+
+    if ((size > pool->block_size) || (align > pool->align))
+    {
+        return(NULL);
+    }
+
+    return(state_machine_pool_alloc(pool));
+}
+
+
+
+static void state_machine_pool_free_block (void *ctx, void *ptr)
+{
+    state_machine_pool_free((fsm_pool_t *)ctx, ptr);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file state_machine_pool.h
+ * @brief Pool of fixed-size blocks used to allocate state machines.
+ *
+ * The blocks are carved from large slabs. Every thread keeps a small cache of free
+ * blocks, so most of the allocations and releases do not take the lock of the pool.
+ * The blocks cached by a thread are given back to the pool when the thread exits.
+ *
+ * Example:
+ *     fsm_allocator_t allocator;
+ *     fsm_attr_t attr = { &allocator };
+ *     fsm_pool_t *pool = state_machine_pool_create(state_machine_size(8, NULL), 16, 1024);
+ *
+ *     state_machine_pool_allocator(pool, &allocator);
+ *     fsm = state_machine_init_ex(8, 0, &attr);
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_POOL_H
+#define STATE_MACHINE_POOL_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @typedef fsm_pool_t
+ * @brief Data type used to handle a pool of blocks.
+ */
+typedef struct _fsm_pool_t fsm_pool_t;
+
+
+
+/**
+ * @fn state_machine_pool_create
+ * @brief Create a new pool.
+ * @param block_size Size of the blocks (e.g. the result of "state_machine_size").
+ * @param align Alignment of the blocks (power of 2).
+ * @param blocks_per_slab Number of blocks allocated every time the pool grows.
+ * @return The new pool, NULL if the memory is not available.
+ */
+fsm_pool_t* state_machine_pool_create (size_t block_size, size_t align, uint32_t blocks_per_slab);
+
+/**
+ * @fn state_machine_pool_create_ex
+ * @brief Create a new pool that takes the slabs from the given allocator.
+ * Example: It is used to place the slabs on a given NUMA node.
+ * See "state_machine_pool_create" for details.
+ * @param slab_allocator Allocator of the slabs (NULL to use "state_machine_malloc_allocator").
+ */
+fsm_pool_t* state_machine_pool_create_ex (size_t block_size, size_t align, uint32_t blocks_per_slab, const fsm_allocator_t *slab_allocator);
+
+/**
+ * @fn state_machine_pool_destroy
+ * @brief Release the pool and all its blocks.
+ * WARNING: The blocks must not be used after the call of this function.
+ * @param pool The pool to be released.
+ */
+void state_machine_pool_destroy (fsm_pool_t *pool);
+
+/**
+ * @fn state_machine_pool_alloc
+ * @brief Get a block from the pool.
+ * @param pool The target pool.
+ * @return Pointer to the block, NULL if the memory is not available.
+ */
+void* state_machine_pool_alloc (fsm_pool_t *pool);
+
+/**
+ * @fn state_machine_pool_free
+ * @brief Give a block back to the pool.
+ * INFO: The block can be released by a thread different from the one that allocated it.
+ * @param pool The target pool.
+ * @param block The block to be released.
+ */
+void state_machine_pool_free (fsm_pool_t *pool, void *block);
+
+/**
+ * @fn state_machine_pool_allocator
+ * @brief Fill an allocator that takes the memory from the given pool.
+ * Allocations bigger than the blocks of the pool fail.
+ * @param pool The pool.
+ * @param allocator The allocator to be filled.
+ */
+void state_machine_pool_allocator (fsm_pool_t *pool, fsm_allocator_t *allocator);
+
+
+
+#endif
@@ -0,0 +1,504 @@
+/**
+ * @file state_machine_profile.c
+ */
+
+#include <stdlib.h>
+
+#include "state_machine_profile.h"
+
+
+
+/**
+ * @def STATE_MACHINE_PROFILE_EMPTY
+ * @brief Key of the free entries of the table (no transition has this key).
+ */
+#define STATE_MACHINE_PROFILE_EMPTY     0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * @def STATE_MACHINE_PROFILE_MIN_SIZE
+ * @brief Initial number of entries of the table.
+ */
+#define STATE_MACHINE_PROFILE_MIN_SIZE  64
+
+/**
+ * @def STATE_MACHINE_PROFILE_NONE
+ * @brief Value of the links not assigned.
+ */
+#define STATE_MACHINE_PROFILE_NONE      0xFFFFFFFF
+
+
+
+/**
+ * @typedef fsm_profile_entry_t
+ * @brief Counter of a transition.
+ */
+typedef struct _fsm_profile_entry_t fsm_profile_entry_t;
+
+/**
+ * @typedef fsm_profile_binding_t
+ * @brief State machine attached to a profile.
+ */
+typedef struct _fsm_profile_binding_t fsm_profile_binding_t;
+
+/**
+ * @struct _fsm_profile_entry_t
+ * @brief See "fsm_profile_entry_t" for details.
+ */
+struct _fsm_profile_entry_t {
+    uint64_t key;               /**< Starting state (high 32 bits) and target state of the transition */
+    uint64_t count;             /**< Number of executions */
+};
+
+/**
+ * @struct _fsm_profile_binding_t
+ * @brief See "fsm_profile_binding_t" for details.
+ */
+struct _fsm_profile_binding_t {
+    fsm_hook_link_t link;       /**< Hook set before the attach (first field, see "state_machine_hook_link") */
+    fsm_profile_t *profile;     /**< The profile */
+};
+
+/**
+ * @struct _fsm_profile_t
+ * @brief See "fsm_profile_t" for details.
+ * INFO: The counters are stored in a hash table with linear probing, so the size of the
+ * profile depends on the transitions executed and not on the number of states.
+ */
+struct _fsm_profile_t {
+    uint32_t state_nr;          /**< Number of states */
+    uint32_t size;              /**< Number of entries of the table (power of 2) */
+    uint32_t used;              /**< Number of entries in use */
+    fsm_profile_entry_t *table; /**< Table of the counters */
+};
+
+
+
+/**
+ * @fn state_machine_profile_hook
+ * @brief Hook of the attached state machines: it counts the transition and calls the hook set before the attach.
+ */
+static void state_machine_profile_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+/**
+ * @fn state_machine_profile_find
+ * @brief Find the entry of the given key (or the free entry where it must be added).
+ */
+static fsm_profile_entry_t* state_machine_profile_find (const fsm_profile_t *profile, uint64_t key);
+
+/**
+ * @fn state_machine_profile_grow
+ * @brief Double the size of the table.
+ * @return true if the table was resized, false if the memory is not available.
+ */
+static bool state_machine_profile_grow (fsm_profile_t *profile);
+
+/**
+ * @fn state_machine_profile_compare
+ * @brief Order the transitions (or the chains) by decreasing number of executions, then by key (see "qsort").
+ */
+static int state_machine_profile_compare (const void *a, const void *b);
+
+/**
+ * @fn state_machine_profile_root
+ * @brief Get the chain of a state (union-find with path halving).
+ */
+static uint32_t state_machine_profile_root (uint32_t *chain, uint32_t id);
+
+
+
+fsm_profile_t* state_machine_profile_create (uint32_t state_nr)
+{
+    fsm_profile_t *profile;
+    uint32_t cntr;
+
+    if (state_nr == 0)
+    {
+        return(NULL);
+    }
+
+    profile = (fsm_profile_t *)calloc(1, sizeof(fsm_profile_t));
+    if (profile == NULL)
+    {
+        return(NULL);
+    }
+
+    profile->state_nr = state_nr;
+    profile->size = STATE_MACHINE_PROFILE_MIN_SIZE;
+    profile->table = (fsm_profile_entry_t *)malloc(profile->size * sizeof(fsm_profile_entry_t));
+    if (profile->table == NULL)
+    {
+        free(profile);
+        return(NULL);
+    }
+
+    for (cntr = 0; cntr < profile->size; cntr++)
+    {
+        profile->table[cntr].key = STATE_MACHINE_PROFILE_EMPTY;
+        profile->table[cntr].count = 0;
+    }
+
+    return(profile);
+}
+
+
+
+void state_machine_profile_destroy (fsm_profile_t *profile)
+{
+    if (profile == NULL)
+    {
+        return;
+    }
+
+    free(profile->table);
+    free(profile);
+}
+
+
+
+bool state_machine_profile_attach (fsm_profile_t *profile, fsm_t *fsm)
+{
+    fsm_profile_binding_t *binding;
+
+    if (state_machine_hook_find(fsm, state_machine_profile_hook) != NULL)
+    {
+        return(false);
+    }
+
+    binding = (fsm_profile_binding_t *)malloc(sizeof(fsm_profile_binding_t));
+    if (binding == NULL)
+    {
+        return(false);
+    }
+
+    binding->profile = profile;
+
+    state_machine_hook_link(fsm, state_machine_profile_hook, &binding->link);
+
+    return(true);
+}
+
+
+
+void state_machine_profile_detach (fsm_t *fsm)
+{
+    free(state_machine_hook_unlink(fsm, state_machine_profile_hook, NULL));
+}
+
+
+
+bool state_machine_profile_record (fsm_profile_t *profile, uint32_t exit_state_id, uint32_t enter_state_id, uint64_t count)
+{
+    fsm_profile_entry_t *entry;
+    uint64_t key;
+
+    if ((exit_state_id >= profile->state_nr) || (enter_state_id >= profile->state_nr))
+    {
+        return(false);
+    }
+
+    key = ((uint64_t)exit_state_id << 32) | enter_state_id;
+
+    entry = state_machine_profile_find(profile, key);
+    if (entry->key == STATE_MACHINE_PROFILE_EMPTY)
+    {
+        /* Keep the load of the table under 50% */
+        if ((profile->used + 1) * 2 > profile->size)
+        {
+            if (state_machine_profile_grow(profile) == false)
+            {
+                return(false);
+            }
+
+            entry = state_machine_profile_find(profile, key);
+        }
+
+        entry->key = key;
+        profile->used++;
+    }
+
+    entry->count += count;
+
+    return(true);
+}
+
+
+
+uint64_t state_machine_profile_count (const fsm_profile_t *profile, uint32_t exit_state_id, uint32_t enter_state_id)
+{
+    fsm_profile_entry_t *entry;
+
+    entry = state_machine_profile_find(profile, ((uint64_t)exit_state_id << 32) | enter_state_id);
+
+    return((entry->key != STATE_MACHINE_PROFILE_EMPTY) ? entry->count : 0);
+}
+
+
+
+bool state_machine_profile_merge (fsm_profile_t *dst, const fsm_profile_t *src)
+{
+    const fsm_profile_entry_t *entry;
+    uint32_t cntr;
+
+    if ((dst == src) || (dst->state_nr != src->state_nr))
+    {
+        return(false);
+    }
+
+    for (cntr = 0; cntr < src->size; cntr++)
+    {
+        entry = &src->table[cntr];
+
+        if ((entry->key != STATE_MACHINE_PROFILE_EMPTY) &&
+            (state_machine_profile_record(dst, (uint32_t)(entry->key >> 32), (uint32_t)entry->key, entry->count) == false))
+        {
+            return(false);
+        }
+    }
+
+    return(true);
+}
+
+
+
+bool state_machine_profile_layout (const fsm_profile_t *profile, uint32_t *layout)
+{
+    fsm_profile_entry_t *edges;
+    uint64_t *heat;
+    uint32_t *next;
+    uint32_t *prev;
+    uint32_t *chain;
+    uint32_t *heads;
+    uint32_t edge_nr;
+    uint32_t head_nr;
+    uint32_t hot_nr;
+    uint32_t exit_id;
+    uint32_t enter_id;
+    uint32_t cntr;
+    uint32_t pos;
+    uint32_t id;
+    uint32_t state_nr;
+    char *block;
+
+    state_nr = profile->state_nr;
+
+    /* Scratch: transitions (then the hot chains: at most 2 states for every transition), heat of the chains and the links of the states */
+    block = (char *)malloc(2 * (size_t)profile->used * sizeof(fsm_profile_entry_t) +
+                           (size_t)state_nr * (sizeof(uint64_t) + 4 * sizeof(uint32_t)));
+    if (block == NULL)
+    {
+        return(false);
+    }
+
+    edges = (fsm_profile_entry_t *)block;
+    heat = (uint64_t *)(block + 2 * (size_t)profile->used * sizeof(fsm_profile_entry_t));
+    next = (uint32_t *)(heat + state_nr);
+    prev = next + state_nr;
+    chain = prev + state_nr;
+    heads = chain + state_nr;
+
+    for (cntr = 0; cntr < state_nr; cntr++)
+    {
+        heat[cntr] = 0;
+        next[cntr] = STATE_MACHINE_PROFILE_NONE;
+        prev[cntr] = STATE_MACHINE_PROFILE_NONE;
+        chain[cntr] = cntr;
+    }
+
+    /* Take the transitions between different states */
+    edge_nr = 0;
+    for (cntr = 0; cntr < profile->size; cntr++)
+    {
+        if (profile->table[cntr].key == STATE_MACHINE_PROFILE_EMPTY)
+        {
+            continue;
+        }
+
+        exit_id = (uint32_t)(profile->table[cntr].key >> 32);
+        enter_id = (uint32_t)profile->table[cntr].key;
+
+        heat[exit_id] += profile->table[cntr].count;
+        heat[enter_id] += profile->table[cntr].count;
+
+        if (exit_id != enter_id)
+        {
+            edges[edge_nr++] = profile->table[cntr];
+        }
+    }
+
+    qsort(edges, edge_nr, sizeof(fsm_profile_entry_t), state_machine_profile_compare);
+
+    /* Join the chains: the target must follow the starting state */
+    for (cntr = 0; cntr < edge_nr; cntr++)
+    {
+        exit_id = (uint32_t)(edges[cntr].key >> 32);
+        enter_id = (uint32_t)edges[cntr].key;
+
+        if ((next[exit_id] != STATE_MACHINE_PROFILE_NONE) || (prev[enter_id] != STATE_MACHINE_PROFILE_NONE))
+        {
+            continue;
+        }
+
+        if (state_machine_profile_root(chain, exit_id) == state_machine_profile_root(chain, enter_id))
+        {
+            continue;
+        }
+
+        next[exit_id] = enter_id;
+        prev[enter_id] = exit_id;
+        chain[state_machine_profile_root(chain, enter_id)] = state_machine_profile_root(chain, exit_id);
+    }
+
+    /*
+     The heat of a chain is stored in the first state of the chain: the hot chains are
+     sorted (the transitions are no longer needed, so their storage is used), the cold
+     ones keep the order of the IDs.
+     */
+    head_nr = 0;
+    hot_nr = 0;
+    for (cntr = 0; cntr < state_nr; cntr++)
+    {
+        if (prev[cntr] == STATE_MACHINE_PROFILE_NONE)
+        {
+            for (id = next[cntr]; id != STATE_MACHINE_PROFILE_NONE; id = next[id])
+            {
+                heat[cntr] += heat[id];
+            }
+
+            if (heat[cntr] > 0)
+            {
+                edges[hot_nr].key = cntr;
+                edges[hot_nr].count = heat[cntr];
+                hot_nr++;
+            }
+            else
+            {
+                heads[head_nr++] = cntr;
+            }
+        }
+    }
+
+    /* Decreasing heat, then increasing ID of the first state (the order is stable) */
+    qsort(edges, hot_nr, sizeof(fsm_profile_entry_t), state_machine_profile_compare);
+
+    pos = 0;
+    for (cntr = 0; cntr < hot_nr; cntr++)
+    {
+        for (id = (uint32_t)edges[cntr].key; id != STATE_MACHINE_PROFILE_NONE; id = next[id])
+        {
+            layout[pos++] = id;
+        }
+    }
+
+    for (cntr = 0; cntr < head_nr; cntr++)
+    {
+        for (id = heads[cntr]; id != STATE_MACHINE_PROFILE_NONE; id = next[id])
+        {
+            layout[pos++] = id;
+        }
+    }
+
+    free(block);
+
+    return(true);
+}
+
+
+
+static void state_machine_profile_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data)
+{
+    fsm_profile_binding_t *binding = (fsm_profile_binding_t *)data;
+
+    state_machine_profile_record(binding->profile, exit_state_id, enter_state_id, 1);
+
+    if (binding->link.on_transition != NULL)
+    {
+        binding->link.on_transition(fsm, exit_state_id, enter_state_id, binding->link.hook_data);
+    }
+}
+
+
+
+static fsm_profile_entry_t* state_machine_profile_find (const fsm_profile_t *profile, uint64_t key)
+{
+    uint32_t mask;
+    uint32_t pos;
+
+    mask = profile->size - 1;
+    pos = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while ((profile->table[pos].key != key) && (profile->table[pos].key != STATE_MACHINE_PROFILE_EMPTY))
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return(&profile->table[pos]);
+}
+
+
+
+static bool state_machine_profile_grow (fsm_profile_t *profile)
+{
+    fsm_profile_entry_t *old_table;
+    fsm_profile_entry_t *entry;
+    uint32_t old_size;
+    uint32_t cntr;
+
+    old_table = profile->table;
+    old_size = profile->size;
+
+    profile->table = (fsm_profile_entry_t *)malloc(2 * (size_t)old_size * sizeof(fsm_profile_entry_t));
+    if (profile->table == NULL)
+    {
+        profile->table = old_table;
+        return(false);
+    }
+
+    profile->size = 2 * old_size;
+    for (cntr = 0; cntr < profile->size; cntr++)
+    {
+        profile->table[cntr].key = STATE_MACHINE_PROFILE_EMPTY;
+        profile->table[cntr].count = 0;
+    }
+
+    for (cntr = 0; cntr < old_size; cntr++)
+    {
+        if (old_table[cntr].key != STATE_MACHINE_PROFILE_EMPTY)
+        {
+            entry = state_machine_profile_find(profile, old_table[cntr].key);
+            *entry = old_table[cntr];
+        }
+    }
+
+    free(old_table);
+
+    return(true);
+}
+
+
+
+static int state_machine_profile_compare (const void *a, const void *b)
+{
+    const fsm_profile_entry_t *first = (const fsm_profile_entry_t *)a;
+    const fsm_profile_entry_t *second = (const fsm_profile_entry_t *)b;
+
+    if (first->count != second->count)
+    {
+        return((first->count > second->count) ? -1 : 1);
+    }
+
+    /* Same count: order by key, so the layout does not depend on the table */
+    return((first->key < second->key) ? -1 : (first->key > second->key));
+}
+
+
+
+static uint32_t state_machine_profile_root (uint32_t *chain, uint32_t id)
+{
+    while (chain[id] != id)
+    {
+        chain[id] = chain[chain[id]];
+        id = chain[id];
+    }
+
+    return(id);
+}
@@ -0,0 +1,97 @@
+/**
+ * @file state_machine_profile.h
+ * @brief Profile of the transitions of state machines, used to order their states in memory.
+ *
+ * A profile counts how many times every transition is executed, either by state
+ * machines attached to it or by counters loaded from a trace. The counts are used
+ * to compute a layout ("fsm_attr_t.layout") that places the states executed one
+ * after the other in adjacent records, so the hot paths touch fewer cache lines.
+ * The IDs of the states do not change.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_PROFILE_H
+#define STATE_MACHINE_PROFILE_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @typedef fsm_profile_t
+ * @brief Data type used to store the profile of the transitions.
+ */
+typedef struct _fsm_profile_t fsm_profile_t;
+
+
+
+/**
+ * @fn state_machine_profile_create
+ * @brief Create an empty profile.
+ * @param state_nr Number of states of the profiled state machines.
+ * @return The new profile, NULL if the memory is not available.
+ */
+fsm_profile_t* state_machine_profile_create (uint32_t state_nr);
+
+/**
+ * @fn state_machine_profile_destroy
+ * @brief Release a profile.
+ * WARNING: The state machines attached to the profile must be detached first.
+ */
+void state_machine_profile_destroy (fsm_profile_t *profile);
+
+/**
+ * @fn state_machine_profile_attach
+ * @brief Count the transitions of the given state machine.
+ * The hook set before is kept and called by the one of the profile (see "state_machine_hook_link").
+ * WARNING: A profile is not thread safe: the state machines run by different threads
+ * must use different profiles (see "state_machine_profile_merge").
+ * @return true if the state machine was attached, false if it is already attached or the memory is not available.
+ */
+bool state_machine_profile_attach (fsm_profile_t *profile, fsm_t *fsm);
+
+/**
+ * @fn state_machine_profile_detach
+ * @brief Stop counting the transitions of the given state machine (the hook set before the attach is restored).
+ */
+void state_machine_profile_detach (fsm_t *fsm);
+
+/**
+ * @fn state_machine_profile_record
+ * @brief Add executions of a transition to the profile (e.g. counters read from a trace).
+ * @param profile The profile.
+ * @param exit_state_id Starting state of the transition.
+ * @param enter_state_id Target state of the transition.
+ * @param count Number of executions.
+ * @return true if the executions were added, false if the states are not valid or the memory is not available.
+ */
+bool state_machine_profile_record (fsm_profile_t *profile, uint32_t exit_state_id, uint32_t enter_state_id, uint64_t count);
+
+/**
+ * @fn state_machine_profile_count
+ * @brief Get the number of executions of a transition.
+ */
+uint64_t state_machine_profile_count (const fsm_profile_t *profile, uint32_t exit_state_id, uint32_t enter_state_id);
+
+/**
+ * @fn state_machine_profile_merge
+ * @brief Add the counts of a profile to another one.
+ * @return true if the counts were added, false if the profiles do not match (or are the same) or the memory is not available.
+ */
+bool state_machine_profile_merge (fsm_profile_t *dst, const fsm_profile_t *src);
+
+/**
+ * @fn state_machine_profile_layout
+ * @brief Compute the order of the states that keeps the frequent transitions between adjacent states.
+ * The most frequent transitions are taken first and join their states in chains; the chains
+ * are then placed by decreasing number of executions (states never executed are the last ones).
+ * @param profile The profile.
+ * @param layout Destination of the order ("state_nr" state IDs, see "fsm_attr_t.layout").
+ * @return true if the layout was computed, false if the memory is not available.
+ */
+bool state_machine_profile_layout (const fsm_profile_t *profile, uint32_t *layout);
+
+
+
+#endif
@@ -0,0 +1,433 @@
+/**
+ * @file state_machine_queue.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_machine_queue.h"
+
+
+
+/**
+ * @def STATE_MACHINE_QUEUE_EMPTY
+ * @brief Key of the free items of the deferral table (no state defers this event).
+ */
+#define STATE_MACHINE_QUEUE_EMPTY       0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * @def STATE_MACHINE_QUEUE_MIN_SIZE
+ * @brief Initial number of items of the deferral table.
+ */
+#define STATE_MACHINE_QUEUE_MIN_SIZE    16
+
+
+
+/**
+ * @typedef fsm_queue_ring_t
+ * @brief Ring of the events of a priority level.
+ */
+typedef struct _fsm_queue_ring_t fsm_queue_ring_t;
+
+/**
+ * @struct _fsm_queue_ring_t
+ * @brief See "fsm_queue_ring_t" for details.
+ */
+struct _fsm_queue_ring_t {
+    uint32_t *events;           /**< The events ("capacity" items) */
+    uint32_t head;              /**< Position of the oldest event */
+    uint32_t count;             /**< Number of events */
+};
+
+/**
+ * @struct _fsm_queue_t
+ * @brief See "fsm_queue_t" for details.
+ * INFO: The queue and the rings are stored in a single block. The deferrals are the keys
+ * (state in the high 32 bits, event in the low ones) of a hash table with linear
+ * probing, so their memory depends on the deferrals set and not on the number of states.
+ */
+struct _fsm_queue_t {
+    fsm_t *fsm;                 /**< The state machine */
+    uint32_t capacity;          /**< Size of every ring (power of 2) */
+    uint32_t level_nr;          /**< Number of priority levels */
+    uint64_t *deferred;         /**< Table of the deferrals (NULL if none was set) */
+    uint32_t deferred_size;     /**< Number of items of the table (power of 2) */
+    uint32_t deferred_nr;       /**< Number of deferrals */
+    uint32_t scan_state;        /**< State of the last search of the queued events */
+    bool dirty;                 /**< true if the queued events must be searched again */
+    uint64_t dropped;           /**< Number of queued events dropped */
+    fsm_queue_ring_t rings[STATE_MACHINE_QUEUE_MAX_LEVELS];  /**< Rings of the levels */
+};
+
+
+
+/**
+ * @fn state_machine_queue_is_deferred
+ * @brief Check if a state defers an event.
+ */
+static bool state_machine_queue_is_deferred (const fsm_queue_t *queue, uint32_t state_id, uint32_t target_id);
+
+/**
+ * @fn state_machine_queue_find
+ * @brief Find the item of a deferral in the table (or the free item where it must be added).
+ */
+static uint32_t state_machine_queue_find (const fsm_queue_t *queue, uint64_t key);
+
+/**
+ * @fn state_machine_queue_grow
+ * @brief Double the size of the deferral table.
+ * @return true if the table was resized, false if the memory is not available.
+ */
+static bool state_machine_queue_grow (fsm_queue_t *queue);
+
+/**
+ * @fn state_machine_queue_remove
+ * @brief Remove an event from a ring, keeping the order of the others.
+ * @param queue The queue.
+ * @param ring The ring.
+ * @param index Position of the event, starting from the oldest one.
+ */
+static void state_machine_queue_remove (const fsm_queue_t *queue, fsm_queue_ring_t *ring, uint32_t index);
+
+/**
+ * @fn state_machine_queue_dispatch
+ * @brief Dispatch the first queued event handled by the actual state and drop the ones not deferred.
+ */
+static void state_machine_queue_dispatch (fsm_queue_t *queue);
+
+
+
+fsm_queue_t* state_machine_queue_create (fsm_t *fsm, uint32_t capacity, uint32_t level_nr)
+{
+    fsm_queue_t *queue;
+    uint32_t size;
+    uint32_t *events;
+    uint32_t cntr;
+
+    if ((fsm == NULL) || (capacity == 0) || (capacity > 0x80000000) || (level_nr == 0) || (level_nr > STATE_MACHINE_QUEUE_MAX_LEVELS))
+    {
+        return(NULL);
+    }
+
+    for (size = 1; size < capacity; size <<= 1);
+
+    /* Queue and rings */
+    queue = (fsm_queue_t *)calloc(1, sizeof(fsm_queue_t) + (size_t)level_nr * size * sizeof(uint32_t));
+    if (queue == NULL)
+    {
+        return(NULL);
+    }
+
+    queue->fsm = fsm;
+    queue->capacity = size;
+    queue->level_nr = level_nr;
+    queue->scan_state = fsm->get_state(fsm);
+
+    events = (uint32_t *)(queue + 1);
+    for (cntr = 0; cntr < level_nr; cntr++)
+    {
+        queue->rings[cntr].events = events + (size_t)cntr * size;
+    }
+
+    return(queue);
+}
+
+
+
+void state_machine_queue_destroy (fsm_queue_t *queue)
+{
+    if (queue == NULL)
+    {
+        return;
+    }
+
+    free(queue->deferred);
+    free(queue);
+}
+
+
+
+bool state_machine_queue_defer (fsm_queue_t *queue, uint32_t state_id, uint32_t target_id, bool defer)
+{
+    uint64_t key;
+    uint32_t mask;
+    uint32_t pos;
+    uint32_t next;
+    uint32_t home;
+
+    if ((state_id >= queue->fsm->state_nr) || (target_id >= queue->fsm->state_nr))
+    {
+        return(false);
+    }
+
+    key = ((uint64_t)state_id << 32) | target_id;
+
+    if (defer == true)
+    {
+        /* Keep the load of the table under 50% */
+        if (((queue->deferred_nr + 1) * 2 > queue->deferred_size) && (state_machine_queue_grow(queue) == false))
+        {
+            return(false);
+        }
+
+        pos = state_machine_queue_find(queue, key);
+        if (queue->deferred[pos] == STATE_MACHINE_QUEUE_EMPTY)
+        {
+            queue->deferred[pos] = key;
+            queue->deferred_nr++;
+        }
+    }
+    else if (queue->deferred_nr > 0)
+    {
+        pos = state_machine_queue_find(queue, key);
+        if (queue->deferred[pos] == key)
+        {
+            /* The following keys of the probe sequence move back to the free item */
+            mask = queue->deferred_size - 1;
+            for (next = (pos + 1) & mask; queue->deferred[next] != STATE_MACHINE_QUEUE_EMPTY; next = (next + 1) & mask)
+            {
+                home = (uint32_t)((queue->deferred[next] * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+                if (((next - home) & mask) >= ((next - pos) & mask))
+                {
+                    queue->deferred[pos] = queue->deferred[next];
+                    pos = next;
+                }
+            }
+
+            queue->deferred[pos] = STATE_MACHINE_QUEUE_EMPTY;
+            queue->deferred_nr--;
+        }
+    }
+
+    queue->dirty = true;
+
+    return(true);
+}
+
+
+
+bool state_machine_queue_post (fsm_queue_t *queue, uint32_t target_id, uint32_t level)
+{
+    fsm_t *fsm = queue->fsm;
+    fsm_queue_ring_t *ring;
+    uint32_t state;
+    uint32_t cntr;
+    bool direct;
+
+    if ((level >= queue->level_nr) || (target_id >= fsm->state_nr))
+    {
+        return(false);
+    }
+
+    state = fsm->get_state(fsm);
+
+    /* Events of the same or higher priority already queued go first */
+    direct = (state_machine_get_target(fsm) == state) && (state_machine_is_pending(fsm) == false);
+    for (cntr = 0; (cntr <= level) && (direct == true); cntr++)
+    {
+        direct = (queue->rings[cntr].count == 0);
+    }
+
+    if (direct == true)
+    {
+        if (fsm->go_to_state(fsm, target_id) == true)
+        {
+            return(true);
+        }
+
+        if (state_machine_queue_is_deferred(queue, state, target_id) == false)
+        {
+            return(false);
+        }
+    }
+
+    ring = &queue->rings[level];
+    if (ring->count == queue->capacity)
+    {
+        return(false);
+    }
+
+    ring->events[(ring->head + ring->count) & (queue->capacity - 1)] = target_id;
+    ring->count++;
+
+    queue->dirty = true;
+
+    return(true);
+}
+
+
+
+uint32_t state_machine_queue_run (fsm_queue_t *queue, void *par)
+{
+    fsm_t *fsm = queue->fsm;
+    uint32_t state;
+
+    state = fsm->get_state(fsm);
+
+    /* The deferred events are searched again after a transition */
+    if (state != queue->scan_state)
+    {
+        queue->scan_state = state;
+        queue->dirty = true;
+    }
+
+    if ((queue->dirty == true) && (state_machine_get_target(fsm) == state) && (state_machine_is_pending(fsm) == false))
+    {
+        state_machine_queue_dispatch(queue);
+    }
+
+    return(fsm->sm_run(fsm, par));
+}
+
+
+
+uint32_t state_machine_queue_size (const fsm_queue_t *queue)
+{
+    uint32_t size;
+    uint32_t cntr;
+
+    size = 0;
+    for (cntr = 0; cntr < queue->level_nr; cntr++)
+    {
+        size += queue->rings[cntr].count;
+    }
+
+    return(size);
+}
+
+
+
+uint64_t state_machine_queue_dropped (const fsm_queue_t *queue)
+{
+    return(queue->dropped);
+}
+
+
+
+static bool state_machine_queue_is_deferred (const fsm_queue_t *queue, uint32_t state_id, uint32_t target_id)
+{
+    uint64_t key;
+
+    if (queue->deferred_nr == 0)
+    {
+        return(false);
+    }
+
+    key = ((uint64_t)state_id << 32) | target_id;
+
+    return(queue->deferred[state_machine_queue_find(queue, key)] == key);
+}
+
+
+
+static uint32_t state_machine_queue_find (const fsm_queue_t *queue, uint64_t key)
+{
+    uint32_t mask;
+    uint32_t pos;
+
+    mask = queue->deferred_size - 1;
+    pos = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while ((queue->deferred[pos] != key) && (queue->deferred[pos] != STATE_MACHINE_QUEUE_EMPTY))
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return(pos);
+}
+
+
+
+static bool state_machine_queue_grow (fsm_queue_t *queue)
+{
+    uint64_t *old_table;
+    uint32_t old_size;
+    uint32_t size;
+    uint32_t cntr;
+
+    old_table = queue->deferred;
+    old_size = queue->deferred_size;
+    size = (old_size == 0) ? STATE_MACHINE_QUEUE_MIN_SIZE : 2 * old_size;
+
+    queue->deferred = (uint64_t *)malloc((size_t)size * sizeof(uint64_t));
+    if (queue->deferred == NULL)
+    {
+        queue->deferred = old_table;
+        return(false);
+    }
+
+    queue->deferred_size = size;
+    for (cntr = 0; cntr < size; cntr++)
+    {
+        queue->deferred[cntr] = STATE_MACHINE_QUEUE_EMPTY;
+    }
+
+    for (cntr = 0; cntr < old_size; cntr++)
+    {
+        if (old_table[cntr] != STATE_MACHINE_QUEUE_EMPTY)
+        {
+            queue->deferred[state_machine_queue_find(queue, old_table[cntr])] = old_table[cntr];
+        }
+    }
+
+    free(old_table);
+
+    return(true);
+}
+
+
+
+static void state_machine_queue_remove (const fsm_queue_t *queue, fsm_queue_ring_t *ring, uint32_t index)
+{
+    uint32_t mask = queue->capacity - 1;
+
+    /* The older events move one position forward */
+    for (; index > 0; index--)
+    {
+        ring->events[(ring->head + index) & mask] = ring->events[(ring->head + index - 1) & mask];
+    }
+
+    ring->head = (ring->head + 1) & mask;
+    ring->count--;
+}
+
+
+
+static void state_machine_queue_dispatch (fsm_queue_t *queue)
+{
+    fsm_t *fsm = queue->fsm;
+    fsm_queue_ring_t *ring;
+    uint32_t target;
+    uint32_t level;
+    uint32_t index;
+
+    queue->dirty = false;
+
+    for (level = 0; level < queue->level_nr; level++)
+    {
+        ring = &queue->rings[level];
+
+        index = 0;
+        while (index < ring->count)
+        {
+            target = ring->events[(ring->head + index) & (queue->capacity - 1)];
+
+            if (fsm->go_to_state(fsm, target) == true)
+            {
+                /* The other events are searched again at the next run */
+                state_machine_queue_remove(queue, ring, index);
+                queue->dirty = true;
+                return;
+            }
+
+            if (state_machine_queue_is_deferred(queue, queue->scan_state, target) == true)
+            {
+                index++;
+                continue;
+            }
+
+            state_machine_queue_remove(queue, ring, index);
+            queue->dropped++;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * @file state_machine_queue.h
+ * @brief Queue of the events of a state machine, with deferral and priorities.
+ *
+ * An event is a required transition (the target of "go_to_state"). Events posted to
+ * the queue are dispatched one per transition: an event that the actual state can not
+ * handle is either kept in the queue, if the state defers it, or dropped. The kept
+ * events are dispatched again after the next transition. Every priority level has its
+ * own ring and the levels are dispatched in order (level 0 first), so control events
+ * (e.g. shutdown) pass the data events already queued. The rings have a fixed capacity
+ * and only "state_machine_queue_defer" allocates memory after the creation of the queue
+ * (the deferrals are stored by pair of state and event, not by state).
+ * WARNING: A queue is not thread safe: it must be used by the thread that runs the state machine.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_QUEUE_H
+#define STATE_MACHINE_QUEUE_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_QUEUE_MAX_LEVELS
+ * @brief Maximum number of priority levels of a queue.
+ */
+#define STATE_MACHINE_QUEUE_MAX_LEVELS  8
+
+
+
+/**
+ * @typedef fsm_queue_t
+ * @brief Data type used to handle the queue of a state machine.
+ */
+typedef struct _fsm_queue_t fsm_queue_t;
+
+
+
+/**
+ * @fn state_machine_queue_create
+ * @brief Create the queue of a state machine.
+ * @param fsm The state machine.
+ * @param capacity Maximum number of events of every level (rounded up to a power of 2).
+ * @param level_nr Number of priority levels (1 to "STATE_MACHINE_QUEUE_MAX_LEVELS").
+ * @return The new queue, NULL if the parameters are not valid or the memory is not available.
+ */
+fsm_queue_t* state_machine_queue_create (fsm_t *fsm, uint32_t capacity, uint32_t level_nr);
+
+/**
+ * @fn state_machine_queue_destroy
+ * @brief Release a queue (the events still queued are dropped).
+ */
+void state_machine_queue_destroy (fsm_queue_t *queue);
+
+/**
+ * @fn state_machine_queue_defer
+ * @brief Set whether a state defers an event it can not handle.
+ * @param queue The queue.
+ * @param state_id The state.
+ * @param target_id The event (target of the transition).
+ * @param defer true to keep the event in the queue, false to drop it.
+ * @return true if the state was updated, false if the states are not valid or the memory is not available.
+ */
+bool state_machine_queue_defer (fsm_queue_t *queue, uint32_t state_id, uint32_t target_id, bool defer);
+
+/**
+ * @fn state_machine_queue_post
+ * @brief Post an event to the state machine.
+ * If no transition is planned and no event of the same or higher priority is queued, the
+ * event is dispatched at once; otherwise it is queued and dispatched by "state_machine_queue_run".
+ * @param queue The queue.
+ * @param target_id The event (target of the transition).
+ * @param level Priority level of the event (0 is the highest).
+ * @return true if the event was dispatched or queued, false if the actual state can not
+ * handle it and does not defer it, or the ring of the level is full.
+ */
+bool state_machine_queue_post (fsm_queue_t *queue, uint32_t target_id, uint32_t level);
+
+/**
+ * @fn state_machine_queue_run
+ * @brief Dispatch the first event that the actual state handles and run the state machine.
+ * The events are searched by level and, inside a level, in the order they were posted.
+ * The events not deferred by the actual state are dropped. No event is dispatched while a
+ * transition is planned or pending, and the deferred events are searched again only after
+ * a transition or a new post.
+ * @param queue The queue.
+ * @param par Parameter "passed" to "sm_run".
+ * @return The value returned by "sm_run".
+ */
+uint32_t state_machine_queue_run (fsm_queue_t *queue, void *par);
+
+/**
+ * @fn state_machine_queue_size
+ * @brief Get the number of events queued (all the levels).
+ */
+uint32_t state_machine_queue_size (const fsm_queue_t *queue);
+
+/**
+ * @fn state_machine_queue_dropped
+ * @brief Get the number of queued events dropped because the state reached could not handle them.
+ */
+uint64_t state_machine_queue_dropped (const fsm_queue_t *queue);
+
+
+
+#endif
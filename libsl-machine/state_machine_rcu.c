@@ -0,0 +1,459 @@
+/**
+ * @file state_machine_rcu.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "state_machine_rcu.h"
+
+
+
+/**
+ * @typedef fsm_rcu_version_t
+ * @brief Immutable version of a definition.
+ */
+typedef struct _fsm_rcu_version_t fsm_rcu_version_t;
+
+/**
+ * @struct _fsm_rcu_version_t
+ * @brief See "fsm_rcu_version_t" for details.
+ */
+struct _fsm_rcu_version_t {
+    fsm_def_t *def;             /**< Copy of the definition (the large state machines use its transitions) */
+    fsm_t *fsm;                 /**< State machine that owns the states shared by the instances */
+    uint64_t epoch;             /**< Number of the version */
+    fsm_rcu_version_t *next;    /**< Next replaced version */
+};
+
+/**
+ * @struct _fsm_rcu_instance_t
+ * @brief See "fsm_rcu_instance_t" for details.
+ */
+struct _fsm_rcu_instance_t {
+    fsm_t *fsm;                 /**< The state machine (its states are the ones of "version") */
+    fsm_state_t *own_states;    /**< States allocated with the state machine (restored before the release) */
+    fsm_rcu_t *rcu;             /**< The versions */
+    fsm_rcu_version_t *version; /**< Version used */
+    uint64_t epoch;             /**< Epoch announced: the versions before it are not used */
+    fsm_rcu_instance_t *prev;   /**< Previous instance */
+    fsm_rcu_instance_t *next;   /**< Next instance */
+};
+
+/**
+ * @struct _fsm_rcu_t
+ * @brief See "fsm_rcu_t" for details.
+ */
+struct _fsm_rcu_t {
+    fsm_rcu_version_t *current; /**< Current version (read by the instances without lock) */
+    fsm_allocator_t allocator;  /**< Allocator of the versions and of the instances */
+    uint32_t flags;             /**< Options of the versions and of the instances */
+    pthread_mutex_t lock;       /**< Lock of the fields below (taken by the writers only) */
+    fsm_rcu_version_t *retired; /**< Replaced versions not released */
+    uint32_t retired_nr;        /**< Number of items of "retired" */
+    fsm_rcu_instance_t *instances;  /**< List of the instances */
+};
+
+
+
+/**
+ * @fn state_machine_rcu_version_create
+ * @brief Build the immutable version of a definition.
+ * @return The version (without epoch), NULL if the definition can not be handled or the memory is not available.
+ */
+static fsm_rcu_version_t* state_machine_rcu_version_create (fsm_rcu_t *rcu, const fsm_def_t *def);
+
+/**
+ * @fn state_machine_rcu_version_free
+ * @brief Release a version.
+ */
+static void state_machine_rcu_version_free (fsm_rcu_version_t *version);
+
+/**
+ * @fn state_machine_rcu_adopt
+ * @brief Move an instance to a version and announce its epoch.
+ * @param instance The instance.
+ * @param version The version.
+ * @param state_id The actual state in the version (valid).
+ */
+static void state_machine_rcu_adopt (fsm_rcu_instance_t *instance, fsm_rcu_version_t *version, uint32_t state_id);
+
+/**
+ * @fn state_machine_rcu_collect
+ * @brief Release the replaced versions whose epoch is older than the ones announced by all the instances (lock taken).
+ */
+static void state_machine_rcu_collect (fsm_rcu_t *rcu);
+
+/**
+ * @fn state_machine_rcu_add_state
+ * @brief "add_state" of the instances: the states belong to the version and can not be changed.
+ */
+static bool state_machine_rcu_add_state (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_t enter);
+
+/**
+ * @fn state_machine_rcu_add_transition
+ * @brief "add_transition" of the instances: the states belong to the version and can not be changed.
+ */
+static bool state_machine_rcu_add_transition (fsm_t *fsm, uint32_t state_id, uint32_t target_id);
+
+
+
+fsm_rcu_t* state_machine_rcu_create (const fsm_def_t *def, const fsm_attr_t *attr)
+{
+    fsm_rcu_t *rcu;
+
+    rcu = (fsm_rcu_t *)calloc(1, sizeof(fsm_rcu_t));
+    if (rcu == NULL)
+    {
+        return(NULL);
+    }
+
+    rcu->allocator = ((attr != NULL) && (attr->allocator != NULL)) ? *attr->allocator : state_machine_malloc_allocator;
+    rcu->flags = (attr != NULL) ? attr->flags : 0;
+
+    rcu->current = state_machine_rcu_version_create(rcu, def);
+    if (rcu->current == NULL)
+    {
+        free(rcu);
+        return(NULL);
+    }
+
+    rcu->current->epoch = 1;
+    pthread_mutex_init(&rcu->lock, NULL);
+
+    return(rcu);
+}
+
+
+
+void state_machine_rcu_destroy (fsm_rcu_t *rcu)
+{
+    fsm_rcu_version_t *version;
+
+    if (rcu == NULL)
+    {
+        return;
+    }
+
+    while (rcu->retired != NULL)
+    {
+        version = rcu->retired;
+        rcu->retired = version->next;
+        state_machine_rcu_version_free(version);
+    }
+
+    state_machine_rcu_version_free(rcu->current);
+    pthread_mutex_destroy(&rcu->lock);
+    free(rcu);
+}
+
+
+
+bool state_machine_rcu_publish (fsm_rcu_t *rcu, const fsm_def_t *def)
+{
+    fsm_rcu_version_t *version;
+    fsm_rcu_version_t *old;
+
+    /* The version is built before the lock: the other writers are not delayed */
+    version = state_machine_rcu_version_create(rcu, def);
+    if (version == NULL)
+    {
+        return(false);
+    }
+
+    pthread_mutex_lock(&rcu->lock);
+
+    old = rcu->current;
+    version->epoch = old->epoch + 1;
+
+    /* The states of the version are visible before the version */
+    __atomic_store_n(&rcu->current, version, __ATOMIC_RELEASE);
+
+    old->next = rcu->retired;
+    rcu->retired = old;
+    rcu->retired_nr++;
+
+    state_machine_rcu_collect(rcu);
+
+    pthread_mutex_unlock(&rcu->lock);
+
+    return(true);
+}
+
+
+
+uint32_t state_machine_rcu_reclaim (fsm_rcu_t *rcu)
+{
+    uint32_t retired_nr;
+
+    pthread_mutex_lock(&rcu->lock);
+    state_machine_rcu_collect(rcu);
+    retired_nr = rcu->retired_nr;
+    pthread_mutex_unlock(&rcu->lock);
+
+    return(retired_nr);
+}
+
+
+
+uint64_t state_machine_rcu_version (const fsm_rcu_t *rcu)
+{
+    return(__atomic_load_n(&rcu->current, __ATOMIC_ACQUIRE)->epoch);
+}
+
+
+
+fsm_rcu_instance_t* state_machine_rcu_instantiate (fsm_rcu_t *rcu)
+{
+    fsm_rcu_instance_t *instance;
+    fsm_attr_t attr = { &rcu->allocator, rcu->flags, NULL };
+
+    instance = (fsm_rcu_instance_t *)calloc(1, sizeof(fsm_rcu_instance_t));
+    if (instance == NULL)
+    {
+        return(NULL);
+    }
+
+    /* A state machine with a single state: the states are taken from the version */
+    instance->fsm = state_machine_init_ex(1, 0, &attr);
+    if (instance->fsm == NULL)
+    {
+        free(instance);
+        return(NULL);
+    }
+
+    instance->own_states = instance->fsm->states;
+    instance->rcu = rcu;
+    instance->fsm->add_state = state_machine_rcu_add_state;
+    instance->fsm->add_transition = state_machine_rcu_add_transition;
+
+    /* The epoch is announced before the writers can see the instance */
+    pthread_mutex_lock(&rcu->lock);
+
+    state_machine_rcu_adopt(instance, rcu->current, rcu->current->def->initial_state);
+
+    instance->next = rcu->instances;
+    if (rcu->instances != NULL)
+    {
+        rcu->instances->prev = instance;
+    }
+    rcu->instances = instance;
+
+    pthread_mutex_unlock(&rcu->lock);
+
+    return(instance);
+}
+
+
+
+void state_machine_rcu_release (fsm_rcu_instance_t *instance)
+{
+    fsm_rcu_t *rcu;
+    fsm_t *fsm;
+
+    if (instance == NULL)
+    {
+        return;
+    }
+
+    rcu = instance->rcu;
+
+    pthread_mutex_lock(&rcu->lock);
+
+    if (instance->prev != NULL)
+    {
+        instance->prev->next = instance->next;
+    }
+    else
+    {
+        rcu->instances = instance->next;
+    }
+
+    if (instance->next != NULL)
+    {
+        instance->next->prev = instance->prev;
+    }
+
+    state_machine_rcu_collect(rcu);
+
+    pthread_mutex_unlock(&rcu->lock);
+
+    /* The block of the state machine is released with its own layout */
+    fsm = instance->fsm;
+    fsm->states = instance->own_states;
+    fsm->state_nr = 1;
+    fsm->id_map = NULL;
+    fsm->actual_state = instance->own_states;
+
+    state_machine_deinit(fsm);
+    free(instance);
+}
+
+
+
+fsm_t* state_machine_rcu_fsm (const fsm_rcu_instance_t *instance)
+{
+    return(instance->fsm);
+}
+
+
+
+uint32_t state_machine_rcu_run (fsm_rcu_instance_t *instance, void *par)
+{
+    fsm_rcu_version_t *version;
+    fsm_t *fsm = instance->fsm;
+    uint32_t state_id;
+
+    version = __atomic_load_n(&instance->rcu->current, __ATOMIC_ACQUIRE);
+
+    /* Safe point: no transition planned (accepted by the old version) or in progress */
+    if ((version != instance->version) &&
+        (state_machine_get_target(fsm) == fsm->actual_state->id) &&
+        (state_machine_is_pending(fsm) == false))
+    {
+        state_id = fsm->actual_state->id;
+        if (state_id >= version->fsm->state_nr)
+        {
+            state_id = version->def->initial_state;
+        }
+
+        state_machine_rcu_adopt(instance, version, state_id);
+    }
+
+    return(fsm->sm_run(fsm, par));
+}
+
+
+
+uint64_t state_machine_rcu_instance_version (const fsm_rcu_instance_t *instance)
+{
+    return(__atomic_load_n(&instance->epoch, __ATOMIC_ACQUIRE));
+}
+
+
+
+static fsm_rcu_version_t* state_machine_rcu_version_create (fsm_rcu_t *rcu, const fsm_def_t *def)
+{
+    fsm_rcu_version_t *version;
+    fsm_attr_t attr = { &rcu->allocator, rcu->flags, NULL };
+
+    if (def == NULL)
+    {
+        return(NULL);
+    }
+
+    version = (fsm_rcu_version_t *)calloc(1, sizeof(fsm_rcu_version_t));
+    if (version == NULL)
+    {
+        return(NULL);
+    }
+
+    /* The copy is never changed, so the states can point to its transitions */
+    version->def = state_machine_def_clone(def, &rcu->allocator);
+    if (version->def == NULL)
+    {
+        free(version);
+        return(NULL);
+    }
+
+    version->fsm = state_machine_def_instantiate(version->def, &attr);
+    if (version->fsm == NULL)
+    {
+        state_machine_def_free(version->def);
+        free(version);
+        return(NULL);
+    }
+
+    return(version);
+}
+
+
+
+static void state_machine_rcu_version_free (fsm_rcu_version_t *version)
+{
+    state_machine_deinit(version->fsm);
+    state_machine_def_free(version->def);
+    free(version);
+}
+
+
+
+static void state_machine_rcu_adopt (fsm_rcu_instance_t *instance, fsm_rcu_version_t *version, uint32_t state_id)
+{
+    fsm_t *fsm = instance->fsm;
+    const fsm_t *shared = version->fsm;
+
+    fsm->states = shared->states;
+    fsm->state_nr = shared->state_nr;
+    fsm->id_map = shared->id_map;
+    fsm->target_state = (fsm->id_map != NULL) ? fsm->id_map[state_id] : state_id;
+    fsm->actual_state = &fsm->states[fsm->target_state];
+
+    instance->version = version;
+
+    /* The old version is no longer read after this store */
+    __atomic_store_n(&instance->epoch, version->epoch, __ATOMIC_RELEASE);
+}
+
+
+
+static void state_machine_rcu_collect (fsm_rcu_t *rcu)
+{
+    fsm_rcu_instance_t *instance;
+    fsm_rcu_version_t **link;
+    fsm_rcu_version_t *version;
+    uint64_t oldest;
+    uint64_t epoch;
+
+    /* Oldest epoch still announced */
+    oldest = rcu->current->epoch;
+
+    for (instance = rcu->instances; instance != NULL; instance = instance->next)
+    {
+        epoch = __atomic_load_n(&instance->epoch, __ATOMIC_ACQUIRE);
+        if (epoch < oldest)
+        {
+            oldest = epoch;
+        }
+    }
+
+    link = &rcu->retired;
+    while (*link != NULL)
+    {
+        version = *link;
+
+        if (version->epoch < oldest)
+        {
+            *link = version->next;
+            rcu->retired_nr--;
+            state_machine_rcu_version_free(version);
+        }
+        else
+        {
+            link = &version->next;
+        }
+    }
+}
+
+
+
+static bool state_machine_rcu_add_state (fsm_t *fsm, uint32_t id, fsm_state_run_t run, fsm_state_enter_t enter)
+{
+    (void)fsm;
+    (void)id;
+    (void)run;
+    (void)enter;
+
+    return(false);
+}
+
+
+
+static bool state_machine_rcu_add_transition (fsm_t *fsm, uint32_t state_id, uint32_t target_id)
+{
+    (void)fsm;
+    (void)state_id;
+    (void)target_id;
+
+    return(false);
+}
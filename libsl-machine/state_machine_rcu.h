@@ -0,0 +1,135 @@
+/**
+ * @file state_machine_rcu.h
+ * @brief Definitions of live state machines updated without stopping them (copy-on-write).
+ *
+ * Every published definition becomes an immutable version: its states and transitions
+ * are built once and shared by all the instances, so no state is ever changed while an
+ * instance reads it. "state_machine_rcu_publish" replaces the current version with a
+ * single atomic store and the instances pick it up at a safe point: the next
+ * "state_machine_rcu_run" with no transition planned or in progress. The ticks read the
+ * current version without locks.
+ *
+ * The versions are released with an epoch scheme: every version has an epoch (its
+ * number) and every instance announces the epoch of the version it uses when it moves
+ * to a new one. A replaced version is released when all the instances announced a
+ * newer epoch, so an instance that is not run keeps its version in memory.
+ *
+ * Example:
+ *     rcu = state_machine_rcu_create(def_v1, NULL);
+ *     instance = state_machine_rcu_instantiate(rcu);
+ *     fsm = state_machine_rcu_fsm(instance);
+ *     ...
+ *     fsm->go_to_state(fsm, STATE_OPEN);
+ *     state_machine_rcu_run(instance, NULL);
+ *
+ *     // Another thread, while the instances are running
+ *     state_machine_rcu_publish(rcu, def_v2);
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_RCU_H
+#define STATE_MACHINE_RCU_H
+
+#include "state_machine.h"
+#include "state_machine_def.h"
+
+
+
+/**
+ * @typedef fsm_rcu_t
+ * @brief Data type used to handle the versions of a definition.
+ */
+typedef struct _fsm_rcu_t fsm_rcu_t;
+
+/**
+ * @typedef fsm_rcu_instance_t
+ * @brief Data type used to handle a state machine that follows the versions of a definition.
+ */
+typedef struct _fsm_rcu_instance_t fsm_rcu_instance_t;
+
+
+
+/**
+ * @fn state_machine_rcu_create
+ * @brief Create the first version of a definition.
+ * @param def The definition (copied).
+ * @param attr Options of the versions and of the instances (the layout is not used, NULL to use the default ones).
+ * @return The versions, NULL if the definition can not be handled or the memory is not available.
+ */
+fsm_rcu_t* state_machine_rcu_create (const fsm_def_t *def, const fsm_attr_t *attr);
+
+/**
+ * @fn state_machine_rcu_destroy
+ * @brief Release all the versions.
+ * WARNING: The instances must be released first.
+ */
+void state_machine_rcu_destroy (fsm_rcu_t *rcu);
+
+/**
+ * @fn state_machine_rcu_publish
+ * @brief Replace the current version (the instances move to it at their next safe point).
+ * The states of the instances not defined by the new version are replaced by its initial state.
+ * INFO: It can be called by any thread, while the instances are running.
+ * @param rcu The versions.
+ * @param def The new definition (copied).
+ * @return true if the version was published, false if the definition can not be handled or the memory is not available.
+ */
+bool state_machine_rcu_publish (fsm_rcu_t *rcu, const fsm_def_t *def);
+
+/**
+ * @fn state_machine_rcu_reclaim
+ * @brief Release the replaced versions no longer used by the instances.
+ * INFO: It is also done by "state_machine_rcu_publish" and "state_machine_rcu_release".
+ * @return The number of versions still in memory, but replaced.
+ */
+uint32_t state_machine_rcu_reclaim (fsm_rcu_t *rcu);
+
+/**
+ * @fn state_machine_rcu_version
+ * @brief Get the number of the current version (the first one is 1).
+ */
+uint64_t state_machine_rcu_version (const fsm_rcu_t *rcu);
+
+/**
+ * @fn state_machine_rcu_instantiate
+ * @brief Create a state machine in the initial state of the current version.
+ * @return The instance, NULL if the memory is not available.
+ */
+fsm_rcu_instance_t* state_machine_rcu_instantiate (fsm_rcu_t *rcu);
+
+/**
+ * @fn state_machine_rcu_release
+ * @brief Release an instance (and the versions no longer used).
+ */
+void state_machine_rcu_release (fsm_rcu_instance_t *instance);
+
+/**
+ * @fn state_machine_rcu_fsm
+ * @brief Get the state machine of an instance.
+ * The state machine can be used as any other one (transitions, hooks, restore, ...), but
+ * its states are shared by the version: "add_state" and "add_transition" fail and
+ * "state_machine_set_targets" and "state_machine_add_state_async" must not be used.
+ * WARNING: The state machine must be released by "state_machine_rcu_release".
+ */
+fsm_t* state_machine_rcu_fsm (const fsm_rcu_instance_t *instance);
+
+/**
+ * @fn state_machine_rcu_run
+ * @brief Move the instance to the current version if it is at a safe point, then run it ("sm_run").
+ * WARNING: An instance must be run by a single thread at a time.
+ * @param instance The instance.
+ * @param par Parameter "passed" to "sm_run".
+ * @return The ID of the actual state.
+ */
+uint32_t state_machine_rcu_run (fsm_rcu_instance_t *instance, void *par);
+
+/**
+ * @fn state_machine_rcu_instance_version
+ * @brief Get the number of the version used by an instance.
+ */
+uint64_t state_machine_rcu_instance_version (const fsm_rcu_instance_t *instance);
+
+
+
+#endif
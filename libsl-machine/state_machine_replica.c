@@ -0,0 +1,614 @@
+/**
+ * @file state_machine_replica.c
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "state_machine_replica.h"
+
+
+
+/**
+ * @def STATE_MACHINE_REPLICA_MAGIC
+ * @brief Identifier of the frames ("SLRE").
+ */
+#define STATE_MACHINE_REPLICA_MAGIC     0x45524C53
+
+/**
+ * @def STATE_MACHINE_REPLICA_MAX_RECORD
+ * @brief Maximum size of an encoded transition (two varints of 5 bytes).
+ */
+#define STATE_MACHINE_REPLICA_MAX_RECORD    10
+
+
+
+/**
+ * @typedef fsm_replica_frame_t
+ * @brief Header of a frame (followed by the encoded transitions).
+ */
+typedef struct _fsm_replica_frame_t fsm_replica_frame_t;
+
+/**
+ * @typedef fsm_replica_cell_t
+ * @brief Transition stored in the ring.
+ */
+typedef struct _fsm_replica_cell_t fsm_replica_cell_t;
+
+/**
+ * @typedef fsm_replica_binding_t
+ * @brief State machine attached to a leader.
+ */
+typedef struct _fsm_replica_binding_t fsm_replica_binding_t;
+
+/**
+ * @struct _fsm_replica_frame_t
+ * @brief See "fsm_replica_frame_t" for details.
+ * INFO: Every transition is encoded as the difference between its state machine ID and the
+ * one of the previous transition (zigzag varint) followed by the state ID (varint).
+ */
+struct _fsm_replica_frame_t {
+    uint32_t magic;             /**< "STATE_MACHINE_REPLICA_MAGIC" */
+    uint32_t size;              /**< Size of the frame (header included) */
+    uint32_t record_nr;         /**< Number of transitions */
+    uint32_t reserved;          /**< Not used */
+    uint64_t dropped;           /**< Number of transitions dropped by the leader so far */
+};
+
+/**
+ * @struct _fsm_replica_cell_t
+ * @brief See "fsm_replica_cell_t" for details.
+ */
+struct _fsm_replica_cell_t {
+    uint64_t seq;               /**< Position + 1 when written, position + size when free */
+    uint32_t machine_id;        /**< The state machine */
+    uint32_t state_id;          /**< The state entered */
+};
+
+/**
+ * @struct _fsm_replica_binding_t
+ * @brief See "fsm_replica_binding_t" for details.
+ */
+struct _fsm_replica_binding_t {
+    fsm_hook_link_t link;                   /**< Hook set before the attach (first field, see "state_machine_hook_link") */
+    fsm_replica_t *replica;                 /**< The leader */
+    uint32_t machine_id;                    /**< ID of the state machine on the follower */
+};
+
+/**
+ * @struct _fsm_replica_t
+ * @brief See "fsm_replica_t" for details.
+ * INFO: The counter of the producers has its own cache line.
+ */
+struct _fsm_replica_t {
+    uint64_t tail;              /**< Number of cells taken by the producers */
+    char tail_pad[STATE_MACHINE_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t dropped;           /**< Number of transitions dropped */
+    uint64_t head;              /**< Number of transitions read by the flush */
+    uint32_t ring_mask;         /**< Number of cells - 1 (power of 2) */
+    fsm_replica_cell_t *cells;  /**< The ring */
+    fsm_transport_t transport;  /**< The transport */
+    uint32_t frame_size;        /**< Size of the frame not sent yet (0 if none) */
+    uint32_t frame_records;     /**< Number of transitions of the frame not sent yet */
+    uint8_t frame[STATE_MACHINE_REPLICA_FRAME];     /**< The frame */
+};
+
+/**
+ * @struct _fsm_follower_t
+ * @brief See "fsm_follower_t" for details.
+ */
+struct _fsm_follower_t {
+    fsm_transport_t transport;  /**< The transport */
+    fsm_t *const *fsms;         /**< The state machines */
+    uint32_t fsm_nr;            /**< Number of state machines */
+    uint64_t lost;              /**< Number of transitions dropped by the leader */
+    uint64_t invalid;           /**< Number of frames and transitions not valid */
+    uint8_t frame[STATE_MACHINE_REPLICA_FRAME];     /**< The frame received */
+};
+
+
+
+/**
+ * @fn state_machine_replica_hook
+ * @brief Hook of the attached state machines: it records the transition and calls the hook set before the attach.
+ */
+static void state_machine_replica_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+/**
+ * @fn state_machine_replica_encode
+ * @brief Move the transitions of the ring to the frame.
+ */
+static void state_machine_replica_encode (fsm_replica_t *replica);
+
+/**
+ * @fn state_machine_replica_put
+ * @brief Write a varint.
+ * @return The number of bytes written.
+ */
+static uint32_t state_machine_replica_put (uint8_t *buf, uint64_t value);
+
+/**
+ * @fn state_machine_replica_get
+ * @brief Read a varint of up to 64 bits.
+ * @return The number of bytes read, 0 if the varint is not valid or not complete.
+ */
+static uint32_t state_machine_replica_get (const uint8_t *buf, size_t size, uint64_t *value);
+
+
+
+fsm_replica_t* state_machine_replica_create (const fsm_transport_t *transport, uint32_t ring_size)
+{
+    fsm_replica_t *replica;
+    uint64_t size;
+    uint64_t cntr;
+
+    if ((transport == NULL) || (transport->send == NULL) || (ring_size == 0) || (ring_size > 0x80000000))
+    {
+        return(NULL);
+    }
+
+    /* At least 2 cells: a free cell and a written one have different sequences */
+    size = 2;
+    while (size < ring_size)
+    {
+        size <<= 1;
+    }
+
+    if (posix_memalign((void **)&replica, STATE_MACHINE_CACHE_LINE, sizeof(fsm_replica_t)) != 0)
+    {
+        return(NULL);
+    }
+    memset(replica, 0, offsetof(fsm_replica_t, frame));
+
+    replica->cells = (fsm_replica_cell_t *)malloc(size * sizeof(fsm_replica_cell_t));
+    if (replica->cells == NULL)
+    {
+        free(replica);
+        return(NULL);
+    }
+
+    for (cntr = 0; cntr < size; cntr++)
+    {
+        replica->cells[cntr].seq = cntr;
+    }
+
+    replica->ring_mask = (uint32_t)(size - 1);
+    replica->transport = *transport;
+
+    return(replica);
+}
+
+
+
+void state_machine_replica_destroy (fsm_replica_t *replica)
+{
+    if (replica == NULL)
+    {
+        return;
+    }
+
+    free(replica->cells);
+    free(replica);
+}
+
+
+
+bool state_machine_replica_attach (fsm_replica_t *replica, fsm_t *fsm, uint32_t machine_id)
+{
+    fsm_replica_binding_t *binding;
+
+    if (state_machine_hook_find(fsm, state_machine_replica_hook) != NULL)
+    {
+        return(false);
+    }
+
+    binding = (fsm_replica_binding_t *)malloc(sizeof(fsm_replica_binding_t));
+    if (binding == NULL)
+    {
+        return(false);
+    }
+
+    binding->replica = replica;
+    binding->machine_id = machine_id;
+
+    state_machine_hook_link(fsm, state_machine_replica_hook, &binding->link);
+
+    return(true);
+}
+
+
+
+void state_machine_replica_detach (fsm_t *fsm)
+{
+    fsm_replica_binding_t *binding;
+
+    binding = (fsm_replica_binding_t *)state_machine_hook_unlink(fsm, state_machine_replica_hook, NULL);
+    if (binding == NULL)
+    {
+        return;
+    }
+
+    free(binding);
+}
+
+
+
+uint32_t state_machine_replica_flush (fsm_replica_t *replica)
+{
+    uint32_t sent;
+
+    sent = 0;
+    for (;;)
+    {
+        /* A frame refused by the transport is sent again before the new transitions */
+        if (replica->frame_size == 0)
+        {
+            state_machine_replica_encode(replica);
+            if (replica->frame_size == 0)
+            {
+                break;
+            }
+        }
+
+        if (replica->transport.send(replica->transport.ctx, replica->frame, replica->frame_size) == false)
+        {
+            break;
+        }
+
+        sent += replica->frame_records;
+        replica->frame_size = 0;
+    }
+
+    return(sent);
+}
+
+
+
+uint64_t state_machine_replica_dropped (const fsm_replica_t *replica)
+{
+    return(__atomic_load_n(&replica->dropped, __ATOMIC_RELAXED));
+}
+
+
+
+fsm_follower_t* state_machine_replica_follower_create (const fsm_transport_t *transport, fsm_t *const *fsms, uint32_t fsm_nr)
+{
+    fsm_follower_t *follower;
+
+    if ((transport == NULL) || (transport->recv == NULL))
+    {
+        return(NULL);
+    }
+
+    follower = (fsm_follower_t *)malloc(sizeof(fsm_follower_t));
+    if (follower == NULL)
+    {
+        return(NULL);
+    }
+
+    follower->transport = *transport;
+    follower->fsms = fsms;
+    follower->fsm_nr = fsm_nr;
+    follower->lost = 0;
+    follower->invalid = 0;
+
+    return(follower);
+}
+
+
+
+void state_machine_replica_follower_destroy (fsm_follower_t *follower)
+{
+    free(follower);
+}
+
+
+
+uint32_t state_machine_replica_follower_poll (fsm_follower_t *follower)
+{
+    fsm_replica_frame_t header;
+    uint64_t machine_id;
+    uint64_t delta;
+    uint64_t state_id;
+    uint32_t applied;
+    uint32_t cntr;
+    uint32_t len;
+    size_t size;
+    size_t pos;
+
+    size = follower->transport.recv(follower->transport.ctx, follower->frame, sizeof(follower->frame));
+    if (size == 0)
+    {
+        return(0);
+    }
+
+    if (size < sizeof(fsm_replica_frame_t))
+    {
+        follower->invalid++;
+        return(0);
+    }
+
+    memcpy(&header, follower->frame, sizeof(fsm_replica_frame_t));
+    if ((header.magic != STATE_MACHINE_REPLICA_MAGIC) || (header.size != size))
+    {
+        follower->invalid++;
+        return(0);
+    }
+
+    if (header.dropped > follower->lost)
+    {
+        follower->lost = header.dropped;
+    }
+
+    applied = 0;
+    machine_id = 0;
+    pos = sizeof(fsm_replica_frame_t);
+    for (cntr = 0; cntr < header.record_nr; cntr++)
+    {
+        len = state_machine_replica_get(follower->frame + pos, size - pos, &delta);
+        if (len == 0)
+        {
+            follower->invalid++;
+            break;
+        }
+        pos += len;
+
+        len = state_machine_replica_get(follower->frame + pos, size - pos, &state_id);
+        if (len == 0)
+        {
+            follower->invalid++;
+            break;
+        }
+        pos += len;
+
+        /* Zigzag: the sign is in the lowest bit */
+        machine_id += (delta & 1) ? ~(delta >> 1) : (delta >> 1);
+
+        if ((machine_id < follower->fsm_nr) && (follower->fsms[machine_id] != NULL) && (state_id <= 0xFFFFFFFF) &&
+            (state_machine_restore_state(follower->fsms[machine_id], (uint32_t)state_id) == true))
+        {
+            applied++;
+        }
+        else
+        {
+            follower->invalid++;
+        }
+    }
+
+    return(applied);
+}
+
+
+
+uint64_t state_machine_replica_follower_lost (const fsm_follower_t *follower)
+{
+    return(follower->lost);
+}
+
+
+
+uint64_t state_machine_replica_follower_invalid (const fsm_follower_t *follower)
+{
+    return(follower->invalid);
+}
+
+
+
+bool state_machine_replica_fd_send (void *ctx, const void *frame, size_t size)
+{
+    const uint8_t *buf = (const uint8_t *)frame;
+    ssize_t done;
+    size_t pos;
+
+    pos = 0;
+    while (pos < size)
+    {
+        done = write(*(int *)ctx, buf + pos, size - pos);
+        if (done < 0)
+        {
+            /* A frame is never cut: once started it is completed */
+            if ((errno == EINTR) || (((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (pos > 0)))
+            {
+                continue;
+            }
+            return(false);
+        }
+        pos += (size_t)done;
+    }
+
+    return(true);
+}
+
+
+
+size_t state_machine_replica_fd_recv (void *ctx, void *frame, size_t size)
+{
+    uint8_t *buf = (uint8_t *)frame;
+    fsm_replica_frame_t header;
+    ssize_t done;
+    size_t total;
+    size_t pos;
+
+    if (size < sizeof(fsm_replica_frame_t))
+    {
+        return(0);
+    }
+
+    /* The header gives the size of the frame */
+    total = sizeof(fsm_replica_frame_t);
+    pos = 0;
+    while (pos < total)
+    {
+        done = read(*(int *)ctx, buf + pos, total - pos);
+        if (done == 0)
+        {
+            return(0);
+        }
+
+        if (done < 0)
+        {
+            if ((errno == EINTR) || (((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (pos > 0)))
+            {
+                continue;
+            }
+            return(0);
+        }
+        pos += (size_t)done;
+
+        if (pos == sizeof(fsm_replica_frame_t))
+        {
+            memcpy(&header, buf, sizeof(fsm_replica_frame_t));
+            if ((header.magic != STATE_MACHINE_REPLICA_MAGIC) || (header.size < sizeof(fsm_replica_frame_t)) || (header.size > size))
+            {
+                return(0);
+            }
+            total = header.size;
+        }
+    }
+
+    return(total);
+}
+
+
+
+static void state_machine_replica_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data)
+{
+    fsm_replica_binding_t *binding = (fsm_replica_binding_t *)data;
+    fsm_replica_t *replica = binding->replica;
+    fsm_replica_cell_t *cell;
+    uint64_t pos;
+    uint64_t seq;
+
+    /* A producer takes a cell with a CAS on the tail, then publishes it with its sequence */
+    pos = __atomic_load_n(&replica->tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        cell = &replica->cells[pos & replica->ring_mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos)
+        {
+            if (__atomic_compare_exchange_n(&replica->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == true)
+            {
+                cell->machine_id = binding->machine_id;
+                cell->state_id = enter_state_id;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+        else if ((int64_t)(seq - pos) < 0)
+        {
+            /* Full: the transition is dropped, the state machine is not slowed down */
+            __atomic_add_fetch(&replica->dropped, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        else
+        {
+            pos = __atomic_load_n(&replica->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (binding->link.on_transition != NULL)
+    {
+        binding->link.on_transition(fsm, exit_state_id, enter_state_id, binding->link.hook_data);
+    }
+}
+
+
+
+static void state_machine_replica_encode (fsm_replica_t *replica)
+{
+    fsm_replica_frame_t header;
+    fsm_replica_cell_t *cell;
+    uint32_t machine_id;
+    uint32_t state_id;
+    uint32_t record_nr;
+    uint32_t prev;
+    uint32_t pos;
+    int64_t delta;
+
+    record_nr = 0;
+    prev = 0;
+    pos = sizeof(fsm_replica_frame_t);
+    while (pos + STATE_MACHINE_REPLICA_MAX_RECORD <= STATE_MACHINE_REPLICA_FRAME)
+    {
+        cell = &replica->cells[replica->head & replica->ring_mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != replica->head + 1)
+        {
+            break;
+        }
+
+        machine_id = cell->machine_id;
+        state_id = cell->state_id;
+
+        /* The cell is free for the producers */
+        __atomic_store_n(&cell->seq, replica->head + replica->ring_mask + 1, __ATOMIC_RELEASE);
+        replica->head++;
+
+        delta = (int64_t)machine_id - (int64_t)prev;
+        pos += state_machine_replica_put(replica->frame + pos, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+        pos += state_machine_replica_put(replica->frame + pos, state_id);
+
+        prev = machine_id;
+        record_nr++;
+    }
+
+    if (record_nr == 0)
+    {
+        return;
+    }
+
+    header.magic = STATE_MACHINE_REPLICA_MAGIC;
+    header.size = pos;
+    header.record_nr = record_nr;
+    header.reserved = 0;
+    header.dropped = __atomic_load_n(&replica->dropped, __ATOMIC_RELAXED);
+    memcpy(replica->frame, &header, sizeof(fsm_replica_frame_t));
+
+    replica->frame_size = pos;
+    replica->frame_records = record_nr;
+}
+
+
+
+static uint32_t state_machine_replica_put (uint8_t *buf, uint64_t value)
+{
+    uint32_t len;
+
+    len = 0;
+    while (value >= 0x80)
+    {
+        buf[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (uint8_t)value;
+
+    return(len);
+}
+
+
+
+static uint32_t state_machine_replica_get (const uint8_t *buf, size_t size, uint64_t *value)
+{
+    uint64_t result;
+    uint32_t shift;
+    uint32_t len;
+
+    result = 0;
+    shift = 0;
+    for (len = 0; (len < size) && (shift < 64); len++)
+    {
+        result |= (uint64_t)(buf[len] & 0x7F) << shift;
+        if ((buf[len] & 0x80) == 0)
+        {
+            *value = result;
+            return(len + 1);
+        }
+        shift += 7;
+    }
+
+    return(0);
+}
@@ -0,0 +1,177 @@
+/**
+ * @file state_machine_replica.h
+ * @brief Replication of the transitions of state machines to a standby process.
+ *
+ * The leader records the transitions executed by the attached state machines in a local
+ * ring (the hook never blocks: when the ring is full the transition is dropped and
+ * counted). A shipping thread calls "state_machine_replica_flush", which packs the
+ * records in frames (delta and varint encoding: a transition takes 2 bytes in most
+ * cases) and gives them to a transport. The follower receives the frames and applies the
+ * transitions to its copies of the state machines with "state_machine_restore_state",
+ * so no callbacks are executed on the standby.
+ *
+ * The transport is a pair of functions: "state_machine_replica_fd_send" and
+ * "state_machine_replica_fd_recv" use a file descriptor (pipe, Unix socket, ...), other
+ * transports (e.g. an in-process queue for tests) can be given by the user.
+ *
+ * Example:
+ *     fsm_transport_t transport = { state_machine_replica_fd_send, state_machine_replica_fd_recv, &fd };
+ *
+ *     // Leader
+ *     replica = state_machine_replica_create(&transport, 65536);
+ *     state_machine_replica_attach(replica, fsm, 0);
+ *     while (running)
+ *         state_machine_replica_flush(replica);
+ *
+ *     // Follower
+ *     follower = state_machine_replica_follower_create(&transport, fsms, fsm_nr);
+ *     while (running)
+ *         state_machine_replica_follower_poll(follower);
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_REPLICA_H
+#define STATE_MACHINE_REPLICA_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_REPLICA_FRAME
+ * @brief Maximum size of a frame (header included).
+ */
+#define STATE_MACHINE_REPLICA_FRAME     65536
+
+
+
+/**
+ * @typedef fsm_replica_t
+ * @brief Data type used to handle the leader side of a replication.
+ */
+typedef struct _fsm_replica_t fsm_replica_t;
+
+/**
+ * @typedef fsm_follower_t
+ * @brief Data type used to handle the follower side of a replication.
+ */
+typedef struct _fsm_follower_t fsm_follower_t;
+
+/**
+ * @typedef fsm_transport_t
+ * @brief Data type used to define how the frames are moved from leader to follower.
+ */
+typedef struct _fsm_transport_t fsm_transport_t;
+
+/**
+ * @struct _fsm_transport_t
+ * @brief See "fsm_transport_t" for details.
+ */
+struct _fsm_transport_t {
+    bool (*send) (void *ctx, const void *frame, size_t size);   /**< Send a whole frame, false if it was not sent (retried by the next flush) */
+    size_t (*recv) (void *ctx, void *frame, size_t size);       /**< Receive a whole frame, 0 if none (or the transport is closed) */
+    void *ctx;                                                  /**< Parameter of the functions */
+};
+
+
+
+/**
+ * @fn state_machine_replica_create
+ * @brief Create the leader side of a replication.
+ * @param transport The transport (copied).
+ * @param ring_size Number of transitions of the ring (rounded up to a power of 2, at least 2).
+ * @return The leader, NULL if the parameters are not valid or the memory is not available.
+ */
+fsm_replica_t* state_machine_replica_create (const fsm_transport_t *transport, uint32_t ring_size);
+
+/**
+ * @fn state_machine_replica_destroy
+ * @brief Release the leader (the transitions not sent are dropped).
+ * WARNING: The state machines must be detached first.
+ */
+void state_machine_replica_destroy (fsm_replica_t *replica);
+
+/**
+ * @fn state_machine_replica_attach
+ * @brief Replicate the transitions of a state machine.
+ * The hook set before is kept and called by the one of the replication.
+ * @param replica The leader.
+ * @param fsm The state machine.
+ * @param machine_id ID of the state machine on the follower (index of its array).
+ * @return true if the state machine was attached, false if it is already attached or the memory is not available.
+ */
+bool state_machine_replica_attach (fsm_replica_t *replica, fsm_t *fsm, uint32_t machine_id);
+
+/**
+ * @fn state_machine_replica_detach
+ * @brief Stop the replication of a state machine (the hook set before the attach is restored).
+ */
+void state_machine_replica_detach (fsm_t *fsm);
+
+/**
+ * @fn state_machine_replica_flush
+ * @brief Send the recorded transitions to the follower.
+ * WARNING: A leader must be flushed by a single thread at a time.
+ * @return The number of transitions sent.
+ */
+uint32_t state_machine_replica_flush (fsm_replica_t *replica);
+
+/**
+ * @fn state_machine_replica_dropped
+ * @brief Get the number of transitions dropped because the ring was full.
+ */
+uint64_t state_machine_replica_dropped (const fsm_replica_t *replica);
+
+/**
+ * @fn state_machine_replica_follower_create
+ * @brief Create the follower side of a replication.
+ * WARNING: The array is not copied and must be valid until the follower is released.
+ * @param transport The transport (copied).
+ * @param fsms The state machines (addressed by the IDs given to "state_machine_replica_attach").
+ * @param fsm_nr Number of state machines.
+ * @return The follower, NULL if the memory is not available.
+ */
+fsm_follower_t* state_machine_replica_follower_create (const fsm_transport_t *transport, fsm_t *const *fsms, uint32_t fsm_nr);
+
+/**
+ * @fn state_machine_replica_follower_destroy
+ * @brief Release the follower (the state machines are not released).
+ */
+void state_machine_replica_follower_destroy (fsm_follower_t *follower);
+
+/**
+ * @fn state_machine_replica_follower_poll
+ * @brief Receive a frame and apply its transitions.
+ * @return The number of transitions applied.
+ */
+uint32_t state_machine_replica_follower_poll (fsm_follower_t *follower);
+
+/**
+ * @fn state_machine_replica_follower_lost
+ * @brief Get the number of transitions dropped by the leader (the states can differ until the next transitions).
+ */
+uint64_t state_machine_replica_follower_lost (const fsm_follower_t *follower);
+
+/**
+ * @fn state_machine_replica_follower_invalid
+ * @brief Get the number of frames not valid and of transitions not applied (unknown state machine or state).
+ */
+uint64_t state_machine_replica_follower_invalid (const fsm_follower_t *follower);
+
+/**
+ * @fn state_machine_replica_fd_send
+ * @brief "send" function of the transports based on a file descriptor ("ctx" points to the descriptor).
+ */
+bool state_machine_replica_fd_send (void *ctx, const void *frame, size_t size);
+
+/**
+ * @fn state_machine_replica_fd_recv
+ * @brief "recv" function of the transports based on a file descriptor ("ctx" points to the descriptor).
+ * INFO: It blocks until a frame is available, unless the descriptor is non-blocking.
+ */
+size_t state_machine_replica_fd_recv (void *ctx, void *frame, size_t size);
+
+
+
+#endif
@@ -0,0 +1,812 @@
+/**
+ * @file state_machine_shm.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "state_machine_shm.h"
+
+
+
+/**
+ * @def STATE_MACHINE_SHM_MAGIC
+ * @brief Identifier of the registries ("SLSM"), written when the segment is ready.
+ */
+#define STATE_MACHINE_SHM_MAGIC         0x4D534C53
+
+/**
+ * @def STATE_MACHINE_SHM_VERSION
+ * @brief Version of the layout of the segment.
+ */
+#define STATE_MACHINE_SHM_VERSION       2
+
+/**
+ * @def STATE_MACHINE_SHM_VALID
+ * @brief Flag of the values of the table that store a state machine.
+ */
+#define STATE_MACHINE_SHM_VALID         0x8000000000000000ULL
+
+/**
+ * @def STATE_MACHINE_SHM_NONE
+ * @brief Process of the mappings not bound.
+ */
+#define STATE_MACHINE_SHM_NONE          0xFFFFFFFF
+
+/**
+ * @def STATE_MACHINE_SHM_SPIN
+ * @brief Number of reads of an item being written before the thread yields.
+ */
+#define STATE_MACHINE_SHM_SPIN          64
+
+
+
+/**
+ * @typedef fsm_shm_header_t
+ * @brief Header of the segment.
+ */
+typedef struct _fsm_shm_header_t fsm_shm_header_t;
+
+/**
+ * @typedef fsm_shm_entry_t
+ * @brief Item of the hash table.
+ */
+typedef struct _fsm_shm_entry_t fsm_shm_entry_t;
+
+/**
+ * @typedef fsm_shm_ring_t
+ * @brief Ring with several producers and a single consumer.
+ */
+typedef struct _fsm_shm_ring_t fsm_shm_ring_t;
+
+/**
+ * @typedef fsm_shm_cell_t
+ * @brief Message of a ring.
+ */
+typedef struct _fsm_shm_cell_t fsm_shm_cell_t;
+
+/**
+ * @struct _fsm_shm_header_t
+ * @brief See "fsm_shm_header_t" for details.
+ */
+struct _fsm_shm_header_t {
+    uint32_t magic;             /**< "STATE_MACHINE_SHM_MAGIC" (stored last by the creator) */
+    uint32_t version;           /**< "STATE_MACHINE_SHM_VERSION" */
+    uint64_t size;              /**< Size of the segment */
+    uint32_t process_nr;        /**< Number of processes */
+    uint32_t table_mask;        /**< Number of items of the table - 1 (power of 2) */
+    uint32_t ring_mask;         /**< Number of messages of every ring - 1 (power of 2) */
+    uint32_t machine_max;       /**< Maximum number of registered state machines */
+    uint64_t table_offset;      /**< Position of the table */
+    uint64_t ring_offset;       /**< Position of the first ring */
+    uint64_t ring_stride;       /**< Distance between two rings */
+    uint32_t machine_nr;        /**< Number of registered state machines */
+    uint32_t writing;           /**< Item being written ("STATE_MACHINE_SHM_NONE" if none) */
+    pthread_mutex_t lock;       /**< Lock of the writers of the table (robust, shared by the processes) */
+};
+
+/**
+ * @struct _fsm_shm_entry_t
+ * @brief See "fsm_shm_entry_t" for details.
+ * INFO: An unregistered handle keeps its item with no "STATE_MACHINE_SHM_VALID" flag
+ * (tombstone), so the lookups of the handles placed after it do not stop there. The
+ * tombstones are taken by the next handles registered and freed when they end a probe
+ * sequence. The writers hold the lock of the header and make the sequence odd while they
+ * change key and value, so the lookups (without lock) read both from the same write.
+ */
+struct _fsm_shm_entry_t {
+    uint64_t seq;               /**< Number of writes of the item * 2 (odd while written) */
+    uint64_t key;               /**< The handle ("STATE_MACHINE_SHM_HANDLE_NONE" if the item is free) */
+    uint64_t value;             /**< "STATE_MACHINE_SHM_VALID", owner (bits 32-62) and slot */
+    uint64_t reserved;          /**< Not used (the items do not cross the cache lines) */
+};
+
+/**
+ * @struct _fsm_shm_cell_t
+ * @brief See "fsm_shm_cell_t" for details.
+ */
+struct _fsm_shm_cell_t {
+    uint64_t seq;               /**< Position + 1 when written, position + size when free */
+    uint32_t slot;              /**< The destination */
+    uint32_t target_id;         /**< The transition required */
+};
+
+/**
+ * @struct _fsm_shm_ring_t
+ * @brief See "fsm_shm_ring_t" for details (followed by the cells).
+ * INFO: The two counters are on different cache lines, so producers and consumer do not
+ * write the same line.
+ */
+struct _fsm_shm_ring_t {
+    uint64_t tail;              /**< Number of cells taken by the producers */
+    char tail_pad[STATE_MACHINE_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t head;              /**< Number of messages read by the consumer */
+    char head_pad[STATE_MACHINE_CACHE_LINE - sizeof(uint64_t)];
+    fsm_shm_cell_t cells[];     /**< The messages */
+};
+
+/**
+ * @struct _fsm_shm_t
+ * @brief See "fsm_shm_t" for details.
+ */
+struct _fsm_shm_t {
+    fsm_shm_header_t *header;   /**< The mapping */
+    fsm_shm_entry_t *table;     /**< The hash table */
+    uint32_t process_id;        /**< Bound process ("STATE_MACHINE_SHM_NONE" if not bound) */
+    fsm_t *const *fsms;         /**< State machines of the bound process */
+    uint32_t slot_nr;           /**< Number of state machines */
+    uint64_t rejected;          /**< Number of messages not accepted */
+};
+
+
+
+/**
+ * @fn state_machine_shm_map
+ * @brief Create the local data of a mapping.
+ * @return The registry, NULL if the memory is not available (the segment is unmapped).
+ */
+static fsm_shm_t* state_machine_shm_map (fsm_shm_header_t *header);
+
+/**
+ * @fn state_machine_shm_ring
+ * @brief Get the ring of a process.
+ */
+static fsm_shm_ring_t* state_machine_shm_ring (const fsm_shm_t *shm, uint32_t process_id);
+
+/**
+ * @fn state_machine_shm_hash
+ * @brief Get the first item of the probe sequence of a handle.
+ */
+static uint32_t state_machine_shm_hash (const fsm_shm_t *shm, fsm_handle_t handle);
+
+/**
+ * @fn state_machine_shm_read
+ * @brief Read key and value of an item, written by the same writer (without lock).
+ */
+static void state_machine_shm_read (fsm_shm_entry_t *entry, uint64_t *key, uint64_t *value);
+
+/**
+ * @fn state_machine_shm_write
+ * @brief Change key and value of an item.
+ * WARNING: The lock of the writers must be held.
+ */
+static void state_machine_shm_write (const fsm_shm_t *shm, uint32_t index, uint64_t key, uint64_t value);
+
+/**
+ * @fn state_machine_shm_lock
+ * @brief Take the lock of the writers of the table.
+ * The item left odd by a process that died with the lock becomes a tombstone.
+ * @return true if the lock was taken.
+ */
+static bool state_machine_shm_lock (const fsm_shm_t *shm);
+
+/**
+ * @fn state_machine_shm_find
+ * @brief Find the item of the table of a handle.
+ * WARNING: The lock of the writers must be held.
+ * @param shm The registry.
+ * @param handle The handle.
+ * @param place Filled with the first item that can take the handle (tombstone or free item), the size of the table if none.
+ * @return The position of the item, the size of the table if the handle is not in the table.
+ */
+static uint32_t state_machine_shm_find (const fsm_shm_t *shm, fsm_handle_t handle, uint32_t *place);
+
+
+
+fsm_shm_t* state_machine_shm_create (const char *name, uint32_t process_nr, uint32_t machine_max, uint32_t ring_size)
+{
+    fsm_shm_header_t *header;
+    fsm_shm_ring_t *ring;
+    pthread_mutexattr_t attr;
+    uint64_t table_offset;
+    uint64_t table_size;
+    uint64_t ring_mask;
+    uint64_t ring_offset;
+    uint64_t ring_stride;
+    uint64_t size;
+    uint32_t cntr;
+    uint32_t index;
+    int fd;
+
+    if ((name == NULL) || (process_nr == 0) || (process_nr > STATE_MACHINE_SHM_MAX_PROCESSES) ||
+        (machine_max == 0) || (machine_max > 0x80000000) || (ring_size == 0) || (ring_size > 0x80000000))
+    {
+        return(NULL);
+    }
+
+    /* At most half of the table is used, so the probes stay short */
+    table_size = 1;
+    while (table_size < 2 * (uint64_t)machine_max)
+    {
+        table_size <<= 1;
+    }
+
+    /* At least 2 cells: a free cell and a written one have different sequences */
+    ring_mask = 2;
+    while (ring_mask < ring_size)
+    {
+        ring_mask <<= 1;
+    }
+    ring_mask--;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        return(NULL);
+    }
+
+    /* The table and the rings start on a cache line */
+    table_offset = (sizeof(fsm_shm_header_t) + STATE_MACHINE_CACHE_LINE - 1) & ~((uint64_t)STATE_MACHINE_CACHE_LINE - 1);
+    ring_offset = table_offset + table_size * sizeof(fsm_shm_entry_t);
+    ring_offset = (ring_offset + STATE_MACHINE_CACHE_LINE - 1) & ~((uint64_t)STATE_MACHINE_CACHE_LINE - 1);
+    ring_stride = sizeof(fsm_shm_ring_t) + (ring_mask + 1) * sizeof(fsm_shm_cell_t);
+    size = ring_offset + process_nr * ring_stride;
+
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return(NULL);
+    }
+
+    /* The new segment is filled with zeros: free items and counters at 0 */
+    header = (fsm_shm_header_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return(NULL);
+    }
+
+    /* A process that dies with the lock does not block the others */
+    if ((pthread_mutexattr_init(&attr) != 0) ||
+        (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0) ||
+        (pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0) ||
+        (pthread_mutex_init(&header->lock, &attr) != 0))
+    {
+        munmap(header, size);
+        shm_unlink(name);
+        return(NULL);
+    }
+
+    pthread_mutexattr_destroy(&attr);
+
+    header->version = STATE_MACHINE_SHM_VERSION;
+    header->size = size;
+    header->process_nr = process_nr;
+    header->table_mask = (uint32_t)(table_size - 1);
+    header->ring_mask = (uint32_t)ring_mask;
+    header->machine_max = machine_max;
+    header->table_offset = table_offset;
+    header->ring_offset = ring_offset;
+    header->ring_stride = ring_stride;
+    header->writing = STATE_MACHINE_SHM_NONE;
+
+    for (cntr = 0; cntr < process_nr; cntr++)
+    {
+        ring = (fsm_shm_ring_t *)((char *)header + header->ring_offset + cntr * header->ring_stride);
+        for (index = 0; index <= ring_mask; index++)
+        {
+            ring->cells[index].seq = index;
+        }
+    }
+
+    /* The other processes can open the registry from now */
+    __atomic_store_n(&header->magic, STATE_MACHINE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return(state_machine_shm_map(header));
+}
+
+
+
+fsm_shm_t* state_machine_shm_open (const char *name)
+{
+    fsm_shm_header_t *header;
+    struct stat info;
+    int fd;
+
+    if (name == NULL)
+    {
+        return(NULL);
+    }
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        return(NULL);
+    }
+
+    if ((fstat(fd, &info) != 0) || ((uint64_t)info.st_size < sizeof(fsm_shm_header_t)))
+    {
+        close(fd);
+        return(NULL);
+    }
+
+    header = (fsm_shm_header_t *)mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        return(NULL);
+    }
+
+    if ((__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != STATE_MACHINE_SHM_MAGIC) ||
+        (header->version != STATE_MACHINE_SHM_VERSION) || (header->size != (uint64_t)info.st_size))
+    {
+        munmap(header, (size_t)info.st_size);
+        return(NULL);
+    }
+
+    return(state_machine_shm_map(header));
+}
+
+
+
+void state_machine_shm_close (fsm_shm_t *shm)
+{
+    if (shm == NULL)
+    {
+        return;
+    }
+
+    munmap(shm->header, (size_t)shm->header->size);
+    free(shm);
+}
+
+
+
+bool state_machine_shm_unlink (const char *name)
+{
+    return(shm_unlink(name) == 0);
+}
+
+
+
+bool state_machine_shm_bind (fsm_shm_t *shm, uint32_t process_id, fsm_t *const *fsms, uint32_t slot_nr)
+{
+    if (process_id >= shm->header->process_nr)
+    {
+        return(false);
+    }
+
+    shm->process_id = process_id;
+    shm->fsms = fsms;
+    shm->slot_nr = slot_nr;
+
+    return(true);
+}
+
+
+
+bool state_machine_shm_register (fsm_shm_t *shm, fsm_handle_t handle, uint32_t slot)
+{
+    fsm_shm_header_t *header;
+    uint32_t index;
+    uint32_t place;
+
+    if ((shm->process_id == STATE_MACHINE_SHM_NONE) || (slot >= shm->slot_nr) ||
+        (handle == STATE_MACHINE_SHM_HANDLE_NONE) || (state_machine_shm_lock(shm) == false))
+    {
+        return(false);
+    }
+
+    header = shm->header;
+    index = state_machine_shm_find(shm, handle, &place);
+    if (index > header->table_mask)
+    {
+        if ((header->machine_nr >= header->machine_max) || (place > header->table_mask))
+        {
+            pthread_mutex_unlock(&header->lock);
+            return(false);
+        }
+
+        index = place;
+        header->machine_nr++;
+    }
+    else if ((shm->table[index].value & STATE_MACHINE_SHM_VALID) == 0)
+    {
+        header->machine_nr++;
+    }
+
+    state_machine_shm_write(shm, index, handle, STATE_MACHINE_SHM_VALID | ((uint64_t)shm->process_id << 32) | slot);
+    pthread_mutex_unlock(&header->lock);
+
+    return(true);
+}
+
+
+
+bool state_machine_shm_unregister (fsm_shm_t *shm, fsm_handle_t handle)
+{
+    fsm_shm_header_t *header;
+    fsm_shm_entry_t *entry;
+    uint32_t index;
+    uint32_t place;
+    uint32_t mask;
+
+    if ((handle == STATE_MACHINE_SHM_HANDLE_NONE) || (state_machine_shm_lock(shm) == false))
+    {
+        return(false);
+    }
+
+    header = shm->header;
+    mask = header->table_mask;
+    index = state_machine_shm_find(shm, handle, &place);
+
+    /* Only the owner removes its state machines (another process can move the handle meanwhile) */
+    if ((index > mask) || ((shm->table[index].value & STATE_MACHINE_SHM_VALID) == 0) ||
+        ((uint32_t)((shm->table[index].value & ~STATE_MACHINE_SHM_VALID) >> 32) != shm->process_id))
+    {
+        pthread_mutex_unlock(&header->lock);
+        return(false);
+    }
+
+    state_machine_shm_write(shm, index, handle, 0);
+    header->machine_nr--;
+
+    /* The tombstones before a free item end no probe sequence: they become free */
+    if (shm->table[(index + 1) & mask].key == STATE_MACHINE_SHM_HANDLE_NONE)
+    {
+        entry = &shm->table[index];
+        while ((entry->key != STATE_MACHINE_SHM_HANDLE_NONE) && ((entry->value & STATE_MACHINE_SHM_VALID) == 0))
+        {
+            state_machine_shm_write(shm, index, STATE_MACHINE_SHM_HANDLE_NONE, 0);
+            index = (index - 1) & mask;
+            entry = &shm->table[index];
+        }
+    }
+
+    pthread_mutex_unlock(&header->lock);
+
+    return(true);
+}
+
+
+
+bool state_machine_shm_lookup (const fsm_shm_t *shm, fsm_handle_t handle, uint32_t *process_id, uint32_t *slot)
+{
+    uint64_t value;
+    uint64_t key;
+    uint32_t index;
+    uint32_t cntr;
+    uint32_t mask;
+
+    if (handle == STATE_MACHINE_SHM_HANDLE_NONE)
+    {
+        return(false);
+    }
+
+    /* Linear probing, without lock: a free item ends the sequence */
+    mask = shm->header->table_mask;
+    index = state_machine_shm_hash(shm, handle);
+    for (cntr = 0; cntr <= mask; cntr++)
+    {
+        state_machine_shm_read(&shm->table[(index + cntr) & mask], &key, &value);
+
+        if (key == STATE_MACHINE_SHM_HANDLE_NONE)
+        {
+            return(false);
+        }
+
+        if (key == handle)
+        {
+            break;
+        }
+    }
+
+    if ((cntr > mask) || ((value & STATE_MACHINE_SHM_VALID) == 0))
+    {
+        return(false);
+    }
+
+    if (process_id != NULL)
+    {
+        *process_id = (uint32_t)((value & ~STATE_MACHINE_SHM_VALID) >> 32);
+    }
+
+    if (slot != NULL)
+    {
+        *slot = (uint32_t)value;
+    }
+
+    return(true);
+}
+
+
+
+bool state_machine_shm_send (fsm_shm_t *shm, fsm_handle_t handle, uint32_t target_id)
+{
+    fsm_shm_ring_t *ring;
+    fsm_shm_cell_t *cell;
+    uint32_t process_id;
+    uint32_t slot;
+    uint64_t pos;
+    uint64_t seq;
+
+    if (state_machine_shm_lookup(shm, handle, &process_id, &slot) == false)
+    {
+        return(false);
+    }
+
+    ring = state_machine_shm_ring(shm, process_id);
+
+    /* A producer takes a cell with a CAS on the tail, then publishes it with its sequence */
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        cell = &ring->cells[pos & shm->header->ring_mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos)
+        {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == true)
+            {
+                break;
+            }
+        }
+        else if ((int64_t)(seq - pos) < 0)
+        {
+            /* The cell was not read yet: full */
+            return(false);
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->slot = slot;
+    cell->target_id = target_id;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return(true);
+}
+
+
+
+uint32_t state_machine_shm_run (fsm_shm_t *shm, void *par)
+{
+    fsm_shm_ring_t *ring;
+    fsm_shm_cell_t *cell;
+    fsm_t *fsm;
+    uint64_t head;
+    uint32_t delivered;
+    uint32_t slot;
+    uint32_t target_id;
+
+    if (shm->process_id == STATE_MACHINE_SHM_NONE)
+    {
+        return(0);
+    }
+
+    ring = state_machine_shm_ring(shm, shm->process_id);
+    head = ring->head;
+
+    /* The messages sent meanwhile (e.g. to itself) are delivered by the next run */
+    delivered = 0;
+    while (delivered <= shm->header->ring_mask)
+    {
+        cell = &ring->cells[head & shm->header->ring_mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != head + 1)
+        {
+            break;
+        }
+
+        slot = cell->slot;
+        target_id = cell->target_id;
+
+        /* The cell is free for the producers */
+        __atomic_store_n(&cell->seq, head + shm->header->ring_mask + 1, __ATOMIC_RELEASE);
+        head++;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELAXED);
+        delivered++;
+
+        fsm = (slot < shm->slot_nr) ? shm->fsms[slot] : NULL;
+        if ((fsm != NULL) && (fsm->go_to_state(fsm, target_id) == true))
+        {
+            fsm->sm_run(fsm, par);
+        }
+        else
+        {
+            shm->rejected++;
+        }
+    }
+
+    return(delivered);
+}
+
+
+
+uint64_t state_machine_shm_rejected (const fsm_shm_t *shm)
+{
+    return(shm->rejected);
+}
+
+
+
+static fsm_shm_t* state_machine_shm_map (fsm_shm_header_t *header)
+{
+    fsm_shm_t *shm;
+
+    shm = (fsm_shm_t *)calloc(1, sizeof(fsm_shm_t));
+    if (shm == NULL)
+    {
+        munmap(header, (size_t)header->size);
+        return(NULL);
+    }
+
+    shm->header = header;
+    shm->table = (fsm_shm_entry_t *)((char *)header + header->table_offset);
+    shm->process_id = STATE_MACHINE_SHM_NONE;
+
+    return(shm);
+}
+
+
+
+static fsm_shm_ring_t* state_machine_shm_ring (const fsm_shm_t *shm, uint32_t process_id)
+{
+    return((fsm_shm_ring_t *)((char *)shm->header + shm->header->ring_offset + process_id * shm->header->ring_stride));
+}
+
+
+
+static uint32_t state_machine_shm_hash (const fsm_shm_t *shm, fsm_handle_t handle)
+{
+    uint64_t hash;
+
+    /* Mix of the bits of the handle (the handles are often consecutive) */
+    hash = handle;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+
+    return((uint32_t)hash & shm->header->table_mask);
+}
+
+
+
+static void state_machine_shm_read (fsm_shm_entry_t *entry, uint64_t *key, uint64_t *value)
+{
+    uint64_t seq;
+    uint32_t spin;
+
+    spin = 0;
+    for (;;)
+    {
+        seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0)
+        {
+            *key = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+            *value = __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq)
+            {
+                return;
+            }
+        }
+
+        /* The writer can be preempted in the middle of the write */
+        spin++;
+        if (spin >= STATE_MACHINE_SHM_SPIN)
+        {
+            sched_yield();
+            spin = 0;
+        }
+    }
+}
+
+
+
+static void state_machine_shm_write (const fsm_shm_t *shm, uint32_t index, uint64_t key, uint64_t value)
+{
+    fsm_shm_entry_t *entry;
+    uint64_t seq;
+
+    entry = &shm->table[index];
+    seq = entry->seq;
+
+    shm->header->writing = index;
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+    shm->header->writing = STATE_MACHINE_SHM_NONE;
+}
+
+
+
+static bool state_machine_shm_lock (const fsm_shm_t *shm)
+{
+    fsm_shm_header_t *header;
+    fsm_shm_entry_t *entry;
+    uint32_t cntr;
+    int error;
+
+    header = shm->header;
+    error = pthread_mutex_lock(&header->lock);
+    if (error == 0)
+    {
+        return(true);
+    }
+
+    if (error != EOWNERDEAD)
+    {
+        return(false);
+    }
+
+    /* The owner died: the item it was writing is closed as a tombstone and the machines counted again */
+    if (header->writing <= header->table_mask)
+    {
+        entry = &shm->table[header->writing];
+        entry->value = 0;
+        __atomic_store_n(&entry->seq, (entry->seq | 1) + 1, __ATOMIC_RELEASE);
+        header->writing = STATE_MACHINE_SHM_NONE;
+    }
+
+    header->machine_nr = 0;
+    for (cntr = 0; cntr <= header->table_mask; cntr++)
+    {
+        if ((shm->table[cntr].value & STATE_MACHINE_SHM_VALID) != 0)
+        {
+            header->machine_nr++;
+        }
+    }
+
+    if (pthread_mutex_consistent(&header->lock) != 0)
+    {
+        pthread_mutex_unlock(&header->lock);
+        return(false);
+    }
+
+    return(true);
+}
+
+
+
+static uint32_t state_machine_shm_find (const fsm_shm_t *shm, fsm_handle_t handle, uint32_t *place)
+{
+    fsm_shm_entry_t *entry;
+    uint32_t index;
+    uint32_t cntr;
+    uint32_t mask;
+
+    mask = shm->header->table_mask;
+    index = state_machine_shm_hash(shm, handle);
+    *place = mask + 1;
+
+    /* Linear probing (the items are changed only with the lock held) */
+    for (cntr = 0; cntr <= mask; cntr++)
+    {
+        entry = &shm->table[(index + cntr) & mask];
+
+        if (entry->key == handle)
+        {
+            return((index + cntr) & mask);
+        }
+
+        if ((entry->key == STATE_MACHINE_SHM_HANDLE_NONE) || ((entry->value & STATE_MACHINE_SHM_VALID) == 0))
+        {
+            if (*place > mask)
+            {
+                *place = (index + cntr) & mask;
+            }
+
+            if (entry->key == STATE_MACHINE_SHM_HANDLE_NONE)
+            {
+                break;
+            }
+        }
+    }
+
+    return(mask + 1);
+}
@@ -0,0 +1,161 @@
+/**
+ * @file state_machine_shm.h
+ * @brief Registry of the state machines of several processes in shared memory.
+ *
+ * The processes of a host map the same POSIX shared memory segment, holding a hash table
+ * from the handles of the state machines (chosen by the user, e.g. a session ID) to
+ * their owner process and slot, and an inbound ring for every process. Any process can
+ * send a transition to any registered state machine: the lookup and the write to the
+ * ring of the owner use only atomic operations on the shared memory (no lock and no
+ * system call), and the owner delivers the messages with "state_machine_shm_run".
+ * The registrations take a lock of the segment (robust: a process that dies with it
+ * does not block the others), and the items of the unregistered handles are reused.
+ *
+ * Example:
+ *     // Before the fork of the workers
+ *     shm = state_machine_shm_create("/fsm", 48, 1000000, 4096);
+ *
+ *     // Worker "id"
+ *     state_machine_shm_bind(shm, id, fsms, count);
+ *     state_machine_shm_register(shm, session_id, slot);
+ *     ...
+ *     state_machine_shm_send(shm, other_session_id, STATE_CLOSING);
+ *     state_machine_shm_run(shm, NULL);
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_SHM_H
+#define STATE_MACHINE_SHM_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_SHM_HANDLE_NONE
+ * @brief Handle reserved (not valid for the state machines).
+ */
+#define STATE_MACHINE_SHM_HANDLE_NONE   0ULL
+
+/**
+ * @def STATE_MACHINE_SHM_MAX_PROCESSES
+ * @brief Maximum number of processes of a registry.
+ */
+#define STATE_MACHINE_SHM_MAX_PROCESSES 0x7FFFFFFF
+
+
+
+/**
+ * @typedef fsm_shm_t
+ * @brief Data type used to handle the mapping of a registry in a process.
+ */
+typedef struct _fsm_shm_t fsm_shm_t;
+
+/**
+ * @typedef fsm_handle_t
+ * @brief Data type used to identify a state machine in a registry.
+ */
+typedef uint64_t fsm_handle_t;
+
+
+
+/**
+ * @fn state_machine_shm_create
+ * @brief Create a registry (the segment must not exist) and map it.
+ * INFO: The processes created with "fork" after the call share the mapping.
+ * @param name Name of the shared memory segment (see "shm_open").
+ * @param process_nr Number of processes.
+ * @param machine_max Maximum number of state machines registered at the same time (at most 2^31).
+ * @param ring_size Number of messages of the ring of every process (rounded up to a power of 2, at least 2).
+ * @return The registry, NULL if the parameters are not valid or the segment cannot be created.
+ */
+fsm_shm_t* state_machine_shm_create (const char *name, uint32_t process_nr, uint32_t machine_max, uint32_t ring_size);
+
+/**
+ * @fn state_machine_shm_open
+ * @brief Map a registry created by another process.
+ * @return The registry, NULL if the segment does not exist or is not a registry.
+ */
+fsm_shm_t* state_machine_shm_open (const char *name);
+
+/**
+ * @fn state_machine_shm_close
+ * @brief Unmap a registry (the segment and the messages are kept).
+ */
+void state_machine_shm_close (fsm_shm_t *shm);
+
+/**
+ * @fn state_machine_shm_unlink
+ * @brief Remove the segment of a registry (the mappings are valid until closed).
+ * @return true if the segment was removed.
+ */
+bool state_machine_shm_unlink (const char *name);
+
+/**
+ * @fn state_machine_shm_bind
+ * @brief Set the process that uses the mapping and its state machines.
+ * WARNING: The array is not copied and must be valid until the registry is closed.
+ * @param shm The registry.
+ * @param process_id ID of the process (0 ... process_nr - 1, a single mapping for each ID).
+ * @param fsms The state machines of the process (addressed by slot).
+ * @param slot_nr Number of state machines.
+ * @return true if the process was bound, false if the ID is not valid.
+ */
+bool state_machine_shm_bind (fsm_shm_t *shm, uint32_t process_id, fsm_t *const *fsms, uint32_t slot_nr);
+
+/**
+ * @fn state_machine_shm_register
+ * @brief Register a state machine of the bound process (a handle already registered is moved to it).
+ * @param shm The registry.
+ * @param handle Handle of the state machine.
+ * @param slot Slot of the state machine in the bound process.
+ * @return true if the state machine was registered, false if the parameters are not valid or "machine_max" state machines are registered.
+ */
+bool state_machine_shm_register (fsm_shm_t *shm, fsm_handle_t handle, uint32_t slot);
+
+/**
+ * @fn state_machine_shm_unregister
+ * @brief Remove a state machine of the bound process from the registry.
+ * @return true if the state machine was removed, false if it is not registered by the bound process.
+ */
+bool state_machine_shm_unregister (fsm_shm_t *shm, fsm_handle_t handle);
+
+/**
+ * @fn state_machine_shm_lookup
+ * @brief Find a state machine.
+ * @param shm The registry.
+ * @param handle Handle of the state machine.
+ * @param process_id Filled with the owner (can be NULL).
+ * @param slot Filled with the slot in the owner (can be NULL).
+ * @return true if the state machine is registered.
+ */
+bool state_machine_shm_lookup (const fsm_shm_t *shm, fsm_handle_t handle, uint32_t *process_id, uint32_t *slot);
+
+/**
+ * @fn state_machine_shm_send
+ * @brief Send a transition to a state machine (written to the ring of its owner).
+ * @return true if the message was sent, false if the handle is not registered or the ring is full.
+ */
+bool state_machine_shm_send (fsm_shm_t *shm, fsm_handle_t handle, uint32_t target_id);
+
+/**
+ * @fn state_machine_shm_run
+ * @brief Deliver the messages received by the bound process.
+ * Every message is delivered with "go_to_state" and, if accepted, "sm_run".
+ * WARNING: A process must be run by a single thread at a time.
+ * @param shm The registry.
+ * @param par Parameter "passed" to "sm_run".
+ * @return The number of messages delivered.
+ */
+uint32_t state_machine_shm_run (fsm_shm_t *shm, void *par);
+
+/**
+ * @fn state_machine_shm_rejected
+ * @brief Get the number of messages delivered by this mapping but not accepted (slot not valid or refused by "go_to_state").
+ */
+uint64_t state_machine_shm_rejected (const fsm_shm_t *shm);
+
+
+
+#endif
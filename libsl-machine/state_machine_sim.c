@@ -0,0 +1,493 @@
+/**
+ * @file state_machine_sim.c
+ */
+
+#include <stdlib.h>
+
+#include "state_machine_sim.h"
+
+
+
+/**
+ * @def STATE_MACHINE_SIM_SLAB_BITS
+ * @brief Number of bits of the index of an event inside its slab.
+ */
+#define STATE_MACHINE_SIM_SLAB_BITS     10
+
+/**
+ * @def STATE_MACHINE_SIM_SLAB_SIZE
+ * @brief Number of events of a slab.
+ */
+#define STATE_MACHINE_SIM_SLAB_SIZE     (1U << STATE_MACHINE_SIM_SLAB_BITS)
+
+
+
+/**
+ * @typedef fsm_sim_event_t
+ * @brief Scheduled event (node of the pairing heap).
+ */
+typedef struct _fsm_sim_event_t fsm_sim_event_t;
+
+/**
+ * @struct _fsm_sim_event_t
+ * @brief See "fsm_sim_event_t" for details.
+ */
+struct _fsm_sim_event_t {
+    fsm_sim_time_t time;        /**< Time of the event */
+    uint64_t seq;               /**< Order of scheduling (for the events with the same time) */
+    fsm_sim_event_t *child;     /**< First child */
+    fsm_sim_event_t *next;      /**< Next sibling (next free event when not used) */
+    fsm_sim_event_t *prev;      /**< Previous sibling, or parent for the first child */
+    fsm_t *fsm;                 /**< State machine of a transition (NULL for a generic event) */
+    uint32_t target_id;         /**< Target of the transition */
+    uint32_t generation;        /**< Incremented every time the event is released (odd while scheduled) */
+    fsm_sim_callback_t callback;    /**< Function of a generic event */
+    void *data;                 /**< Parameter of "sm_run" or of the function */
+    uint32_t index;             /**< Position of the event in the slabs */
+};
+
+/**
+ * @struct _fsm_sim_t
+ * @brief See "fsm_sim_t" for details.
+ */
+struct _fsm_sim_t {
+    fsm_sim_time_t now;         /**< The virtual clock */
+    uint64_t seq;               /**< Number of events scheduled */
+    uint64_t pending;           /**< Number of events in the heap */
+    uint64_t rejected;          /**< Number of transitions not accepted */
+    fsm_sim_event_t *root;      /**< Root of the heap (next event) */
+    fsm_sim_event_t *free_events;   /**< List of the events not used */
+    fsm_sim_event_t **slabs;    /**< The slabs of the events */
+    uint32_t slab_nr;           /**< Number of slabs */
+};
+
+
+
+/**
+ * @var state_machine_sim_active
+ * @brief Simulation that is executing an event in the calling thread.
+ */
+static __thread fsm_sim_t *state_machine_sim_active;
+
+
+
+/**
+ * @fn state_machine_sim_alloc
+ * @brief Get an event from the free list (a new slab is added when it is empty).
+ * @return The event, NULL if the memory is not available.
+ */
+static fsm_sim_event_t* state_machine_sim_alloc (fsm_sim_t *sim);
+
+/**
+ * @fn state_machine_sim_insert
+ * @brief Schedule an event at the given delay.
+ */
+static fsm_sim_handle_t state_machine_sim_insert (fsm_sim_t *sim, fsm_sim_event_t *event, fsm_sim_time_t delay);
+
+/**
+ * @fn state_machine_sim_release
+ * @brief Give an event back to the free list (its handle is no longer valid).
+ */
+static void state_machine_sim_release (fsm_sim_t *sim, fsm_sim_event_t *event);
+
+/**
+ * @fn state_machine_sim_meld
+ * @brief Join two heaps.
+ * @return The root of the result.
+ */
+static fsm_sim_event_t* state_machine_sim_meld (fsm_sim_event_t *a, fsm_sim_event_t *b);
+
+/**
+ * @fn state_machine_sim_merge_pairs
+ * @brief Join a list of siblings into a heap (two-pass pairing).
+ * @return The root of the result (NULL if the list is empty).
+ */
+static fsm_sim_event_t* state_machine_sim_merge_pairs (fsm_sim_event_t *first);
+
+
+
+fsm_sim_t* state_machine_sim_create (void)
+{
+    return((fsm_sim_t *)calloc(1, sizeof(fsm_sim_t)));
+}
+
+
+
+void state_machine_sim_destroy (fsm_sim_t *sim)
+{
+    uint32_t cntr;
+
+    if (sim == NULL)
+    {
+        return;
+    }
+
+    for (cntr = 0; cntr < sim->slab_nr; cntr++)
+    {
+        free(sim->slabs[cntr]);
+    }
+
+    free(sim->slabs);
+    free(sim);
+}
+
+
+
+fsm_sim_time_t state_machine_sim_now (const fsm_sim_t *sim)
+{
+    return(sim->now);
+}
+
+
+
+fsm_sim_t* state_machine_sim_current (void)
+{
+    return(state_machine_sim_active);
+}
+
+
+
+fsm_sim_handle_t state_machine_sim_schedule (fsm_sim_t *sim, fsm_t *fsm, uint32_t target_id, fsm_sim_time_t delay, void *par)
+{
+    fsm_sim_event_t *event;
+
+    event = state_machine_sim_alloc(sim);
+    if (event == NULL)
+    {
+        return(STATE_MACHINE_SIM_NONE);
+    }
+
+    event->fsm = fsm;
+    event->target_id = target_id;
+    event->callback = NULL;
+    event->data = par;
+
+    return(state_machine_sim_insert(sim, event, delay));
+}
+
+
+
+fsm_sim_handle_t state_machine_sim_call (fsm_sim_t *sim, fsm_sim_time_t delay, fsm_sim_callback_t callback, void *data)
+{
+    fsm_sim_event_t *event;
+
+    event = state_machine_sim_alloc(sim);
+    if (event == NULL)
+    {
+        return(STATE_MACHINE_SIM_NONE);
+    }
+
+    event->fsm = NULL;
+    event->target_id = 0;
+    event->callback = callback;
+    event->data = data;
+
+    return(state_machine_sim_insert(sim, event, delay));
+}
+
+
+
+bool state_machine_sim_cancel (fsm_sim_t *sim, fsm_sim_handle_t handle)
+{
+    fsm_sim_event_t *event;
+    fsm_sim_event_t *children;
+    uint32_t index;
+
+    /* The handle stores the generation (high 32 bits) and the position of the event */
+    index = (uint32_t)handle;
+    if ((handle == STATE_MACHINE_SIM_NONE) || ((index >> STATE_MACHINE_SIM_SLAB_BITS) >= sim->slab_nr))
+    {
+        return(false);
+    }
+
+    event = &sim->slabs[index >> STATE_MACHINE_SIM_SLAB_BITS][index & (STATE_MACHINE_SIM_SLAB_SIZE - 1)];
+    if ((event->generation != (uint32_t)(handle >> 32)) || ((event->generation & 1) == 0))
+    {
+        return(false);
+    }
+
+    if (event == sim->root)
+    {
+        sim->root = state_machine_sim_merge_pairs(event->child);
+    }
+    else
+    {
+        /* Detach the event from its siblings and join its children to the heap */
+        if (event->prev->child == event)
+        {
+            event->prev->child = event->next;
+        }
+        else
+        {
+            event->prev->next = event->next;
+        }
+
+        if (event->next != NULL)
+        {
+            event->next->prev = event->prev;
+        }
+
+        children = state_machine_sim_merge_pairs(event->child);
+        sim->root = state_machine_sim_meld(sim->root, children);
+    }
+
+    if (sim->root != NULL)
+    {
+        sim->root->prev = NULL;
+    }
+
+    sim->pending--;
+    state_machine_sim_release(sim, event);
+
+    return(true);
+}
+
+
+
+bool state_machine_sim_step (fsm_sim_t *sim)
+{
+    fsm_sim_event_t *event;
+    fsm_sim_callback_t callback;
+    fsm_sim_t *saved;
+    fsm_t *fsm;
+    uint32_t target_id;
+    void *data;
+
+    event = sim->root;
+    if (event == NULL)
+    {
+        return(false);
+    }
+
+    sim->root = state_machine_sim_merge_pairs(event->child);
+    if (sim->root != NULL)
+    {
+        sim->root->prev = NULL;
+    }
+    sim->pending--;
+
+    sim->now = event->time;
+
+    /* The event is released first: the callbacks can schedule new events (and reuse it) */
+    fsm = event->fsm;
+    target_id = event->target_id;
+    callback = event->callback;
+    data = event->data;
+    state_machine_sim_release(sim, event);
+
+    saved = state_machine_sim_active;
+    state_machine_sim_active = sim;
+
+    if (fsm != NULL)
+    {
+        if (fsm->go_to_state(fsm, target_id) == true)
+        {
+            fsm->sm_run(fsm, data);
+        }
+        else
+        {
+            sim->rejected++;
+        }
+    }
+    else
+    {
+        callback(sim, data);
+    }
+
+    state_machine_sim_active = saved;
+
+    return(true);
+}
+
+
+
+uint64_t state_machine_sim_run (fsm_sim_t *sim, fsm_sim_time_t until)
+{
+    uint64_t executed;
+
+    executed = 0;
+    while ((sim->root != NULL) && (sim->root->time <= until))
+    {
+        state_machine_sim_step(sim);
+        executed++;
+    }
+
+    if ((until != STATE_MACHINE_SIM_FOREVER) && (sim->now < until))
+    {
+        sim->now = until;
+    }
+
+    return(executed);
+}
+
+
+
+uint64_t state_machine_sim_pending (const fsm_sim_t *sim)
+{
+    return(sim->pending);
+}
+
+
+
+uint64_t state_machine_sim_rejected (const fsm_sim_t *sim)
+{
+    return(sim->rejected);
+}
+
+
+
+static fsm_sim_event_t* state_machine_sim_alloc (fsm_sim_t *sim)
+{
+    fsm_sim_event_t **slabs;
+    fsm_sim_event_t *slab;
+    fsm_sim_event_t *event;
+    uint32_t cntr;
+
+    if (sim->free_events == NULL)
+    {
+        /* The handles store the position of the events in 32 bits */
+        if (sim->slab_nr == (1U << (32 - STATE_MACHINE_SIM_SLAB_BITS)))
+        {
+            return(NULL);
+        }
+
+        slabs = (fsm_sim_event_t **)realloc(sim->slabs, (sim->slab_nr + 1) * sizeof(fsm_sim_event_t *));
+        if (slabs == NULL)
+        {
+            return(NULL);
+        }
+        sim->slabs = slabs;
+
+        slab = (fsm_sim_event_t *)calloc(STATE_MACHINE_SIM_SLAB_SIZE, sizeof(fsm_sim_event_t));
+        if (slab == NULL)
+        {
+            return(NULL);
+        }
+
+        for (cntr = STATE_MACHINE_SIM_SLAB_SIZE; cntr > 0; cntr--)
+        {
+            slab[cntr - 1].index = (sim->slab_nr << STATE_MACHINE_SIM_SLAB_BITS) | (cntr - 1);
+            slab[cntr - 1].next = sim->free_events;
+            sim->free_events = &slab[cntr - 1];
+        }
+
+        sim->slabs[sim->slab_nr++] = slab;
+    }
+
+    event = sim->free_events;
+    sim->free_events = event->next;
+
+    /* Odd generation: scheduled */
+    event->generation++;
+
+    return(event);
+}
+
+
+
+static fsm_sim_handle_t state_machine_sim_insert (fsm_sim_t *sim, fsm_sim_event_t *event, fsm_sim_time_t delay)
+{
+    event->time = (delay > STATE_MACHINE_SIM_FOREVER - sim->now) ? STATE_MACHINE_SIM_FOREVER : sim->now + delay;
+    event->seq = sim->seq++;
+    event->child = NULL;
+    event->next = NULL;
+    event->prev = NULL;
+
+    sim->root = state_machine_sim_meld(sim->root, event);
+    sim->pending++;
+
+    return(((uint64_t)event->generation << 32) | event->index);
+}
+
+
+
+static void state_machine_sim_release (fsm_sim_t *sim, fsm_sim_event_t *event)
+{
+    event->generation++;
+    event->next = sim->free_events;
+    sim->free_events = event;
+}
+
+
+
+static fsm_sim_event_t* state_machine_sim_meld (fsm_sim_event_t *a, fsm_sim_event_t *b)
+{
+    fsm_sim_event_t *tmp;
+
+    if (a == NULL)
+    {
+        return(b);
+    }
+
+    if (b == NULL)
+    {
+        return(a);
+    }
+
+    /* "a" becomes the root: the earlier event (or the one scheduled first) */
+    if ((b->time < a->time) || ((b->time == a->time) && (b->seq < a->seq)))
+    {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL)
+    {
+        a->child->prev = b;
+    }
+    a->child = b;
+
+    a->next = NULL;
+    a->prev = NULL;
+
+    return(a);
+}
+
+
+
+static fsm_sim_event_t* state_machine_sim_merge_pairs (fsm_sim_event_t *first)
+{
+    fsm_sim_event_t *pairs;
+    fsm_sim_event_t *a;
+    fsm_sim_event_t *b;
+    fsm_sim_event_t *next;
+    fsm_sim_event_t *root;
+
+    /* First pass: join the siblings two by two, building a reversed list of the pairs */
+    pairs = NULL;
+    while (first != NULL)
+    {
+        a = first;
+        b = a->next;
+        next = (b != NULL) ? b->next : NULL;
+
+        a->next = NULL;
+        if (b != NULL)
+        {
+            b->next = NULL;
+        }
+
+        a = state_machine_sim_meld(a, b);
+        a->next = pairs;
+        pairs = a;
+
+        first = next;
+    }
+
+    /* Second pass: join the pairs from the last one */
+    root = NULL;
+    while (pairs != NULL)
+    {
+        next = pairs->next;
+        pairs->next = NULL;
+
+        root = state_machine_sim_meld(root, pairs);
+
+        pairs = next;
+    }
+
+    return(root);
+}
@@ -0,0 +1,154 @@
+/**
+ * @file state_machine_sim.h
+ * @brief Discrete-event simulation of state machines with a virtual clock.
+ *
+ * The events (transitions of state machines and generic callbacks) are scheduled at a
+ * virtual time and executed in order of time and, for the same time, in order of
+ * scheduling, so every run of a simulation gives the same result. The clock jumps from
+ * an event to the next one: a simulation runs as fast as the callbacks allow, whatever
+ * the time simulated. The state machines and their callbacks are the production ones;
+ * the callbacks can schedule new events and timeouts with "state_machine_sim_current".
+ * The events are stored in a pairing heap and their memory is reused.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_SIM_H
+#define STATE_MACHINE_SIM_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_SIM_FOREVER
+ * @brief Time limit of "state_machine_sim_run" that executes all the events.
+ */
+#define STATE_MACHINE_SIM_FOREVER       0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * @def STATE_MACHINE_SIM_NONE
+ * @brief Value of the handles not valid.
+ */
+#define STATE_MACHINE_SIM_NONE          0ULL
+
+
+
+/**
+ * @typedef fsm_sim_t
+ * @brief Data type used to handle a simulation.
+ */
+typedef struct _fsm_sim_t fsm_sim_t;
+
+/**
+ * @typedef fsm_sim_time_t
+ * @brief Data type used to store a virtual time (the unit is chosen by the user, e.g. ns).
+ */
+typedef uint64_t fsm_sim_time_t;
+
+/**
+ * @typedef fsm_sim_handle_t
+ * @brief Data type used to identify a scheduled event (e.g. to cancel a timeout).
+ */
+typedef uint64_t fsm_sim_handle_t;
+
+/**
+ * @typedef fsm_sim_callback_t
+ * @brief Pointer to the function called by a generic event (e.g. the arrival of external load).
+ * @param sim The simulation.
+ * @param data Parameter given with the event.
+ */
+typedef void (*fsm_sim_callback_t) (fsm_sim_t *sim, void *data);
+
+
+
+/**
+ * @fn state_machine_sim_create
+ * @brief Create a simulation with the clock at 0 and no events.
+ * @return The new simulation, NULL if the memory is not available.
+ */
+fsm_sim_t* state_machine_sim_create (void);
+
+/**
+ * @fn state_machine_sim_destroy
+ * @brief Release a simulation (the events not executed are dropped).
+ */
+void state_machine_sim_destroy (fsm_sim_t *sim);
+
+/**
+ * @fn state_machine_sim_now
+ * @brief Get the virtual time of the simulation.
+ */
+fsm_sim_time_t state_machine_sim_now (const fsm_sim_t *sim);
+
+/**
+ * @fn state_machine_sim_current
+ * @brief Get the simulation that is executing an event in the calling thread (NULL if none).
+ * Example: The "enter" callback of a state starts its timeout with
+ * "state_machine_sim_schedule(state_machine_sim_current(), ...)".
+ */
+fsm_sim_t* state_machine_sim_current (void);
+
+/**
+ * @fn state_machine_sim_schedule
+ * @brief Schedule a transition of a state machine.
+ * When the event is executed, "go_to_state" is called and, if the transition is accepted, "sm_run".
+ * @param sim The simulation.
+ * @param fsm The state machine.
+ * @param target_id The target of the transition.
+ * @param delay Time from now to the event.
+ * @param par Parameter "passed" to "sm_run".
+ * @return The handle of the event, "STATE_MACHINE_SIM_NONE" if the memory is not available.
+ */
+fsm_sim_handle_t state_machine_sim_schedule (fsm_sim_t *sim, fsm_t *fsm, uint32_t target_id, fsm_sim_time_t delay, void *par);
+
+/**
+ * @fn state_machine_sim_call
+ * @brief Schedule a generic event.
+ * @param sim The simulation.
+ * @param delay Time from now to the event.
+ * @param callback The function called by the event.
+ * @param data Parameter passed to the function.
+ * @return The handle of the event, "STATE_MACHINE_SIM_NONE" if the memory is not available.
+ */
+fsm_sim_handle_t state_machine_sim_call (fsm_sim_t *sim, fsm_sim_time_t delay, fsm_sim_callback_t callback, void *data);
+
+/**
+ * @fn state_machine_sim_cancel
+ * @brief Cancel a scheduled event (e.g. a timeout of a state left before it expires).
+ * @return true if the event was cancelled, false if it was already executed or cancelled.
+ */
+bool state_machine_sim_cancel (fsm_sim_t *sim, fsm_sim_handle_t handle);
+
+/**
+ * @fn state_machine_sim_step
+ * @brief Execute the next event, moving the clock to its time.
+ * @return true if an event was executed, false if there are no events.
+ */
+bool state_machine_sim_step (fsm_sim_t *sim);
+
+/**
+ * @fn state_machine_sim_run
+ * @brief Execute the events up to the given time (the events scheduled meanwhile included).
+ * At the end the clock is moved to the time limit (unless it is "STATE_MACHINE_SIM_FOREVER").
+ * @param sim The simulation.
+ * @param until Time limit.
+ * @return The number of events executed.
+ */
+uint64_t state_machine_sim_run (fsm_sim_t *sim, fsm_sim_time_t until);
+
+/**
+ * @fn state_machine_sim_pending
+ * @brief Get the number of events scheduled and not executed.
+ */
+uint64_t state_machine_sim_pending (const fsm_sim_t *sim);
+
+/**
+ * @fn state_machine_sim_rejected
+ * @brief Get the number of scheduled transitions not accepted by "go_to_state".
+ */
+uint64_t state_machine_sim_rejected (const fsm_sim_t *sim);
+
+
+
+#endif
@@ -0,0 +1,483 @@
+/**
+ * @file state_machine_trace.c
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "state_machine_trace.h"
+
+
+
+/**
+ * @def STATE_MACHINE_TRACE_BUFFER
+ * @brief Number of records buffered by a recorder before they are written.
+ */
+#define STATE_MACHINE_TRACE_BUFFER      4096
+
+
+
+/**
+ * @typedef fsm_trace_binding_t
+ * @brief State machine attached to a recorder.
+ */
+typedef struct _fsm_trace_binding_t fsm_trace_binding_t;
+
+/**
+ * @struct _fsm_trace_binding_t
+ * @brief See "fsm_trace_binding_t" for details.
+ */
+struct _fsm_trace_binding_t {
+    fsm_hook_link_t link;                   /**< Hook set before the attach (first field, see "state_machine_hook_link") */
+    fsm_trace_t *trace;                     /**< The recorder */
+    uint32_t machine_id;                    /**< ID of the state machine in the trace */
+    fsm_run_t sm_run;                       /**< Original "sm_run" */
+    state_machine_go_to_state_t go_to_state;/**< Original "go_to_state" */
+};
+
+/**
+ * @struct _fsm_trace_t
+ * @brief See "fsm_trace_t" for details.
+ */
+struct _fsm_trace_t {
+    FILE *file;                 /**< The trace file */
+    pthread_mutex_t lock;       /**< Lock of the buffer and of the file */
+    bool failed;                /**< true if a write failed */
+    uint32_t machine_nr;        /**< Highest ID of the attached state machines + 1 */
+    uint64_t event_nr;          /**< Number of records */
+    uint64_t start_ns;          /**< Time of the creation */
+    uint32_t used;              /**< Number of records in the buffer */
+    fsm_trace_record_t buffer[STATE_MACHINE_TRACE_BUFFER];  /**< Records not written yet */
+};
+
+/**
+ * @struct _fsm_replay_t
+ * @brief See "fsm_replay_t" for details.
+ */
+struct _fsm_replay_t {
+    void *map;                  /**< The mapped file */
+    size_t size;                /**< Size of the mapping */
+    const fsm_trace_record_t *records;  /**< The records */
+    size_t event_nr;            /**< Number of records */
+    uint32_t machine_nr;        /**< Highest ID of the state machines + 1 */
+};
+
+
+
+/**
+ * @fn state_machine_trace_now
+ * @brief Get the time of the monotonic clock in ns.
+ */
+static uint64_t state_machine_trace_now (void);
+
+/**
+ * @fn state_machine_trace_write
+ * @brief Add a record to the recorder (the buffer is written when full).
+ */
+static void state_machine_trace_write (fsm_trace_t *trace, uint32_t machine, uint32_t value);
+
+/**
+ * @fn state_machine_trace_flush
+ * @brief Write the buffered records (the lock must be held).
+ */
+static void state_machine_trace_flush (fsm_trace_t *trace);
+
+/**
+ * @fn state_machine_trace_run
+ * @brief Wrapper of "sm_run" of the attached state machines: see "fsm_run_t" for details.
+ */
+static uint32_t state_machine_trace_run (fsm_t *fsm, void *par);
+
+/**
+ * @fn state_machine_trace_go_to_state
+ * @brief Wrapper of "go_to_state" of the attached state machines: see "state_machine_go_to_state_t" for details.
+ */
+static bool state_machine_trace_go_to_state (fsm_t *fsm, uint32_t target_id);
+
+/**
+ * @fn state_machine_trace_hook
+ * @brief Hook of the attached state machines: it calls the hook set before the attach.
+ */
+static void state_machine_trace_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data);
+
+
+
+fsm_trace_t* state_machine_trace_create (const char *path)
+{
+    fsm_trace_t *trace;
+    fsm_trace_header_t header = {0};
+
+    trace = (fsm_trace_t *)calloc(1, sizeof(fsm_trace_t));
+    if (trace == NULL)
+    {
+        return(NULL);
+    }
+
+    if (pthread_mutex_init(&trace->lock, NULL) != 0)
+    {
+        free(trace);
+        return(NULL);
+    }
+
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL)
+    {
+        pthread_mutex_destroy(&trace->lock);
+        free(trace);
+        return(NULL);
+    }
+
+    /* The header is written again with the counters by "state_machine_trace_close" */
+    header.magic = STATE_MACHINE_TRACE_MAGIC;
+    header.version = STATE_MACHINE_TRACE_VERSION;
+    if (fwrite(&header, sizeof(header), 1, trace->file) != 1)
+    {
+        trace->failed = true;
+    }
+
+    trace->start_ns = state_machine_trace_now();
+
+    return(trace);
+}
+
+
+
+bool state_machine_trace_attach (fsm_trace_t *trace, fsm_t *fsm, uint32_t machine_id)
+{
+    fsm_trace_binding_t *binding;
+
+    if ((machine_id > STATE_MACHINE_TRACE_MAX_MACHINE) || (state_machine_hook_find(fsm, state_machine_trace_hook) != NULL))
+    {
+        return(false);
+    }
+
+    binding = (fsm_trace_binding_t *)malloc(sizeof(fsm_trace_binding_t));
+    if (binding == NULL)
+    {
+        return(false);
+    }
+
+    binding->trace = trace;
+    binding->machine_id = machine_id;
+    binding->sm_run = fsm->sm_run;
+    binding->go_to_state = fsm->go_to_state;
+
+    pthread_mutex_lock(&trace->lock);
+    if (trace->machine_nr <= machine_id)
+    {
+        trace->machine_nr = machine_id + 1;
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    state_machine_hook_link(fsm, state_machine_trace_hook, &binding->link);
+    fsm->sm_run = state_machine_trace_run;
+    fsm->go_to_state = state_machine_trace_go_to_state;
+
+    return(true);
+}
+
+
+
+void state_machine_trace_detach (fsm_t *fsm)
+{
+    fsm_trace_binding_t *binding;
+
+    binding = (fsm_trace_binding_t *)state_machine_hook_unlink(fsm, state_machine_trace_hook, NULL);
+    if (binding == NULL)
+    {
+        return;
+    }
+
+    fsm->sm_run = binding->sm_run;
+    fsm->go_to_state = binding->go_to_state;
+
+    free(binding);
+}
+
+
+
+bool state_machine_trace_close (fsm_trace_t *trace)
+{
+    fsm_trace_header_t header = {0};
+    bool result;
+
+    if (trace == NULL)
+    {
+        return(false);
+    }
+
+    state_machine_trace_flush(trace);
+
+    header.magic = STATE_MACHINE_TRACE_MAGIC;
+    header.version = STATE_MACHINE_TRACE_VERSION;
+    header.machine_nr = trace->machine_nr;
+    header.event_nr = trace->event_nr;
+    header.duration_ns = state_machine_trace_now() - trace->start_ns;
+
+    if ((fseek(trace->file, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, trace->file) != 1))
+    {
+        trace->failed = true;
+    }
+
+    if (fclose(trace->file) != 0)
+    {
+        trace->failed = true;
+    }
+
+    result = !trace->failed;
+
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+
+    return(result);
+}
+
+
+
+fsm_replay_t* state_machine_replay_open (const char *path)
+{
+    fsm_replay_t *replay;
+    const fsm_trace_header_t *header;
+    struct stat info;
+    size_t cntr;
+    uint32_t machine;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return(NULL);
+    }
+
+    if ((fstat(fd, &info) != 0) || ((size_t)info.st_size < sizeof(fsm_trace_header_t)))
+    {
+        close(fd);
+        return(NULL);
+    }
+
+    replay = (fsm_replay_t *)calloc(1, sizeof(fsm_replay_t));
+    if (replay == NULL)
+    {
+        close(fd);
+        return(NULL);
+    }
+
+    replay->size = (size_t)info.st_size;
+    replay->map = mmap(NULL, replay->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (replay->map == MAP_FAILED)
+    {
+        free(replay);
+        return(NULL);
+    }
+
+    header = (const fsm_trace_header_t *)replay->map;
+    if ((header->magic != STATE_MACHINE_TRACE_MAGIC) || (header->version != STATE_MACHINE_TRACE_VERSION))
+    {
+        munmap(replay->map, replay->size);
+        free(replay);
+        return(NULL);
+    }
+
+    /*
+     The number of records comes from the size of the file (a partial record is ignored).
+     The scan of the IDs also loads the pages of the file before the replay.
+     */
+    replay->records = (const fsm_trace_record_t *)(header + 1);
+    replay->event_nr = (replay->size - sizeof(fsm_trace_header_t)) / sizeof(fsm_trace_record_t);
+
+    madvise(replay->map, replay->size, MADV_SEQUENTIAL);
+
+    for (cntr = 0; cntr < replay->event_nr; cntr++)
+    {
+        machine = replay->records[cntr].machine & ~STATE_MACHINE_TRACE_TYPE;
+        if (replay->machine_nr <= machine)
+        {
+            replay->machine_nr = machine + 1;
+        }
+    }
+
+    return(replay);
+}
+
+
+
+uint32_t state_machine_replay_machine_nr (const fsm_replay_t *replay)
+{
+    return(replay->machine_nr);
+}
+
+
+
+size_t state_machine_replay_event_nr (const fsm_replay_t *replay)
+{
+    return(replay->event_nr);
+}
+
+
+
+bool state_machine_replay_run (const fsm_replay_t *replay, fsm_t *const *machines, uint32_t machine_nr, void *par, fsm_replay_stats_t *stats)
+{
+    const fsm_trace_record_t *record;
+    fsm_t *fsm;
+    uint64_t mismatch_nr;
+    uint64_t first_mismatch;
+    uint64_t start_ns;
+    uint32_t type;
+    uint32_t cntr;
+    size_t index;
+    bool result;
+
+    if (machine_nr < replay->machine_nr)
+    {
+        return(false);
+    }
+
+    for (cntr = 0; cntr < replay->machine_nr; cntr++)
+    {
+        if (machines[cntr] == NULL)
+        {
+            return(false);
+        }
+    }
+
+    mismatch_nr = 0;
+    first_mismatch = replay->event_nr;
+    start_ns = state_machine_trace_now();
+
+    for (index = 0; index < replay->event_nr; index++)
+    {
+        record = &replay->records[index];
+        type = record->machine & STATE_MACHINE_TRACE_TYPE;
+        fsm = machines[record->machine & ~STATE_MACHINE_TRACE_TYPE];
+
+        if (type == STATE_MACHINE_TRACE_RUN)
+        {
+            result = (fsm->sm_run(fsm, par) == record->value);
+        }
+        else
+        {
+            result = (fsm->go_to_state(fsm, record->value) == (type == STATE_MACHINE_TRACE_GO_TO));
+        }
+
+        if (result == false)
+        {
+            if (mismatch_nr == 0)
+            {
+                first_mismatch = index;
+            }
+            mismatch_nr++;
+        }
+    }
+
+    if (stats != NULL)
+    {
+        stats->event_nr = replay->event_nr;
+        stats->mismatch_nr = mismatch_nr;
+        stats->first_mismatch = first_mismatch;
+        stats->duration_ns = state_machine_trace_now() - start_ns;
+    }
+
+    return(mismatch_nr == 0);
+}
+
+
+
+void state_machine_replay_close (fsm_replay_t *replay)
+{
+    if (replay == NULL)
+    {
+        return;
+    }
+
+    munmap(replay->map, replay->size);
+    free(replay);
+}
+
+
+
+static uint64_t state_machine_trace_now (void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec);
+}
+
+
+
+static void state_machine_trace_write (fsm_trace_t *trace, uint32_t machine, uint32_t value)
+{
+    pthread_mutex_lock(&trace->lock);
+
+    trace->buffer[trace->used].machine = machine;
+    trace->buffer[trace->used].value = value;
+    trace->used++;
+    trace->event_nr++;
+
+    if (trace->used == STATE_MACHINE_TRACE_BUFFER)
+    {
+        state_machine_trace_flush(trace);
+    }
+
+    pthread_mutex_unlock(&trace->lock);
+}
+
+
+
+static void state_machine_trace_flush (fsm_trace_t *trace)
+{
+    if ((trace->used > 0) && (fwrite(trace->buffer, sizeof(fsm_trace_record_t), trace->used, trace->file) != trace->used))
+    {
+        trace->failed = true;
+    }
+
+    trace->used = 0;
+}
+
+
+
+static uint32_t state_machine_trace_run (fsm_t *fsm, void *par)
+{
+    /* Other hooks can be linked after the recorder */
+    fsm_trace_binding_t *binding = (fsm_trace_binding_t *)state_machine_hook_find(fsm, state_machine_trace_hook);
+    uint32_t state;
+
+    state = binding->sm_run(fsm, par);
+    state_machine_trace_write(binding->trace, binding->machine_id | STATE_MACHINE_TRACE_RUN, state);
+
+    return(state);
+}
+
+
+
+static bool state_machine_trace_go_to_state (fsm_t *fsm, uint32_t target_id)
+{
+    fsm_trace_binding_t *binding = (fsm_trace_binding_t *)state_machine_hook_find(fsm, state_machine_trace_hook);
+    bool result;
+
+    result = binding->go_to_state(fsm, target_id);
+    state_machine_trace_write(binding->trace, binding->machine_id | ((result == true) ? STATE_MACHINE_TRACE_GO_TO : STATE_MACHINE_TRACE_GO_TO_FAILED), target_id);
+
+    return(result);
+}
+
+
+
+static void state_machine_trace_hook (fsm_t *fsm, uint32_t exit_state_id, uint32_t enter_state_id, void *data)
+{
+    fsm_trace_binding_t *binding = (fsm_trace_binding_t *)data;
+
+    if (binding->link.on_transition != NULL)
+    {
+        binding->link.on_transition(fsm, exit_state_id, enter_state_id, binding->link.hook_data);
+    }
+}
@@ -0,0 +1,221 @@
+/**
+ * @file state_machine_trace.h
+ * @brief Recorder and replayer of the calls made to state machines.
+ *
+ * A trace stores the calls of "go_to_state" and "sm_run" of a set of state machines,
+ * with their results, in a compact binary file: a header followed by one record of
+ * 8 bytes per call. The recorder wraps the function pointers of the attached machines;
+ * the replayer maps the file in memory and executes the calls again on other machines
+ * (e.g. built by a different version of the library) without allocating memory,
+ * checking that every call gives the recorded result. A trace is also a realistic
+ * input for benchmarks.
+ * INFO: The files use the byte order of the machine that records them.
+ *
+ * @author Slave77 <henry.slave77@gmail.com>
+ */
+
+#ifndef STATE_MACHINE_TRACE_H
+#define STATE_MACHINE_TRACE_H
+
+#include "state_machine.h"
+
+
+
+/**
+ * @def STATE_MACHINE_TRACE_MAGIC
+ * @brief First field of the header of a trace ("SLFT").
+ */
+#define STATE_MACHINE_TRACE_MAGIC       0x54464C53
+
+/**
+ * @def STATE_MACHINE_TRACE_VERSION
+ * @brief Version of the format of the traces.
+ */
+#define STATE_MACHINE_TRACE_VERSION     1
+
+/**
+ * @def STATE_MACHINE_TRACE_MAX_MACHINE
+ * @brief Maximum ID of a traced state machine (the high bits of the records store the type of the call).
+ */
+#define STATE_MACHINE_TRACE_MAX_MACHINE 0x3FFFFFFF
+
+/**
+ * @def STATE_MACHINE_TRACE_GO_TO
+ * @brief Type of record: "go_to_state" returned true ("value" is the target).
+ */
+#define STATE_MACHINE_TRACE_GO_TO       0x00000000
+
+/**
+ * @def STATE_MACHINE_TRACE_GO_TO_FAILED
+ * @brief Type of record: "go_to_state" returned false ("value" is the target).
+ */
+#define STATE_MACHINE_TRACE_GO_TO_FAILED 0x40000000
+
+/**
+ * @def STATE_MACHINE_TRACE_RUN
+ * @brief Type of record: "sm_run" was called ("value" is the state returned).
+ */
+#define STATE_MACHINE_TRACE_RUN         0x80000000
+
+/**
+ * @def STATE_MACHINE_TRACE_TYPE
+ * @brief Mask of the type in "fsm_trace_record_t.machine".
+ */
+#define STATE_MACHINE_TRACE_TYPE        0xC0000000
+
+
+
+/**
+ * @typedef fsm_trace_t
+ * @brief Data type used to record a trace.
+ */
+typedef struct _fsm_trace_t fsm_trace_t;
+
+/**
+ * @typedef fsm_replay_t
+ * @brief Data type used to replay a trace.
+ */
+typedef struct _fsm_replay_t fsm_replay_t;
+
+/**
+ * @typedef fsm_trace_header_t
+ * @brief Data type used to store the header of a trace file.
+ */
+typedef struct _fsm_trace_header_t fsm_trace_header_t;
+
+/**
+ * @typedef fsm_trace_record_t
+ * @brief Data type used to store a call in a trace file.
+ */
+typedef struct _fsm_trace_record_t fsm_trace_record_t;
+
+/**
+ * @typedef fsm_replay_stats_t
+ * @brief Data type used to report the result of a replay.
+ */
+typedef struct _fsm_replay_stats_t fsm_replay_stats_t;
+
+
+
+/**
+ * @struct _fsm_trace_header_t
+ * @brief Header of a trace file.
+ * INFO: The counters are written when the recorder is closed: the replayer does not use them,
+ * so the traces of a recorder not closed (e.g. after a crash) can be replayed.
+ */
+struct _fsm_trace_header_t {
+    uint32_t magic;             /**< "STATE_MACHINE_TRACE_MAGIC" */
+    uint32_t version;           /**< "STATE_MACHINE_TRACE_VERSION" */
+    uint32_t machine_nr;        /**< Highest ID of the traced state machines + 1 */
+    uint32_t reserved;          /**< Not used (0) */
+    uint64_t event_nr;          /**< Number of records */
+    uint64_t duration_ns;       /**< Duration of the recording in ns */
+};
+
+/**
+ * @struct _fsm_trace_record_t
+ * @brief Call recorded in a trace file.
+ */
+struct _fsm_trace_record_t {
+    uint32_t machine;           /**< ID of the state machine and type of the call (e.g. "STATE_MACHINE_TRACE_RUN") */
+    uint32_t value;             /**< Target of "go_to_state" or state returned by "sm_run" */
+};
+
+/**
+ * @struct _fsm_replay_stats_t
+ * @brief Result of "state_machine_replay_run".
+ */
+struct _fsm_replay_stats_t {
+    uint64_t event_nr;          /**< Number of calls executed */
+    uint64_t mismatch_nr;       /**< Number of calls whose result is different from the recorded one */
+    uint64_t first_mismatch;    /**< Index of the first different call ("event_nr" if none) */
+    uint64_t duration_ns;       /**< Duration of the replay in ns */
+};
+
+
+
+/**
+ * @fn state_machine_trace_create
+ * @brief Create a recorder that writes a new trace file.
+ * @param path Path of the file (replaced if it exists).
+ * @return The new recorder, NULL if the file can not be created or the memory is not available.
+ */
+fsm_trace_t* state_machine_trace_create (const char *path);
+
+/**
+ * @fn state_machine_trace_attach
+ * @brief Record the calls of "go_to_state" and "sm_run" of the given state machine.
+ * The function pointers of the state machine are replaced by wrappers that call the
+ * original ones; the recorder is found in the chain of the hooks (see "state_machine_hook_link")
+ * and the hook already set is still called.
+ * WARNING: While the state machine is attached, its hook can only be changed by linked hooks
+ * (e.g. a profile) and the state machine must not be cloned (the copy would share the
+ * wrappers). The recorder is thread
+ * safe, but the calls of machines run by different threads are stored in the order they
+ * complete.
+ * INFO: The completions of asynchronous transitions are not recorded.
+ * @param trace The recorder.
+ * @param fsm The state machine.
+ * @param machine_id ID of the state machine in the trace (index of "machines" in "state_machine_replay_run").
+ * @return true if the state machine was attached, false if the ID is not valid, the state
+ * machine is already attached or the memory is not available.
+ */
+bool state_machine_trace_attach (fsm_trace_t *trace, fsm_t *fsm, uint32_t machine_id);
+
+/**
+ * @fn state_machine_trace_detach
+ * @brief Stop recording the calls of the given state machine and restore its function pointers and hook.
+ */
+void state_machine_trace_detach (fsm_t *fsm);
+
+/**
+ * @fn state_machine_trace_close
+ * @brief Write the records still buffered and the header, then release the recorder.
+ * WARNING: The state machines attached to the recorder must be detached first.
+ * @return true if the whole trace was written, false if an error occurred.
+ */
+bool state_machine_trace_close (fsm_trace_t *trace);
+
+/**
+ * @fn state_machine_replay_open
+ * @brief Map a trace file in memory.
+ * @param path Path of the file.
+ * @return The trace, NULL if the file can not be read or is not a valid trace.
+ */
+fsm_replay_t* state_machine_replay_open (const char *path);
+
+/**
+ * @fn state_machine_replay_machine_nr
+ * @brief Get the number of state machines required to replay a trace (highest ID + 1).
+ */
+uint32_t state_machine_replay_machine_nr (const fsm_replay_t *replay);
+
+/**
+ * @fn state_machine_replay_event_nr
+ * @brief Get the number of calls stored in a trace.
+ */
+size_t state_machine_replay_event_nr (const fsm_replay_t *replay);
+
+/**
+ * @fn state_machine_replay_run
+ * @brief Execute the calls of a trace in the recorded order.
+ * The results are compared with the recorded ones and the calls go on after a mismatch.
+ * @param replay The trace.
+ * @param machines The state machines, indexed by their ID in the trace (they must be in
+ * the states of the recorded ones at the start of the recording).
+ * @param machine_nr Number of state machines (at least "state_machine_replay_machine_nr").
+ * @param par Parameter "passed" to "sm_run" (the recorded ones are not stored).
+ * @param stats Optional pointer filled with the result of the replay.
+ * @return true if all the calls gave the recorded result, false if not or if the state machines are not valid.
+ */
+bool state_machine_replay_run (const fsm_replay_t *replay, fsm_t *const *machines, uint32_t machine_nr, void *par, fsm_replay_stats_t *stats);
+
+/**
+ * @fn state_machine_replay_close
+ * @brief Unmap a trace file.
+ */
+void state_machine_replay_close (fsm_replay_t *replay);
+
+
+
+#endif
@@ -2,5 +2,7 @@
 
 echo "Updating sl-machine library..."
 cp state_machine.h /usr/include/sl_machine.h
-cp bin/Debug/libsl-machine.so /usr/lib/libsl-machine.so.1
+cp state_machine.h state_machine_*.h /usr/include/
+cp bin/Debug/libsl-machine.so /usr/lib/libsl-machine.so.2
+ln -sf libsl-machine.so.2 /usr/lib/libsl-machine.so
 echo "Done!"